@@ -0,0 +1,155 @@
+#include "BlockEncoder.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+static uint16_t packRGB565(const int* rgb)
+{
+	return (uint16_t)(((rgb[0] * 31 + 127) / 255) << 11 |
+		((rgb[1] * 63 + 127) / 255) << 5 |
+		((rgb[2] * 31 + 127) / 255));
+}
+
+static void unpackRGB565(uint16_t c, int* rgb)
+{
+	const int r = (c >> 11) & 31;
+	const int g = (c >> 5) & 63;
+	const int b = c & 31;
+
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+void encodeBC1(const uint8_t* rgba, uint8_t* out)
+{
+	int minColour[3] = { 255, 255, 255 };
+	int maxColour[3] = { 0, 0, 0 };
+
+	for (uint32_t i = 0; i < 16; ++i)
+	{
+		for (uint32_t c = 0; c < 3; ++c)
+		{
+			minColour[c] = (std::min)(minColour[c], (int)rgba[i * 4 + c]);
+			maxColour[c] = (std::max)(maxColour[c], (int)rgba[i * 4 + c]);
+		}
+	}
+
+	//Pull the endpoints in slightly; the box corners are rarely the best fit.
+	for (uint32_t c = 0; c < 3; ++c)
+	{
+		const int inset = (maxColour[c] - minColour[c]) / 16;
+		minColour[c] = (std::min)(minColour[c] + inset, 255);
+		maxColour[c] = (std::max)(maxColour[c] - inset, 0);
+	}
+
+	uint16_t colour0 = packRGB565(maxColour);
+	uint16_t colour1 = packRGB565(minColour);
+
+	//colour0 > colour1 selects the 4-colour mode.
+	if (colour0 < colour1)
+		std::swap(colour0, colour1);
+
+	int palette[4][3];
+	unpackRGB565(colour0, palette[0]);
+	unpackRGB565(colour1, palette[1]);
+
+	for (uint32_t c = 0; c < 3; ++c)
+	{
+		palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+	}
+
+	uint32_t indices = 0;
+	if (colour0 != colour1)
+	{
+		for (uint32_t i = 0; i < 16; ++i)
+		{
+			uint32_t best = 0;
+			int bestError = INT32_MAX;
+
+			for (uint32_t p = 0; p < 4; ++p)
+			{
+				int error = 0;
+				for (uint32_t c = 0; c < 3; ++c)
+				{
+					const int d = (int)rgba[i * 4 + c] - palette[p][c];
+					error += d * d;
+				}
+
+				if (error < bestError)
+				{
+					bestError = error;
+					best = p;
+				}
+			}
+
+			indices |= best << (i * 2);
+		}
+	}
+
+	memcpy(out, &colour0, 2);
+	memcpy(out + 2, &colour1, 2);
+	memcpy(out + 4, &indices, 4);
+}
+
+void encodeBC3(const uint8_t* rgba, uint8_t* out)
+{
+	encodeBC4(rgba, 3, out);
+	encodeBC1(rgba, out + 8);
+}
+
+void encodeBC4(const uint8_t* rgba, uint32_t channel, uint8_t* out)
+{
+	int minValue = 255;
+	int maxValue = 0;
+
+	for (uint32_t i = 0; i < 16; ++i)
+	{
+		minValue = (std::min)(minValue, (int)rgba[i * 4 + channel]);
+		maxValue = (std::max)(maxValue, (int)rgba[i * 4 + channel]);
+	}
+
+	//endpoint0 > endpoint1 selects the 8-value mode; when they're equal every index is 0.
+	int palette[8];
+	palette[0] = maxValue;
+	palette[1] = minValue;
+	for (int p = 2; p < 8; ++p)
+		palette[p] = ((8 - p) * maxValue + (p - 1) * minValue) / 7;
+
+	uint64_t indices = 0;
+	if (maxValue != minValue)
+	{
+		for (uint32_t i = 0; i < 16; ++i)
+		{
+			const int value = rgba[i * 4 + channel];
+
+			uint64_t best = 0;
+			int bestError = INT32_MAX;
+
+			for (uint32_t p = 0; p < 8; ++p)
+			{
+				const int error = std::abs(value - palette[p]);
+				if (error < bestError)
+				{
+					bestError = error;
+					best = p;
+				}
+			}
+
+			indices |= best << (i * 3);
+		}
+	}
+
+	out[0] = (uint8_t)maxValue;
+	out[1] = (uint8_t)minValue;
+	for (uint32_t b = 0; b < 6; ++b)
+		out[2 + b] = (uint8_t)(indices >> (b * 8));
+}
+
+void encodeBC5(const uint8_t* rgba, uint8_t* out)
+{
+	encodeBC4(rgba, 0, out);
+	encodeBC4(rgba, 1, out + 8);
+}
\ No newline at end of file
@@ -0,0 +1,22 @@
+#ifndef BLOCK_ENCODER_H_
+#define BLOCK_ENCODER_H_
+
+#include <cstdint>
+
+//Range-fit BCn encoders. Each takes one 4x4 block of RGBA8 texels in row order and
+//writes a single compressed block. Quality is roughly on par with a fast/low setting
+//of the usual offline compressors, which is plenty for the sponza assets.
+
+//8 bytes; opaque 4-colour mode only, alpha is ignored.
+void encodeBC1(const uint8_t* rgba, uint8_t* out);
+
+//16 bytes; BC4 alpha block followed by a BC1 colour block.
+void encodeBC3(const uint8_t* rgba, uint8_t* out);
+
+//8 bytes; encodes the given channel (0-3) of each texel.
+void encodeBC4(const uint8_t* rgba, uint32_t channel, uint8_t* out);
+
+//16 bytes; red and green as two BC4 blocks.
+void encodeBC5(const uint8_t* rgba, uint8_t* out);
+
+#endif //BLOCK_ENCODER_H_
\ No newline at end of file
@@ -0,0 +1,105 @@
+#include "DDSWriter.h"
+
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+
+static const uint32_t DDS_MAGIC = 0x20534444; //"DDS "
+
+static const uint32_t DDSD_CAPS = 0x1;
+static const uint32_t DDSD_HEIGHT = 0x2;
+static const uint32_t DDSD_WIDTH = 0x4;
+static const uint32_t DDSD_PIXELFORMAT = 0x1000;
+static const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+static const uint32_t DDSD_LINEARSIZE = 0x80000;
+
+static const uint32_t DDPF_FOURCC = 0x4;
+
+static const uint32_t DDSCAPS_COMPLEX = 0x8;
+static const uint32_t DDSCAPS_TEXTURE = 0x1000;
+static const uint32_t DDSCAPS_MIPMAP = 0x400000;
+
+struct DDSPixelFormat
+{
+	uint32_t size;
+	uint32_t flags;
+	uint32_t fourCC;
+	uint32_t rgbBitCount;
+	uint32_t rBitMask;
+	uint32_t gBitMask;
+	uint32_t bBitMask;
+	uint32_t aBitMask;
+};
+
+struct DDSHeader
+{
+	uint32_t size;
+	uint32_t flags;
+	uint32_t height;
+	uint32_t width;
+	uint32_t pitchOrLinearSize;
+	uint32_t depth;
+	uint32_t mipMapCount;
+	uint32_t reserved1[11];
+	DDSPixelFormat format;
+	uint32_t caps;
+	uint32_t caps2;
+	uint32_t caps3;
+	uint32_t caps4;
+	uint32_t reserved2;
+};
+
+static uint32_t fourCC(const char* code)
+{
+	return (uint32_t)code[0] | ((uint32_t)code[1] << 8) | ((uint32_t)code[2] << 16) | ((uint32_t)code[3] << 24);
+}
+
+uint32_t blockBytes(BlockFormat format)
+{
+	return (format == BLOCK_BC1 || format == BLOCK_BC4) ? 8 : 16;
+}
+
+bool writeDDS(const std::string& path, BlockFormat format, uint32_t width, uint32_t height,
+	const std::vector<std::vector<uint8_t>>& levels)
+{
+	static const char* codes[] = { "DXT1", "DXT5", "ATI1", "ATI2" };
+
+	DDSHeader header;
+	memset(&header, 0, sizeof(header));
+	header.size = sizeof(DDSHeader);
+	header.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_LINEARSIZE;
+	header.width = width;
+	header.height = height;
+	header.pitchOrLinearSize = (uint32_t)levels[0].size();
+	header.mipMapCount = (uint32_t)levels.size();
+	header.format.size = sizeof(DDSPixelFormat);
+	header.format.flags = DDPF_FOURCC;
+	header.format.fourCC = fourCC(codes[format]);
+	header.caps = DDSCAPS_TEXTURE;
+
+	if (levels.size() > 1)
+	{
+		header.flags |= DDSD_MIPMAPCOUNT;
+		header.caps |= DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
+	}
+
+	//Write next to the destination first so a failed run never leaves a truncated .dds behind.
+	const std::string tmpPath = path + ".tmp";
+	{
+		std::ofstream file(tmpPath, std::ios::binary | std::ios::out | std::ios::trunc);
+		if (!file)
+			return false;
+
+		file.write((const char*)&DDS_MAGIC, sizeof(DDS_MAGIC));
+		file.write((const char*)&header, sizeof(header));
+
+		for (const std::vector<uint8_t>& level : levels)
+			file.write((const char*)level.data(), level.size());
+
+		if (!file.good())
+			return false;
+	}
+
+	remove(path.c_str());
+	return rename(tmpPath.c_str(), path.c_str()) == 0;
+}
\ No newline at end of file
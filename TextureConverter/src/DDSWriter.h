@@ -0,0 +1,24 @@
+#ifndef DDS_WRITER_H_
+#define DDS_WRITER_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum BlockFormat
+{
+	BLOCK_BC1,
+	BLOCK_BC3,
+	BLOCK_BC4,
+	BLOCK_BC5
+};
+
+//Bytes per 4x4 block.
+uint32_t blockBytes(BlockFormat format);
+
+//Writes a 2D DDS with a legacy FourCC header (DXT1/DXT5/ATI1/ATI2), which every
+//DDS reader understands. levels holds the compressed data of each mip, largest first.
+bool writeDDS(const std::string& path, BlockFormat format, uint32_t width, uint32_t height,
+	const std::vector<std::vector<uint8_t>>& levels);
+
+#endif //DDS_WRITER_H_
\ No newline at end of file
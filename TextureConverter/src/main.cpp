@@ -0,0 +1,267 @@
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include "BlockEncoder.h"
+#include "DDSWriter.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//Offline BCn converter for the renderer's material textures.
+//Usage: TextureConverter <file.mtl>...
+//Every texture referenced by the materials is encoded with a full mip chain and written as
+//a .dds next to the source image, which the renderer picks up in place of the original.
+
+//Mirrors TEXLAYER_* in the renderer; lower values win when one image serves several roles.
+enum Role
+{
+	ROLE_DIFFUSE = 0,
+	ROLE_BUMP = 1,
+	ROLE_SPEC = 2,
+	ROLE_ALPHA = 3
+};
+
+static const char* FORMAT_NAMES[] = { "BC1", "BC3", "BC4", "BC5" };
+
+struct Image
+{
+	uint32_t width;
+	uint32_t height;
+	std::vector<uint8_t> rgba;
+};
+
+static std::string directoryOf(const std::string& path)
+{
+	const size_t slash = path.find_last_of("/\\");
+	return slash == std::string::npos ? "" : path.substr(0, slash + 1);
+}
+
+static std::string ddsPath(const std::string& sourcePath)
+{
+	const size_t dot = sourcePath.find_last_of('.');
+	const size_t slash = sourcePath.find_last_of("/\\");
+
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return sourcePath + ".dds";
+
+	return sourcePath.substr(0, dot) + ".dds";
+}
+
+//Collects every texture in an .mtl with the role it's used for.
+static bool parseMaterials(const std::string& mtlPath, std::map<std::string, Role>& textures)
+{
+	std::ifstream file(mtlPath);
+	if (!file)
+		return false;
+
+	const std::string baseDir = directoryOf(mtlPath);
+
+	std::string line;
+	while (std::getline(file, line))
+	{
+		std::istringstream tokens(line);
+		std::string key;
+		tokens >> key;
+
+		Role role;
+		if (key == "map_Kd")
+			role = ROLE_DIFFUSE;
+		else if (key == "map_bump" || key == "bump")
+			role = ROLE_BUMP;
+		else if (key == "map_Ns")
+			role = ROLE_SPEC;
+		else if (key == "map_d")
+			role = ROLE_ALPHA;
+		else
+			continue;
+
+		//Options such as "-bm 0.02" come before the file name.
+		std::string name;
+		std::string token;
+		while (tokens >> token)
+			name = token;
+
+		if (name.empty())
+			continue;
+
+		const std::string path = baseDir + name;
+		std::map<std::string, Role>::iterator it = textures.find(path);
+		if (it == textures.end())
+			textures[path] = role;
+		else
+			it->second = (std::min)(it->second, role);
+	}
+
+	return true;
+}
+
+//2x2 box filter, clamping at the edges of odd-sized levels.
+static Image downsample(const Image& src)
+{
+	Image dst;
+	dst.width = (std::max)(src.width / 2, 1u);
+	dst.height = (std::max)(src.height / 2, 1u);
+	dst.rgba.resize(dst.width * dst.height * 4);
+
+	for (uint32_t y = 0; y < dst.height; ++y)
+	{
+		const uint32_t y0 = (std::min)(y * 2, src.height - 1);
+		const uint32_t y1 = (std::min)(y * 2 + 1, src.height - 1);
+
+		for (uint32_t x = 0; x < dst.width; ++x)
+		{
+			const uint32_t x0 = (std::min)(x * 2, src.width - 1);
+			const uint32_t x1 = (std::min)(x * 2 + 1, src.width - 1);
+
+			for (uint32_t ch = 0; ch < 4; ++ch)
+			{
+				const uint32_t sum = src.rgba[(y0 * src.width + x0) * 4 + ch] + src.rgba[(y0 * src.width + x1) * 4 + ch] +
+					src.rgba[(y1 * src.width + x0) * 4 + ch] + src.rgba[(y1 * src.width + x1) * 4 + ch];
+
+				dst.rgba[(y * dst.width + x) * 4 + ch] = (uint8_t)((sum + 2) / 4);
+			}
+		}
+	}
+
+	return dst;
+}
+
+static std::vector<uint8_t> compress(const Image& image, BlockFormat format)
+{
+	const uint32_t blocksX = (image.width + 3) / 4;
+	const uint32_t blocksY = (image.height + 3) / 4;
+	const uint32_t bytes = blockBytes(format);
+
+	std::vector<uint8_t> out(blocksX * blocksY * bytes);
+	uint8_t block[16 * 4];
+
+	for (uint32_t by = 0; by < blocksY; ++by)
+	{
+		for (uint32_t bx = 0; bx < blocksX; ++bx)
+		{
+			//Levels smaller than a block repeat their edge texels.
+			for (uint32_t y = 0; y < 4; ++y)
+			{
+				for (uint32_t x = 0; x < 4; ++x)
+				{
+					const uint32_t sx = (std::min)(bx * 4 + x, image.width - 1);
+					const uint32_t sy = (std::min)(by * 4 + y, image.height - 1);
+					memcpy(&block[(y * 4 + x) * 4], &image.rgba[(sy * image.width + sx) * 4], 4);
+				}
+			}
+
+			uint8_t* dst = &out[(by * blocksX + bx) * bytes];
+			switch (format)
+			{
+			case BLOCK_BC1: encodeBC1(block, dst); break;
+			case BLOCK_BC3: encodeBC3(block, dst); break;
+			case BLOCK_BC4: encodeBC4(block, 0, dst); break;
+			case BLOCK_BC5: encodeBC5(block, dst); break;
+			}
+		}
+	}
+
+	return out;
+}
+
+static BlockFormat chooseFormat(Role role, const Image& image)
+{
+	switch (role)
+	{
+	case ROLE_DIFFUSE:
+		//Only pay for an alpha block if the image actually uses its alpha channel.
+		for (size_t i = 3; i < image.rgba.size(); i += 4)
+		{
+			if (image.rgba[i] != 255)
+				return BLOCK_BC3;
+		}
+		return BLOCK_BC1;
+	case ROLE_BUMP:
+		return BLOCK_BC5;
+	default:
+		//Spec and alpha masks are read from the red channel.
+		return BLOCK_BC4;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		printf("Usage: TextureConverter <file.mtl>...\n");
+		return 1;
+	}
+
+	std::map<std::string, Role> textures;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!parseMaterials(argv[i], textures))
+			printf("Couldn't read %s\n", argv[i]);
+	}
+
+	size_t rgbaTotal = 0;
+	size_t compressedTotal = 0;
+	uint32_t failed = 0;
+
+	for (const std::pair<const std::string, Role>& texture : textures)
+	{
+		const std::string& path = texture.first;
+
+		int width, height, channels;
+		stbi_uc* pixels = stbi_load(path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+		if (!pixels)
+		{
+			printf("%-48s missing\n", path.c_str());
+			failed++;
+			continue;
+		}
+
+		Image image;
+		image.width = (uint32_t)width;
+		image.height = (uint32_t)height;
+		image.rgba.assign(pixels, pixels + width * height * 4);
+		stbi_image_free(pixels);
+
+		const BlockFormat format = chooseFormat(texture.second, image);
+
+		std::vector<std::vector<uint8_t>> levels;
+		size_t rgbaSize = 0;
+		size_t compressedSize = 0;
+
+		while (true)
+		{
+			levels.push_back(compress(image, format));
+			rgbaSize += image.rgba.size();
+			compressedSize += levels.back().size();
+
+			if (image.width == 1 && image.height == 1)
+				break;
+
+			image = downsample(image);
+		}
+
+		if (!writeDDS(ddsPath(path), format, (uint32_t)width, (uint32_t)height, levels))
+		{
+			printf("%-48s couldn't write %s\n", path.c_str(), ddsPath(path).c_str());
+			failed++;
+			continue;
+		}
+
+		printf("%-48s %s %4ux%-4u %2u levels %8zu KB -> %6zu KB\n", path.c_str(), FORMAT_NAMES[format],
+			width, height, (uint32_t)levels.size(), rgbaSize / 1024, compressedSize / 1024);
+
+		rgbaTotal += rgbaSize;
+		compressedTotal += compressedSize;
+	}
+
+	printf("%zu textures: %.1f MB RGBA8 -> %.1f MB compressed\n", textures.size() - failed,
+		rgbaTotal / (1024.0 * 1024.0), compressedTotal / (1024.0 * 1024.0));
+
+	return failed ? 1 : 0;
+}
\ No newline at end of file
@@ -14,7 +14,7 @@ layout(location = 0) out uvec4 fragColor;
 layout(location = 1) out vec4 normalColor;
 
 layout(set = 2, binding = 0) uniform sampler texsampler;
-layout(set = 3, binding = 0) uniform texture2DArray materials[MATERIAL_COUNT];
+layout(set = 3, binding = 0) uniform texture2DArray materials[MATERIAL_TEXTURE_COUNT];
 layout(set = 4, binding = 0) uniform LightUniform {
 	LightData lightData;
 };
@@ -42,7 +42,7 @@ void main() {
     //Quick check to see if we should just discard and move on.
     if(matFlag(MATFLAG_ALPHAMASK))
     {
-        float alpha = texture(sampler2DArray(materials[materialId], texsampler), vec3(uv, TEXLAYER_ALPHA)).r;
+        float alpha = texture(sampler2DArray(materials[materialTexture(materialId, TEXLAYER_ALPHA)], texsampler), vec3(uv, 0)).r;
 
         if(alpha < 0.1)
             discard;
@@ -52,7 +52,7 @@ void main() {
     vec3 bump = vec3(0.5);
     if(matFlag(MATFLAG_BUMPMAP) && sceneFlag(SCENEFLAG_ENABLEBUMPMAPS))
     {
-        bump = texture(sampler2DArray(materials[materialId], texsampler), vec3(uv, TEXLAYER_BUMP)).rgb;
+        bump = decodeBump(texture(sampler2DArray(materials[materialTexture(materialId, TEXLAYER_BUMP)], texsampler), vec3(uv, 0)).rg);
     }
 
     vec3 adjustedNormal = normal;
@@ -7,18 +7,26 @@ layout(location = 0) in vec2 uv;
 layout(location = 1) in vec3 normal;
 layout(location = 2) in vec3 lightVec;
 layout(location = 3) in vec3 viewVec;
-layout(location = 4) in vec4 shadowCoord;
+layout(location = 4) in vec4 worldPos;
 layout(location = 5) flat in uint materialId;
 
 layout(location = 0) out vec4 fragColor;
 
+layout(set = 0, binding = 0) uniform CameraUniform {
+	Camera camera;
+};
 layout(set = 2, binding = 0) uniform sampler texsampler;
-layout(set = 3, binding = 0) uniform texture2DArray materials[MATERIAL_COUNT];
+layout(set = 3, binding = 0) uniform texture2DArray materials[MATERIAL_TEXTURE_COUNT];
 layout(set = 4, binding = 0) uniform LightUniform { 
 	LightData lightData;
 };
 layout(set = 5, binding = 0) uniform textureCube shadowCube;
-//layout(set = 5, binding = 1) uniform texture2D shadowMap;
+layout(set = 5, binding = 1) uniform texture2DArray shadowCascades;
+layout(set = 5, binding = 2) uniform texture2D shadowAtlas;
+layout(std430, set = 5, binding = 3) readonly buffer AtlasBuffer {
+	AtlasData atlas;
+};
+layout(set = 5, binding = 4) uniform sampler shadowSampler;
 layout(std140, set = 6, binding = 0) uniform MaterialUniform {
 	MaterialData materialData;
 };
@@ -37,11 +45,26 @@ bool matFlag(uint mask)
     return flag(materialData.flags[materialId], mask);
 }
 
+//Whether this pixel's shadows are filtered through the comparison sampler.
+bool hardwareShadows()
+{
+    if(sceneFlag(SCENEFLAG_SHADOWSPLIT))
+        return gl_FragCoord.x >= float(camera.width) * 0.5;
+    return sceneFlag(SCENEFLAG_HARDWARESHADOWS);
+}
+
+//Turns the Vogel disk per pixel, so that neighbouring pixels' taps fill each other's gaps.
+float vogelRotation()
+{
+    return interleavedGradientNoise(gl_FragCoord.xy) * 6.28318531;
+}
+
+//The cube map stores distance over the far plane.
 float sampleShadowCube(vec3 offset)
 {
 	vec3 shadowUV = vec3(-lightVec.x, lightVec.y, -lightVec.z);
-    vec4 shadow = texture(samplerCube(shadowCube, texsampler), shadowUV);
-	if(length(lightVec) > (shadow.r) + SHADOW_BIAS_CUBE)
+    float shadow = texture(samplerCube(shadowCube, texsampler), shadowUV).r * lightData.farPlane;
+	if(length(lightVec) > shadow + SHADOW_BIAS_CUBE)
         return SHADOW_MUL;
     else
         return 1.0;
@@ -56,7 +79,7 @@ float shadowCubePCF()
 	{
 		vec3 shadowUV = vec3(-lightVec.x, lightVec.y, -lightVec.z);
 		shadowUV += (shadowCubeSampleDirections[i] * PCF_RADIUS);
-		float shadow = texture(samplerCube(shadowCube, texsampler), shadowUV).r;
+		float shadow = texture(samplerCube(shadowCube, texsampler), shadowUV).r * lightData.farPlane;
 
 		if(length(lightVec) < shadow + SHADOW_BIAS_CUBE)
 			lightVal += 1.0;
@@ -65,30 +88,60 @@ float shadowCubePCF()
 	return max(lightVal, SHADOW_MUL);
 }
 
-float sampleShadowMap(vec2 offset)
+float shadowCubeHardware(bool pcf)
+{
+    vec3 dir = vec3(-lightVec.x, lightVec.y, -lightVec.z);
+    float ref = (length(lightVec) - SHADOW_BIAS_CUBE) / lightData.farPlane;
+
+    if(!pcf)
+        return max(texture(samplerCubeShadow(shadowCube, shadowSampler), vec4(dir, ref)), SHADOW_MUL);
+
+    //Taps are spread across the plane facing the light.
+    vec3 n = normalize(dir);
+    vec3 t = normalize(cross(n, abs(n.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0)));
+    vec3 b = cross(n, t);
+    float rotation = vogelRotation();
+
+    float lit = 0.0;
+    for(uint i = 0; i < SHADOW_VOGEL_TAPS; i++)
+    {
+        vec2 o = vogelDisk(i, SHADOW_VOGEL_TAPS, rotation) * SHADOW_CUBE_FILTER_RADIUS;
+        lit += texture(samplerCubeShadow(shadowCube, shadowSampler), vec4(dir + t * o.x + b * o.y, ref));
+    }
+    return max(lit / float(SHADOW_VOGEL_TAPS), SHADOW_MUL);
+}
+
+//The first cascade reaching past depth; numViews if none do.
+uint cascadeFor(float depth)
+{
+    uint cascade = 0;
+    while(cascade < lightData.numViews && depth > lightData.cascadeSplits[cascade])
+        cascade++;
+    return cascade;
+}
+
+float sampleShadowMap(vec3 coord, uint cascade, ivec2 offset)
 {
-    vec4 coord = shadowCoord/ shadowCoord.w;
-	vec2 shadowUV = coord.xy + offset;
-	//vec4 shadow = texture(sampler2D(shadowMap, texsampler), shadowUV);
-	vec4 shadow = vec4(1.0);
-    if(coord.z > shadow.r + SHADOW_BIAS)
+    //Depth formats can't be relied on to filter, so texels are fetched.
+    ivec2 size = textureSize(sampler2DArray(shadowCascades, texsampler), 0).xy;
+    ivec2 texel = clamp(ivec2(coord.xy * size) + offset, ivec2(0), size - 1);
+    float shadow = texelFetch(sampler2DArray(shadowCascades, texsampler), ivec3(texel, cascade), 0).r;
+    if(coord.z > shadow + SHADOW_BIAS)
         return SHADOW_MUL;
     else
         return 1.0;
 }
 
-float shadowPCF()
+float shadowPCF(vec3 coord, uint cascade)
 {
     float shadowValue = 0.0;
-    const float SHADOW_DIM = 1024.0;
     const int SAMPLE_COUNT = 4;
 
     for(int x = -(SAMPLE_COUNT/2); x < (SAMPLE_COUNT/2); x++)
     {
         for(int y = -(SAMPLE_COUNT/2); y < (SAMPLE_COUNT/2); y++)
         {
-            vec2 offset = vec2(x * (1.0/SHADOW_DIM), y * (1.0/SHADOW_DIM));
-            shadowValue += sampleShadowMap(offset);
+            shadowValue += sampleShadowMap(coord, cascade, ivec2(x, y));
         }
     }
 
@@ -96,9 +149,123 @@ float shadowPCF()
     return shadowValue;
 }
 
-void main() {
-    vec4 coord = shadowCoord/ shadowCoord.w;
+float shadowMapHardware(vec3 coord, uint cascade, bool pcf)
+{
+    float ref = coord.z - SHADOW_BIAS;
+
+    if(!pcf)
+        return mix(SHADOW_MUL, 1.0, texture(sampler2DArrayShadow(shadowCascades, shadowSampler), vec4(coord.xy, cascade, ref)));
+
+    vec2 texelSize = 1.0 / vec2(textureSize(sampler2DArrayShadow(shadowCascades, shadowSampler), 0).xy);
+    float rotation = vogelRotation();
+
+    float lit = 0.0;
+    for(uint i = 0; i < SHADOW_VOGEL_TAPS; i++)
+    {
+        vec2 uv = coord.xy + vogelDisk(i, SHADOW_VOGEL_TAPS, rotation) * SHADOW_FILTER_RADIUS * texelSize;
+        lit += texture(sampler2DArrayShadow(shadowCascades, shadowSampler), vec4(uv, cascade, ref));
+    }
+    return mix(SHADOW_MUL, 1.0, lit / float(SHADOW_VOGEL_TAPS));
+}
+
+float sampleAtlas(AtlasTile tile, vec2 coord, float depth, ivec2 offset)
+{
+    //Clamped to the tile, so that filtering never reads a neighbour's.
+    ivec2 texel = clamp(ivec2(tile.rect.xy + coord * tile.rect.zw) + offset,
+        ivec2(tile.rect.xy), ivec2(tile.rect.xy + tile.rect.zw) - 1);
+    float shadow = texelFetch(sampler2D(shadowAtlas, texsampler), texel, 0).r;
+    if(depth > shadow + ATLAS_BIAS)
+        return 0.0;
+    else
+        return 1.0;
+}
+
+float atlasShadowHardware(AtlasTile tile, vec2 coord, float depth, bool pcf)
+{
+    //Half a texel inside the tile, so that bilinear comparisons never reach a neighbour's.
+    vec2 lo = tile.rect.xy + 0.5;
+    vec2 hi = tile.rect.xy + tile.rect.zw - 0.5;
+    vec2 size = vec2(textureSize(sampler2DShadow(shadowAtlas, shadowSampler), 0));
+    vec2 center = tile.rect.xy + coord * tile.rect.zw;
+    float ref = depth - ATLAS_BIAS;
 
+    if(!pcf)
+        return texture(sampler2DShadow(shadowAtlas, shadowSampler), vec3(clamp(center, lo, hi) / size, ref));
+
+    float rotation = vogelRotation();
+
+    float lit = 0.0;
+    for(uint i = 0; i < ATLAS_VOGEL_TAPS; i++)
+    {
+        vec2 texel = clamp(center + vogelDisk(i, ATLAS_VOGEL_TAPS, rotation) * ATLAS_FILTER_RADIUS, lo, hi);
+        lit += texture(sampler2DShadow(shadowAtlas, shadowSampler), vec3(texel / size, ref));
+    }
+    return lit / float(ATLAS_VOGEL_TAPS);
+}
+
+float atlasShadow(AtlasLight light, vec3 pos)
+{
+    if(light.tiles.y == 0)
+        return 1.0;
+
+    vec3 d = pos - light.posRange.xyz;
+    uint index = light.tiles.x + (light.spot.w > 0.0 ? 0 : atlasFace(d));
+    AtlasTile tile = atlas.tiles[index];
+
+    vec4 clip = tile.viewProj * vec4(pos, 1.0);
+    vec2 coord = clamp(clip.xy / clip.w * 0.5 + 0.5, 0.0, 1.0);
+    float depth = length(d) / light.posRange.w;
+
+    if(hardwareShadows())
+        return atlasShadowHardware(tile, coord, depth, sceneFlag(SCENEFLAG_ENABLEPCF));
+
+    if(!sceneFlag(SCENEFLAG_ENABLEPCF))
+        return sampleAtlas(tile, coord, depth, ivec2(0));
+
+    float lit = 0.0;
+    for(int x = -1; x <= 1; x++)
+    {
+        for(int y = -1; y <= 1; y++)
+        {
+            lit += sampleAtlas(tile, coord, depth, ivec2(x, y));
+        }
+    }
+    return lit / 9.0;
+}
+
+//Light from the atlas's point and spot lights, which fades to nothing at their range.
+vec3 atlasLighting(vec3 pos, vec3 normal, vec3 diffuse)
+{
+    vec3 color = vec3(0.0);
+
+    for(uint i = 0; i < atlas.lightCount; i++)
+    {
+        AtlasLight light = atlas.lights[i];
+        vec3 toLight = light.posRange.xyz - pos;
+        float dist = length(toLight);
+        if(dist >= light.posRange.w)
+            continue;
+
+        vec3 l = toLight / dist;
+        float falloff = 1.0 - dist / light.posRange.w;
+        falloff *= falloff * max(dot(normal, l), 0.0);
+
+        if(light.spot.w > 0.0)
+            falloff *= smoothstep(light.spot.w, mix(light.spot.w, 1.0, 0.2), dot(-l, light.spot.xyz));
+
+        if(falloff <= 0.0)
+            continue;
+
+        if(sceneFlag(SCENEFLAG_ENABLESHADOWS))
+            falloff *= atlasShadow(light, pos);
+
+        color += diffuse * light.color.rgb * falloff;
+    }
+
+    return color;
+}
+
+void main() {
     vec4 ambient = materialData.ambient[materialId];
     vec4 diffuse = materialData.diffuse[materialId];
     vec4 specular = materialData.specular[materialId];
@@ -108,7 +275,7 @@ void main() {
     //Quick check to see if we should just discard and move on.
     if(matFlag(MATFLAG_ALPHAMASK))
     {
-        float alpha = texture(sampler2DArray(materials[materialId], texsampler), vec3(uv, TEXLAYER_ALPHA)).r;
+        float alpha = texture(sampler2DArray(materials[materialTexture(materialId, TEXLAYER_ALPHA)], texsampler), vec3(uv, 0)).r;
 
         if(alpha < 0.1)
             discard;
@@ -117,14 +284,14 @@ void main() {
     const bool useBumpMapping = matFlag(MATFLAG_BUMPMAP) && sceneFlag(SCENEFLAG_ENABLEBUMPMAPS);
 
     if(matFlag(MATFLAG_DIFFUSEMAP))
-        diffuse = texture(sampler2DArray(materials[materialId], texsampler), vec3(uv, TEXLAYER_DIFFUSE));
+        diffuse = texture(sampler2DArray(materials[materialTexture(materialId, TEXLAYER_DIFFUSE)], texsampler), vec3(uv, 0));
 
     ambient = diffuse * 0.2;
 
     vec3 bump = vec3(0.5);
     if(useBumpMapping)
     {
-        bump = texture(sampler2DArray(materials[materialId], texsampler), vec3(uv, TEXLAYER_BUMP)).rgb;
+        bump = decodeBump(texture(sampler2DArray(materials[materialTexture(materialId, TEXLAYER_BUMP)], texsampler), vec3(uv, 0)).rg);
     }
 
     if(useBumpMapping && sceneFlag(SCENEFLAG_MAPSPLIT))
@@ -136,16 +303,28 @@ void main() {
     float shadowValue = 1.0;
     if(sceneFlag(SCENEFLAG_ENABLESHADOWS))
     {
-		if(lightData.numViews == 1)
+		if(lightData.numViews <= MAX_CASCADES)
 		{
-			if(sceneFlag(SCENEFLAG_ENABLEPCF))
-				shadowValue = shadowPCF();
-			else
-				shadowValue = sampleShadowMap(vec2(0.0));
+			//Past the last cascade nothing is shadowed.
+			uint cascade = cascadeFor(worldPos.w);
+			if(cascade < lightData.numViews)
+			{
+				vec4 shadowCoord = biasMatrix * lightData.proj * lightData.views[cascade] * vec4(worldPos.xyz, 1.0);
+				vec3 coord = shadowCoord.xyz / shadowCoord.w;
+
+				if(hardwareShadows())
+					shadowValue = shadowMapHardware(coord, cascade, sceneFlag(SCENEFLAG_ENABLEPCF));
+				else if(sceneFlag(SCENEFLAG_ENABLEPCF))
+					shadowValue = shadowPCF(coord, cascade);
+				else
+					shadowValue = sampleShadowMap(coord, cascade, ivec2(0));
+			}
 		}
 		else
 		{
-			if(sceneFlag(SCENEFLAG_ENABLEPCF))
+			if(hardwareShadows())
+				shadowValue = shadowCubeHardware(sceneFlag(SCENEFLAG_ENABLEPCF));
+			else if(sceneFlag(SCENEFLAG_ENABLEPCF))
 				shadowValue = shadowCubePCF();
 			else
 				shadowValue = sampleShadowCube(vec3(0.0));
@@ -171,7 +350,7 @@ void main() {
         {
             float exponent = materialData.specular[materialId].x;
             if(matFlag(MATFLAG_SPECMAP))
-                exponent = texture(sampler2DArray(materials[materialId], texsampler), vec3(uv, TEXLAYER_SPEC)).r;
+                exponent = texture(sampler2DArray(materials[materialTexture(materialId, TEXLAYER_SPEC)], texsampler), vec3(uv, 0)).r;
             
             float mul = 1.0;
             if(materialData.shininess[materialId] > 0.0)
@@ -183,6 +362,7 @@ void main() {
 
         vec3 color = ambient.xyz + emissive.xyz + specComponent + (diffuse.xyz * (lightData.color.rgb * clamp(dot(normalize(lightVec), adjustedNormal), 0.0, 1.0)));
         color *= shadowValue;
+        color += atlasLighting(worldPos.xyz, normalize(adjustedNormal), diffuse.xyz);
 
         fragColor = vec4(color, 1.0);
     }
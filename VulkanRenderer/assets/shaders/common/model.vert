@@ -12,7 +12,7 @@ layout(location = 0) out vec2 outUV;
 layout(location = 1) out vec3 outNormal;
 layout(location = 2) out vec3 outLightVec;
 layout(location = 3) out vec3 outViewVec;
-layout(location = 4) out vec4 outShadowCoord;
+layout(location = 4) out vec4 outWorldPos;
 layout(location = 5) flat out uint outMaterialId;
 
 layout(set = 0, binding = 0) uniform CameraUniform {
@@ -39,7 +39,8 @@ void main()
     outNormal = normalize(mat3(model.pos) * inNormal);
     outLightVec = (lightData.pos - fragPos.xyz);
     outViewVec = normalize(camera.pos.xyz - fragPos.xyz);
-    outShadowCoord = biasMatrix * lightData.proj * lightData.views[0] * fragPos;
+    //Cascades are picked by view depth, carried in w.
+    outWorldPos = vec4(fragPos.xyz, -(camera.view * fragPos).z);
     outMaterialId = inMaterialId;
 
     gl_Position =  camera.projview * fragPos;
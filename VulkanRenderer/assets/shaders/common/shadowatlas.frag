@@ -0,0 +1,40 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+#include "../shadercommon.inc"
+
+layout(location = 0) in vec2 uv;
+layout(location = 1) flat in uint materialId;
+layout(location = 2) in vec3 fragPos;
+layout(location = 3) flat in uint tile;
+
+layout(set = 2, binding = 0) uniform sampler texsampler;
+layout(set = 3, binding = 0) uniform texture2DArray materials[MATERIAL_TEXTURE_COUNT];
+layout(std430, set = 5, binding = 3) readonly buffer AtlasBuffer {
+	AtlasData atlas;
+};
+layout(std140, set = 6, binding = 0) uniform MaterialUniform {
+	MaterialData materialData;
+};
+
+bool matFlag(uint mask)
+{
+    return flag(materialData.flags[materialId], mask);
+}
+
+void main() {
+    if(matFlag(MATFLAG_ALPHAMASK))
+    {
+        float alpha = texture(sampler2DArray(materials[materialTexture(materialId, TEXLAYER_ALPHA)], texsampler), vec3(uv, 0)).r;
+
+        if(alpha < 0.1)
+            discard;
+    }
+
+	if(materialData.transparency[materialId].x < 0.1)
+		discard;
+
+	//Linear, so that every tile compares at the same precision whatever its light's range.
+	vec4 light = atlas.tiles[tile].lightPosRange;
+	gl_FragDepth = length(fragPos - light.xyz) / light.w;
+}
@@ -0,0 +1,41 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+#include "../shadercommon.inc"
+
+layout(location = 0) in vec3 inPos;
+layout(location = 1) in vec2 inUV;
+layout(location = 2) in vec3 inNormal;
+layout(location = 3) in uint inMaterialId;
+
+layout(location = 0) out vec2 uv;
+layout(location = 1) flat out uint materialId;
+layout(location = 2) out vec3 outFragPos;
+layout(location = 3) flat out uint outTile;
+
+layout(set = 1, binding = 0) uniform ModelUniform {
+	Model model;
+};
+
+layout(std430, set = 5, binding = 3) readonly buffer AtlasBuffer {
+	AtlasData atlas;
+};
+
+layout(push_constant) uniform TileData {
+	uint tile;
+};
+
+out gl_PerVertex 
+{
+    vec4 gl_Position;   
+};
+
+void main()
+{
+    uv = inUV;
+    materialId = inMaterialId;
+    vec4 fragPos = model.pos * vec4(inPos * model.scale, 1.0);
+    gl_Position = atlas.tiles[tile].viewProj * fragPos;
+	outFragPos = fragPos.xyz;
+	outTile = tile;
+}
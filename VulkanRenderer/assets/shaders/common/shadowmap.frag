@@ -7,10 +7,8 @@ layout(location = 0) in vec2 uv;
 layout(location = 1) flat in uint materialId;
 layout(location = 2) in vec3 fragPos;
 
-layout(location = 0) out float outFragDepth;
-
 layout(set = 2, binding = 0) uniform sampler texsampler;
-layout(set = 3, binding = 0) uniform texture2DArray materials[MATERIAL_COUNT];
+layout(set = 3, binding = 0) uniform texture2DArray materials[MATERIAL_TEXTURE_COUNT];
 layout(set = 4, binding = 0) uniform LightUniform { 
 	LightData lightData;
 };
@@ -26,7 +24,7 @@ bool matFlag(uint mask)
 void main() {
     if(matFlag(MATFLAG_ALPHAMASK))
     {
-        float alpha = texture(sampler2DArray(materials[materialId], texsampler), vec3(uv, 3)).r;
+        float alpha = texture(sampler2DArray(materials[materialTexture(materialId, TEXLAYER_ALPHA)], texsampler), vec3(uv, 0)).r;
 
         if(alpha < 0.1)
             discard;
@@ -35,5 +33,7 @@ void main() {
 	if(materialData.transparency[materialId].x < 0.1)
 		discard;
 
-	outFragDepth = length(lightData.pos - fragPos);// / lightData.farPlane;
+	//The cube map stores linear distance over the far plane. Cascades use shadowcascade.frag,
+	//which leaves depth alone so early depth testing stays on.
+	gl_FragDepth = length(lightData.pos - fragPos) / lightData.farPlane;
 }
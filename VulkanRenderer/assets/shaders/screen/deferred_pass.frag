@@ -17,15 +17,29 @@ layout(set = 1, binding = 1) uniform samplerCube skybox;
 layout(set = 2, binding = 0) uniform LightUniform {
 	LightData lightData;
 };
-layout(set = 3, binding = 0) uniform texture2DArray materials[MATERIAL_COUNT];
+layout(set = 3, binding = 0) uniform texture2DArray materials[MATERIAL_TEXTURE_COUNT];
 layout(set = 4, binding = 0) uniform CameraUniform {
 	Camera camera;
 };
 layout(set = 5, binding = 0) uniform textureCube shadowCube;
-//layout(set = 5, binding = 1) uniform texture2D shadowMap;
+layout(set = 5, binding = 1) uniform texture2DArray shadowCascades;
+layout(set = 5, binding = 2) uniform texture2D shadowAtlas;
+layout(std430, set = 5, binding = 3) readonly buffer AtlasBuffer {
+	AtlasData atlas;
+};
+layout(set = 5, binding = 4) uniform sampler shadowSampler;
 layout(std140, set = 6, binding = 0) uniform MaterialUniform {
 	MaterialData materialData;
 };
+layout(std430, set = 7, binding = 0) readonly buffer PointLightBuffer {
+	PointLightData pointLights;
+};
+layout(std430, set = 7, binding = 1) readonly buffer ClusterCounts {
+	uint clusterCounts[];
+};
+layout(std430, set = 7, binding = 2) readonly buffer ClusterLists {
+	uint clusterLights[];
+};
 layout(push_constant) uniform SceneFlags {
     uint flags;
 } sceneFlags;
@@ -40,11 +54,26 @@ bool matFlag(uint materialId, uint mask)
     return flag(materialData.flags[materialId], mask);
 }
 
+//Whether this pixel's shadows are filtered through the comparison sampler.
+bool hardwareShadows()
+{
+    if(sceneFlag(SCENEFLAG_SHADOWSPLIT))
+        return gl_FragCoord.x >= float(camera.width) * 0.5;
+    return sceneFlag(SCENEFLAG_HARDWARESHADOWS);
+}
+
+//Turns the Vogel disk per pixel, so that neighbouring pixels' taps fill each other's gaps.
+float vogelRotation()
+{
+    return interleavedGradientNoise(gl_FragCoord.xy) * 6.28318531;
+}
+
+//The cube map stores distance over the far plane.
 float sampleShadowCube(vec3 shadowUV, vec3 offset)
 {
 	//vec3 shadowUV = vec3(-lightVec.x, lightVec.y, -lightVec.z);
-    vec4 shadow = texture(samplerCube(shadowCube, texsampler), shadowUV);
-	if(length(shadowUV) > (shadow.r) + SHADOW_BIAS_CUBE)
+    float shadow = texture(samplerCube(shadowCube, texsampler), shadowUV).r * lightData.farPlane;
+	if(length(shadowUV) > shadow + SHADOW_BIAS_CUBE)
         return SHADOW_MUL;
     else
         return 1.0;
@@ -59,7 +88,7 @@ float shadowCubePCF(vec3 lightVec)
 	{
 		//vec3 shadowUV = vec3(-lightVec.x, lightVec.y, -lightVec.z);
 		vec3 shadowUV = lightVec + (shadowCubeSampleDirections[i] * PCF_RADIUS);
-		float shadow = texture(samplerCube(shadowCube, texsampler), shadowUV).r;
+		float shadow = texture(samplerCube(shadowCube, texsampler), shadowUV).r * lightData.farPlane;
 
 		if(length(lightVec) < shadow + SHADOW_BIAS_CUBE*2.0)
 			lightVal += 1.0;
@@ -68,30 +97,60 @@ float shadowCubePCF(vec3 lightVec)
 	return max(lightVal, SHADOW_MUL);
 }
 
-float sampleShadowMap(vec3 shadowPos, vec2 offset)
+float shadowCubeHardware(vec3 lightVec, bool pcf)
+{
+    float ref = (length(lightVec) - SHADOW_BIAS_CUBE*2.0) / lightData.farPlane;
+
+    if(!pcf)
+        return max(texture(samplerCubeShadow(shadowCube, shadowSampler), vec4(lightVec, ref)), SHADOW_MUL);
+
+    //Taps are spread across the plane facing the light.
+    vec3 n = normalize(lightVec);
+    vec3 t = normalize(cross(n, abs(n.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0)));
+    vec3 b = cross(n, t);
+    float rotation = vogelRotation();
+
+    float lit = 0.0;
+    for(uint i = 0; i < SHADOW_VOGEL_TAPS; i++)
+    {
+        vec2 o = vogelDisk(i, SHADOW_VOGEL_TAPS, rotation) * SHADOW_CUBE_FILTER_RADIUS;
+        lit += texture(samplerCubeShadow(shadowCube, shadowSampler), vec4(lightVec + t * o.x + b * o.y, ref));
+    }
+    return max(lit / float(SHADOW_VOGEL_TAPS), SHADOW_MUL);
+}
+
+//The first cascade reaching past depth; numViews if none do.
+uint cascadeFor(float depth)
+{
+    uint cascade = 0;
+    while(cascade < lightData.numViews && depth > lightData.cascadeSplits[cascade])
+        cascade++;
+    return cascade;
+}
+
+float sampleShadowMap(vec3 shadowPos, uint cascade, ivec2 offset)
 {
     const float SHADOW_BIAS = 0.0005;
-	//vec4 coord = shadowCoord/ shadowCoord.w;
-    //vec4 shadow = texture(sampler2D(shadowMap, texsampler), shadowPos.xy + offset);
-	vec4 shadow = vec4(1.0);
-    if(shadowPos.z > shadow.r + SHADOW_BIAS)
+    //Depth formats can't be relied on to filter, so texels are fetched.
+    ivec2 size = textureSize(sampler2DArray(shadowCascades, texsampler), 0).xy;
+    ivec2 texel = clamp(ivec2(shadowPos.xy * size) + offset, ivec2(0), size - 1);
+    float shadow = texelFetch(sampler2DArray(shadowCascades, texsampler), ivec3(texel, cascade), 0).r;
+    if(shadowPos.z > shadow + SHADOW_BIAS)
         return SHADOW_MUL;
     else
         return 1.0;
 }
 
-float shadowPCF(vec3 shadowPos)
+float shadowPCF(vec3 shadowPos, uint cascade)
 {
     float shadowValue = 0.0;
-    const float SHADOW_DIM = 1024.0;
     const int SAMPLE_COUNT = 4;
 
     for(int x = -(SAMPLE_COUNT/2); x < (SAMPLE_COUNT/2); x++)
     {
         for(int y = -(SAMPLE_COUNT/2); y < (SAMPLE_COUNT/2); y++)
         {
-            vec2 offset = vec2(x * (1.0/SHADOW_DIM), y * (1.0/SHADOW_DIM));
-            shadowValue += sampleShadowMap(shadowPos, offset);
+            shadowValue += sampleShadowMap(shadowPos, cascade, ivec2(x, y));
         }
     }
 
@@ -99,6 +158,158 @@ float shadowPCF(vec3 shadowPos)
     return shadowValue;
 }
 
+float shadowMapHardware(vec3 shadowPos, uint cascade, bool pcf)
+{
+    float ref = shadowPos.z - SHADOW_BIAS;
+
+    if(!pcf)
+        return mix(SHADOW_MUL, 1.0, texture(sampler2DArrayShadow(shadowCascades, shadowSampler), vec4(shadowPos.xy, cascade, ref)));
+
+    vec2 texelSize = 1.0 / vec2(textureSize(sampler2DArrayShadow(shadowCascades, shadowSampler), 0).xy);
+    float rotation = vogelRotation();
+
+    float lit = 0.0;
+    for(uint i = 0; i < SHADOW_VOGEL_TAPS; i++)
+    {
+        vec2 uv = shadowPos.xy + vogelDisk(i, SHADOW_VOGEL_TAPS, rotation) * SHADOW_FILTER_RADIUS * texelSize;
+        lit += texture(sampler2DArrayShadow(shadowCascades, shadowSampler), vec4(uv, cascade, ref));
+    }
+    return mix(SHADOW_MUL, 1.0, lit / float(SHADOW_VOGEL_TAPS));
+}
+
+float sampleAtlas(AtlasTile tile, vec2 coord, float depth, ivec2 offset)
+{
+    //Clamped to the tile, so that filtering never reads a neighbour's.
+    ivec2 texel = clamp(ivec2(tile.rect.xy + coord * tile.rect.zw) + offset,
+        ivec2(tile.rect.xy), ivec2(tile.rect.xy + tile.rect.zw) - 1);
+    float shadow = texelFetch(sampler2D(shadowAtlas, texsampler), texel, 0).r;
+    if(depth > shadow + ATLAS_BIAS)
+        return 0.0;
+    else
+        return 1.0;
+}
+
+float atlasShadowHardware(AtlasTile tile, vec2 coord, float depth, bool pcf)
+{
+    //Half a texel inside the tile, so that bilinear comparisons never reach a neighbour's.
+    vec2 lo = tile.rect.xy + 0.5;
+    vec2 hi = tile.rect.xy + tile.rect.zw - 0.5;
+    vec2 size = vec2(textureSize(sampler2DShadow(shadowAtlas, shadowSampler), 0));
+    vec2 center = tile.rect.xy + coord * tile.rect.zw;
+    float ref = depth - ATLAS_BIAS;
+
+    if(!pcf)
+        return texture(sampler2DShadow(shadowAtlas, shadowSampler), vec3(clamp(center, lo, hi) / size, ref));
+
+    float rotation = vogelRotation();
+
+    float lit = 0.0;
+    for(uint i = 0; i < ATLAS_VOGEL_TAPS; i++)
+    {
+        vec2 texel = clamp(center + vogelDisk(i, ATLAS_VOGEL_TAPS, rotation) * ATLAS_FILTER_RADIUS, lo, hi);
+        lit += texture(sampler2DShadow(shadowAtlas, shadowSampler), vec3(texel / size, ref));
+    }
+    return lit / float(ATLAS_VOGEL_TAPS);
+}
+
+float atlasShadow(AtlasLight light, vec3 pos)
+{
+    if(light.tiles.y == 0)
+        return 1.0;
+
+    vec3 d = pos - light.posRange.xyz;
+    uint index = light.tiles.x + (light.spot.w > 0.0 ? 0 : atlasFace(d));
+    AtlasTile tile = atlas.tiles[index];
+
+    vec4 clip = tile.viewProj * vec4(pos, 1.0);
+    vec2 coord = clamp(clip.xy / clip.w * 0.5 + 0.5, 0.0, 1.0);
+    float depth = length(d) / light.posRange.w;
+
+    if(hardwareShadows())
+        return atlasShadowHardware(tile, coord, depth, sceneFlag(SCENEFLAG_ENABLEPCF));
+
+    if(!sceneFlag(SCENEFLAG_ENABLEPCF))
+        return sampleAtlas(tile, coord, depth, ivec2(0));
+
+    float lit = 0.0;
+    for(int x = -1; x <= 1; x++)
+    {
+        for(int y = -1; y <= 1; y++)
+        {
+            lit += sampleAtlas(tile, coord, depth, ivec2(x, y));
+        }
+    }
+    return lit / 9.0;
+}
+
+//Light from the atlas's point and spot lights, which fades to nothing at their range.
+vec3 atlasLighting(vec3 pos, vec3 normal, vec3 diffuse)
+{
+    vec3 color = vec3(0.0);
+
+    for(uint i = 0; i < atlas.lightCount; i++)
+    {
+        AtlasLight light = atlas.lights[i];
+        vec3 toLight = light.posRange.xyz - pos;
+        float dist = length(toLight);
+        if(dist >= light.posRange.w)
+            continue;
+
+        vec3 l = toLight / dist;
+        float falloff = 1.0 - dist / light.posRange.w;
+        falloff *= falloff * max(dot(normal, l), 0.0);
+
+        if(light.spot.w > 0.0)
+            falloff *= smoothstep(light.spot.w, mix(light.spot.w, 1.0, 0.2), dot(-l, light.spot.xyz));
+
+        if(falloff <= 0.0)
+            continue;
+
+        if(sceneFlag(SCENEFLAG_ENABLESHADOWS))
+            falloff *= atlasShadow(light, pos);
+
+        color += diffuse * light.color.rgb * falloff;
+    }
+
+    return color;
+}
+
+vec3 pointLight(uint index, vec3 pos, vec3 normal, vec3 diffuse)
+{
+    PointLight light = pointLights.lights[index];
+    vec3 toLight = light.posRange.xyz - pos;
+    float dist = length(toLight);
+    if(dist >= light.posRange.w)
+        return vec3(0.0);
+
+    float falloff = 1.0 - dist / light.posRange.w;
+    return diffuse * light.color.rgb * (falloff * falloff * max(dot(normal, toLight / dist), 0.0));
+}
+
+//Only the lights listed for the cluster the pixel is in, unless clustering is off.
+vec3 pointLighting(vec3 pos, float viewDepth, vec3 normal, vec3 diffuse)
+{
+    vec3 color = vec3(0.0);
+
+    if(pointLights.clustered == 0)
+    {
+        for(uint i = 0; i < pointLights.count; i++)
+            color += pointLight(i, pos, normal, diffuse);
+        return color;
+    }
+
+    uvec2 tile = min(uvec2(gl_FragCoord.xy / vec2(camera.width, camera.height) * vec2(CLUSTER_X, CLUSTER_Y)),
+        uvec2(CLUSTER_X - 1, CLUSTER_Y - 1));
+    float slice = log(viewDepth / pointLights.zNear) / log(pointLights.zFar / pointLights.zNear) * float(CLUSTER_Z);
+    uint cluster = clusterIndex(uvec3(tile, uint(clamp(slice, 0.0, float(CLUSTER_Z - 1)))));
+
+    uint count = clusterCounts[cluster];
+    for(uint i = 0; i < count; i++)
+        color += pointLight(clusterLights[cluster * CLUSTER_MAX_LIGHTS + i], pos, normal, diffuse);
+
+    return color;
+}
+
 void main()
 {
     float depth = texture(depthAttachment, uv).x;
@@ -131,15 +342,15 @@ void main()
     vec2 matUV = vec2((diffuse.x) / 1000.0, (diffuse.y) / 1000.0);
     vec4 albedo = diffuseMat;
 	if(matFlag(materialId, MATFLAG_DIFFUSEMAP))
-		albedo = texture(sampler2DArray(materials[materialId], texsampler), vec3(matUV, TEXLAYER_DIFFUSE));
+		albedo = texture(sampler2DArray(materials[materialTexture(materialId, TEXLAYER_DIFFUSE)], texsampler), vec3(matUV, 0));
 
 	vec4 normalMap = vec4(1.0);
 	if(matFlag(materialId, MATFLAG_NORMALMAP))
-		normalMap = texture(sampler2DArray(materials[materialId], texsampler), vec3(matUV, TEXLAYER_BUMP));
+		normalMap = vec4(decodeBump(texture(sampler2DArray(materials[materialTexture(materialId, TEXLAYER_BUMP)], texsampler), vec3(matUV, 0)).rg), 1.0);
 
     float exponent = materialData.specular[materialId].x;
     if(matFlag(materialId, MATFLAG_SPECMAP))
-		exponent = texture(sampler2DArray(materials[materialId], texsampler), vec3(matUV, TEXLAYER_SPEC)).r;
+		exponent = texture(sampler2DArray(materials[materialTexture(materialId, TEXLAYER_SPEC)], texsampler), vec3(matUV, 0)).r;
 	
 	float specMul = 1.0;
     if(materialData.shininess[materialId] > 0.0)
@@ -153,21 +364,28 @@ void main()
 
 	if(sceneFlag(SCENEFLAG_ENABLESHADOWS))
 	{
-		if(lightData.numViews == 1)
+		if(lightData.numViews <= MAX_CASCADES)
 		{
-			vec4 shadowCoord = biasMatrix * lightData.proj * lightData.views[0] * vec4(worldPos, 1.0);
-			vec3 shadowPos = shadowCoord.xyz / shadowCoord.w;
-			//vec2 shadowUV = vec2(shadowPos.xy);
-			//vec4 shadowRGBA = texture(sampler2D(shadowMap, texsampler), shadowUV);
-
-			if(sceneFlag(SCENEFLAG_ENABLEPCF))
-				shadowValue = shadowPCF(shadowPos);
-			else
-				shadowValue = sampleShadowMap(shadowPos, vec2(0.0));
+			//Past the last cascade nothing is shadowed.
+			uint cascade = cascadeFor(-(camera.view * vec4(worldPos, 1.0)).z);
+			if(cascade < lightData.numViews)
+			{
+				vec4 shadowCoord = biasMatrix * lightData.proj * lightData.views[cascade] * vec4(worldPos, 1.0);
+				vec3 shadowPos = shadowCoord.xyz / shadowCoord.w;
+
+				if(hardwareShadows())
+					shadowValue = shadowMapHardware(shadowPos, cascade, sceneFlag(SCENEFLAG_ENABLEPCF));
+				else if(sceneFlag(SCENEFLAG_ENABLEPCF))
+					shadowValue = shadowPCF(shadowPos, cascade);
+				else
+					shadowValue = sampleShadowMap(shadowPos, cascade, ivec2(0));
+			}
 		}
 		else
 		{
-			if(sceneFlag(SCENEFLAG_ENABLEPCF))
+			if(hardwareShadows())
+				shadowValue = shadowCubeHardware(lightVec, sceneFlag(SCENEFLAG_ENABLEPCF));
+			else if(sceneFlag(SCENEFLAG_ENABLEPCF))
 				shadowValue = shadowCubePCF((lightVec));
 			else
 				shadowValue = sampleShadowCube(lightVec, vec3(0.0));
@@ -214,6 +432,13 @@ void main()
 		fragColor.w = 1.0;
 
 		fragColor.xyz *= shadowValue;
+		fragColor.xyz += atlasLighting(worldPos, normalize(normal.xyz), diffuseValue);
+
+		if(pointLights.count > 0)
+		{
+			float viewDepth = -(camera.view * vec4(worldPos, 1.0)).z;
+			fragColor.xyz += pointLighting(worldPos, viewDepth, normalize(normal.xyz), diffuseValue);
+		}
 
 		//TODO: better transparency handling
 		if(transparencyMat.r == 0.0) fragColor.rgb = skyboxColor;
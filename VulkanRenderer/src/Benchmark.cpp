@@ -0,0 +1,620 @@
+#include "Benchmark.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "GpuCuller.h"
+#include "LightClusterer.h"
+#include "Model.h"
+#include "MeshCache.h"
+#include "JobSystem.h"
+#include "CommandRecorder.h"
+#include "renderpass/ShadowMapRenderPass.h"
+#include "texture/TextureLoader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include <SDL.h>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+const uint32_t WARMUP_FRAMES = 30;
+const uint32_t MEASURED_FRAMES = 300;
+const uint32_t LOAD_RUNS = 5;
+
+//Distances along the camera's view axis for the distance benchmark.
+const float DISTANCES[] = { 1.0f, 2.0f, 4.0f, 8.0f, 16.0f, 32.0f, 64.0f };
+
+//The flythrough moves this far forward each frame while turning through FLY_TURNS full turns.
+const float FLY_STEP = 0.02f;
+const float FLY_TURNS = 2.0f;
+
+//TODO: retrieve from global config.
+const uint32_t MAX_MODELS = 64;
+
+//Point light counts for the lights benchmark. Looping over every light per pixel is only
+//measured up to LIGHTS_UNCLUSTERED_MAX, beyond which a frame takes too long.
+const uint32_t LIGHT_COUNTS[] = { 1, 64, 1024, 8192 };
+const uint32_t LIGHTS_UNCLUSTERED_MAX = 1024;
+
+//Shadow atlas lights lit alongside the point light for the shadows benchmark.
+const uint32_t SHADOW_ATLAS_LIGHTS = 8;
+
+Benchmark::Benchmark(Renderer& renderer, Scene& scene, const std::string& model, float scale)
+	: _renderer(&renderer), _scene(&scene), _model(model), _scale(scale)
+{
+
+}
+
+void Benchmark::run(const std::string& name)
+{
+	if (name == "models")
+		_modelCount();
+	else if (name == "distance")
+		_distance();
+	else if (name == "load")
+		_loadTime();
+	else if (name == "threads")
+		_threadCount();
+	else if (name == "recording")
+		_recording();
+	else if (name == "parallel")
+		_parallelRecording();
+	else if (name == "calls")
+		_callCount();
+	else if (name == "flythrough")
+		_flythrough();
+	else if (name == "cascades")
+		_cascades();
+	else if (name == "lights")
+		_lights();
+	else if (name == "shadows")
+		_shadows();
+	else
+		printf("Unknown benchmark '%s'\n", name.c_str());
+}
+
+void Benchmark::_addModels(uint32_t count)
+{
+	while (_scene->models().size() < count)
+	{
+		const float offset = (float)_scene->models().size();
+		_scene->addModel(_model, _scale);
+		_scene->models().back()->setPosition(glm::vec3(0.0f, offset * 2.0f, 0.0f));
+	}
+}
+
+void Benchmark::_callCount()
+{
+	if (_model.empty())
+	{
+		printf("The calls benchmark needs a model name\n");
+		return;
+	}
+
+	_addModels(MAX_MODELS);
+
+	_renderer->textureLoader().flush();
+	for (Model* model : _scene->models())
+		model->finishUpload();
+
+	//Every frame is recorded afresh, so the counts and recording time are for the current mode.
+	_renderer->setRecordEachFrame(true);
+
+	for (uint32_t tracking = 0; tracking < 2; ++tracking)
+	{
+		CommandRecorder::setTracking(tracking != 0);
+
+		float record = 0.0f;
+		_runFrames(WARMUP_FRAMES);
+		const float cpu = _runFrames(MEASURED_FRAMES, nullptr, &record);
+
+		printf("%s state tracking: %.3f cpu ms/frame, %.3f record ms/frame\n",
+			tracking ? "With" : "Without", cpu, record);
+		_renderer->printCallCounts();
+	}
+
+	_renderer->setRecordEachFrame(false);
+}
+
+float Benchmark::_runFrames(uint32_t count, float* gpuTime, float* recordTime)
+{
+	std::chrono::duration<float> total(0.0f);
+	std::chrono::duration<float> dtime(0.0f);
+	float gpuTotal = 0.0f;
+	float recordTotal = 0.0f;
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		//Keep the window responsive without handing input to the scene.
+		SDL_PumpEvents();
+
+		std::chrono::time_point<std::chrono::steady_clock> start = Clock::now();
+		_scene->update(dtime.count());
+		_renderer->render();
+		dtime = Clock::now() - start;
+
+		total += dtime;
+		gpuTotal += _renderer->gpuFrameTime();
+		recordTotal += _renderer->recordTime();
+	}
+
+	if (gpuTime)
+		*gpuTime = gpuTotal / count;
+
+	if (recordTime)
+		*recordTime = recordTotal / count;
+
+	return (total.count() * 1000.0f) / count;
+}
+
+void Benchmark::_cascades()
+{
+	if (_model.empty())
+	{
+		printf("The cascades benchmark needs a model name\n");
+		return;
+	}
+
+	_addModels(MAX_MODELS);
+
+	_renderer->textureLoader().flush();
+	for (Model* model : _scene->models())
+		model->finishUpload();
+
+	printf("cascades | cpu ms/frame | gpu ms/frame | shadow faces/frame | cascade 0 texels/unit\n");
+
+	Camera& camera = _scene->camera();
+	ShadowMapRenderPass* shadow = (ShadowMapRenderPass*)_renderer->getRenderPass(RenderPassType::SHADOWMAP);
+	const uint32_t cascades = _scene->cascades();
+
+	for (uint32_t count = 1; count <= MAX_CASCADES; ++count)
+	{
+		_scene->setCascades(count);
+
+		std::chrono::duration<float> total(0.0f);
+		std::chrono::duration<float> dtime(0.0f);
+		float gpuTotal = 0.0f;
+		uint64_t faces = 0;
+
+		//The same path as the flythrough, so the cascades are refitted as the camera moves.
+		camera.reset();
+
+		for (uint32_t i = 0; i < WARMUP_FRAMES + MEASURED_FRAMES; ++i)
+		{
+			SDL_PumpEvents();
+
+			camera.move(glm::vec3(-FLY_STEP, 0.0f, 0.0f));
+			camera.turn((FLY_TURNS * 4.0f) / (WARMUP_FRAMES + MEASURED_FRAMES));
+
+			std::chrono::time_point<std::chrono::steady_clock> start = Clock::now();
+			_scene->update(dtime.count());
+			_renderer->render();
+			dtime = Clock::now() - start;
+
+			if (i < WARMUP_FRAMES)
+				continue;
+
+			total += dtime;
+			gpuTotal += _renderer->gpuFrameTime();
+			faces += shadow->facesRendered();
+		}
+
+		printf("%8u | %12.3f | %12.3f | %18.2f | %21.1f\n", count,
+			(total.count() * 1000.0f) / MEASURED_FRAMES, gpuTotal / MEASURED_FRAMES,
+			(float)faces / MEASURED_FRAMES, _scene->cascadeResolution(0));
+	}
+
+	camera.reset();
+	_scene->setCascades(cascades);
+}
+
+void Benchmark::_distance()
+{
+	if (_model.empty())
+	{
+		printf("The distance benchmark needs a model name\n");
+		return;
+	}
+
+	//The camera starts at the origin looking down +X, so pushing the model along X
+	//shrinks it on screen and shifts texture fetches towards the smaller mip levels.
+	printf("distance | cpu ms/frame | gpu ms/frame\n");
+
+	Model* model = _scene->models().front();
+
+	for (float distance : DISTANCES)
+	{
+		model->setPosition(glm::vec3(distance, 0.0f, 0.0f));
+
+		float gpu = 0.0f;
+		_runFrames(WARMUP_FRAMES);
+		const float cpu = _runFrames(MEASURED_FRAMES, &gpu);
+
+		printf("%8.1f | %12.3f | %12.3f\n", distance, cpu, gpu);
+	}
+}
+
+void Benchmark::_flythrough()
+{
+	if (_model.empty())
+	{
+		printf("The flythrough benchmark needs a model name\n");
+		return;
+	}
+
+	_addModels(MAX_MODELS);
+
+	_renderer->textureLoader().flush();
+	for (Model* model : _scene->models())
+		model->finishUpload();
+
+	//Culling happens as command buffers are recorded, so they have to be recorded every frame.
+	_renderer->setRecordEachFrame(true);
+
+	printf("culling | cpu ms/frame | record ms/frame | gpu ms/frame | shapes tested | culled | drawn\n");
+
+	Camera& camera = _scene->camera();
+	const char* modes[] = { "off", "cpu", "gpu" };
+	uint64_t submittedTriangles = 0;
+	uint64_t visibleTriangles = 0;
+
+	for (uint32_t mode = 0; mode < 3; ++mode)
+	{
+		_scene->setCulling(mode == 1);
+		_scene->setGpuCulling(mode == 2);
+
+		std::chrono::duration<float> total(0.0f);
+		std::chrono::duration<float> dtime(0.0f);
+		float gpuTotal = 0.0f;
+		float recordTotal = 0.0f;
+		uint64_t tested = 0;
+		uint64_t culled = 0;
+
+		//Every run follows the same path, stepped per frame rather than by frame time. The first
+		//frames aren't counted so that the GPU timestamps and cull stats have caught up.
+		camera.reset();
+
+		for (uint32_t i = 0; i < WARMUP_FRAMES + MEASURED_FRAMES; ++i)
+		{
+			SDL_PumpEvents();
+
+			camera.move(glm::vec3(-FLY_STEP, 0.0f, 0.0f));
+			camera.turn((FLY_TURNS * 4.0f) / (WARMUP_FRAMES + MEASURED_FRAMES));
+
+			std::chrono::time_point<std::chrono::steady_clock> start = Clock::now();
+			_scene->update(dtime.count());
+			_renderer->render();
+			dtime = Clock::now() - start;
+
+			if (i < WARMUP_FRAMES)
+				continue;
+
+			total += dtime;
+			gpuTotal += _renderer->gpuFrameTime();
+			recordTotal += _renderer->recordTime();
+
+			//The GPU culler's stats lag a few frames behind, which evens out over the run.
+			if (mode == 2)
+			{
+				const GpuCuller::Stats& stats = _renderer->gpuCuller().stats();
+				tested += stats.submittedShapes;
+				culled += stats.submittedShapes - stats.visibleShapes;
+				submittedTriangles += stats.submittedTriangles;
+				visibleTriangles += stats.visibleTriangles;
+			}
+			else
+			{
+				tested += _scene->testedShapes();
+				culled += _scene->culledShapes();
+			}
+		}
+
+		//Without culling nothing is tested, but every shape is drawn.
+		uint64_t drawn = 0;
+		for (Model* model : _scene->models())
+			drawn += model->shapeCount();
+		drawn = mode ? tested - culled : drawn * MEASURED_FRAMES;
+
+		printf("%-7s | %12.3f | %15.3f | %12.3f | %13.1f | %6.1f | %5.1f\n", modes[mode],
+			(total.count() * 1000.0f) / MEASURED_FRAMES, recordTotal / MEASURED_FRAMES,
+			gpuTotal / MEASURED_FRAMES, (float)tested / MEASURED_FRAMES,
+			(float)culled / MEASURED_FRAMES, (float)drawn / MEASURED_FRAMES);
+	}
+
+	printf("GPU culling drew %.0f of %.0f triangles per frame\n", (float)visibleTriangles / MEASURED_FRAMES,
+		(float)submittedTriangles / MEASURED_FRAMES);
+
+	_scene->setGpuCulling(false);
+	camera.reset();
+	_scene->setCulling(true);
+	_renderer->setRecordEachFrame(false);
+}
+
+void Benchmark::_lights()
+{
+	if (_model.empty())
+	{
+		printf("The lights benchmark needs a model name\n");
+		return;
+	}
+
+	_addModels(1);
+
+	_renderer->textureLoader().flush();
+	for (Model* model : _scene->models())
+		model->finishUpload();
+
+	LightClusterer& clusterer = _renderer->lightClusterer();
+
+	printf("Point lights are only drawn by the deferred path (-deferred)\n");
+	printf("lights | clustered | cpu ms/frame | gpu ms/frame | lights/cluster\n");
+
+	for (uint32_t count : LIGHT_COUNTS)
+	{
+		_scene->setPointLights(count);
+
+		for (uint32_t clustered = 0; clustered < 2; ++clustered)
+		{
+			if (!clustered && count > LIGHTS_UNCLUSTERED_MAX)
+				continue;
+
+			_scene->setLightClustering(clustered != 0);
+
+			_runFrames(WARMUP_FRAMES);
+
+			float gpuTime = 0.0f;
+			const float cpuTime = _runFrames(MEASURED_FRAMES, &gpuTime);
+
+			printf("%6u | %9s | %12.3f | %12.3f | %14.2f\n", count, clustered ? "yes" : "no", cpuTime, gpuTime,
+				clustered ? (float)clusterer.listedLights() / CLUSTER_COUNT : (float)count);
+		}
+	}
+
+	_scene->setLightClustering(true);
+	_scene->setPointLights(0);
+}
+
+void Benchmark::_loadTime()
+{
+	if (_model.empty())
+	{
+		printf("The load benchmark needs a model name\n");
+		return;
+	}
+
+	const std::string cachePath = MeshCache::path(_model);
+
+	printf("run  | cold ms (OBJ) | warm ms (cache)\n");
+
+	float coldTotal = 0.0f;
+	float warmTotal = 0.0f;
+
+	for (uint32_t run = 0; run < LOAD_RUNS; ++run)
+	{
+		float times[2];
+
+		//Cold parses the OBJ and writes a fresh cache, warm maps that cache.
+		for (uint32_t warm = 0; warm < 2; ++warm)
+		{
+			if (!warm)
+				remove(cachePath.c_str());
+
+			std::chrono::time_point<std::chrono::steady_clock> start = Clock::now();
+			Model* model = new Model(_model, _renderer);
+			_renderer->textureLoader().flush();
+			model->finishUpload();
+			std::chrono::duration<float> elapsed = Clock::now() - start;
+
+			delete model;
+			times[warm] = elapsed.count() * 1000.0f;
+		}
+
+		coldTotal += times[0];
+		warmTotal += times[1];
+		printf("%4u | %13.2f | %15.2f\n", run, times[0], times[1]);
+	}
+
+	printf("mean | %13.2f | %15.2f\n", coldTotal / LOAD_RUNS, warmTotal / LOAD_RUNS);
+}
+
+void Benchmark::_threadCount()
+{
+	if (_model.empty())
+	{
+		printf("The threads benchmark needs a model name\n");
+		return;
+	}
+
+	const uint32_t defaultThreads = JobSystem::threadCount();
+	const uint32_t maxThreads = (std::max)(std::thread::hardware_concurrency(), 1u);
+
+	//Make sure the mesh cache exists and the textures are in the OS file cache, so that
+	//only decoding and uploading are being measured.
+	Model* warmup = new Model(_model, _renderer);
+	_renderer->textureLoader().flush();
+	warmup->finishUpload();
+	delete warmup;
+
+	printf("threads | load ms | speedup\n");
+
+	float serial = 0.0f;
+
+	//0 decodes everything on the main thread, as loading used to.
+	for (uint32_t threads = 0; threads <= maxThreads; threads = threads ? threads * 2 : 1)
+	{
+		JobSystem::init(threads);
+
+		float total = 0.0f;
+		for (uint32_t run = 0; run < LOAD_RUNS; ++run)
+		{
+			std::chrono::time_point<std::chrono::steady_clock> start = Clock::now();
+			Model* model = new Model(_model, _renderer);
+			_renderer->textureLoader().flush();
+			model->finishUpload();
+			std::chrono::duration<float> elapsed = Clock::now() - start;
+
+			delete model;
+			total += elapsed.count() * 1000.0f;
+		}
+
+		const float mean = total / LOAD_RUNS;
+		if (threads == 0)
+			serial = mean;
+
+		printf("%7u | %7.2f | %7.2f\n", threads, mean, serial / mean);
+	}
+
+	JobSystem::init(defaultThreads);
+}
+
+void Benchmark::_modelCount()
+{
+	if (_model.empty())
+	{
+		printf("The models benchmark needs a model name\n");
+		return;
+	}
+
+	printf("models | cpu ms/frame\n");
+
+	for (uint32_t count = 1; count <= MAX_MODELS; count *= 2)
+	{
+		_addModels(count);
+
+		_runFrames(WARMUP_FRAMES);
+		printf("%6u | %12.3f\n", count, _runFrames(MEASURED_FRAMES));
+	}
+}
+
+void Benchmark::_parallelRecording()
+{
+	if (_model.empty())
+	{
+		printf("The parallel benchmark needs a model name\n");
+		return;
+	}
+
+	const uint32_t defaultThreads = JobSystem::threadCount();
+	const uint32_t maxThreads = (std::max)(std::thread::hardware_concurrency(), 1u);
+
+	//Recording has to be spread over enough models to be worth splitting.
+	_addModels(MAX_MODELS);
+
+	_renderer->textureLoader().flush();
+	for (Model* model : _scene->models())
+		model->finishUpload();
+
+	//Recording every frame puts the recording cost on each frame, where it can be timed.
+	_renderer->setRecordEachFrame(true);
+
+	printf("%u models\n", (uint32_t)_scene->models().size());
+	printf("threads | cpu ms/frame | record ms/frame | speedup\n");
+
+	float serial = 0.0f;
+
+	//0 records every secondary command buffer on the main thread.
+	for (uint32_t threads = 0; threads <= maxThreads; threads = threads ? threads * 2 : 1)
+	{
+		JobSystem::init(threads);
+
+		float record = 0.0f;
+		_runFrames(WARMUP_FRAMES);
+		const float cpu = _runFrames(MEASURED_FRAMES, nullptr, &record);
+
+		if (threads == 0)
+			serial = record;
+
+		printf("%7u | %12.3f | %15.3f | %7.2f\n", threads, cpu, record, serial / record);
+	}
+
+	_renderer->setRecordEachFrame(false);
+	JobSystem::init(defaultThreads);
+}
+
+void Benchmark::_recording()
+{
+	if (_model.empty())
+	{
+		printf("The recording benchmark needs a model name\n");
+		return;
+	}
+
+	printf("mode       | cpu ms/frame | record ms/frame | gpu ms/frame\n");
+
+	for (uint32_t eachFrame = 0; eachFrame < 2; ++eachFrame)
+	{
+		_renderer->setRecordEachFrame(eachFrame != 0);
+
+		float gpu = 0.0f;
+		float record = 0.0f;
+		_runFrames(WARMUP_FRAMES);
+		const float cpu = _runFrames(MEASURED_FRAMES, &gpu, &record);
+
+		printf("%-10s | %12.3f | %15.3f | %12.3f\n", eachFrame ? "each frame" : "up front", cpu, record, gpu);
+	}
+
+	_renderer->setRecordEachFrame(false);
+}
+
+void Benchmark::_shadows()
+{
+	if (_model.empty())
+	{
+		printf("The shadows benchmark needs a model name\n");
+		return;
+	}
+
+	_addModels(1);
+
+	_renderer->textureLoader().flush();
+	for (Model* model : _scene->models())
+		model->finishUpload();
+
+	const uint32_t cascades = _scene->cascades();
+	const uint32_t atlasLights = _scene->shadowAtlas().lightCount();
+	const bool pcf = _scene->pcf();
+	const ShadowFilter filter = _scene->shadowFilter();
+
+	const char* lights[] = { "point", "cascades", "point+atlas" };
+
+	//A single tap is the same either way, so it's only measured once, through the comparison sampler.
+	struct Run
+	{
+		const char* name;
+		ShadowFilter filter;
+		bool pcf;
+	};
+	const Run runs[] = {
+		{ "single", ShadowFilter::SHADOW_FILTER_HARDWARE, false },
+		{ "manual", ShadowFilter::SHADOW_FILTER_MANUAL, true },
+		{ "hardware", ShadowFilter::SHADOW_FILTER_HARDWARE, true }
+	};
+
+	printf("light       | filter   | cpu ms/frame | gpu ms/frame\n");
+
+	for (uint32_t light = 0; light < 3; ++light)
+	{
+		_scene->setCascades(light == 1 ? MAX_CASCADES : 0);
+		_scene->setAtlasLights(light == 2 ? SHADOW_ATLAS_LIGHTS : 0);
+
+		for (const Run& run : runs)
+		{
+			_scene->setShadowFilter(run.filter);
+			_scene->setPCF(run.pcf);
+
+			_runFrames(WARMUP_FRAMES);
+
+			float gpuTime = 0.0f;
+			const float cpuTime = _runFrames(MEASURED_FRAMES, &gpuTime);
+
+			printf("%-11s | %-8s | %12.3f | %12.3f\n", lights[light], run.name, cpuTime, gpuTime);
+		}
+	}
+
+	_scene->setCascades(cascades);
+	_scene->setAtlasLights(atlasLights);
+	_scene->setShadowFilter(filter);
+	_scene->setPCF(pcf);
+}
\ No newline at end of file
@@ -0,0 +1,45 @@
+#ifndef BENCHMARK_H_
+#define BENCHMARK_H_
+
+#include <string>
+
+class Renderer;
+class Scene;
+
+//Scripted, non-interactive runs for measuring the renderer.
+//Selected with `-benchmark <name>` on the command line; results are printed to the console.
+class Benchmark
+{
+public:
+	Benchmark(Renderer& renderer, Scene& scene, const std::string& model, float scale);
+
+	void run(const std::string& name);
+
+private:
+	Renderer* _renderer;
+	Scene* _scene;
+
+	std::string _model;
+	float _scale;
+
+	//Returns the average CPU time per frame, in milliseconds. The average GPU time and
+	//command buffer recording time are written to gpuTime and recordTime if provided.
+	float _runFrames(uint32_t count, float* gpuTime = nullptr, float* recordTime = nullptr);
+
+	//Fills the scene with copies of the model, spaced out vertically.
+	void _addModels(uint32_t count);
+
+	void _callCount();
+	void _cascades();
+	void _distance();
+	void _flythrough();
+	void _lights();
+	void _loadTime();
+	void _modelCount();
+	void _parallelRecording();
+	void _recording();
+	void _shadows();
+	void _threadCount();
+};
+
+#endif //BENCHMARK_H_
\ No newline at end of file
@@ -3,17 +3,23 @@
 
 Buffer::~Buffer()
 {
-	if(buffer != VK_NULL_HANDLE)
-		vkDestroyBuffer(Renderer::device(), buffer, nullptr);
-
-	if(memory != VK_NULL_HANDLE)
-		vkFreeMemory(Renderer::device(), memory, nullptr);
+	destroy();
 }
 
 void Buffer::copyData(void* data, size_t size, size_t offset) const
 {
-	void* dst;
-	VkCheck(vkMapMemory(Renderer::device(), memory, offset, size, 0, &dst));
-	memcpy(dst, data, size);
-	vkUnmapMemory(Renderer::device(), memory);
+	//Host-visible memory is persistently mapped by the allocator.
+	assert(memory.mapped);
+	memcpy(memory.mapped + offset, data, size);
+}
+
+void Buffer::destroy()
+{
+	if(buffer != VK_NULL_HANDLE)
+		vkDestroyBuffer(Renderer::device(), buffer, nullptr);
+
+	if (memory.memory != VK_NULL_HANDLE)
+		Renderer::allocator().free(memory);
+
+	buffer = VK_NULL_HANDLE;
 }
\ No newline at end of file
@@ -3,14 +3,18 @@
 
 #include <vulkan/vulkan.h>
 
+#include "MemoryAllocator.h"
+
 struct Buffer
 {
-	VkBuffer buffer;
-	VkDeviceMemory memory;
+	VkBuffer buffer = VK_NULL_HANDLE;
+	Allocation memory;
 
 	~Buffer();
 
 	void copyData(void* data, size_t size, size_t offset = 0) const;
+
+	void destroy();
 };
 
 #endif //BUFFER_H_
\ No newline at end of file
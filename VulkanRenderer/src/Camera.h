@@ -33,6 +33,27 @@ public:
 		_reset();
 	}
 
+	inline float aspectRatio() const
+	{
+		return _aspectRatio;
+	}
+
+	inline float farClip() const
+	{
+		return _farClip;
+	}
+
+	//Vertical, in degrees.
+	inline float fov() const
+	{
+		return _fov;
+	}
+
+	inline float nearClip() const
+	{
+		return _nearClip;
+	}
+
 	void lookAt(const glm::vec3& point)
 	{
 		//
@@ -42,6 +63,18 @@ public:
 
 	void move(const glm::vec3& moveBy);
 
+	//Back to the origin, looking along the positive X-axis.
+	inline void reset()
+	{
+		_reset();
+	}
+
+	//Same units as the arrow keys: a yaw of 1.0 is a quarter turn.
+	inline void turn(float yaw, float pitch = 0.0f)
+	{
+		_adjustView(yaw, pitch);
+	}
+
 	glm::mat4 projectionMatrix() const
 	{
 		glm::mat4 projectionMatrix = glm::perspective(glm::radians(_fov), _aspectRatio, _nearClip, _farClip);
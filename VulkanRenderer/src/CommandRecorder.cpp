@@ -0,0 +1,147 @@
+#include "CommandRecorder.h"
+
+#include <cstring>
+
+bool CommandRecorder::_tracking = true;
+CommandRecorder::DrawIndexedIndirectCountFn CommandRecorder::_drawIndexedIndirectCount = nullptr;
+
+CommandRecorder::CommandRecorder(VkCommandBuffer cmd) : _cmd(cmd), _layout(VK_NULL_HANDLE),
+	_pipeline(VK_NULL_HANDLE), _vertexBuffer(VK_NULL_HANDLE), _vertexOffset(0),
+	_indexBuffer(VK_NULL_HANDLE), _indexOffset(0), _indexType(VK_INDEX_TYPE_UINT32),
+	_calls(0), _skipped(0)
+{
+	memset(_sets, 0, sizeof(_sets));
+}
+
+void CommandRecorder::bindDescriptorSet(VkPipelineLayout layout, uint32_t index,
+	VkDescriptorSet set, uint32_t offsetCount, const uint32_t* offsets)
+{
+	if (layout != _layout)
+	{
+		memset(_sets, 0, sizeof(_sets));
+		_layout = layout;
+	}
+
+	const bool trackable = index < MAX_SETS && offsetCount <= MAX_DYNAMIC_OFFSETS;
+
+	if (_tracking && trackable)
+	{
+		const BoundSet& bound = _sets[index];
+		if (bound.set == set && bound.offsetCount == offsetCount &&
+			(offsetCount == 0 || memcmp(bound.offsets, offsets, offsetCount * sizeof(uint32_t)) == 0))
+		{
+			_skipped++;
+			return;
+		}
+	}
+
+	vkCmdBindDescriptorSets(_cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, index, 1, &set,
+		offsetCount, offsets);
+	_calls++;
+
+	if (trackable)
+	{
+		BoundSet& bound = _sets[index];
+		bound.set = set;
+		bound.offsetCount = offsetCount;
+		if (offsetCount)
+			memcpy(bound.offsets, offsets, offsetCount * sizeof(uint32_t));
+	}
+	else if (index < MAX_SETS)
+		_sets[index].set = VK_NULL_HANDLE;
+}
+
+void CommandRecorder::bindIndexBuffer(VkBuffer buffer, VkDeviceSize offset, VkIndexType type)
+{
+	if (_tracking && buffer == _indexBuffer && offset == _indexOffset && type == _indexType)
+	{
+		_skipped++;
+		return;
+	}
+
+	vkCmdBindIndexBuffer(_cmd, buffer, offset, type);
+	_calls++;
+
+	_indexBuffer = buffer;
+	_indexOffset = offset;
+	_indexType = type;
+}
+
+void CommandRecorder::bindPipeline(VkPipeline pipeline)
+{
+	if (_tracking && pipeline == _pipeline)
+	{
+		_skipped++;
+		return;
+	}
+
+	vkCmdBindPipeline(_cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+	_calls++;
+
+	_pipeline = pipeline;
+}
+
+void CommandRecorder::bindVertexBuffer(VkBuffer buffer, VkDeviceSize offset)
+{
+	if (_tracking && buffer == _vertexBuffer && offset == _vertexOffset)
+	{
+		_skipped++;
+		return;
+	}
+
+	vkCmdBindVertexBuffers(_cmd, 0, 1, &buffer, &offset);
+	_calls++;
+
+	_vertexBuffer = buffer;
+	_vertexOffset = offset;
+}
+
+void CommandRecorder::drawIndexed(uint32_t indexCount, uint32_t instanceCount,
+	uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance)
+{
+	vkCmdDrawIndexed(_cmd, indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
+	_calls++;
+}
+
+void CommandRecorder::drawIndexedIndirect(VkBuffer buffer, VkDeviceSize offset,
+	uint32_t drawCount, uint32_t stride)
+{
+	vkCmdDrawIndexedIndirect(_cmd, buffer, offset, drawCount, stride);
+	_calls++;
+}
+
+void CommandRecorder::drawIndexedIndirectCount(VkBuffer buffer, VkDeviceSize offset,
+	VkBuffer countBuffer, VkDeviceSize countOffset, uint32_t maxDrawCount, uint32_t stride)
+{
+	_drawIndexedIndirectCount(_cmd, buffer, offset, countBuffer, countOffset, maxDrawCount, stride);
+	_calls++;
+}
+
+void CommandRecorder::pushConstants(VkPipelineLayout layout, VkShaderStageFlags stages,
+	uint32_t offset, uint32_t size, const void* data)
+{
+	vkCmdPushConstants(_cmd, layout, stages, offset, size, data);
+	_calls++;
+}
+
+void CommandRecorder::setDrawIndirectCount(DrawIndexedIndirectCountFn fn)
+{
+	_drawIndexedIndirectCount = fn;
+}
+
+void CommandRecorder::setScissor(const VkRect2D& scissor)
+{
+	vkCmdSetScissor(_cmd, 0, 1, &scissor);
+	_calls++;
+}
+
+void CommandRecorder::setTracking(bool enable)
+{
+	_tracking = enable;
+}
+
+void CommandRecorder::setViewport(const VkViewport& viewport)
+{
+	vkCmdSetViewport(_cmd, 0, 1, &viewport);
+	_calls++;
+}
\ No newline at end of file
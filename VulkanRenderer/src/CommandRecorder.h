@@ -0,0 +1,112 @@
+#ifndef COMMAND_RECORDER_H_
+#define COMMAND_RECORDER_H_
+
+#include <vulkan/vulkan.h>
+
+//Records into a command buffer on behalf of the draw code, dropping descriptor set, pipeline,
+//vertex and index buffer binds that would leave the bound state unchanged. Every call that
+//reaches Vulkan is counted, as is every bind that was dropped.
+//A recorder assumes nothing is bound when it is created, and belongs to a single thread.
+class CommandRecorder
+{
+public:
+	CommandRecorder(VkCommandBuffer cmd);
+
+	void bindDescriptorSet(VkPipelineLayout layout, uint32_t index, VkDescriptorSet set,
+		uint32_t offsetCount = 0, const uint32_t* offsets = nullptr);
+
+	void bindIndexBuffer(VkBuffer buffer, VkDeviceSize offset, VkIndexType type);
+
+	void bindPipeline(VkPipeline pipeline);
+
+	void bindVertexBuffer(VkBuffer buffer, VkDeviceSize offset);
+
+	void drawIndexed(uint32_t indexCount, uint32_t instanceCount = 1, uint32_t firstIndex = 0,
+		int32_t vertexOffset = 0, uint32_t firstInstance = 0);
+
+	void drawIndexedIndirect(VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride);
+
+	//Draws as many of the commands as the count buffer holds, up to maxDrawCount. Only valid
+	//once drawIndirectCountSupported().
+	void drawIndexedIndirectCount(VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer,
+		VkDeviceSize countOffset, uint32_t maxDrawCount, uint32_t stride);
+
+	void pushConstants(VkPipelineLayout layout, VkShaderStageFlags stages, uint32_t offset,
+		uint32_t size, const void* data);
+
+	void setScissor(const VkRect2D& scissor);
+
+	void setViewport(const VkViewport& viewport);
+
+	//Calls made to Vulkan so far.
+	inline uint32_t calls() const
+	{
+		return _calls;
+	}
+
+	//Binds dropped so far because they wouldn't have changed anything.
+	inline uint32_t skipped() const
+	{
+		return _skipped;
+	}
+
+	inline VkCommandBuffer commandBuffer() const
+	{
+		return _cmd;
+	}
+
+	//With tracking off every bind is passed through, for comparing call counts.
+	static void setTracking(bool enable);
+
+	inline static bool tracking()
+	{
+		return _tracking;
+	}
+
+	//Same signature for VK_KHR_draw_indirect_count and VK_AMD_draw_indirect_count.
+	typedef void (VKAPI_PTR *DrawIndexedIndirectCountFn)(VkCommandBuffer cmd, VkBuffer buffer,
+		VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countOffset, uint32_t maxDrawCount,
+		uint32_t stride);
+
+	//Set by the renderer when the device has one of the extensions enabled.
+	static void setDrawIndirectCount(DrawIndexedIndirectCountFn fn);
+
+	inline static bool drawIndirectCountSupported()
+	{
+		return _drawIndexedIndirectCount != nullptr;
+	}
+
+private:
+	static const uint32_t MAX_SETS = 8;
+	static const uint32_t MAX_DYNAMIC_OFFSETS = 4;
+
+	struct BoundSet
+	{
+		VkDescriptorSet set;
+		uint32_t offsetCount;
+		uint32_t offsets[MAX_DYNAMIC_OFFSETS];
+	};
+
+	VkCommandBuffer _cmd;
+
+	//Sets bound with a different layout may have been disturbed, so they are forgotten.
+	VkPipelineLayout _layout;
+	BoundSet _sets[MAX_SETS];
+
+	VkPipeline _pipeline;
+
+	VkBuffer _vertexBuffer;
+	VkDeviceSize _vertexOffset;
+
+	VkBuffer _indexBuffer;
+	VkDeviceSize _indexOffset;
+	VkIndexType _indexType;
+
+	uint32_t _calls;
+	uint32_t _skipped;
+
+	static bool _tracking;
+	static DrawIndexedIndirectCountFn _drawIndexedIndirectCount;
+};
+
+#endif //COMMAND_RECORDER_H_
\ No newline at end of file
@@ -1,11 +1,16 @@
 #include "Core.h"
 #include "Window.h"
 #include "Scene.h"
+#include "Benchmark.h"
+#include "JobSystem.h"
+#include "SwapChain.h"
+#include "texture/Texture.h"
 #include "renderpass/ShadowMapRenderPass.h"
 #include "renderpass/SceneRenderPass.h"
 #include "renderpass/PostProcessRenderPass.h"
 #include "renderpass/DeferredSceneRenderPass.h"
 
+#include <cstdio>
 #include <iostream>
 #include <chrono>
 
@@ -25,16 +30,89 @@ Core::~Core()
 
 void Core::run(int argc, char** argv)
 {
-	_init();
-
-	if (argc > 1) //argv[0] on win32 is exe path
+	//Picks the scene pass, so it has to be known before anything else is set up.
+	bool deferred = false;
+	for (int i = 1; i < argc; ++i)
+		deferred |= std::string(argv[i]) == "-deferred";
+
+	_init(deferred);
+
+	std::string model;
+	std::string benchmark;
+	float scale = 1.0f;
+	uint32_t threads = JobSystem::defaultThreadCount();
+	uint32_t frames = MAX_FRAMES_IN_FLIGHT;
+	bool gpuCulling = false;
+	uint32_t cascades = 0;
+	uint32_t atlasLights = 0;
+	uint32_t pointLights = 0;
+
+	//argv[0] on win32 is exe path
+	for (int i = 1; i < argc; ++i)
 	{
-		const float scale = (argc > 2 ? strtof(argv[2], 0) : 1.0f);
-		_scene->addModel(argv[1], scale);
+		const std::string arg = argv[i];
+
+		if (arg == "-benchmark" && i + 1 < argc)
+			benchmark = argv[++i];
+		else if (arg == "-nomips")
+			Texture::enableMipmaps(false);
+		else if (arg == "-threads" && i + 1 < argc)
+			threads = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (arg == "-recordeachframe")
+			_renderer->setRecordEachFrame(true);
+		else if (arg == "-gpuculling")
+			gpuCulling = true;
+		else if (arg == "-nomultiview")
+			((ShadowMapRenderPass*)_renderer->getRenderPass(RenderPassType::SHADOWMAP))->setMultiview(false);
+		else if (arg == "-cascades" && i + 1 < argc)
+			cascades = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (arg == "-atlaslights" && i + 1 < argc)
+			atlasLights = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (arg == "-pointlights" && i + 1 < argc)
+			pointLights = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (arg == "-deferred")
+			continue;
+		else if (arg == "-frames" && i + 1 < argc)
+			frames = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (arg == "-framelog" && i + 1 < argc)
+		{
+			if (!_renderer->openFrameLog(argv[++i]))
+				printf("Couldn't open frame log %s\n", argv[i]);
+		}
+		else if (model.empty())
+			model = arg;
+		else
+			scale = strtof(argv[i], 0);
 	}
 
+	JobSystem::init(threads);
+
+	if (gpuCulling)
+		_scene->setGpuCulling(true);
+
+	if (cascades)
+		_scene->setCascades(cascades);
+
+	if (atlasLights)
+		_scene->setAtlasLights(atlasLights);
+
+	if (pointLights)
+		_scene->setPointLights(pointLights);
+
+	if (!model.empty())
+		_scene->addModel(model, scale);
+
+	//Applied by the swap chain recreation below.
+	_renderer->setFramesInFlight(frames);
 	_renderer->recreateSwapChain();
 
+	if (!benchmark.empty())
+	{
+		Benchmark(*_renderer, *_scene, model, scale).run(benchmark);
+		_shutdown();
+		return;
+	}
+
 	std::chrono::time_point<std::chrono::steady_clock> now = Clock::now();
 	std::chrono::duration<float> dtime;
 
@@ -52,7 +130,7 @@ void Core::run(int argc, char** argv)
 	_shutdown();
 }
 
-void Core::_init()
+void Core::_init(bool deferred)
 {
 	SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS);
 
@@ -70,8 +148,10 @@ void Core::_init()
 	_renderer->addRenderPass(shadow);
 
 	//TODO: allow runtime toggling
-	_renderer->addRenderPass(new SceneRenderPass(*_scene, *shadow));
-	//_renderer->addRenderPass(new DeferredSceneRenderPass(*_scene, *shadow));
+	if (deferred)
+		_renderer->addRenderPass(new DeferredSceneRenderPass(*_scene, *shadow));
+	else
+		_renderer->addRenderPass(new SceneRenderPass(*_scene, *shadow));
 
 
 	//Example postprocess chain setup:
@@ -126,6 +206,8 @@ void Core::_shutdown()
 		_scene = nullptr;
 	}
 
+	JobSystem::shutdown();
+
 	if (_renderer)
 	{
 		delete _renderer;
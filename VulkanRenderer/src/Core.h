@@ -21,7 +21,7 @@ private:
 
 	bool _running;
 
-	void _init();
+	void _init(bool deferred);
 	void _pollEvents();
 	void _shutdown();
 };
@@ -3,17 +3,19 @@
 
 #include <vulkan/vulkan.h>
 
+#include "MemoryAllocator.h"
+
 struct Framebuffer
 {
 	VkFramebuffer framebuffer;
 
 	VkImage image;
 	VkImageView view;
-	VkDeviceMemory memory;
+	Allocation memory;
 
 	VkImage depthImage;
 	VkImageView depthView;
-	VkDeviceMemory depthMemory;
+	Allocation depthMemory;
 };
 
 #endif //FRAMEBUFFER_H_
\ No newline at end of file
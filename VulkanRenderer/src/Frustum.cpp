@@ -0,0 +1,123 @@
+#include "Frustum.h"
+
+#include <algorithm>
+
+#include <xmmintrin.h>
+
+BoundsList::BoundsList() : _count(0)
+{
+
+}
+
+void BoundsList::add(const glm::vec3& center, const glm::vec3& extents)
+{
+	//Grow in fours; padding boxes are never reported, so their contents don't matter.
+	if (_count % 4 == 0)
+	{
+		const size_t padded = _count + 4;
+		_centerX.resize(padded, 0.0f);
+		_centerY.resize(padded, 0.0f);
+		_centerZ.resize(padded, 0.0f);
+		_extentX.resize(padded, 0.0f);
+		_extentY.resize(padded, 0.0f);
+		_extentZ.resize(padded, 0.0f);
+	}
+
+	_centerX[_count] = center.x;
+	_centerY[_count] = center.y;
+	_centerZ[_count] = center.z;
+	_extentX[_count] = extents.x;
+	_extentY[_count] = extents.y;
+	_extentZ[_count] = extents.z;
+
+	_count++;
+}
+
+void BoundsList::clear()
+{
+	_centerX.clear();
+	_centerY.clear();
+	_centerZ.clear();
+	_extentX.clear();
+	_extentY.clear();
+	_extentZ.clear();
+
+	_count = 0;
+}
+
+Frustum::Frustum(const glm::mat4& m)
+{
+	//Gribb/Hartmann: each plane is the last row of m plus or minus one of the others.
+	const glm::vec4 x(m[0][0], m[1][0], m[2][0], m[3][0]);
+	const glm::vec4 y(m[0][1], m[1][1], m[2][1], m[3][1]);
+	const glm::vec4 z(m[0][2], m[1][2], m[2][2], m[3][2]);
+	const glm::vec4 w(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+	_planes[0] = w + x;
+	_planes[1] = w - x;
+	_planes[2] = w + y;
+	_planes[3] = w - y;
+	_planes[4] = z;
+	_planes[5] = w - z;
+}
+
+uint32_t Frustum::cull(const BoundsList& bounds, std::vector<uint8_t>& visible) const
+{
+	visible.resize(bounds.size());
+
+	//The planes aren't normalised, but the box's projected radius scales with them.
+	__m128 nx[6], ny[6], nz[6], nd[6], ax[6], ay[6], az[6];
+	for (int p = 0; p < 6; ++p)
+	{
+		nx[p] = _mm_set1_ps(_planes[p].x);
+		ny[p] = _mm_set1_ps(_planes[p].y);
+		nz[p] = _mm_set1_ps(_planes[p].z);
+		nd[p] = _mm_set1_ps(_planes[p].w);
+		ax[p] = _mm_set1_ps(glm::abs(_planes[p].x));
+		ay[p] = _mm_set1_ps(glm::abs(_planes[p].y));
+		az[p] = _mm_set1_ps(glm::abs(_planes[p].z));
+	}
+
+	const __m128 zero = _mm_setzero_ps();
+	uint32_t culled = 0;
+
+	for (size_t i = 0; i < bounds.size(); i += 4)
+	{
+		const __m128 cx = _mm_loadu_ps(&bounds._centerX[i]);
+		const __m128 cy = _mm_loadu_ps(&bounds._centerY[i]);
+		const __m128 cz = _mm_loadu_ps(&bounds._centerZ[i]);
+		const __m128 ex = _mm_loadu_ps(&bounds._extentX[i]);
+		const __m128 ey = _mm_loadu_ps(&bounds._extentY[i]);
+		const __m128 ez = _mm_loadu_ps(&bounds._extentZ[i]);
+
+		//A lane's bit is set once its box is found to be outside any plane.
+		__m128 outside = _mm_setzero_ps();
+
+		for (int p = 0; p < 6; ++p)
+		{
+			__m128 distance = _mm_add_ps(_mm_mul_ps(nx[p], cx), nd[p]);
+			distance = _mm_add_ps(distance, _mm_mul_ps(ny[p], cy));
+			distance = _mm_add_ps(distance, _mm_mul_ps(nz[p], cz));
+
+			__m128 radius = _mm_mul_ps(ax[p], ex);
+			radius = _mm_add_ps(radius, _mm_mul_ps(ay[p], ey));
+			radius = _mm_add_ps(radius, _mm_mul_ps(az[p], ez));
+
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+		}
+
+		const int mask = _mm_movemask_ps(outside);
+		const size_t lanes = (std::min)(bounds.size() - i, (size_t)4);
+
+		for (size_t lane = 0; lane < lanes; ++lane)
+		{
+			const bool out = (mask & (1 << lane)) != 0;
+			visible[i + lane] = out ? 0 : 1;
+
+			if (out)
+				culled++;
+		}
+	}
+
+	return culled;
+}
\ No newline at end of file
@@ -0,0 +1,49 @@
+#ifndef FRUSTUM_H_
+#define FRUSTUM_H_
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+//Axis-aligned boxes laid out as separate arrays of floats, so that Frustum::cull can load the
+//same component of four boxes at once. The arrays are padded to a multiple of four.
+class BoundsList
+{
+public:
+	BoundsList();
+
+	void add(const glm::vec3& center, const glm::vec3& extents);
+
+	void clear();
+
+	inline size_t size() const
+	{
+		return _count;
+	}
+
+private:
+	friend class Frustum;
+
+	std::vector<float> _centerX, _centerY, _centerZ;
+	std::vector<float> _extentX, _extentY, _extentZ;
+
+	size_t _count;
+};
+
+//The six clip planes of a projection matrix, as (normal, distance) with the inside positive.
+class Frustum
+{
+public:
+	//Extracted from whatever space m transforms into clip space, so passing projView * model
+	//gives planes in the model's own space, where its boxes are. Expects 0..1 depth.
+	Frustum(const glm::mat4& m);
+
+	//Sets visible[i] to 0 for every box wholly outside a plane and 1 otherwise, four boxes
+	//at a time. Returns how many were culled.
+	uint32_t cull(const BoundsList& bounds, std::vector<uint8_t>& visible) const;
+
+private:
+	glm::vec4 _planes[6];
+};
+
+#endif //FRUSTUM_H_
\ No newline at end of file
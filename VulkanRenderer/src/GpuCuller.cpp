@@ -0,0 +1,675 @@
+#include "GpuCuller.h"
+#include "CommandRecorder.h"
+#include "Model.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "PipelineCache.h"
+#include "ShaderCache.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+//Depth buffers the pyramid can be built from before its descriptor pool is reset, e.g. one per
+//swap chain image.
+const uint32_t MAX_DEPTH_VIEWS = 8;
+
+const uint32_t CULL_GROUP_SIZE = 64;
+const uint32_t HIZ_GROUP_SIZE = 8;
+
+//Matches the shader's layout (std430).
+struct CullItem
+{
+	//Model space, before the model's scale; w is the bounding sphere's radius.
+	glm::vec4 center;
+	glm::vec4 extents;
+	uint32_t model;
+	//The model's first draw, and this shape's own one when draws aren't compacted.
+	uint32_t firstDraw;
+	uint32_t drawSlot;
+	uint32_t indexCount;
+	uint32_t firstIndex;
+	int32_t vertexOffset;
+	uint32_t padding[2];
+};
+
+struct CullPushConstants
+{
+	uint32_t itemCount;
+	uint32_t slot;
+	uint32_t compact;
+};
+
+struct HiZPushConstants
+{
+	int32_t srcSize[2];
+	int32_t dstSize[2];
+};
+
+GpuCuller::GpuCuller(Renderer& renderer) : _renderer(&renderer), _enabled(false), _created(false),
+	_compact(false), _cullLayout(VK_NULL_HANDLE), _hiZLayout(VK_NULL_HANDLE),
+	_cullPipelineLayout(VK_NULL_HANDLE), _hiZPipelineLayout(VK_NULL_HANDLE),
+	_cullPipeline(VK_NULL_HANDLE), _hiZPipeline(VK_NULL_HANDLE),
+	_cullPool(VK_NULL_HANDLE), _cullSet(VK_NULL_HANDLE), _hiZPool(VK_NULL_HANDLE),
+	_hiZSampler(VK_NULL_HANDLE), _hiZ(VK_NULL_HANDLE), _hiZView(VK_NULL_HANDLE),
+	_hiZExtent({ 0, 0 }), _extent({ 0, 0 }), _slots(0), _itemCount(0), _prevProjView(1.0f)
+{
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+GpuCuller::~GpuCuller()
+{
+	if (!_created)
+		return;
+
+	_destroyHiZ();
+
+	vkDestroyDescriptorPool(Renderer::device(), _cullPool, nullptr);
+	vkDestroySampler(Renderer::device(), _hiZSampler, nullptr);
+
+	vkDestroyPipeline(Renderer::device(), _cullPipeline, nullptr);
+	vkDestroyPipeline(Renderer::device(), _hiZPipeline, nullptr);
+	vkDestroyPipelineLayout(Renderer::device(), _cullPipelineLayout, nullptr);
+	vkDestroyPipelineLayout(Renderer::device(), _hiZPipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(Renderer::device(), _cullLayout, nullptr);
+	vkDestroyDescriptorSetLayout(Renderer::device(), _hiZLayout, nullptr);
+
+	_items.destroy();
+	_draws.destroy();
+	_counts.destroy();
+	_statsBuffer.destroy();
+}
+
+void GpuCuller::buildHiZ(VkCommandBuffer cmd, VkImage depthImage, VkImageView depthView, VkImageLayout layout)
+{
+	if (!_enabled || !_hiZ)
+		return;
+
+	//The depth has to be written before it's read, and the previous frame's cull has to have
+	//read the pyramid before it's overwritten.
+	VkImageMemoryBarrier depth = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+	depth.image = depthImage;
+	depth.oldLayout = layout;
+	depth.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	depth.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	depth.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	depth.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	depth.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	depth.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+	depth.subresourceRange.levelCount = 1;
+	depth.subresourceRange.layerCount = 1;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &depth);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _hiZPipeline);
+
+	//Level 0 is already half the depth buffer's size.
+	VkExtent2D src = _extent;
+	VkExtent2D dst = _hiZExtent;
+
+	VkMemoryBarrier written = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+	written.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	written.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	for (size_t level = 0; level < _hiZLevels.size(); ++level)
+	{
+		const VkDescriptorSet set = level == 0 ? _depthSet(depthView) : _hiZSets[level - 1];
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _hiZPipelineLayout, 0, 1, &set, 0, nullptr);
+
+		const HiZPushConstants push = {
+			{ (int32_t)src.width, (int32_t)src.height },
+			{ (int32_t)dst.width, (int32_t)dst.height }
+		};
+		vkCmdPushConstants(cmd, _hiZPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+
+		vkCmdDispatch(cmd, (dst.width + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE,
+			(dst.height + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+
+		//Each level reads the last; the final barrier is for the next frame's cull.
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 1, &written, 0, nullptr, 0, nullptr);
+
+		src = dst;
+		dst = { (std::max)(dst.width / 2, 1u), (std::max)(dst.height / 2, 1u) };
+	}
+}
+
+void GpuCuller::cull(VkCommandBuffer cmd, size_t slot)
+{
+	if (!_enabled || !_hiZ || _itemCount == 0)
+		return;
+
+	//The previous frame has to be done drawing from the buffers being rewritten, and done
+	//writing the pyramid read here.
+	VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	vkCmdFillBuffer(cmd, _counts.buffer, 0, VK_WHOLE_SIZE, 0);
+	vkCmdFillBuffer(cmd, _statsBuffer.buffer, slot * sizeof(Stats), sizeof(Stats), 0);
+
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _cullPipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _cullPipelineLayout, 0, 1, &_cullSet, 0, nullptr);
+
+	const CullPushConstants push = { _itemCount, (uint32_t)slot, _compact ? 1u : 0u };
+	vkCmdPushConstants(cmd, _cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+
+	vkCmdDispatch(cmd, (_itemCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+	//The stats are read on the host once the frame's fence has signalled.
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+bool GpuCuller::draw(CommandRecorder& cmd, const Model* model) const
+{
+	if (!_enabled)
+		return false;
+
+	std::unordered_map<const Model*, ModelDraws>::const_iterator it = _modelDraws.find(model);
+	if (it == _modelDraws.end())
+		return false;
+
+	const ModelDraws& draws = it->second;
+	assert(draws.drawCount <= _renderer->maxDrawIndirectCount() || !_compact);
+	const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	const VkDeviceSize offset = draws.firstDraw * stride;
+
+	if (_compact)
+	{
+		cmd.drawIndexedIndirectCount(_draws.buffer, offset, _counts.buffer,
+			draws.slot * sizeof(uint32_t), draws.drawCount, stride);
+	}
+	else if (draws.drawCount <= _renderer->maxDrawIndirectCount())
+		cmd.drawIndexedIndirect(_draws.buffer, offset, draws.drawCount, stride);
+	else
+	{
+		for (uint32_t i = 0; i < draws.drawCount; ++i)
+			cmd.drawIndexedIndirect(_draws.buffer, offset + i * stride, 1, stride);
+	}
+
+	return true;
+}
+
+void GpuCuller::readStats(size_t slot)
+{
+	if (!_enabled || !_statsBuffer.memory.mapped || slot >= _slots)
+		return;
+
+	memcpy(&_stats, _statsBuffer.memory.mapped + slot * sizeof(Stats), sizeof(Stats));
+}
+
+void GpuCuller::resize(VkExtent2D extent, size_t slots)
+{
+	_extent = extent;
+
+	if (!_created)
+	{
+		_slots = slots;
+		return;
+	}
+
+	_destroyHiZ();
+	_createHiZ();
+
+	if (slots != _slots)
+	{
+		_slots = slots;
+		_statsBuffer.destroy();
+
+		VkBufferCreateInfo info = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+		info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		info.size = _slots * sizeof(Stats);
+		_renderer->createAndBindBuffer(info, _statsBuffer,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+		memset(_statsBuffer.memory.mapped, 0, (size_t)info.size);
+	}
+
+	_writeCullSet();
+}
+
+void GpuCuller::setEnabled(bool enable)
+{
+	if (enable && !_created)
+		_create();
+
+	_enabled = enable;
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+bool GpuCuller::update(const Scene& scene, const glm::mat4& projView)
+{
+	if (!_enabled)
+		return false;
+
+	std::vector<const Model*> models;
+	for (const Model* model : scene.models())
+	{
+		if (model->resident() && model->shapeCount() && models.size() < CULL_MAX_MODELS)
+			models.push_back(model);
+	}
+
+	//Rare, so it's simplest to wait for the frames using the buffers to finish.
+	const bool changed = models != _models;
+	if (changed)
+	{
+		_renderer->waitForFrames();
+		_build(models);
+		_writeCullSet();
+	}
+
+	CullUniform uniform = {};
+	uniform.projView = projView;
+	uniform.prevProjView = _prevProjView;
+	uniform.hiZSize = glm::vec4((float)_hiZExtent.width, (float)_hiZExtent.height, (float)_hiZLevels.size(), 0.0f);
+
+	for (size_t i = 0; i < _models.size(); ++i)
+		uniform.models[i] = _models[i]->worldMatrix();
+
+	_renderer->updateUniform("cull", (void*)&uniform, sizeof(uniform));
+	_prevProjView = projView;
+
+	return changed;
+}
+
+void GpuCuller::_build(const std::vector<const Model*>& models)
+{
+	_models = models;
+	_modelDraws.clear();
+
+	std::vector<CullItem> items;
+
+	for (uint32_t slot = 0; slot < _models.size(); ++slot)
+	{
+		const Model* model = _models[slot];
+		const std::vector<Shape>& shapes = model->shapes();
+
+		ModelDraws draws = { slot, (uint32_t)items.size(), (uint32_t)shapes.size() };
+		_modelDraws[model] = draws;
+
+		for (uint32_t i = 0; i < shapes.size(); ++i)
+		{
+			const Shape& s = shapes[i];
+
+			CullItem item = {};
+			item.center = glm::vec4(s.center, s.radius);
+			item.extents = glm::vec4(s.extents, 0.0f);
+			item.model = slot;
+			item.firstDraw = draws.firstDraw;
+			item.drawSlot = draws.firstDraw + i;
+			item.indexCount = s.indexCount;
+			item.firstIndex = s.firstIndex;
+			item.vertexOffset = s.vertexOffset;
+
+			items.push_back(item);
+		}
+	}
+
+	_itemCount = (uint32_t)items.size();
+
+	//Never empty, so the descriptors always have something to point at.
+	const size_t count = (std::max)(items.size(), (size_t)1);
+
+	_items.destroy();
+	_draws.destroy();
+
+	VkBufferCreateInfo info = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	//Only written when the scene changes, so the shader reads it straight from host memory.
+	info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	info.size = count * sizeof(CullItem);
+	_renderer->createAndBindBuffer(info, _items,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+	if (!items.empty())
+		_items.copyData(items.data(), items.size() * sizeof(CullItem));
+
+	info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+	info.size = count * sizeof(VkDrawIndexedIndirectCommand);
+	_renderer->createAndBindBuffer(info, _draws, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+}
+
+void GpuCuller::_create()
+{
+	_compact = CommandRecorder::drawIndirectCountSupported() && _renderer->maxDrawIndirectCount() > 1;
+	printf("GPU culling %s\n", _compact ? "compacts draws with a draw count" :
+		"gives culled draws no instances, as draw counts are unsupported");
+
+	_createPipelines();
+
+	VkSamplerCreateInfo sampler = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+	sampler.minFilter = VK_FILTER_NEAREST;
+	sampler.magFilter = VK_FILTER_NEAREST;
+	sampler.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	sampler.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler.maxLod = VK_LOD_CLAMP_NONE;
+	VkCheck(vkCreateSampler(Renderer::device(), &sampler, nullptr, &_hiZSampler));
+
+	VkDescriptorPoolSize sizes[3] = {};
+	sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	sizes[0].descriptorCount = 1;
+	sizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	sizes[1].descriptorCount = 4;
+	sizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	sizes[2].descriptorCount = 1;
+
+	VkDescriptorPoolCreateInfo pool = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+	pool.poolSizeCount = 3;
+	pool.pPoolSizes = sizes;
+	pool.maxSets = 1;
+	VkCheck(vkCreateDescriptorPool(Renderer::device(), &pool, nullptr, &_cullPool));
+
+	VkDescriptorSetAllocateInfo alloc = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+	alloc.descriptorPool = _cullPool;
+	alloc.descriptorSetCount = 1;
+	alloc.pSetLayouts = &_cullLayout;
+	VkCheck(vkAllocateDescriptorSets(Renderer::device(), &alloc, &_cullSet));
+
+	VkBufferCreateInfo info = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	info.size = CULL_MAX_MODELS * sizeof(uint32_t);
+	_renderer->createAndBindBuffer(info, _counts, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	_created = true;
+	_build(_models);
+
+	//Creates the pyramid and the stats, then writes every descriptor.
+	const size_t slots = _slots;
+	_slots = 0;
+	resize(_extent, slots);
+}
+
+void GpuCuller::_createHiZ()
+{
+	_hiZExtent = { (std::max)(_extent.width / 2, 1u), (std::max)(_extent.height / 2, 1u) };
+
+	uint32_t levels = 1;
+	while (((std::max)(_hiZExtent.width, _hiZExtent.height) >> levels) > 0)
+		levels++;
+
+	VkImageCreateInfo info = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+	info.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	info.extent = { _hiZExtent.width, _hiZExtent.height, 1 };
+	info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	info.samples = VK_SAMPLE_COUNT_1_BIT;
+	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	info.mipLevels = levels;
+	info.arrayLayers = 1;
+	info.format = VK_FORMAT_R32_SFLOAT;
+	info.imageType = VK_IMAGE_TYPE_2D;
+
+	VkCheck(vkCreateImage(Renderer::device(), &info, nullptr, &_hiZ));
+	_renderer->allocateImageMemory(_hiZ, _hiZMemory);
+
+	VkImageViewCreateInfo view = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+	view.image = _hiZ;
+	view.format = VK_FORMAT_R32_SFLOAT;
+	view.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	view.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	view.subresourceRange.levelCount = levels;
+	view.subresourceRange.layerCount = 1;
+	VkCheck(vkCreateImageView(Renderer::device(), &view, nullptr, &_hiZView));
+
+	//Each level is written through a view of its own.
+	_hiZLevels.resize(levels);
+	view.subresourceRange.levelCount = 1;
+	for (uint32_t i = 0; i < levels; ++i)
+	{
+		view.subresourceRange.baseMipLevel = i;
+		VkCheck(vkCreateImageView(Renderer::device(), &view, nullptr, &_hiZLevels[i]));
+	}
+
+	VkDescriptorPoolSize sizes[2] = {};
+	sizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	sizes[0].descriptorCount = levels + MAX_DEPTH_VIEWS;
+	sizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	sizes[1].descriptorCount = levels + MAX_DEPTH_VIEWS;
+
+	VkDescriptorPoolCreateInfo pool = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+	pool.poolSizeCount = 2;
+	pool.pPoolSizes = sizes;
+	pool.maxSets = levels + MAX_DEPTH_VIEWS;
+
+	VkCheck(vkCreateDescriptorPool(Renderer::device(), &pool, nullptr, &_hiZPool));
+
+	//Level i is reduced from level i - 1; level 0 comes from whichever depth buffer is passed in.
+	_hiZSets.resize(levels - 1);
+	for (uint32_t i = 1; i < levels; ++i)
+	{
+		VkDescriptorSetAllocateInfo alloc = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+		alloc.descriptorPool = _hiZPool;
+		alloc.descriptorSetCount = 1;
+		alloc.pSetLayouts = &_hiZLayout;
+		VkCheck(vkAllocateDescriptorSets(Renderer::device(), &alloc, &_hiZSets[i - 1]));
+
+		VkDescriptorImageInfo src = { _hiZSampler, _hiZLevels[i - 1], VK_IMAGE_LAYOUT_GENERAL };
+		VkDescriptorImageInfo dst = { VK_NULL_HANDLE, _hiZLevels[i], VK_IMAGE_LAYOUT_GENERAL };
+
+		VkWriteDescriptorSet writes[2] = {};
+		writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[0].dstSet = _hiZSets[i - 1];
+		writes[0].dstBinding = 0;
+		writes[0].descriptorCount = 1;
+		writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		writes[0].pImageInfo = &src;
+
+		writes[1] = writes[0];
+		writes[1].dstBinding = 1;
+		writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		writes[1].pImageInfo = &dst;
+
+		vkUpdateDescriptorSets(Renderer::device(), 2, writes, 0, nullptr);
+	}
+
+	//The pyramid stays in GENERAL, where it can be both written and sampled. Cleared to the far
+	//plane, nothing is occluded until the first one has been built.
+	VkCommandBuffer cmd = _renderer->startOneShotCmdBuffer();
+
+	VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+	barrier.image = _hiZ;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.levelCount = levels;
+	barrier.subresourceRange.layerCount = 1;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	VkClearColorValue far = {};
+	far.float32[0] = 1.0f;
+	vkCmdClearColorImage(cmd, _hiZ, VK_IMAGE_LAYOUT_GENERAL, &far, 1, &barrier.subresourceRange);
+
+	barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	VkFenceCreateInfo fenceInfo = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+	VkFence fence;
+	VkCheck(vkCreateFence(Renderer::device(), &fenceInfo, nullptr, &fence));
+
+	_renderer->submitOneShotCmdBuffer(cmd, fence);
+	VkCheck(vkWaitForFences(Renderer::device(), 1, &fence, VK_TRUE, UINT64_MAX));
+
+	vkDestroyFence(Renderer::device(), fence, nullptr);
+	_renderer->freeOneShotCmdBuffer(cmd);
+}
+
+void GpuCuller::_createPipelines()
+{
+	//Cull: the uniform, items, draws, counts, stats and the pyramid.
+	VkDescriptorSetLayoutBinding bindings[6] = {};
+	for (uint32_t i = 0; i < 6; ++i)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorCount = 1;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	bindings[5].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+	VkDescriptorSetLayoutCreateInfo info = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+	info.bindingCount = 6;
+	info.pBindings = bindings;
+	VkCheck(vkCreateDescriptorSetLayout(Renderer::device(), &info, nullptr, &_cullLayout));
+
+	//Hi-Z: the level above (or the depth buffer) and the level being written.
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	info.bindingCount = 2;
+	VkCheck(vkCreateDescriptorSetLayout(Renderer::device(), &info, nullptr, &_hiZLayout));
+
+	VkPushConstantRange push = {};
+	push.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	push.size = sizeof(CullPushConstants);
+
+	VkPipelineLayoutCreateInfo layout = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+	layout.setLayoutCount = 1;
+	layout.pSetLayouts = &_cullLayout;
+	layout.pushConstantRangeCount = 1;
+	layout.pPushConstantRanges = &push;
+	VkCheck(vkCreatePipelineLayout(Renderer::device(), &layout, nullptr, &_cullPipelineLayout));
+
+	push.size = sizeof(HiZPushConstants);
+	layout.pSetLayouts = &_hiZLayout;
+	VkCheck(vkCreatePipelineLayout(Renderer::device(), &layout, nullptr, &_hiZPipelineLayout));
+
+	VkComputePipelineCreateInfo pipeline = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+	pipeline.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipeline.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipeline.stage.pName = "main";
+
+	pipeline.stage.module = ShaderCache::getModule("shaders/compute/cull.comp");
+	pipeline.layout = _cullPipelineLayout;
+	PipelineCache::createCompute(pipeline, &_cullPipeline);
+
+	pipeline.stage.module = ShaderCache::getModule("shaders/compute/hiz.comp");
+	pipeline.layout = _hiZPipelineLayout;
+	PipelineCache::createCompute(pipeline, &_hiZPipeline);
+}
+
+VkDescriptorSet GpuCuller::_depthSet(VkImageView depthView)
+{
+	std::unordered_map<VkImageView, VkDescriptorSet>::iterator it = _depthSets.find(depthView);
+	if (it != _depthSets.end())
+		return it->second;
+
+	assert(_depthSets.size() < MAX_DEPTH_VIEWS);
+
+	VkDescriptorSet set;
+	VkDescriptorSetAllocateInfo alloc = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+	alloc.descriptorPool = _hiZPool;
+	alloc.descriptorSetCount = 1;
+	alloc.pSetLayouts = &_hiZLayout;
+	VkCheck(vkAllocateDescriptorSets(Renderer::device(), &alloc, &set));
+
+	VkDescriptorImageInfo src = { _hiZSampler, depthView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+	VkDescriptorImageInfo dst = { VK_NULL_HANDLE, _hiZLevels[0], VK_IMAGE_LAYOUT_GENERAL };
+
+	VkWriteDescriptorSet writes[2] = {};
+	writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writes[0].dstSet = set;
+	writes[0].dstBinding = 0;
+	writes[0].descriptorCount = 1;
+	writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	writes[0].pImageInfo = &src;
+
+	writes[1] = writes[0];
+	writes[1].dstBinding = 1;
+	writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	writes[1].pImageInfo = &dst;
+
+	vkUpdateDescriptorSets(Renderer::device(), 2, writes, 0, nullptr);
+
+	_depthSets[depthView] = set;
+	return set;
+}
+
+void GpuCuller::_destroyHiZ()
+{
+	//Frees every set referring to the pyramid or to a depth buffer; the level count may change.
+	vkDestroyDescriptorPool(Renderer::device(), _hiZPool, nullptr);
+	_hiZPool = VK_NULL_HANDLE;
+
+	_hiZSets.clear();
+	_depthSets.clear();
+
+	for (VkImageView view : _hiZLevels)
+		vkDestroyImageView(Renderer::device(), view, nullptr);
+	_hiZLevels.clear();
+
+	if (_hiZView)
+		vkDestroyImageView(Renderer::device(), _hiZView, nullptr);
+
+	if (_hiZ)
+		vkDestroyImage(Renderer::device(), _hiZ, nullptr);
+
+	Renderer::allocator().free(_hiZMemory);
+
+	_hiZView = VK_NULL_HANDLE;
+	_hiZ = VK_NULL_HANDLE;
+}
+
+void GpuCuller::_writeCullSet()
+{
+	const Uniform* uniform = _renderer->getUniform("cull");
+
+	VkDescriptorBufferInfo buffers[5] = {};
+	buffers[0] = { uniform->localBuffer.buffer, 0, uniform->size };
+	buffers[1] = { _items.buffer, 0, VK_WHOLE_SIZE };
+	buffers[2] = { _draws.buffer, 0, VK_WHOLE_SIZE };
+	buffers[3] = { _counts.buffer, 0, VK_WHOLE_SIZE };
+	buffers[4] = { _statsBuffer.buffer, 0, VK_WHOLE_SIZE };
+
+	VkDescriptorImageInfo hiZ = { _hiZSampler, _hiZView, VK_IMAGE_LAYOUT_GENERAL };
+
+	VkWriteDescriptorSet writes[6] = {};
+	for (uint32_t i = 0; i < 6; ++i)
+	{
+		writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[i].dstSet = _cullSet;
+		writes[i].dstBinding = i;
+		writes[i].descriptorCount = 1;
+		writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+
+		if (i < 5)
+			writes[i].pBufferInfo = &buffers[i];
+	}
+
+	writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	writes[5].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	writes[5].pImageInfo = &hiZ;
+
+	vkUpdateDescriptorSets(Renderer::device(), 6, writes, 0, nullptr);
+}
\ No newline at end of file
@@ -0,0 +1,158 @@
+#ifndef GPU_CULLER_H_
+#define GPU_CULLER_H_
+
+#include <vulkan/vulkan.h>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include <unordered_map>
+#include <vector>
+
+#include "Buffer.h"
+
+class CommandRecorder;
+class Model;
+class Renderer;
+class Scene;
+
+//TODO: retrieve from global config.
+static const uint32_t CULL_MAX_MODELS = 64;
+
+struct CullUniform
+{
+	glm::mat4 projView;
+	//The camera when the depth in the Hi-Z pyramid was drawn.
+	glm::mat4 prevProjView;
+	//Model matrix with the scale applied, per model being culled.
+	glm::mat4 models[CULL_MAX_MODELS];
+	//Width, height and level count of the pyramid.
+	glm::vec4 hiZSize;
+};
+
+//Culls the shapes of every model on the GPU before the scene is drawn. A compute shader tests
+//each shape's box against the camera frustum, then against a hierarchical depth (Hi-Z) pyramid
+//built from the previous frame's depth buffer, and writes the draws that survive into an
+//indirect buffer, compacted, with a count per model. Models then draw with
+//vkCmdDrawIndexedIndirectCount, so the CPU never learns what is visible and command buffers
+//recorded up front stay valid as the camera moves.
+//Without VK_KHR_draw_indirect_count (or the AMD original) culled draws are written with an
+//instance count of 0 instead, and every draw is still issued.
+class GpuCuller
+{
+public:
+	//Shapes and triangles that survived culling, out of all of those submitted to it.
+	struct Stats
+	{
+		uint32_t visibleShapes;
+		uint32_t visibleTriangles;
+		uint32_t submittedShapes;
+		uint32_t submittedTriangles;
+	};
+
+	GpuCuller(Renderer& renderer);
+	GpuCuller& operator=(const GpuCuller&) = delete;
+	GpuCuller(const GpuCuller&) = delete;
+	GpuCuller(GpuCuller&&) = delete;
+	~GpuCuller();
+
+	//Rebuilds the pyramid the next frame is culled against, from the depth buffer the scene has
+	//just been drawn into. The depth image is left in SHADER_READ_ONLY_OPTIMAL.
+	void buildHiZ(VkCommandBuffer cmd, VkImage depthImage, VkImageView depthView, VkImageLayout layout);
+
+	//Records the cull for a frame slot; outside any render pass, before the scene is drawn.
+	void cull(VkCommandBuffer cmd, size_t slot);
+
+	//Issues the model's draws as the last cull left them, with its buffers already bound.
+	//Returns false if the model isn't being culled, in which case it should draw everything.
+	bool draw(CommandRecorder& cmd, const Model* model) const;
+
+	inline bool enabled() const
+	{
+		return _enabled;
+	}
+
+	//Picks up the stats of a frame slot whose fence has signalled.
+	void readStats(size_t slot);
+
+	//Recreates the pyramid for a new swap chain, along with the stats for each frame slot.
+	//No frame may be executing.
+	void resize(VkExtent2D extent, size_t slots);
+
+	//Resources are created the first time culling is enabled, and kept until destruction.
+	void setEnabled(bool enable);
+
+	//Of the most recently completed frame.
+	inline const Stats& stats() const
+	{
+		return _stats;
+	}
+
+	//Writes this frame's matrices. Returns true if the shapes being culled have changed since
+	//the last call, in which case command buffers have to be recorded again.
+	bool update(const Scene& scene, const glm::mat4& projView);
+
+private:
+	//Where a model's draws are in the draw buffer, and its slot in CullUniform and the counts.
+	struct ModelDraws
+	{
+		uint32_t slot;
+		uint32_t firstDraw;
+		uint32_t drawCount;
+	};
+
+	Renderer* _renderer;
+
+	bool _enabled;
+	bool _created;
+
+	//Draws are compacted and counted on the GPU; otherwise culled ones get no instances.
+	bool _compact;
+
+	VkDescriptorSetLayout _cullLayout;
+	VkDescriptorSetLayout _hiZLayout;
+	VkPipelineLayout _cullPipelineLayout;
+	VkPipelineLayout _hiZPipelineLayout;
+	VkPipeline _cullPipeline;
+	VkPipeline _hiZPipeline;
+
+	VkDescriptorPool _cullPool;
+	VkDescriptorSet _cullSet;
+
+	//Recreated along with the pyramid, which its sets refer to.
+	VkDescriptorPool _hiZPool;
+	std::vector<VkDescriptorSet> _hiZSets;
+	std::unordered_map<VkImageView, VkDescriptorSet> _depthSets;
+
+	VkSampler _hiZSampler;
+	VkImage _hiZ;
+	Allocation _hiZMemory;
+	VkImageView _hiZView;
+	std::vector<VkImageView> _hiZLevels;
+	VkExtent2D _hiZExtent;
+
+	VkExtent2D _extent;
+	size_t _slots;
+
+	//A CullItem per shape, the draws written for them, a count per model and Stats per slot.
+	Buffer _items;
+	Buffer _draws;
+	Buffer _counts;
+	Buffer _statsBuffer;
+	uint32_t _itemCount;
+
+	std::vector<const Model*> _models;
+	std::unordered_map<const Model*, ModelDraws> _modelDraws;
+
+	glm::mat4 _prevProjView;
+	Stats _stats;
+
+	void _build(const std::vector<const Model*>& models);
+	void _create();
+	void _createHiZ();
+	void _createPipelines();
+	VkDescriptorSet _depthSet(VkImageView depthView);
+	void _destroyHiZ();
+	void _writeCullSet();
+};
+
+#endif //GPU_CULLER_H_
\ No newline at end of file
@@ -0,0 +1,77 @@
+#include "JobSystem.h"
+
+#include <algorithm>
+
+std::vector<std::thread> JobSystem::_threads;
+std::deque<JobSystem::Job> JobSystem::_jobs;
+std::mutex JobSystem::_mutex;
+std::condition_variable JobSystem::_wake;
+bool JobSystem::_running = false;
+
+void JobSystem::init(uint32_t threadCount)
+{
+	shutdown();
+
+	_running = true;
+	for (uint32_t i = 0; i < threadCount; ++i)
+		_threads.push_back(std::thread(_work));
+}
+
+void JobSystem::shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_running = false;
+	}
+
+	_wake.notify_all();
+
+	for (std::thread& t : _threads)
+		t.join();
+
+	_threads.clear();
+}
+
+void JobSystem::submit(const Job& job)
+{
+	if (_threads.empty())
+	{
+		job();
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_jobs.push_back(job);
+	}
+
+	_wake.notify_one();
+}
+
+uint32_t JobSystem::defaultThreadCount()
+{
+	const uint32_t cores = std::thread::hardware_concurrency();
+	return (std::max)(cores, 2u) - 1;
+}
+
+void JobSystem::_work()
+{
+	while (true)
+	{
+		Job job;
+
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wake.wait(lock, [] { return !_jobs.empty() || !_running; });
+
+			//Drain the queue before exiting so nobody is left waiting on a job that never ran.
+			if (_jobs.empty())
+				return;
+
+			job = _jobs.front();
+			_jobs.pop_front();
+		}
+
+		job();
+	}
+}
\ No newline at end of file
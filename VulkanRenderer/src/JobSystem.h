@@ -0,0 +1,48 @@
+#ifndef JOB_SYSTEM_H_
+#define JOB_SYSTEM_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Fixed pool of worker threads pulling jobs from a single FIFO queue.
+//Jobs must not touch Vulkan, except for recording secondary command buffers from pools of their
+//own (see SecondaryRecorder); anything that submits work stays on the main thread.
+struct JobSystem final
+{
+	typedef std::function<void()> Job;
+
+	JobSystem& operator=(const JobSystem&) = delete;
+	JobSystem(const JobSystem&) = delete;
+	JobSystem(JobSystem&&) = delete;
+
+	//0 runs every job inline in submit(), which is handy for comparing against serial loading.
+	static void init(uint32_t threadCount);
+
+	//Finishes whatever is queued, then joins the workers.
+	static void shutdown();
+
+	static void submit(const Job& job);
+
+	//One worker per core, leaving the main thread free to upload and render.
+	static uint32_t defaultThreadCount();
+
+	inline static uint32_t threadCount()
+	{
+		return (uint32_t)_threads.size();
+	}
+
+private:
+	static std::vector<std::thread> _threads;
+	static std::deque<Job> _jobs;
+	static std::mutex _mutex;
+	static std::condition_variable _wake;
+	static bool _running;
+
+	static void _work();
+};
+
+#endif //JOB_SYSTEM_H_
\ No newline at end of file
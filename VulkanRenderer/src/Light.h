@@ -3,14 +3,86 @@
 
 #include <glm/glm.hpp>
 
+//A directional light's shadow is split into at most this many cascades.
+const uint32_t MAX_CASCADES = 4;
+
+//A point light has a view per cube map face. A directional light has a view per cascade
+//instead, each with its projection already applied, and proj left as the identity.
 struct Light
 {
 	glm::mat4 proj;
 	glm::mat4 views[6];
+	//View space distance each cascade ends at.
+	glm::vec4 cascadeSplits;
 	glm::vec4 color;
 	glm::vec3 pos;
 	uint32_t numViews;
 	float farPlane;
+
+	inline bool cascaded() const
+	{
+		return numViews <= MAX_CASCADES;
+	}
+};
+
+//Lights beyond the first are shadowed through tiles of the shadow atlas.
+const uint32_t MAX_ATLAS_LIGHTS = 32;
+//Enough for every light to be a point light, with a tile per cube face.
+const uint32_t MAX_ATLAS_TILES = MAX_ATLAS_LIGHTS * 6;
+
+//Laid out for std430, as in shadercommon.inc.
+struct AtlasLight
+{
+	//Position, then range.
+	glm::vec4 posRange;
+	glm::vec4 color;
+	//Direction, then the cosine of the cone's half angle; 0 for a point light.
+	glm::vec4 spot;
+	//First tile and tile count; no tiles when the light can't be seen.
+	uint32_t firstTile;
+	uint32_t tileCount;
+	uint32_t pad[2];
+};
+
+struct AtlasTile
+{
+	glm::mat4 viewProj;
+	//Top left corner and size, in atlas texels.
+	glm::vec4 rect;
+	//Of the light the tile belongs to, as tiles store distance over range.
+	glm::vec4 lightPosRange;
+};
+
+struct AtlasData
+{
+	uint32_t lightCount;
+	uint32_t tileCount;
+	uint32_t pad[2];
+	AtlasLight lights[MAX_ATLAS_LIGHTS];
+	AtlasTile tiles[MAX_ATLAS_TILES];
+};
+
+//Unshadowed point lights, which the deferred lighting pass finds through the clusters of the
+//view they reach.
+const uint32_t MAX_POINT_LIGHTS = 8192;
+
+//Laid out for std430, as in shadercommon.inc.
+struct PointLight
+{
+	//Position, then range.
+	glm::vec4 posRange;
+	glm::vec4 color;
+};
+
+struct PointLightData
+{
+	uint32_t count;
+	//0 to loop over every light rather than those listed for the cluster.
+	uint32_t clustered;
+	//The camera's, which the clusters' depth slices are spaced between.
+	float zNear;
+	float zFar;
+	PointLight lights[MAX_POINT_LIGHTS];
 };
 
 #endif //LIGHT_H_
\ No newline at end of file
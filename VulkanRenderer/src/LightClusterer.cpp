@@ -0,0 +1,254 @@
+#include "LightClusterer.h"
+#include "Camera.h"
+#include "Renderer.h"
+#include "PipelineCache.h"
+#include "ShaderCache.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+LightClusterer::LightClusterer(Renderer& renderer) : _renderer(&renderer),
+	_clusterLayout(VK_NULL_HANDLE), _shadingLayout(VK_NULL_HANDLE), _pipelineLayout(VK_NULL_HANDLE),
+	_pipeline(VK_NULL_HANDLE), _pool(VK_NULL_HANDLE), _clusterSet(VK_NULL_HANDLE),
+	_shadingSet(VK_NULL_HANDLE), _slots(0), _listedLights(0)
+{
+	memset(&_data, 0, offsetof(PointLightData, lights));
+	_data.clustered = 1;
+
+	_createLayouts();
+
+	VkDescriptorPoolSize sizes[2] = {};
+	sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	sizes[0].descriptorCount = 1;
+	sizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	sizes[1].descriptorCount = 7;
+
+	VkDescriptorPoolCreateInfo pool = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+	pool.poolSizeCount = 2;
+	pool.pPoolSizes = sizes;
+	pool.maxSets = 2;
+	VkCheck(vkCreateDescriptorPool(Renderer::device(), &pool, nullptr, &_pool));
+
+	const VkDescriptorSetLayout layouts[] = { _clusterLayout, _shadingLayout };
+	VkDescriptorSet sets[2];
+
+	VkDescriptorSetAllocateInfo alloc = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+	alloc.descriptorPool = _pool;
+	alloc.descriptorSetCount = 2;
+	alloc.pSetLayouts = layouts;
+	VkCheck(vkAllocateDescriptorSets(Renderer::device(), &alloc, sets));
+
+	_clusterSet = sets[0];
+	_shadingSet = sets[1];
+
+	VkBufferCreateInfo info = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+	//A list per cluster at a fixed place, so clusters never have to share out one buffer.
+	info.size = CLUSTER_COUNT * sizeof(uint32_t);
+	_renderer->createAndBindBuffer(info, _counts, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	info.size = CLUSTER_COUNT * CLUSTER_MAX_LIGHTS * sizeof(uint32_t);
+	_renderer->createAndBindBuffer(info, _lists, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+}
+
+LightClusterer::~LightClusterer()
+{
+	vkDestroyDescriptorPool(Renderer::device(), _pool, nullptr);
+
+	vkDestroyPipeline(Renderer::device(), _pipeline, nullptr);
+	vkDestroyPipelineLayout(Renderer::device(), _pipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(Renderer::device(), _clusterLayout, nullptr);
+	vkDestroyDescriptorSetLayout(Renderer::device(), _shadingLayout, nullptr);
+
+	_counts.destroy();
+	_lists.destroy();
+	_statsBuffer.destroy();
+}
+
+void LightClusterer::cluster(VkCommandBuffer cmd, size_t slot)
+{
+	if (_data.count == 0 || !_data.clustered)
+		return;
+
+	//The previous frame has to be done shading with the lists being rewritten.
+	VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+	barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	vkCmdFillBuffer(cmd, _statsBuffer.buffer, slot * sizeof(uint32_t), sizeof(uint32_t), 0);
+
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _pipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _pipelineLayout, 0, 1, &_clusterSet, 0, nullptr);
+
+	const uint32_t push = (uint32_t)slot;
+	vkCmdPushConstants(cmd, _pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+
+	//A work group per cluster.
+	vkCmdDispatch(cmd, CLUSTER_X, CLUSTER_Y, CLUSTER_Z);
+
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void LightClusterer::readStats(size_t slot)
+{
+	if (!_statsBuffer.memory.mapped || slot >= _slots)
+		return;
+
+	memcpy(&_listedLights, _statsBuffer.memory.mapped + slot * sizeof(uint32_t), sizeof(uint32_t));
+}
+
+void LightClusterer::resize(size_t slots)
+{
+	if (slots == _slots)
+		return;
+
+	_slots = slots;
+	_statsBuffer.destroy();
+
+	VkBufferCreateInfo info = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	info.size = _slots * sizeof(uint32_t);
+	_renderer->createAndBindBuffer(info, _statsBuffer,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+	memset(_statsBuffer.memory.mapped, 0, (size_t)info.size);
+
+	_writeSets();
+}
+
+void LightClusterer::setClustered(bool enable)
+{
+	_data.clustered = enable ? 1u : 0u;
+	_listedLights = 0;
+}
+
+void LightClusterer::setLights(const std::vector<PointLight>& lights)
+{
+	_data.count = (uint32_t)(std::min)(lights.size(), (size_t)MAX_POINT_LIGHTS);
+
+	//Nothing is binned until there are lights, so scenes without any never load the shader.
+	if (_data.count && _pipeline == VK_NULL_HANDLE)
+		_createPipeline();
+
+	if (_data.count)
+		memcpy(_data.lights, lights.data(), _data.count * sizeof(PointLight));
+
+	_listedLights = 0;
+	_renderer->updateUniform("pointlights", (void*)&_data,
+		offsetof(PointLightData, lights) + _data.count * sizeof(PointLight));
+}
+
+void LightClusterer::update(const Camera& camera)
+{
+	_data.zNear = camera.nearClip();
+	_data.zFar = camera.farClip();
+
+	//Only the header; the lights are written when they change.
+	_renderer->updateUniform("pointlights", (void*)&_data, offsetof(PointLightData, lights));
+}
+
+void LightClusterer::_createLayouts()
+{
+	//Cluster: the camera, the lights, the counts, the lists and the stats.
+	VkDescriptorSetLayoutBinding bindings[5] = {};
+	for (uint32_t i = 0; i < 5; ++i)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorCount = 1;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+
+	VkDescriptorSetLayoutCreateInfo info = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+	info.bindingCount = 5;
+	info.pBindings = bindings;
+	VkCheck(vkCreateDescriptorSetLayout(Renderer::device(), &info, nullptr, &_clusterLayout));
+
+	//Shading: the lights, the counts and the lists.
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	}
+
+	info.bindingCount = 3;
+	VkCheck(vkCreateDescriptorSetLayout(Renderer::device(), &info, nullptr, &_shadingLayout));
+
+	VkPushConstantRange push = {};
+	push.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	push.size = sizeof(uint32_t);
+
+	VkPipelineLayoutCreateInfo layout = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+	layout.setLayoutCount = 1;
+	layout.pSetLayouts = &_clusterLayout;
+	layout.pushConstantRangeCount = 1;
+	layout.pPushConstantRanges = &push;
+	VkCheck(vkCreatePipelineLayout(Renderer::device(), &layout, nullptr, &_pipelineLayout));
+}
+
+void LightClusterer::_createPipeline()
+{
+	VkComputePipelineCreateInfo pipeline = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+	pipeline.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipeline.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipeline.stage.pName = "main";
+	pipeline.stage.module = ShaderCache::getModule("shaders/compute/cluster.comp");
+	pipeline.layout = _pipelineLayout;
+	PipelineCache::createCompute(pipeline, &_pipeline);
+}
+
+void LightClusterer::_writeSets()
+{
+	const Uniform* camera = _renderer->getUniform("camera");
+	const Uniform* lights = _renderer->getUniform("pointlights");
+
+	VkDescriptorBufferInfo buffers[5] = {};
+	buffers[0] = { camera->localBuffer.buffer, 0, camera->size };
+	buffers[1] = { lights->localBuffer.buffer, 0, lights->size };
+	buffers[2] = { _counts.buffer, 0, VK_WHOLE_SIZE };
+	buffers[3] = { _lists.buffer, 0, VK_WHOLE_SIZE };
+	buffers[4] = { _statsBuffer.buffer, 0, VK_WHOLE_SIZE };
+
+	VkWriteDescriptorSet writes[8] = {};
+	for (uint32_t i = 0; i < 5; ++i)
+	{
+		writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[i].dstSet = _clusterSet;
+		writes[i].dstBinding = i;
+		writes[i].descriptorCount = 1;
+		writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		writes[i].pBufferInfo = &buffers[i];
+	}
+
+	writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+
+	//The shading set has the same buffers, bar the camera and the stats.
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		writes[5 + i] = writes[1 + i];
+		writes[5 + i].dstSet = _shadingSet;
+		writes[5 + i].dstBinding = i;
+	}
+
+	vkUpdateDescriptorSets(Renderer::device(), 8, writes, 0, nullptr);
+}
\ No newline at end of file
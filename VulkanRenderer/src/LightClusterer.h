@@ -0,0 +1,117 @@
+#ifndef LIGHT_CLUSTERER_H_
+#define LIGHT_CLUSTERER_H_
+
+#include <vulkan/vulkan.h>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include "Buffer.h"
+#include "Light.h"
+
+class Camera;
+class Renderer;
+
+//The view is split into froxels: tiles across the screen, and slices along the view's depth
+//spaced exponentially between the near and far planes, so that each is roughly cube shaped.
+//Matches shadercommon.inc.
+const uint32_t CLUSTER_X = 16;
+const uint32_t CLUSTER_Y = 9;
+const uint32_t CLUSTER_Z = 24;
+const uint32_t CLUSTER_COUNT = CLUSTER_X * CLUSTER_Y * CLUSTER_Z;
+
+//Lights a single cluster can list; any more reaching it are left out.
+const uint32_t CLUSTER_MAX_LIGHTS = 256;
+
+//Bins the scene's point lights into clusters of the view before the frame is drawn. A compute
+//shader tests every light's sphere against each cluster's box, in view space, and writes a list
+//of the lights reaching it, so the deferred lighting pass only loops over the lights that can
+//affect the pixel being shaded, rather than every light in the scene.
+class LightClusterer
+{
+public:
+	LightClusterer(Renderer& renderer);
+	LightClusterer& operator=(const LightClusterer&) = delete;
+	LightClusterer(const LightClusterer&) = delete;
+	LightClusterer(LightClusterer&&) = delete;
+	~LightClusterer();
+
+	//Records the binning for a frame slot; outside any render pass, before the scene is drawn.
+	void cluster(VkCommandBuffer cmd, size_t slot);
+
+	inline bool clustered() const
+	{
+		return _data.clustered != 0;
+	}
+
+	inline uint32_t lightCount() const
+	{
+		return _data.count;
+	}
+
+	//Light indices written into every cluster's list by the most recently completed frame.
+	inline uint32_t listedLights() const
+	{
+		return _listedLights;
+	}
+
+	//Picks up the stats of a frame slot whose fence has signalled.
+	void readStats(size_t slot);
+
+	//Recreates the stats for each frame slot. No frame may be executing.
+	void resize(size_t slots);
+
+	//With clustering off the lighting pass loops over every light instead, for comparison.
+	//Either way, command buffers have to be recorded again, as the binning is only recorded
+	//while clustering with lights to bin.
+	void setClustered(bool enable);
+
+	//Replaces the lights; only the first MAX_POINT_LIGHTS are kept. Command buffers have to be
+	//recorded again when going to or from having none. The binning pipeline is created the
+	//first time there are any.
+	void setLights(const std::vector<PointLight>& lights);
+
+	//What the lighting pass reads: the lights, each cluster's count and the lists.
+	inline VkDescriptorSetLayout shadingLayout() const
+	{
+		return _shadingLayout;
+	}
+
+	inline VkDescriptorSet shadingSet() const
+	{
+		return _shadingSet;
+	}
+
+	//Writes this frame's slice distances, which follow the camera's near and far planes.
+	void update(const Camera& camera);
+
+private:
+	Renderer* _renderer;
+
+	VkDescriptorSetLayout _clusterLayout;
+	VkDescriptorSetLayout _shadingLayout;
+	VkPipelineLayout _pipelineLayout;
+	VkPipeline _pipeline;
+
+	VkDescriptorPool _pool;
+	VkDescriptorSet _clusterSet;
+	VkDescriptorSet _shadingSet;
+
+	//A light count per cluster, and a list of CLUSTER_MAX_LIGHTS indices per cluster.
+	Buffer _counts;
+	Buffer _lists;
+	//Indices listed, per frame slot.
+	Buffer _statsBuffer;
+	size_t _slots;
+
+	PointLightData _data;
+	uint32_t _listedLights;
+
+	void _createLayouts();
+	//Created with the first lights, rather than up front.
+	void _createPipeline();
+	void _writeSets();
+};
+
+#endif //LIGHT_CLUSTERER_H_
\ No newline at end of file
@@ -0,0 +1,337 @@
+#include "MemoryAllocator.h"
+#include "Renderer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+//Device-local blocks; host-visible memory is usually far scarcer so it gets smaller blocks.
+const VkDeviceSize DEVICE_BLOCK_SIZE = 64 * 1024 * 1024;
+const VkDeviceSize HOST_BLOCK_SIZE = 16 * 1024 * 1024;
+
+struct MemoryRange
+{
+	VkDeviceSize offset;
+	VkDeviceSize size;
+};
+
+struct MemoryBlock
+{
+	VkDeviceMemory memory;
+	VkDeviceSize size;
+	uint32_t memoryType;
+	bool linear;
+	uint8_t* mapped;
+	uint32_t allocations;
+
+	//Sorted by offset; adjacent ranges are always merged.
+	std::vector<MemoryRange> free;
+};
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+MemoryAllocator::MemoryAllocator(VkPhysicalDevice physicalDevice)
+{
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &_properties);
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	_maxAllocationCount = properties.limits.maxMemoryAllocationCount;
+
+	memset(_stats, 0, sizeof(_stats));
+}
+
+MemoryAllocator::~MemoryAllocator()
+{
+	for (MemoryBlock* block : _blocks)
+		_destroyBlock(block);
+
+	_blocks.clear();
+}
+
+bool MemoryAllocator::allocate(const VkMemoryRequirements& memReq,
+	VkMemoryPropertyFlags flags, bool linear, Allocation& allocation)
+{
+	const uint32_t memoryType = _findMemoryType(memReq.memoryTypeBits, flags);
+	assert(memoryType != -1);
+	if (memoryType == -1)
+		return false;
+
+	const VkDeviceSize blockSize = _blockSize(memoryType);
+	TypeStats& stats = _stats[memoryType];
+
+	//Render targets and large textures would waste most of a shared block.
+	if (memReq.size > blockSize / 2)
+		return _createDedicated(memoryType, memReq.size, allocation);
+
+	MemoryBlock* target = nullptr;
+	size_t rangeIdx = 0;
+
+	for (MemoryBlock* block : _blocks)
+	{
+		if (block->memoryType != memoryType || block->linear != linear)
+			continue;
+
+		//First fit.
+		for (size_t i = 0; i < block->free.size(); ++i)
+		{
+			const MemoryRange& range = block->free[i];
+			const VkDeviceSize offset = alignUp(range.offset, memReq.alignment);
+
+			if (offset + memReq.size <= range.offset + range.size)
+			{
+				target = block;
+				rangeIdx = i;
+				break;
+			}
+		}
+
+		if (target)
+			break;
+	}
+
+	if (!target)
+	{
+		target = _createBlock(memoryType, blockSize, linear);
+		if (!target)
+			return false;
+
+		_blocks.push_back(target);
+		rangeIdx = 0;
+	}
+
+	//Carve the allocation out of the free range, keeping any alignment padding and
+	//the remaining tail as free ranges of their own.
+	const MemoryRange range = target->free[rangeIdx];
+	const VkDeviceSize offset = alignUp(range.offset, memReq.alignment);
+	const VkDeviceSize end = offset + memReq.size;
+
+	target->free.erase(target->free.begin() + rangeIdx);
+
+	if (end < range.offset + range.size)
+		target->free.insert(target->free.begin() + rangeIdx, { end, range.offset + range.size - end });
+
+	if (offset > range.offset)
+		target->free.insert(target->free.begin() + rangeIdx, { range.offset, offset - range.offset });
+
+	target->allocations++;
+
+	allocation.memory = target->memory;
+	allocation.offset = offset;
+	allocation.size = memReq.size;
+	allocation.mapped = target->mapped ? target->mapped + offset : nullptr;
+	allocation.memoryType = memoryType;
+	allocation.block = target;
+
+	stats.allocations++;
+	stats.used += memReq.size;
+
+	return true;
+}
+
+void MemoryAllocator::free(Allocation& allocation)
+{
+	if (allocation.memory == VK_NULL_HANDLE)
+		return;
+
+	MemoryBlock* block = allocation.block;
+
+	if (!block)
+	{
+		TypeStats& stats = _stats[allocation.memoryType];
+		stats.dedicated--;
+		stats.allocations--;
+		stats.reserved -= allocation.size;
+		stats.used -= allocation.size;
+
+		vkFreeMemory(Renderer::device(), allocation.memory, nullptr);
+	}
+	else
+	{
+		std::vector<MemoryRange>& ranges = block->free;
+
+		size_t idx = 0;
+		while (idx < ranges.size() && ranges[idx].offset < allocation.offset)
+			idx++;
+
+		ranges.insert(ranges.begin() + idx, { allocation.offset, allocation.size });
+
+		//Merge with the following range, then the preceding one.
+		if (idx + 1 < ranges.size() &&
+			ranges[idx].offset + ranges[idx].size == ranges[idx + 1].offset)
+		{
+			ranges[idx].size += ranges[idx + 1].size;
+			ranges.erase(ranges.begin() + idx + 1);
+		}
+
+		if (idx > 0 && ranges[idx - 1].offset + ranges[idx - 1].size == ranges[idx].offset)
+		{
+			ranges[idx - 1].size += ranges[idx].size;
+			ranges.erase(ranges.begin() + idx);
+		}
+
+		block->allocations--;
+
+		TypeStats& stats = _stats[block->memoryType];
+		stats.allocations--;
+		stats.used -= allocation.size;
+
+		//Keep one empty block per pool around so that short-lived staging
+		//allocations don't create and destroy a block every time.
+		if (block->allocations == 0)
+		{
+			for (size_t i = 0; i < _blocks.size(); ++i)
+			{
+				MemoryBlock* other = _blocks[i];
+				if (other != block && other->allocations == 0 &&
+					other->memoryType == block->memoryType && other->linear == block->linear)
+				{
+					_blocks.erase(std::find(_blocks.begin(), _blocks.end(), block));
+					_destroyBlock(block);
+					break;
+				}
+			}
+		}
+	}
+
+	allocation = Allocation();
+}
+
+void MemoryAllocator::printStats() const
+{
+	printf("Device memory: %u of %u allocations used\n", _allocationCount(), _maxAllocationCount);
+	printf("type | blocks | dedicated | allocs | reserved KB |  used KB | free ranges | largest free KB | fragmentation\n");
+
+	for (uint32_t type = 0; type < _properties.memoryTypeCount; ++type)
+	{
+		const TypeStats& stats = _stats[type];
+
+		if (stats.blocks == 0 && stats.dedicated == 0)
+			continue;
+
+		uint32_t freeRanges = 0;
+		VkDeviceSize totalFree = 0;
+		VkDeviceSize largestFree = 0;
+
+		for (const MemoryBlock* block : _blocks)
+		{
+			if (block->memoryType != type)
+				continue;
+
+			for (const MemoryRange& range : block->free)
+			{
+				freeRanges++;
+				totalFree += range.size;
+				if (range.size > largestFree)
+					largestFree = range.size;
+			}
+		}
+
+		//0 when all free space is contiguous, approaching 1 as it splinters.
+		const float fragmentation = totalFree ? 1.0f - ((float)largestFree / totalFree) : 0.0f;
+
+		printf("%4u | %6u | %9u | %6u | %11llu | %8llu | %11u | %15llu | %13.3f\n",
+			type, stats.blocks, stats.dedicated, stats.allocations,
+			stats.reserved / 1024, stats.used / 1024, freeRanges, largestFree / 1024,
+			fragmentation);
+	}
+}
+
+uint32_t MemoryAllocator::_allocationCount() const
+{
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < _properties.memoryTypeCount; ++i)
+		count += _stats[i].blocks + _stats[i].dedicated;
+
+	return count;
+}
+
+MemoryBlock* MemoryAllocator::_createBlock(uint32_t memoryType, VkDeviceSize size, bool linear)
+{
+	VkMemoryAllocateInfo alloc = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+	alloc.allocationSize = size;
+	alloc.memoryTypeIndex = memoryType;
+
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkCheck(vkAllocateMemory(Renderer::device(), &alloc, nullptr, &memory));
+	if (memory == VK_NULL_HANDLE)
+		return nullptr;
+
+	MemoryBlock* block = new MemoryBlock;
+	block->memory = memory;
+	block->size = size;
+	block->memoryType = memoryType;
+	block->linear = linear;
+	block->mapped = nullptr;
+	block->allocations = 0;
+	block->free.push_back({ 0, size });
+
+	//Host-visible blocks stay mapped for their whole lifetime; a VkDeviceMemory can
+	//only be mapped once, so sub-allocations can't map themselves individually.
+	if (_properties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		VkCheck(vkMapMemory(Renderer::device(), memory, 0, VK_WHOLE_SIZE, 0, (void**)&block->mapped));
+
+	_stats[memoryType].blocks++;
+	_stats[memoryType].reserved += size;
+
+	return block;
+}
+
+bool MemoryAllocator::_createDedicated(uint32_t memoryType, VkDeviceSize size, Allocation& allocation)
+{
+	VkMemoryAllocateInfo alloc = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+	alloc.allocationSize = size;
+	alloc.memoryTypeIndex = memoryType;
+
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkCheck(vkAllocateMemory(Renderer::device(), &alloc, nullptr, &memory));
+	if (memory == VK_NULL_HANDLE)
+		return false;
+
+	allocation.memory = memory;
+	allocation.offset = 0;
+	allocation.size = size;
+	allocation.mapped = nullptr;
+	allocation.memoryType = memoryType;
+	allocation.block = nullptr;
+
+	if (_properties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		VkCheck(vkMapMemory(Renderer::device(), memory, 0, VK_WHOLE_SIZE, 0, (void**)&allocation.mapped));
+
+	TypeStats& stats = _stats[memoryType];
+	stats.dedicated++;
+	stats.allocations++;
+	stats.reserved += size;
+	stats.used += size;
+
+	return true;
+}
+
+void MemoryAllocator::_destroyBlock(MemoryBlock* block)
+{
+	_stats[block->memoryType].blocks--;
+	_stats[block->memoryType].reserved -= block->size;
+
+	vkFreeMemory(Renderer::device(), block->memory, nullptr);
+	delete block;
+}
+
+uint32_t MemoryAllocator::_findMemoryType(uint32_t bits, VkMemoryPropertyFlags flags) const
+{
+	for (uint32_t i = 0; i < _properties.memoryTypeCount; i++)
+	{
+		if (((_properties.memoryTypes[i].propertyFlags & flags) == flags) && (bits & (1 << i)))
+			return i;
+	}
+
+	return -1;
+}
+
+VkDeviceSize MemoryAllocator::_blockSize(uint32_t memoryType) const
+{
+	const VkMemoryPropertyFlags flags = _properties.memoryTypes[memoryType].propertyFlags;
+	return (flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ? DEVICE_BLOCK_SIZE : HOST_BLOCK_SIZE;
+}
\ No newline at end of file
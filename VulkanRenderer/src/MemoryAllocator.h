@@ -0,0 +1,70 @@
+#ifndef MEMORY_ALLOCATOR_H_
+#define MEMORY_ALLOCATOR_H_
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+
+struct MemoryBlock;
+
+struct Allocation
+{
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+
+	//Host pointer to the start of the allocation; null unless the memory is host-visible
+	uint8_t* mapped = nullptr;
+
+	uint32_t memoryType = 0;
+
+	//Null for dedicated allocations
+	MemoryBlock* block = nullptr;
+};
+
+//Sub-allocates buffers and images from a small number of large VkDeviceMemory blocks.
+//Each memory type has its own pool of blocks with a sorted free list. Linear resources
+//(buffers) and optimal-tiling images are kept in separate blocks so that
+//bufferImageGranularity never needs to be considered. Anything too large to share a
+//block gets a dedicated allocation of its own.
+class MemoryAllocator
+{
+public:
+	MemoryAllocator(VkPhysicalDevice physicalDevice);
+	MemoryAllocator& operator=(const MemoryAllocator&) = delete;
+	MemoryAllocator(const MemoryAllocator&) = delete;
+	MemoryAllocator(MemoryAllocator&&) = delete;
+	~MemoryAllocator();
+
+	bool allocate(const VkMemoryRequirements& memReq, VkMemoryPropertyFlags flags,
+		bool linear, Allocation& allocation);
+
+	void free(Allocation& allocation);
+
+	void printStats() const;
+
+private:
+	struct TypeStats
+	{
+		uint32_t blocks;
+		uint32_t dedicated;
+		uint32_t allocations;
+		VkDeviceSize reserved;
+		VkDeviceSize used;
+	};
+
+	std::vector<MemoryBlock*> _blocks;
+	TypeStats _stats[VK_MAX_MEMORY_TYPES];
+
+	VkPhysicalDeviceMemoryProperties _properties;
+	uint32_t _maxAllocationCount;
+
+	uint32_t _allocationCount() const;
+	MemoryBlock* _createBlock(uint32_t memoryType, VkDeviceSize size, bool linear);
+	bool _createDedicated(uint32_t memoryType, VkDeviceSize size, Allocation& allocation);
+	void _destroyBlock(MemoryBlock* block);
+	uint32_t _findMemoryType(uint32_t bits, VkMemoryPropertyFlags flags) const;
+	VkDeviceSize _blockSize(uint32_t memoryType) const;
+};
+
+#endif //MEMORY_ALLOCATOR_H_
\ No newline at end of file
@@ -0,0 +1,489 @@
+#include "MeshCache.h"
+
+#include <assert.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static const char CACHE_MAGIC[4] = { 'V', 'R', 'M', 'C' };
+
+//Bump whenever the layout below or the way models are processed changes.
+static const uint32_t CACHE_VERSION = 3;
+
+static const uint32_t MAX_MATERIAL_PATHS = 4;
+
+//Offsets are all relative to the start of the file.
+struct CacheHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t vertexSize;
+	uint32_t materialDataSize;
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	uint32_t shapeCount;
+	uint32_t materialCount;
+	uint32_t libraryCount;
+};
+
+struct CacheShape
+{
+	uint64_t vertexOffset;
+	uint64_t indexOffset;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t nameOffset;
+	uint32_t nameLength;
+	float center[3];
+	float extents[3];
+	float radius;
+	uint32_t padding;
+};
+
+struct CacheMaterial
+{
+	uint32_t pathCount;
+	uint32_t pathOffset[MAX_MATERIAL_PATHS];
+	uint32_t pathLength[MAX_MATERIAL_PATHS];
+};
+
+//A .mtl the OBJ refers to; its materials are baked into the cache too.
+struct CacheLibrary
+{
+	uint64_t size;
+	int64_t time;
+	uint32_t pathOffset;
+	uint32_t pathLength;
+};
+
+static bool sourceInfo(const std::string& path, uint64_t& size, int64_t& time)
+{
+#ifdef _WIN32
+	struct _stat64 st;
+	if (_stat64(path.c_str(), &st) != 0)
+		return false;
+#else
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0)
+		return false;
+#endif
+
+	size = (uint64_t)st.st_size;
+	time = (int64_t)st.st_mtime;
+	return true;
+}
+
+//The .mtl files named by the OBJ's mtllib lines, relative to the OBJ as tinyobjloader reads them.
+static std::vector<std::string> materialLibraries(const std::string& sourcePath)
+{
+	const size_t slash = sourcePath.find_last_of("/\\");
+	const std::string baseDir = (slash == std::string::npos) ? "" : sourcePath.substr(0, slash + 1);
+
+	std::vector<std::string> libraries;
+	std::ifstream file(sourcePath);
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (line.compare(0, 7, "mtllib ") != 0 && line.compare(0, 7, "mtllib\t") != 0)
+			continue;
+
+		std::istringstream names(line.substr(7));
+		std::string name;
+		while (names >> name)
+			libraries.push_back(baseDir + name);
+	}
+
+	return libraries;
+}
+
+//A library that couldn't be found is recorded as empty, so creating it later invalidates the cache.
+static void libraryInfo(const std::string& path, uint64_t& size, int64_t& time)
+{
+	if (!sourceInfo(path, size, time))
+	{
+		size = 0;
+		time = 0;
+	}
+}
+
+static size_t alignUp(size_t value, size_t alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+//Follows the material table, aligned for its 64 bit fields.
+static size_t libraryTableOffset(size_t shapeCount, size_t materialCount)
+{
+	return alignUp(sizeof(CacheHeader) + sizeof(MaterialData) +
+		sizeof(CacheShape) * shapeCount + sizeof(CacheMaterial) * materialCount, 8);
+}
+
+MeshCache::MeshCache() : _data(nullptr), _size(0),
+#ifdef _WIN32
+	_file(INVALID_HANDLE_VALUE), _mapping(nullptr)
+#else
+	_file(-1)
+#endif
+{
+
+}
+
+MeshCache::~MeshCache()
+{
+	close();
+}
+
+bool MeshCache::open(const std::string& path, const std::string& sourcePath)
+{
+	close();
+
+	if (!_map(path))
+		return false;
+
+	if (!_validate(sourcePath))
+	{
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void MeshCache::close()
+{
+#ifdef _WIN32
+	if (_data)
+		UnmapViewOfFile(_data);
+	if (_mapping)
+		CloseHandle(_mapping);
+	if (_file != INVALID_HANDLE_VALUE)
+		CloseHandle(_file);
+
+	_mapping = nullptr;
+	_file = INVALID_HANDLE_VALUE;
+#else
+	if (_data)
+		munmap((void*)_data, _size);
+	if (_file != -1)
+		::close(_file);
+
+	_file = -1;
+#endif
+
+	_data = nullptr;
+	_size = 0;
+}
+
+std::string MeshCache::path(const std::string& modelName)
+{
+	return "assets/models/" + modelName + "/" + modelName + ".meshcache";
+}
+
+bool MeshCache::write(const std::string& path, const std::string& sourcePath,
+	const std::vector<Shape>& shapes, const MaterialData& materialData,
+	const std::vector<MaterialPaths>& materialPaths)
+{
+	CacheHeader header = {};
+	memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.version = CACHE_VERSION;
+	header.vertexSize = sizeof(Vertex);
+	header.materialDataSize = sizeof(MaterialData);
+	header.shapeCount = (uint32_t)shapes.size();
+	header.materialCount = (uint32_t)materialPaths.size();
+
+	if (!sourceInfo(sourcePath, header.sourceSize, header.sourceTime))
+		return false;
+
+	//Indices are drawn as they are, so one past the shape's vertices would read past its buffer.
+	//They're checked here, once, rather than every time the cache is loaded.
+	for (const Shape& shape : shapes)
+	{
+		for (uint32_t index : shape.indices)
+		{
+			if (index >= shape.vertices.size())
+				return false;
+		}
+	}
+
+	const std::vector<std::string> libraries = materialLibraries(sourcePath);
+	header.libraryCount = (uint32_t)libraries.size();
+
+	//Lay out the tables first, then the string data, then the 16 byte aligned mesh data.
+	size_t offset = sizeof(CacheHeader) + sizeof(MaterialData);
+	const size_t shapeTable = offset;
+	offset += sizeof(CacheShape) * shapes.size();
+	const size_t materialTable = offset;
+	const size_t libraryTable = libraryTableOffset(shapes.size(), materialPaths.size());
+	offset = libraryTable + sizeof(CacheLibrary) * libraries.size();
+
+	std::vector<CacheShape> shapeEntries(shapes.size());
+	std::vector<CacheMaterial> materialEntries(materialPaths.size());
+	std::vector<CacheLibrary> libraryEntries(libraries.size());
+
+	for (size_t i = 0; i < libraries.size(); ++i)
+	{
+		libraryInfo(libraries[i], libraryEntries[i].size, libraryEntries[i].time);
+		libraryEntries[i].pathOffset = (uint32_t)offset;
+		libraryEntries[i].pathLength = (uint32_t)libraries[i].size();
+		offset += libraries[i].size();
+	}
+
+	for (size_t i = 0; i < shapes.size(); ++i)
+	{
+		shapeEntries[i].nameOffset = (uint32_t)offset;
+		shapeEntries[i].nameLength = (uint32_t)shapes[i].name.size();
+		offset += shapes[i].name.size();
+
+		memcpy(shapeEntries[i].center, &shapes[i].center, sizeof(shapeEntries[i].center));
+		memcpy(shapeEntries[i].extents, &shapes[i].extents, sizeof(shapeEntries[i].extents));
+		shapeEntries[i].radius = shapes[i].radius;
+	}
+
+	for (size_t i = 0; i < materialPaths.size(); ++i)
+	{
+		assert(materialPaths[i].size() <= MAX_MATERIAL_PATHS);
+		materialEntries[i] = {};
+		materialEntries[i].pathCount = (uint32_t)materialPaths[i].size();
+
+		for (size_t p = 0; p < materialPaths[i].size(); ++p)
+		{
+			materialEntries[i].pathOffset[p] = (uint32_t)offset;
+			materialEntries[i].pathLength[p] = (uint32_t)materialPaths[i][p].size();
+			offset += materialPaths[i][p].size();
+		}
+	}
+
+	for (size_t i = 0; i < shapes.size(); ++i)
+	{
+		offset = alignUp(offset, 16);
+		shapeEntries[i].vertexOffset = offset;
+		shapeEntries[i].vertexCount = (uint32_t)shapes[i].vertices.size();
+		offset += sizeof(Vertex) * shapes[i].vertices.size();
+
+		offset = alignUp(offset, 16);
+		shapeEntries[i].indexOffset = offset;
+		shapeEntries[i].indexCount = (uint32_t)shapes[i].indices.size();
+		offset += sizeof(uint32_t) * shapes[i].indices.size();
+	}
+
+	std::vector<uint8_t> data(offset, 0);
+	memcpy(data.data(), &header, sizeof(header));
+	memcpy(data.data() + sizeof(header), &materialData, sizeof(MaterialData));
+
+	if (!shapeEntries.empty())
+		memcpy(data.data() + shapeTable, shapeEntries.data(), sizeof(CacheShape) * shapeEntries.size());
+	if (!materialEntries.empty())
+		memcpy(data.data() + materialTable, materialEntries.data(), sizeof(CacheMaterial) * materialEntries.size());
+	if (!libraryEntries.empty())
+		memcpy(data.data() + libraryTable, libraryEntries.data(), sizeof(CacheLibrary) * libraryEntries.size());
+
+	for (size_t i = 0; i < libraries.size(); ++i)
+		memcpy(data.data() + libraryEntries[i].pathOffset, libraries[i].data(), libraryEntries[i].pathLength);
+
+	for (size_t i = 0; i < shapes.size(); ++i)
+	{
+		const CacheShape& entry = shapeEntries[i];
+		memcpy(data.data() + entry.nameOffset, shapes[i].name.data(), entry.nameLength);
+		memcpy(data.data() + entry.vertexOffset, shapes[i].vertices.data(), sizeof(Vertex) * entry.vertexCount);
+		memcpy(data.data() + entry.indexOffset, shapes[i].indices.data(), sizeof(uint32_t) * entry.indexCount);
+	}
+
+	for (size_t i = 0; i < materialPaths.size(); ++i)
+	{
+		for (size_t p = 0; p < materialPaths[i].size(); ++p)
+			memcpy(data.data() + materialEntries[i].pathOffset[p], materialPaths[i][p].data(), materialPaths[i][p].size());
+	}
+
+	//Write to a temporary file first so an interrupted write never leaves a truncated cache behind.
+	const std::string tmpPath = path + ".tmp";
+
+	std::ofstream file(tmpPath, std::ios::binary | std::ios::out | std::ios::trunc);
+	if (!file)
+		return false;
+
+	file.write((const char*)data.data(), data.size());
+	const bool written = file.good();
+	file.close();
+
+	remove(path.c_str());
+	if (!written || rename(tmpPath.c_str(), path.c_str()) != 0)
+	{
+		remove(tmpPath.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+const MaterialData& MeshCache::materialData() const
+{
+	return *(const MaterialData*)(_data + sizeof(CacheHeader));
+}
+
+std::vector<MaterialPaths> MeshCache::materialPaths() const
+{
+	const CacheHeader* header = (const CacheHeader*)_data;
+	const CacheMaterial* materials = (const CacheMaterial*)(_data + sizeof(CacheHeader) +
+		sizeof(MaterialData) + sizeof(CacheShape) * header->shapeCount);
+
+	std::vector<MaterialPaths> paths(header->materialCount);
+	for (uint32_t i = 0; i < header->materialCount; ++i)
+	{
+		for (uint32_t p = 0; p < materials[i].pathCount; ++p)
+			paths[i].push_back(std::string((const char*)_data + materials[i].pathOffset[p], materials[i].pathLength[p]));
+	}
+
+	return paths;
+}
+
+uint32_t MeshCache::shapeCount() const
+{
+	return ((const CacheHeader*)_data)->shapeCount;
+}
+
+MeshCache::ShapeData MeshCache::shape(uint32_t idx) const
+{
+	const CacheShape& entry = ((const CacheShape*)(_data + sizeof(CacheHeader) + sizeof(MaterialData)))[idx];
+
+	ShapeData shape;
+	shape.name = (const char*)_data + entry.nameOffset;
+	shape.nameLength = entry.nameLength;
+	shape.vertices = (const Vertex*)(_data + entry.vertexOffset);
+	shape.vertexCount = entry.vertexCount;
+	shape.indices = (const uint32_t*)(_data + entry.indexOffset);
+	shape.indexCount = entry.indexCount;
+	shape.center = glm::vec3(entry.center[0], entry.center[1], entry.center[2]);
+	shape.extents = glm::vec3(entry.extents[0], entry.extents[1], entry.extents[2]);
+	shape.radius = entry.radius;
+
+	return shape;
+}
+
+bool MeshCache::_map(const std::string& path)
+{
+#ifdef _WIN32
+	_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (_file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(_file, &size) || size.QuadPart == 0)
+	{
+		close();
+		return false;
+	}
+
+	_mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!_mapping)
+	{
+		close();
+		return false;
+	}
+
+	_data = (const uint8_t*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+	_size = (size_t)size.QuadPart;
+#else
+	_file = ::open(path.c_str(), O_RDONLY);
+	if (_file == -1)
+		return false;
+
+	struct stat st;
+	if (fstat(_file, &st) != 0 || st.st_size == 0)
+	{
+		close();
+		return false;
+	}
+
+	void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, _file, 0);
+	_data = (data == MAP_FAILED) ? nullptr : (const uint8_t*)data;
+	_size = (size_t)st.st_size;
+#endif
+
+	if (!_data)
+	{
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+bool MeshCache::_validate(const std::string& sourcePath) const
+{
+	if (_size < sizeof(CacheHeader) + sizeof(MaterialData))
+		return false;
+
+	const CacheHeader* header = (const CacheHeader*)_data;
+
+	if (memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+		header->version != CACHE_VERSION ||
+		header->vertexSize != sizeof(Vertex) ||
+		header->materialDataSize != sizeof(MaterialData))
+		return false;
+
+	uint64_t sourceSize = 0;
+	int64_t sourceTime = 0;
+	if (!sourceInfo(sourcePath, sourceSize, sourceTime) ||
+		sourceSize != header->sourceSize || sourceTime != header->sourceTime)
+		return false;
+
+	const size_t tables = libraryTableOffset(header->shapeCount, header->materialCount) +
+		sizeof(CacheLibrary) * header->libraryCount;
+	if (tables > _size)
+		return false;
+
+	//Everything below is only read through the mapping, so make sure nothing points outside it.
+	//Index values were checked when the cache was written and aren't walked again here.
+	const CacheShape* shapes = (const CacheShape*)(_data + sizeof(CacheHeader) + sizeof(MaterialData));
+	for (uint32_t i = 0; i < header->shapeCount; ++i)
+	{
+		const CacheShape& s = shapes[i];
+		if ((uint64_t)s.nameOffset + s.nameLength > _size ||
+			s.vertexOffset + (uint64_t)sizeof(Vertex) * s.vertexCount > _size ||
+			s.indexOffset + (uint64_t)sizeof(uint32_t) * s.indexCount > _size)
+			return false;
+	}
+
+	const CacheMaterial* materials = (const CacheMaterial*)(shapes + header->shapeCount);
+	for (uint32_t i = 0; i < header->materialCount; ++i)
+	{
+		if (materials[i].pathCount > MAX_MATERIAL_PATHS)
+			return false;
+
+		for (uint32_t p = 0; p < materials[i].pathCount; ++p)
+		{
+			if ((uint64_t)materials[i].pathOffset[p] + materials[i].pathLength[p] > _size)
+				return false;
+		}
+	}
+
+	//Materials come from the .mtl files, so editing one has to invalidate the cache too.
+	const CacheLibrary* libraries = (const CacheLibrary*)(_data +
+		libraryTableOffset(header->shapeCount, header->materialCount));
+	for (uint32_t i = 0; i < header->libraryCount; ++i)
+	{
+		if ((uint64_t)libraries[i].pathOffset + libraries[i].pathLength > _size)
+			return false;
+
+		const std::string path((const char*)_data + libraries[i].pathOffset, libraries[i].pathLength);
+
+		uint64_t size = 0;
+		int64_t time = 0;
+		libraryInfo(path, size, time);
+		if (size != libraries[i].size || time != libraries[i].time)
+			return false;
+	}
+
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,73 @@
+#ifndef MESH_CACHE_H_
+#define MESH_CACHE_H_
+
+#include <string>
+#include <vector>
+
+#include "Model.h"
+
+//Binary snapshot of a processed OBJ model, written next to the source after the first load.
+//The file is memory mapped on load so shape data can be copied straight into staging buffers.
+//A cache is rejected if its version, vertex layout, or the size/mtime of the OBJ or any .mtl it
+//names differ, or if it's malformed.
+class MeshCache
+{
+public:
+	struct ShapeData
+	{
+		const char* name;
+		uint32_t nameLength;
+
+		const Vertex* vertices;
+		uint32_t vertexCount;
+
+		const uint32_t* indices;
+		uint32_t indexCount;
+
+		//Model space bounds, worked out when the cache was written.
+		glm::vec3 center;
+		glm::vec3 extents;
+		float radius;
+	};
+
+	MeshCache();
+	MeshCache& operator=(const MeshCache&) = delete;
+	MeshCache(const MeshCache&) = delete;
+	MeshCache(MeshCache&&) = delete;
+	~MeshCache();
+
+	bool open(const std::string& path, const std::string& sourcePath);
+
+	void close();
+
+	//Location of the cache file for a model in assets/models.
+	static std::string path(const std::string& modelName);
+
+	static bool write(const std::string& path, const std::string& sourcePath,
+		const std::vector<Shape>& shapes, const MaterialData& materialData,
+		const std::vector<MaterialPaths>& materialPaths);
+
+	const MaterialData& materialData() const;
+
+	std::vector<MaterialPaths> materialPaths() const;
+
+	uint32_t shapeCount() const;
+
+	ShapeData shape(uint32_t idx) const;
+
+private:
+	const uint8_t* _data;
+	size_t _size;
+
+#ifdef _WIN32
+	void* _file;
+	void* _mapping;
+#else
+	int _file;
+#endif
+
+	bool _map(const std::string& path);
+	bool _validate(const std::string& sourcePath) const;
+};
+
+#endif //MESH_CACHE_H_
\ No newline at end of file
@@ -1,17 +1,71 @@
 #include "Model.h"
+#include "CommandRecorder.h"
+#include "GpuCuller.h"
+#include "Light.h"
+#include "MeshCache.h"
 #include "Renderer.h"
+#include "UploadBatch.h"
 #include "texture/TextureCache.h"
+#include "texture/TextureLoader.h"
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
 
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <unordered_map>
+
+typedef std::chrono::high_resolution_clock Clock;
+
 static uint32_t MODEL_INDEX = 0;
 
+static size_t hashFloat(float f)
+{
+	//-0.0 and 0.0 compare equal so they have to hash equally too.
+	if (f == 0.0f)
+		return 0;
+
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	return bits;
+}
+
+//Welding key for identical OBJ corners. Compared field by field since Vertex has padding.
+struct VertexHash
+{
+	size_t operator()(const Vertex& v) const
+	{
+		const float fields[] = {
+			v.position.x, v.position.y, v.position.z,
+			v.uv.x, v.uv.y,
+			v.normal.x, v.normal.y, v.normal.z
+		};
+
+		size_t hash = v.materialId;
+		for (float f : fields)
+			hash ^= hashFloat(f) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+
+		return hash;
+	}
+};
+
+struct VertexEqual
+{
+	bool operator()(const Vertex& a, const Vertex& b) const
+	{
+		return a.position == b.position && a.uv == b.uv &&
+			a.normal == b.normal && a.materialId == b.materialId;
+	}
+};
+
 Model::Model(const std::string& name, Renderer* renderer)
 	: _name(name), _position(glm::vec3(0.0f, 0.0f, 0.0f)), _scale(1.0f),
-	_pipeline(VK_NULL_HANDLE), _shadowPipeline(VK_NULL_HANDLE)
+	_materialSet(VK_NULL_HANDLE), _culled(false), _shadowCulledShapes(0),
+	_shadowFaceMask(~0u),
+	_upload(nullptr), _renderer(renderer)
 {
 	_load(renderer);
 	_index = MODEL_INDEX;
@@ -20,183 +74,358 @@ Model::Model(const std::string& name, Renderer* renderer)
 
 Model::~Model()
 {
-	for (TextureArray* a : _materials)
-		delete a;
+	//Waits for any copies into the buffers that are about to go away.
+	delete _upload;
+
+	//Other models may share these textures, so only stop them being bound into this set.
+	_renderer->textureLoader().cancelBindings(_materialSet);
+	_renderer->releaseTextureRing(_materialSet);
+
+	for (Texture* t : _materials)
+	{
+		if (t)
+			TextureCache::release(t, *_renderer);
+	}
 }
 
-void Model::draw(Renderer* renderer, VkCommandBuffer cmd, RenderPass& pass)
+bool Model::clearCulling()
 {
-	pass.bindDescriptorSetById(cmd, SET_BINDING_SAMPLER);
-	
-	std::vector<uint32_t> descOffsets = {(uint32_t)renderer->getAlignedRange(sizeof(ModelUniform))*_index};
-	pass.bindDescriptorSetById(cmd, SET_BINDING_MODEL, &descOffsets);
+	const bool culled = _culled;
+	_culled = false;
 
-	std::vector<uint32_t> matOffsets = {(uint32_t)renderer->getAlignedRange(sizeof(MaterialData))*_index};
-	pass.bindDescriptorSetById(cmd, SET_BINDING_MATERIAL, &matOffsets);
+	return culled;
+}
 
-	pass.bindDescriptorSet(cmd, SET_BINDING_TEXTURE, *_materialSet);
-	for (TextureArray* m : _materials)
-	{
-		if(m && m->set())
-			pass.bindDescriptorSet(cmd, SET_BINDING_TEXTURE, m->set());
-	}
+bool Model::clearShadowCulling()
+{
+	const bool culled = !_shadowFaces.empty();
+	_shadowFaces.clear();
+	_shadowCulledShapes = 0;
+	_shadowFaceMask = ~0u;
 
-	if (_pipeline == VK_NULL_HANDLE)
-		_pipeline = pass.getPipelineForShader("shaders/common/model");
+	return culled;
+}
 
-	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipeline);
+uint32_t Model::cull(const glm::mat4& projView)
+{
+	//The shader scales vertices before the model matrix is applied.
+	const glm::mat4 m = projView * worldMatrix();
 
-	//TODO: copy whatever is in the Staging Buffer to GPU local memory
-	
-	for (const Shape& s : _shapes)
-	{
-		VkDeviceSize offsets[] = { 0 };
-		vkCmdBindVertexBuffers(cmd, 0, 1, &s.vertexBuffer.buffer, offsets);
-		vkCmdBindIndexBuffer(cmd, s.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdDrawIndexed(cmd, (uint32_t)s.indices.size(), 1, 0, 0, 0);
-	}
+	_culled = true;
+	return Frustum(m).cull(_bounds, _visible);
 }
 
-void Model::drawGeom(Renderer* renderer, VkCommandBuffer cmd, RenderPass& pass)
+bool Model::cullShadows(const Light& light)
 {
-	pass.bindDescriptorSetById(cmd, SET_BINDING_SAMPLER);
-	
-	std::vector<uint32_t> descOffsets = {(uint32_t)renderer->getAlignedRange(sizeof(ModelUniform))*_index};
-	pass.bindDescriptorSetById(cmd, SET_BINDING_MODEL, &descOffsets);
+	const uint32_t faces = (std::min)(light.numViews, (uint32_t)(sizeof(light.views) / sizeof(light.views[0])));
+	const glm::mat4 world = worldMatrix();
 
-	std::vector<uint32_t> matOffsets = {(uint32_t)renderer->getAlignedRange(sizeof(MaterialData))*_index};
-	pass.bindDescriptorSetById(cmd, SET_BINDING_MATERIAL, &matOffsets);
+	std::vector<glm::mat4> matrices(faces);
+	for (uint32_t f = 0; f < faces; ++f)
+		matrices[f] = light.proj * light.views[f] * world;
+
+	if (matrices == _shadowFaces)
+		return false;
 
-	pass.bindDescriptorSet(cmd, SET_BINDING_TEXTURE, *_materialSet);
-	for (TextureArray* m : _materials)
+	//Nothing further from the cube's centre than the far plane is written, even in the corners
+	//of a face's frustum. The centre is where the views look out from. Cascades have no range.
+	std::vector<uint8_t> inRange(_shapes.size(), 1);
+	if (!light.cascaded())
 	{
-		if(m && m->set())
-			pass.bindDescriptorSet(cmd, SET_BINDING_TEXTURE, m->set());
+		const glm::vec3 origin = glm::vec3(glm::inverse(light.views[0])[3]);
+
+		for (size_t i = 0; i < _shapes.size(); ++i)
+		{
+			const glm::vec3 center = glm::vec3(world * glm::vec4(_shapes[i].center, 1.0f));
+			if (glm::length(center - origin) - _shapes[i].radius * _scale > light.farPlane)
+				inRange[i] = 0;
+		}
 	}
 
-	if (_pipeline == VK_NULL_HANDLE)
-		_pipeline = pass.getPipelineForShader("shaders/common/deferred_model");
+	bool changed = _shadowFaces.size() != matrices.size();
+	_shadowCulledShapes = 0;
+	_shadowFaceMask = 0;
 
-	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipeline);
+	std::vector<uint8_t> visible;
+	_shadowVisibleAny.assign(_shapes.size(), 0);
 
-	for (const Shape& s : _shapes)
+	for (uint32_t f = 0; f < faces; ++f)
 	{
-		VkDeviceSize offsets[] = { 0 };
-		vkCmdBindVertexBuffers(cmd, 0, 1, &s.vertexBuffer.buffer, offsets);
-		vkCmdBindIndexBuffer(cmd, s.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdDrawIndexed(cmd, (uint32_t)s.indices.size(), 1, 0, 0, 0);
+		Frustum(matrices[f]).cull(_bounds, visible);
+
+		for (size_t i = 0; i < _shapes.size(); ++i)
+		{
+			visible[i] &= inRange[i];
+			_shadowVisibleAny[i] |= visible[i];
+			_shadowCulledShapes += visible[i] ? 0 : 1;
+		}
+
+		if (visible != _shadowVisible[f])
+			changed = true;
+
+		if (std::find(visible.begin(), visible.end(), (uint8_t)1) != visible.end())
+			_shadowFaceMask |= 1u << f;
+
+		_shadowVisible[f].swap(visible);
 	}
+
+	_shadowFaces.swap(matrices);
+	return changed;
 }
 
-void Model::drawShadow(Renderer* renderer, VkCommandBuffer cmd, RenderPass& pass)
+void Model::draw(Renderer* renderer, CommandRecorder& cmd, RenderPass& pass)
 {
-	pass.bindDescriptorSetById(cmd, SET_BINDING_SAMPLER);
+	_draw(renderer, cmd, pass, "shaders/common/model", true, _culled ? &_visible : nullptr);
+}
 
-	std::vector<uint32_t> descOffsets = { (uint32_t)renderer->getAlignedRange(sizeof(ModelUniform))*_index };
-	pass.bindDescriptorSetById(cmd, SET_BINDING_MODEL, &descOffsets);
+void Model::drawGeom(Renderer* renderer, CommandRecorder& cmd, RenderPass& pass)
+{
+	_draw(renderer, cmd, pass, "shaders/common/deferred_model", true, _culled ? &_visible : nullptr);
+}
 
-	std::vector<uint32_t> matOffsets = { (uint32_t)renderer->getAlignedRange(sizeof(MaterialData))*_index };
-	pass.bindDescriptorSetById(cmd, SET_BINDING_MATERIAL, &matOffsets);
+void Model::drawShadow(Renderer* renderer, CommandRecorder& cmd, RenderPass& pass, uint32_t face)
+{
+	//The shadow shader reads the material textures too, for alpha masked materials.
+	//Shapes outside the camera's view can still cast shadows into it, so only the face is culled.
+	//Drawing every face at once, a shape is drawn if it can cast into any of them.
+	const std::vector<uint8_t>* visible = nullptr;
+	if (face == SHADOW_FACES_ALL)
+		visible = _shadowFaces.empty() ? nullptr : &_shadowVisibleAny;
+	else if (face < _shadowFaces.size())
+		visible = &_shadowVisible[face];
+
+	_draw(renderer, cmd, pass, "shaders/common/shadowmap", false, visible);
+}
 
-	pass.bindDescriptorSet(cmd, SET_BINDING_TEXTURE, *_materialSet);
-	for (TextureArray* m : _materials)
+void Model::drawShadowTile(Renderer* renderer, CommandRecorder& cmd, RenderPass& pass, const glm::vec4& lightPosRange)
+{
+	//Built while recording, as tiles only change when they're recorded again anyway.
+	const glm::mat4 world = worldMatrix();
+	const glm::vec3 light = glm::vec3(lightPosRange);
+
+	std::vector<uint8_t> visible(_shapes.size());
+	for (size_t i = 0; i < _shapes.size(); ++i)
 	{
-		if (m && m->set())
-			pass.bindDescriptorSet(cmd, SET_BINDING_TEXTURE, m->set());
+		const glm::vec3 center = glm::vec3(world * glm::vec4(_shapes[i].center, 1.0f));
+		visible[i] = glm::length(center - light) - _shapes[i].radius * _scale <= lightPosRange.w;
 	}
 
-	if (!_shadowPipeline)
-		_shadowPipeline = pass.getPipelineForShader("shaders/common/shadowmap");
+	_draw(renderer, cmd, pass, "shaders/common/shadowatlas", false, &visible);
+}
 
-	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _shadowPipeline);
+void Model::finishUpload()
+{
+	if (_upload)
+		_upload->wait();
 
-	for (const Shape& s : _shapes)
-	{
-		VkDeviceSize offsets[] = { 0 };
-		vkCmdBindVertexBuffers(cmd, 0, 1, &s.vertexBuffer.buffer, offsets);
-		vkCmdBindIndexBuffer(cmd, s.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdDrawIndexed(cmd, (uint32_t)s.indices.size(), 1, 0, 0, 0);
-	}
+	delete _upload;
+	_upload = nullptr;
 }
 
-void Model::reload(Renderer* renderer)
+VkDescriptorSet Model::set() const
 {
-	_pipeline = VK_NULL_HANDLE;
-	_shadowPipeline = VK_NULL_HANDLE;
+	return _renderer->slotDescriptor(_materialSet);
 }
 
 void Model::update(Renderer* renderer, float dtime)
 {
 	static float time = 0;
 	time += dtime;
-	ModelUniform model = { glm::translate(glm::mat4(), _position), _scale };
-	model.pos = glm::rotate(model.pos, glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-	model.pos = glm::rotate(model.pos, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	ModelUniform model = { _modelMatrix(), _scale };
 
 	//model.pos = glm::rotate(model.pos, glm::radians(-90.0f) * (time/2.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 
-	//TODO: Don't update the GPU-local memory here, just the staging buffer.
 	renderer->updateUniform("model", (void*)&model, sizeof(model), 
 		renderer->getAlignedRange(sizeof(model)) * _index);
 	renderer->updateUniform("material", (void*)&_materialData, 
 		sizeof(_materialData), renderer->getAlignedRange(sizeof(_materialData)) * _index);
 }
 
+bool Model::updateUpload()
+{
+	if (!_upload || !_upload->complete())
+		return false;
+
+	delete _upload;
+	_upload = nullptr;
+
+	return true;
+}
+
+glm::mat4 Model::worldMatrix() const
+{
+	return glm::scale(_modelMatrix(), glm::vec3(_scale));
+}
+
+
+void Model::_draw(Renderer* renderer, CommandRecorder& cmd, RenderPass& pass, const char* shader, bool camera,
+	const std::vector<uint8_t>* visible)
+{
+	if (!resident() || _drawBuffer.buffer == VK_NULL_HANDLE)
+		return;
+
+	//The recorder drops whatever the previous model already bound, like the sampler and
+	//the pipeline, so only the per-model sets reach Vulkan.
+	pass.bindDescriptorSetById(cmd, SET_BINDING_SAMPLER);
+
+	std::vector<uint32_t> descOffsets = { (uint32_t)renderer->getAlignedRange(sizeof(ModelUniform))*_index };
+	pass.bindDescriptorSetById(cmd, SET_BINDING_MODEL, &descOffsets);
+
+	std::vector<uint32_t> matOffsets = { (uint32_t)renderer->getAlignedRange(sizeof(MaterialData))*_index };
+	pass.bindDescriptorSetById(cmd, SET_BINDING_MATERIAL, &matOffsets);
+
+	//Every material texture is in the model's set.
+	pass.bindDescriptorSet(cmd, SET_BINDING_TEXTURE, set());
+
+	//Not cached on the model: the same model may be recorded on several threads at once.
+	cmd.bindPipeline(pass.getPipelineForShader(shader));
+
+	cmd.bindVertexBuffer(_vertexBuffer.buffer, 0);
+	cmd.bindIndexBuffer(_indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+
+	//The GPU culler writes its own draws for the shapes it left visible.
+	if (camera && renderer->gpuCuller().draw(cmd, this))
+		return;
+
+	if (!visible)
+	{
+		_drawShapes(renderer, cmd, 0, _shapes.size());
+		return;
+	}
+
+	//Each run of visible shapes is still a single indirect draw.
+	size_t first = 0;
+	while (first < _shapes.size())
+	{
+		while (first < _shapes.size() && !(*visible)[first])
+			first++;
+
+		size_t last = first;
+		while (last < _shapes.size() && (*visible)[last])
+			last++;
+
+		if (last > first)
+			_drawShapes(renderer, cmd, first, last - first);
+
+		first = last;
+	}
+}
+
+void Model::_drawShapes(Renderer* renderer, CommandRecorder& cmd, size_t first, size_t count)
+{
+	//One call for every shape where the device allows it.
+	if (count <= renderer->maxDrawIndirectCount())
+	{
+		cmd.drawIndexedIndirect(_drawBuffer.buffer, first * sizeof(VkDrawIndexedIndirectCommand),
+			(uint32_t)count, sizeof(VkDrawIndexedIndirectCommand));
+	}
+	else
+	{
+		for (size_t i = first; i < first + count; ++i)
+		{
+			const Shape& s = _shapes[i];
+			cmd.drawIndexed(s.indexCount, 1, s.firstIndex, s.vertexOffset);
+		}
+	}
+}
+
 void Model::_load(Renderer* renderer)
 {
 	assert(sizeof(MaterialData) <= renderer->properties().limits.maxUniformBufferRange);
 
-	_loadModel(renderer);
+	char sourcePath[128] = { '\0' };
+	sprintf_s(sourcePath, "assets/models/%s/%s.obj", _name.c_str(), _name.c_str());
+
+	const std::string cachePath = MeshCache::path(_name);
+
+	std::chrono::time_point<std::chrono::steady_clock> start = Clock::now();
+
+	MeshCache cache;
+	std::vector<MaterialPaths> materialPaths;
+	const bool cached = cache.open(cachePath, sourcePath);
+
+	if (cached)
+		_loadCached(cache, materialPaths);
+	else
+	{
+		if (!_loadModel(materialPaths))
+			return;
+
+		if (!MeshCache::write(cachePath, sourcePath, _shapes, _materialData, materialPaths))
+			printf("%s: failed to write mesh cache %s\n", _name.c_str(), cachePath.c_str());
+	}
+
+	std::chrono::duration<float> elapsed = Clock::now() - start;
+	printf("%s: mesh data %s in %.2f ms\n", _name.c_str(),
+		cached ? "mapped from cache" : "parsed from OBJ", elapsed.count() * 1000.0f);
+
+	_loadMaterials(renderer, materialPaths);
 
 	//TODO: override default shaders if custom shaders are present in the model dir
 	//char shaderName[128] = {'\0'};
 	//sprintf_s(shaderName, "models/%s/%s", _name.c_str(), _name.c_str());
 	//_pipeline = renderer->getPipelineForShader(shaderName);
 
-	//TODO: fix allocation inefficiencies - use one big buffer instead of lots of small ones.
-	for (Shape& s : _shapes)
+	//Every shape goes to the GPU in a single batch, which may run on the transfer queue
+	//alongside rendering; the model is left out of command buffers until it completes.
+	UploadBatch* batch = new UploadBatch(*renderer);
+	_uploadGeometry(renderer, *batch, cached ? &cache : nullptr);
+	batch->submit();
+	_upload = batch;
+}
+
+void Model::_loadCached(const MeshCache& cache, std::vector<MaterialPaths>& materialPaths)
+{
+	_shapes.resize(cache.shapeCount());
+
+	for (uint32_t i = 0; i < cache.shapeCount(); ++i)
 	{
-		//Vertex buffer
-		{
-			size_t size = (s.vertices.size() * sizeof(Vertex));
-			VkBufferCreateInfo info = {};
-			info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-			info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-			info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-			info.size = size;
+		MeshCache::ShapeData data = cache.shape(i);
+		_shapes[i].name.assign(data.name, data.nameLength);
+		_shapes[i].indexCount = data.indexCount;
+		_shapes[i].vertexCount = data.vertexCount;
+		_shapes[i].center = data.center;
+		_shapes[i].extents = data.extents;
+		_shapes[i].radius = data.radius;
+	}
 
-			Buffer staging;
-			renderer->createAndBindBuffer(info, staging, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-			staging.copyData((void*)s.vertices.data(), size);
+	_materialData = cache.materialData();
+	materialPaths = cache.materialPaths();
+}
 
-			info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-			renderer->createAndBindBuffer(info, s.vertexBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+void Model::_loadMaterials(Renderer* renderer, const std::vector<MaterialPaths>& materialPaths)
+{
+	//Textures are swapped in while frames are in flight, so each frame slot binds its own copy.
+	renderer->allocateTextureRing(_materialSet);
 
-			renderer->copyBuffer(s.vertexBuffer, staging, size);
-		}
+	//Every slot starts out with the placeholder so the model can be drawn straight away; the
+	//real textures are decoded in the background and swapped in as they arrive.
+	Texture* placeholder = TextureCache::getTexture("assets/textures/missingtexture.png", *renderer);
+	for (size_t i = 0; i < INDICES * TEXLAYER_COUNT; i++)
+		placeholder->unbind(renderer, _materialSet, 0, (uint32_t)i);
 
-		//Index buffer
-		{
-			size_t size = (s.indices.size() * sizeof(uint32_t));
-			VkBufferCreateInfo info = {};
-			info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-			info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-			info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-			info.size = size;
+	//One image per material role, so that each role can use the format that suits it.
+	_materials.resize(materialPaths.size() * TEXLAYER_COUNT);
 
-			Buffer staging;
-			renderer->createAndBindBuffer(info, staging, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-			staging.copyData((void*)s.indices.data(), size);
+	for (size_t i = 0; i < materialPaths.size(); ++i)
+	{
+		for (size_t layer = 0; layer < materialPaths[i].size(); ++layer)
+		{
+			const std::string& path = materialPaths[i][layer];
+			const size_t idx = i * TEXLAYER_COUNT + layer;
 
-			info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
-			renderer->createAndBindBuffer(info, s.indexBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+			if (path.empty())
+			{
+				_materials[idx] = nullptr;
+				continue;
+			}
 
-			renderer->copyBuffer(s.indexBuffer, staging, size);
+			_materials[idx] = TextureCache::acquire(path, *renderer, _materialSet, 0, (uint32_t)idx);
 		}
 	}
 }
 
-void Model::_loadModel(Renderer* renderer)
+bool Model::_loadModel(std::vector<MaterialPaths>& materialPaths)
 {
 	char baseDir[128] = { '\0' };
 	sprintf_s(baseDir, "assets/models/%s/", _name.c_str());
@@ -210,7 +439,7 @@ void Model::_loadModel(Renderer* renderer)
 	std::string err;
 
 	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, modelName, baseDir))
-		return;
+		return false;
 	
 	const float scale = 1.0f;
 
@@ -293,15 +522,24 @@ void Model::_loadModel(Renderer* renderer)
 
 
 	_shapes.resize(shapes.size());
-	_materials.resize(materials.size());
+	materialPaths.resize(materials.size());
+
+	size_t cornerCount = 0;
+	size_t vertexCount = 0;
+	size_t indexCount = 0;
 
-	
 	for(size_t s = 0; s < shapes.size(); ++s)
 	{
 		const tinyobj::shape_t& shape = shapes[s];
 
 		_shapes[s].name = shape.name;
 
+		//Every face corner is a separate index in the OBJ; weld identical ones so the
+		//index buffer actually shares vertices.
+		std::unordered_map<Vertex, uint32_t, VertexHash, VertexEqual> unique;
+		unique.reserve(shape.mesh.indices.size());
+		_shapes[s].indices.reserve(shape.mesh.indices.size());
+
 		for(size_t idx = 0; idx < shape.mesh.indices.size(); idx++)
 		{
 			tinyobj::index_t i = shape.mesh.indices[idx];
@@ -340,12 +578,32 @@ void Model::_loadModel(Renderer* renderer)
 			}
 
 			//TODO: these can be cleaned up after being copied to the GPU
-			_shapes[s].vertices.push_back(vtx);
-			_shapes[s].indices.push_back((uint32_t)_shapes[s].indices.size());
+			auto it = unique.find(vtx);
+			if (it == unique.end())
+			{
+				it = unique.insert({ vtx, (uint32_t)_shapes[s].vertices.size() }).first;
+				_shapes[s].vertices.push_back(vtx);
+			}
+
+			_shapes[s].indices.push_back(it->second);
 		}
+
+		_shapes[s].indexCount = (uint32_t)_shapes[s].indices.size();
+		_shapes[s].vertexCount = (uint32_t)_shapes[s].vertices.size();
+
+		//Worked out once here and stored in the mesh cache, so warm loads never walk the vertices.
+		_computeBounds(_shapes[s], _shapes[s].vertices.data());
+
+		cornerCount += shape.mesh.indices.size();
+		vertexCount += _shapes[s].vertices.size();
+		indexCount += _shapes[s].indices.size();
 	}
 
-	TextureArray* master = nullptr;
+	printf("%s: %zu -> %zu vertices (%zu KB -> %zu KB vertex data, %zu KB index data)\n",
+		_name.c_str(), cornerCount, vertexCount,
+		(cornerCount * sizeof(Vertex)) / 1024, (vertexCount * sizeof(Vertex)) / 1024,
+		(indexCount * sizeof(uint32_t)) / 1024);
+
 	for(size_t i = 0; i < materials.size(); ++i)
 	{
 		tinyobj::material_t mat = materials[i];
@@ -359,7 +617,7 @@ void Model::_loadModel(Renderer* renderer)
 		_materialData.shininess[i][0] = mat.shininess;
 		_materialData.flags[i][0] = 0;
 
-		std::vector<std::string> paths;
+		MaterialPaths& paths = materialPaths[i];
 
 		if (mat.diffuse_texname != "")
 		{
@@ -395,38 +653,131 @@ void Model::_loadModel(Renderer* renderer)
 			_materialData.flags[i][0] |= MATFLAG_ALPHAMASK;
 		}
 
-		if (_materialData.flags[i][0] != 0)
-		{
-			//TODO: it's possible a texture array already exists for this material
-			// could locate & reuse instead of reallocating
-			_materials[i] = new TextureArray(paths, renderer);
-			if (!_materialSet) _materialSet = &(_materials[i]->set());
-			if (!master) master = _materials[i];
-			if(_materials[i]->load(renderer))
-				_materials[i]->bind(renderer, *_materialSet, 0, (uint32_t)i);
-		}
-		else
-			_materials[i] = nullptr;
+		//Without any textures the placeholder entries aren't needed.
+		if (_materialData.flags[i][0] == 0)
+			paths.clear();
 	}
 
+	delete[] normals;
+	delete[] faceNormals;
+
+	return true;
+}
 
-	//TODO: the validation layer warning that arises from not doing this is basically safe to ignore
-	//however in the interest of keeping the output clean we do this here. Maybe there is a better way?
-	if (!master)
+void Model::_computeBounds(Shape& shape, const Vertex* vertices)
+{
+	if (shape.vertexCount == 0)
 	{
-		std::vector<std::string> missing = { "assets/textures/missingtexture.png" };
-		master = new TextureArray(missing, renderer);
-		_materialSet = &(master->set());
-		if(master->load(renderer))
-			master->bind(renderer, *_materialSet, 0, 0);
+		shape.center = shape.extents = glm::vec3(0.0f);
+		shape.radius = 0.0f;
+		return;
 	}
 
-	for (size_t i = 0; i < 64; i++)
+	glm::vec3 lo = vertices[0].position;
+	glm::vec3 hi = vertices[0].position;
+
+	for (uint32_t i = 1; i < shape.vertexCount; ++i)
 	{
-		if((i >= _materials.size() || _materials[i] == nullptr) && master)
-			master->unbind(renderer, *_materialSet, 0, (uint32_t)i);
+		lo = glm::min(lo, vertices[i].position);
+		hi = glm::max(hi, vertices[i].position);
 	}
 
-	delete[] normals;
-	delete[] faceNormals;
+	shape.center = (lo + hi) * 0.5f;
+	shape.extents = (hi - lo) * 0.5f;
+
+	float radius = 0.0f;
+	for (uint32_t i = 0; i < shape.vertexCount; ++i)
+		radius = glm::max(radius, glm::length(vertices[i].position - shape.center));
+
+	shape.radius = radius;
+}
+
+glm::mat4 Model::_modelMatrix() const
+{
+	glm::mat4 m = glm::translate(glm::mat4(), _position);
+	m = glm::rotate(m, glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	m = glm::rotate(m, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+
+	return m;
+}
+
+void Model::_uploadGeometry(Renderer* renderer, UploadBatch& batch, const MeshCache* cache)
+{
+	//Shapes are laid out back to back, each drawn with its own offsets into the shared buffers.
+	std::vector<VkDrawIndexedIndirectCommand> draws(_shapes.size());
+	uint32_t vertexCount = 0;
+	uint32_t indexCount = 0;
+
+	for (size_t i = 0; i < _shapes.size(); ++i)
+	{
+		Shape& s = _shapes[i];
+		s.firstIndex = indexCount;
+		s.vertexOffset = (int32_t)vertexCount;
+
+		VkDrawIndexedIndirectCommand& draw = draws[i];
+		draw.indexCount = s.indexCount;
+		draw.instanceCount = 1;
+		draw.firstIndex = s.firstIndex;
+		draw.vertexOffset = s.vertexOffset;
+		draw.firstInstance = 0;
+
+		vertexCount += s.vertexCount;
+		indexCount += s.indexCount;
+	}
+
+	//Nothing to draw; the buffers stay null and draws are skipped.
+	if (vertexCount == 0 || indexCount == 0)
+		return;
+
+	const VkDeviceSize vertexSize = vertexCount * sizeof(Vertex);
+	const VkDeviceSize indexSize = indexCount * sizeof(uint32_t);
+	const VkDeviceSize drawSize = draws.size() * sizeof(VkDrawIndexedIndirectCommand);
+
+	VkBufferCreateInfo info = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	info.size = vertexSize;
+	renderer->createAndBindBuffer(info, _vertexBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+	info.size = indexSize;
+	renderer->createAndBindBuffer(info, _indexBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+	info.size = drawSize;
+	renderer->createAndBindBuffer(info, _drawBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	//Gather everything into one staging buffer: vertices, then indices, then draws.
+	const Buffer& staging = batch.stage(vertexSize + indexSize + drawSize);
+	uint8_t* vertices = staging.memory.mapped;
+	uint8_t* indices = vertices + vertexSize;
+
+	_bounds.clear();
+
+	for (uint32_t i = 0; i < _shapes.size(); ++i)
+	{
+		Shape& s = _shapes[i];
+		const void* shapeVertices = s.vertices.data();
+		const void* shapeIndices = s.indices.data();
+
+		//Cached models copy straight from the mapped file.
+		if (cache)
+		{
+			MeshCache::ShapeData data = cache->shape(i);
+			shapeVertices = data.vertices;
+			shapeIndices = data.indices;
+		}
+
+		memcpy(vertices + s.vertexOffset * sizeof(Vertex), shapeVertices, s.vertexCount * sizeof(Vertex));
+		memcpy(indices + s.firstIndex * sizeof(uint32_t), shapeIndices, s.indexCount * sizeof(uint32_t));
+
+		_bounds.add(s.center, s.extents);
+	}
+
+	memcpy(indices + indexSize, draws.data(), (size_t)drawSize);
+
+	batch.copyStaged(staging, 0, _vertexBuffer, vertexSize);
+	batch.copyStaged(staging, vertexSize, _indexBuffer, indexSize);
+	batch.copyStaged(staging, vertexSize + indexSize, _drawBuffer, drawSize);
 }
\ No newline at end of file
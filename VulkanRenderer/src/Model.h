@@ -10,8 +10,13 @@
 #include "texture/Texture.h"
 #include "texture/TextureArray.h"
 #include "Buffer.h"
+#include "Frustum.h"
 
+class CommandRecorder;
+struct Light;
+class MeshCache;
 class Renderer;
+class UploadBatch;
 
 struct Vertex
 {
@@ -45,16 +50,42 @@ enum MatFlags
 	MATFLAG_ALPHAMASK = 0x0020
 };
 
+//Each material role gets its own image, bound at (materialId * TEXLAYER_COUNT + layer).
+enum TexLayer
+{
+	TEXLAYER_DIFFUSE = 0,
+	TEXLAYER_BUMP = 1,
+	TEXLAYER_SPEC = 2,
+	TEXLAYER_ALPHA = 3,
+	TEXLAYER_COUNT = 4
+};
+
+//Texture path for each TEXLAYER_* role of a single material; empty when it has no textures.
+typedef std::vector<std::string> MaterialPaths;
+
+//A range of the model's vertex and index buffers.
 struct Shape
 {
-	Buffer vertexBuffer;
-	Buffer indexBuffer;
+	uint32_t firstIndex = 0;
+	uint32_t indexCount = 0;
+	int32_t vertexOffset = 0;
+	uint32_t vertexCount = 0;
+
+	//Model space bounds, before the model's scale.
+	glm::vec3 center;
+	glm::vec3 extents;
+	float radius = 0.0f;
 
 	std::string name;
+
+	//Only filled when the model is parsed from OBJ; cached models upload straight from the mapped file.
 	std::vector<Vertex> vertices;
 	std::vector<uint32_t> indices;
 };
 
+//Passed as the face to Model::drawShadow to draw into every face at once, with multiview.
+static const uint32_t SHADOW_FACES_ALL = ~0u;
+
 struct ModelUniform
 {
 	glm::mat4 pos;
@@ -67,29 +98,53 @@ public:
 	Model(const std::string& name, Renderer* renderer);
 	~Model();
 
-	void draw(Renderer* renderer, VkCommandBuffer cmd, RenderPass& pass);
+	//Tests every shape against the camera frustum; the forward and geometry passes then only
+	//draw those left visible. Returns the number of shapes culled.
+	uint32_t cull(const glm::mat4& projView);
+
+	//Tests every shape against each face the light renders its shadow map with, and against
+	//the light's range, so that each face only draws the shapes that can cast into it.
+	//Returns true if which shapes each face draws has changed.
+	bool cullShadows(const Light& light);
 
-	void drawGeom(Renderer* renderer, VkCommandBuffer cmd, RenderPass& pass);
+	//Draws every shape again. Returns true if shapes had been culled.
+	bool clearCulling();
 
-	void drawShadow(Renderer* renderer, VkCommandBuffer cmd, RenderPass& pass);
+	//Draws every shape into every face again. Returns true if shapes had been culled.
+	bool clearShadowCulling();
 
-	void reload(Renderer* renderer);
+	void draw(Renderer* renderer, CommandRecorder& cmd, RenderPass& pass);
+
+	void drawGeom(Renderer* renderer, CommandRecorder& cmd, RenderPass& pass);
+
+	void drawShadow(Renderer* renderer, CommandRecorder& cmd, RenderPass& pass, uint32_t face);
+
+	//Draws into a tile of the shadow atlas, leaving out shapes outside the light's range.
+	void drawShadowTile(Renderer* renderer, CommandRecorder& cmd, RenderPass& pass, const glm::vec4& lightPosRange);
+
+	//Blocks until the mesh data is on the GPU.
+	void finishUpload();
 
 	void update(Renderer*, float dtime);
 
-	inline const std::string& name() const
+	//Returns true once, when the mesh upload completes and command buffers have to be
+	//recorded again to include the model.
+	bool updateUpload();
+
+	//The model isn't drawn until its mesh data has reached the GPU.
+	inline bool resident() const
 	{
-		return _name;
+		return _upload == nullptr;
 	}
 
-	inline VkDescriptorSet set() const
+	inline const std::string& name() const
 	{
-		if (_materialSet)
-			return *_materialSet;
-		else
-			return VK_NULL_HANDLE;
+		return _name;
 	}
 
+	//The frame slot's copy of the material set, for the command buffer being recorded.
+	VkDescriptorSet set() const;
+
 	inline void setPosition(glm::vec3 pos)
 	{
 		_position = pos;
@@ -100,26 +155,83 @@ public:
 		_scale = glm::max(0.0f, scale);
 	}
 
+	inline size_t shapeCount() const
+	{
+		return _shapes.size();
+	}
+
+	//Shape draws left out of the shadow map's faces by the last cullShadows(), summed over faces.
+	inline uint32_t shadowCulledShapes() const
+	{
+		return _shadowCulledShapes;
+	}
+
+	//A bit per shadow map face the model draws anything into; every bit when not culled.
+	inline uint32_t shadowFaceMask() const
+	{
+		return _shadowFaceMask;
+	}
+
+	inline const std::vector<Shape>& shapes() const
+	{
+		return _shapes;
+	}
+
+	//Model to world, with the scale applied.
+	glm::mat4 worldMatrix() const;
+
 private:
 	std::vector<Shape> _shapes;
-	std::vector<TextureArray*> _materials;
+	//Indexed by material * TEXLAYER_COUNT + layer; null where a material has no texture for that role
+	//Owned by the TextureCache, which may share them with other models.
+	std::vector<Texture*> _materials;
 	MaterialData _materialData;
 
 	std::string _name;
 
 	glm::vec3 _position;
 
-	VkPipeline _pipeline;
-	VkPipeline _shadowPipeline;
 	VkPipeline _geomPipeline;
-	const VkDescriptorSet* _materialSet;
+	VkDescriptorSet _materialSet;
+
+	//Every shape's vertices and indices, and a VkDrawIndexedIndirectCommand per shape.
+	Buffer _vertexBuffer;
+	Buffer _indexBuffer;
+	Buffer _drawBuffer;
+
+	//Every shape's box, and whether it survived the last cull().
+	BoundsList _bounds;
+	std::vector<uint8_t> _visible;
+	bool _culled;
+
+	//The same per shadow map face, along with the face matrices they were culled with, as
+	//shadows only need culling again once the light or the model moves.
+	std::vector<uint8_t> _shadowVisible[6];
+	std::vector<uint8_t> _shadowVisibleAny;
+	std::vector<glm::mat4> _shadowFaces;
+	uint32_t _shadowCulledShapes;
+	uint32_t _shadowFaceMask;
+
+	//Outstanding vertex and index copies; null once they've completed.
+	UploadBatch* _upload;
+
+	//Needed to cancel outstanding texture loads on destruction.
+	Renderer* _renderer;
 	
 	uint32_t _index;
 
 	float _scale;
 
+	void _computeBounds(Shape& shape, const Vertex* vertices);
+	void _draw(Renderer* renderer, CommandRecorder& cmd, RenderPass& pass, const char* shader, bool camera,
+		const std::vector<uint8_t>* visible);
+	void _drawShapes(Renderer* renderer, CommandRecorder& cmd, size_t first, size_t count);
 	void _load(Renderer* renderer);
-	void _loadModel(Renderer* renderer);
+	void _loadCached(const MeshCache& cache, std::vector<MaterialPaths>& materialPaths);
+	void _loadMaterials(Renderer* renderer, const std::vector<MaterialPaths>& materialPaths);
+	bool _loadModel(std::vector<MaterialPaths>& materialPaths);
+	glm::mat4 _modelMatrix() const;
+	void _uploadGeometry(Renderer* renderer, UploadBatch& batch, const MeshCache* cache);
 };
 
 #endif //MODEL_H_
\ No newline at end of file
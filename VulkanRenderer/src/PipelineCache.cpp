@@ -0,0 +1,109 @@
+#include "PipelineCache.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+VkPipelineCache PipelineCache::_cache = VK_NULL_HANDLE;
+std::mutex PipelineCache::_statsMutex;
+uint32_t PipelineCache::_created = 0;
+double PipelineCache::_createTime = 0.0;
+
+//Length, version, vendor and device IDs, then the UUID; see vkGetPipelineCacheData.
+static const size_t HEADER_SIZE = 16 + VK_UUID_SIZE;
+
+static uint32_t readUint(const char* data)
+{
+	uint32_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+static double msSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void PipelineCache::init(const VkPhysicalDeviceProperties& properties)
+{
+	std::vector<char> data;
+
+	std::ifstream file(ASSET_PATH + PIPELINE_CACHE_FILE, std::ios::binary | std::ios::in | std::ios::ate);
+	if (file.is_open())
+	{
+		data.resize((size_t)file.tellg());
+		file.seekg(0);
+		file.read(data.data(), data.size());
+
+		if (!file || !_validHeader(data, properties))
+		{
+			printf("Ignoring %s, written by another device or driver\n", PIPELINE_CACHE_FILE.c_str());
+			data.clear();
+		}
+	}
+
+	VkPipelineCacheCreateInfo info = { VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+	info.initialDataSize = data.size();
+	info.pInitialData = data.empty() ? nullptr : data.data();
+
+	VkCheck(vkCreatePipelineCache(Renderer::device(), &info, nullptr, &_cache));
+
+	if (!data.empty())
+		printf("Loaded %u bytes of cached pipelines\n", (uint32_t)data.size());
+}
+
+void PipelineCache::createGraphics(const VkGraphicsPipelineCreateInfo& info, VkPipeline* pipeline)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	VkCheck(vkCreateGraphicsPipelines(Renderer::device(), _cache, 1, &info, nullptr, pipeline));
+	_addTime(msSince(start));
+}
+
+void PipelineCache::createCompute(const VkComputePipelineCreateInfo& info, VkPipeline* pipeline)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	VkCheck(vkCreateComputePipelines(Renderer::device(), _cache, 1, &info, nullptr, pipeline));
+	_addTime(msSince(start));
+}
+
+void PipelineCache::save()
+{
+	size_t size = 0;
+	VkCheck(vkGetPipelineCacheData(Renderer::device(), _cache, &size, nullptr));
+
+	std::vector<char> data(size);
+	VkCheck(vkGetPipelineCacheData(Renderer::device(), _cache, &size, data.data()));
+
+	std::ofstream file(ASSET_PATH + PIPELINE_CACHE_FILE, std::ios::binary | std::ios::out | std::ios::trunc);
+	file.write(data.data(), size);
+	if (!file)
+		printf("Failed to write %s\n", PIPELINE_CACHE_FILE.c_str());
+}
+
+void PipelineCache::printStats()
+{
+	std::lock_guard<std::mutex> lock(_statsMutex);
+	printf("Pipelines created: %u in %.2f ms\n", _created, _createTime);
+}
+
+bool PipelineCache::_validHeader(const std::vector<char>& data, const VkPhysicalDeviceProperties& properties)
+{
+	if (data.size() < HEADER_SIZE)
+		return false;
+
+	//The length is fixed for version one; any other length is a layout we can't read.
+	return readUint(&data[4]) == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+		readUint(&data[0]) == HEADER_SIZE &&
+		readUint(&data[8]) == properties.vendorID &&
+		readUint(&data[12]) == properties.deviceID &&
+		memcmp(&data[16], properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void PipelineCache::_addTime(double ms)
+{
+	std::lock_guard<std::mutex> lock(_statsMutex);
+	_created++;
+	_createTime += ms;
+}
\ No newline at end of file
@@ -0,0 +1,61 @@
+#ifndef PIPELINE_CACHE_H_
+#define PIPELINE_CACHE_H_
+
+#include "Renderer.h"
+#include <vulkan/vulkan.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+const std::string PIPELINE_CACHE_FILE = "pipelines.cache";
+
+//Every pipeline is created through a single VkPipelineCache, which is kept on disk between
+//runs so drivers can skip compiling pipelines they've seen before. A file written by another
+//device or driver is ignored rather than handed to the driver.
+struct PipelineCache final
+{
+	PipelineCache& operator=(const PipelineCache&) = delete;
+	PipelineCache(const PipelineCache&) = delete;
+	PipelineCache(PipelineCache&&) = delete;
+
+	//Loads the file, if there is one that matches the device.
+	static void init(const VkPhysicalDeviceProperties& properties);
+
+	static void createGraphics(const VkGraphicsPipelineCreateInfo& info, VkPipeline* pipeline);
+
+	static void createCompute(const VkComputePipelineCreateInfo& info, VkPipeline* pipeline);
+
+	//Writes out everything the driver has cached so far.
+	static void save();
+
+	//Pipelines created, and the time spent creating them, since startup or the last reset.
+	static void printStats();
+
+	static void resetStats()
+	{
+		std::lock_guard<std::mutex> lock(_statsMutex);
+		_created = 0;
+		_createTime = 0.0;
+	}
+
+	static void shutdown()
+	{
+		vkDestroyPipelineCache(Renderer::device(), _cache, nullptr);
+		_cache = VK_NULL_HANDLE;
+	}
+
+private:
+	static VkPipelineCache _cache;
+
+	//Pipelines are created lazily, from whichever thread records first.
+	static std::mutex _statsMutex;
+	static uint32_t _created;
+	static double _createTime;
+
+	//Whether data starts with a header written by this device and driver.
+	static bool _validHeader(const std::vector<char>& data, const VkPhysicalDeviceProperties& properties);
+
+	static void _addTime(double ms);
+};
+
+#endif //PIPELINE_CACHE_H_
\ No newline at end of file
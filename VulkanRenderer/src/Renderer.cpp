@@ -1,13 +1,22 @@
 #include "Renderer.h"
 #include "SwapChain.h"
 #include "ShaderCache.h"
+#include "PipelineCache.h"
 #include "texture/TextureCache.h"
+#include "texture/TextureLoader.h"
 #include "Model.h"
 #include "Camera.h"
 #include "Scene.h"
+#include "SecondaryRecorder.h"
+#include "CommandRecorder.h"
+#include "GpuCuller.h"
+#include "LightClusterer.h"
 #include "renderpass/PostProcessRenderPass.h"
 
 #include <set>
+#include <cstring>
+#include <algorithm>
+#include <cstdio>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -15,13 +24,20 @@
 
 VkDevice Renderer::_device = VK_NULL_HANDLE;
 VkPhysicalDevice Renderer::_physicalDevice = VK_NULL_HANDLE;
+MemoryAllocator* Renderer::_allocator = nullptr;
 
 //TODO: don't hardcode this and recreate the pool if necessary
 const int MAX_TEXTURES = 64;
 const int MAX_MODELS = 64;
 const int MAX_MATERIALS = 64;
 
-Renderer::Renderer() : _swapChain(nullptr)
+//Staging memory each texture loader update may submit; a handful of 2K textures per frame.
+const VkDeviceSize TEXTURE_STAGING_SIZE = 64 * 1024 * 1024;
+
+Renderer::Renderer() : _recordEachFrame(false), _recordTime(0.0f), _recordingImage(0),
+	_uniformSlots(0), _timestampPool(VK_NULL_HANDLE), _timestampMask(0), _gpuFrameTime(0.0f),
+	_frameCount(0), _textureRingPool(VK_NULL_HANDLE), _swapChain(nullptr), _textureLoader(nullptr),
+	_secondaryRecorder(nullptr), _gpuCuller(nullptr), _lightClusterer(nullptr), _getProperties2(false), _multiview(false)
 {
 
 }
@@ -37,6 +53,17 @@ void Renderer::addRenderPass(RenderPass* renderPass)
 	renderPass->init(this);
 }
 
+void Renderer::allocateImageMemory(VkImage image, Allocation& allocation,
+	VkMemoryPropertyFlags flags) const
+{
+	VkMemoryRequirements memReq;
+	vkGetImageMemoryRequirements(_device, image, &memReq);
+
+	//All images in the renderer use optimal tiling.
+	_allocator->allocate(memReq, flags, false, allocation);
+	VkCheck(vkBindImageMemory(_device, image, allocation.memory, allocation.offset));
+}
+
 void Renderer::allocateTextureDescriptor(VkDescriptorSet& set, SetBinding binding)
 {
 	VkDescriptorSetAllocateInfo alloc = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
@@ -46,18 +73,10 @@ void Renderer::allocateTextureDescriptor(VkDescriptorSet& set, SetBinding bindin
 	VkCheck(vkAllocateDescriptorSets(Renderer::device(), &alloc, &set));
 }
 
-void Renderer::copyBuffer(const Buffer& dst, const Buffer& src, 
-	VkDeviceSize size, VkDeviceSize offset) const
+void Renderer::allocateTextureRing(VkDescriptorSet& set)
 {
-	VkCommandBuffer buffer = startOneShotCmdBuffer();
-
-	VkBufferCopy copy = {};
-	copy.size = size;
-	copy.dstOffset = copy.srcOffset = offset;
-
-	vkCmdCopyBuffer(buffer, src.buffer, dst.buffer, 1, &copy);
-	
-	submitOneShotCmdBuffer(buffer);
+	allocateTextureDescriptor(set);
+	_allocateTextureRing(_textureRings[set]);
 }
 
 void Renderer::clearShaderCache()
@@ -73,16 +92,11 @@ void Renderer::createAndBindBuffer(const VkBufferCreateInfo& info,
 	VkCheck(vkCreateBuffer(_device, &info, nullptr, &buffer.buffer));
 	vkGetBufferMemoryRequirements(Renderer::device(), buffer.buffer, &memReq);
 
-	VkMemoryAllocateInfo alloc = {};
-	alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	alloc.allocationSize = memReq.size;
-	alloc.memoryTypeIndex = getMemoryTypeIndex(memReq.memoryTypeBits, flags);
-
-	VkCheck(vkAllocateMemory(Renderer::device(), &alloc, nullptr, &buffer.memory));
-	VkCheck(vkBindBufferMemory(Renderer::device(), buffer.buffer, buffer.memory, 0));
+	_allocator->allocate(memReq, flags, true, buffer.memory);
+	VkCheck(vkBindBufferMemory(Renderer::device(), buffer.buffer, buffer.memory.memory, buffer.memory.offset));
 }
 
-Uniform* Renderer::createUniform(const std::string& name, size_t size, size_t range)
+Uniform* Renderer::createUniform(const std::string& name, size_t size, size_t range, VkBufferUsageFlags usage)
 {
 	if (_uniforms.find(name) != _uniforms.end())
 	{
@@ -95,18 +109,19 @@ Uniform* Renderer::createUniform(const std::string& name, size_t size, size_t ra
 	
 	uniform->size = size;
 	uniform->range = (range > 0 ? range : size);
+	uniform->mapped = nullptr;
+	uniform->shadow.resize(size);
 
 	VkBufferCreateInfo info = {};
 	info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	info.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 	info.size = size;
 
-	createAndBindBuffer(info, uniform->stagingBuffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-	info.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 	createAndBindBuffer(info, uniform->localBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
+	_allocateUniformRing(uniform);
+
 	return uniform;
 }
 
@@ -118,6 +133,66 @@ void Renderer::destroyPipelines()
 		p->destroyPipelines();
 }
 
+VkCommandBuffer Renderer::frameCommandBuffer(size_t frame, size_t image)
+{
+	if (!_recordEachFrame)
+		return _commandBuffers[image];
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	//Nothing recorded from the pool can still be executing once the frame's fence has signalled.
+	VkCheck(vkResetCommandPool(_device, _framePools[frame], 0));
+	_recordCommandBuffer(_frameCommandBuffers[frame], image, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
+	std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start;
+	_recordTime = elapsed.count() * 1000.0f;
+
+	return _frameCommandBuffers[frame];
+}
+
+void Renderer::flushDescriptors(size_t slot)
+{
+	//Only this slot's copies are rewritten; the other slots' frames may still be reading theirs.
+	std::vector<VkCopyDescriptorSet> copies;
+
+	for (TextureRingPair& pair : _textureRings)
+	{
+		TextureRing& ring = pair.second;
+		if (!ring.dirty[slot])
+			continue;
+
+		VkCopyDescriptorSet copy = { VK_STRUCTURE_TYPE_COPY_DESCRIPTOR_SET };
+		copy.srcSet = pair.first;
+		copy.dstSet = ring.slots[slot];
+		copy.descriptorCount = MAX_MATERIALS * TEXLAYER_COUNT;
+		copies.push_back(copy);
+
+		ring.dirty[slot] = false;
+	}
+
+	if (!copies.empty())
+		vkUpdateDescriptorSets(_device, 0, nullptr, (uint32_t)copies.size(), copies.data());
+}
+
+void Renderer::flushUniforms(size_t slot)
+{
+	//Copy everything written since this slot was last used into its region of the ring.
+	//The GPU-side copy into the local buffers is recorded at the start of each command buffer.
+	for (UniformPair& pair : _uniforms)
+	{
+		Uniform* uniform = pair.second;
+		std::pair<size_t, size_t>& range = uniform->dirty[slot];
+
+		if (range.first == range.second)
+			continue;
+
+		uint8_t* dst = uniform->mapped + (uniform->size * slot);
+		memcpy(dst + range.first, uniform->shadow.data() + range.first, range.second - range.first);
+
+		range.first = range.second = 0;
+	}
+}
+
 size_t Renderer::getAlignedRange(size_t needed) const
 {
 	size_t min = _physicalProperties.limits.minUniformBufferOffsetAlignment;
@@ -173,26 +248,40 @@ void Renderer::init(const Window& window)
 
 	window.createSurface(_instance, &_surface);
 	_initDevice();
+	_allocator = new MemoryAllocator(_physicalDevice);
 	_createCommandPool();
+	_secondaryRecorder = new SecondaryRecorder(_graphicsQueue.index);
 	ShaderCache::init();
+	PipelineCache::init(_physicalProperties);
 	TextureCache::init();
+	Texture::enableCompression(_physicalFeatures.textureCompressionBC == VK_TRUE);
+	_textureLoader = new TextureLoader(*this, TEXTURE_STAGING_SIZE);
 	_createSwapChain();
+	_createTimestampPool();
 	_createSampler();
 	_createUniforms();
 
+	_gpuCuller = new GpuCuller(*this);
+	_gpuCuller->resize(_extent, _uniformSlots);
+
+	_lightClusterer = new LightClusterer(*this);
+	_lightClusterer->resize(_uniformSlots);
+
 	//create Texture descriptor
 	{
 		VkDescriptorPoolSize sizes[1] = {};
 		
 		//Textures
-		sizes[0].descriptorCount = MAX_TEXTURES * MAX_MATERIALS + 2;
+		sizes[0].descriptorCount = MAX_TEXTURES * MAX_MATERIALS * TEXLAYER_COUNT + 3;
 		sizes[0].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
 
 		VkDescriptorPoolCreateInfo pool = {};
 		pool.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 		pool.poolSizeCount = 1;
 		pool.pPoolSizes = sizes;
-		pool.maxSets = MAX_TEXTURES + 1;
+		//Depth and cube textures get a set of their own: the cube shadow map, the cascades and
+		//the shadow atlas.
+		pool.maxSets = MAX_TEXTURES + 3;
 
 		VkCheck(vkCreateDescriptorPool(Renderer::device(), &pool, nullptr, &_textureDescriptorPool));
 
@@ -200,7 +289,7 @@ void Renderer::init(const Window& window)
 		binding.binding = 0;
 		binding.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
 		binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-		binding.descriptorCount = MAX_TEXTURES;
+		binding.descriptorCount = MAX_MATERIALS * TEXLAYER_COUNT;
 
 		VkDescriptorSetLayoutCreateInfo info = {};
 		info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -218,60 +307,124 @@ void Renderer::init(const Window& window)
 		VkCheck(vkCreateDescriptorSetLayout(Renderer::device(), &info, nullptr, &_shadowLayout));
 	}
 
+	_allocateTextureRings();
+
 	//recreateSwapChain();
 }
 
-void Renderer::recordCommandBuffers(const Scene* scene)
+void Renderer::markDescriptorsDirty(VkDescriptorSet set)
 {
-	//TODO: use fences properly instead
-	vkDeviceWaitIdle(_device);
+	std::unordered_map<VkDescriptorSet, TextureRing>::iterator it = _textureRings.find(set);
+	if (it != _textureRings.end())
+		it->second.dirty.assign(it->second.dirty.size(), true);
+}
 
-	//const std::vector<Framebuffer> framebuffers = _swapChain->framebuffers();
+bool Renderer::openFrameLog(const std::string& path)
+{
+	_frameLog.open(path, std::ios::out | std::ios::trunc);
+	if (!_frameLog)
+		return false;
 
-	for (size_t i = 0; i < _commandBuffers.size(); i++)
+	_frameLog << "frame,frame_ms,cpu_ms,fence_wait_ms,record_ms,gpu_ms,frames_queued\n";
+	return true;
+}
+
+void Renderer::printCallCounts() const
+{
+	printf("pass | type       | vulkan calls | skipped binds\n");
+
+	for (size_t i = 0; i < _renderPasses.size(); ++i)
 	{
-		VkCommandBuffer buffer = _commandBuffers[i];
+		RenderPass* pass = _renderPasses[i];
 
-		VkCommandBufferBeginInfo beginInfo = {};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+		//Passes not drawing through a CommandRecorder have nothing to report.
+		if (pass->callCount() == 0 && pass->skippedCount() == 0)
+			continue;
 
-		VkCheck(vkBeginCommandBuffer(buffer, &beginInfo));
+		const char* type = "postprocess";
+		if (pass->type() == RenderPassType::SHADOWMAP)
+			type = "shadowmap";
+		else if (pass->type() == RenderPassType::SCENE)
+			type = "scene";
 
-		/*
-		Shadow
-		In: N/A
-		Out: Shadow map
+		printf("%4u | %-10s | %12u | %13u\n", (uint32_t)i, type, pass->callCount(), pass->skippedCount());
+	}
+}
 
-		Scene
-		In: Shadow map
-		Out: Color & depth buffers
+void Renderer::printStats() const
+{
+	_allocator->printStats();
+	TextureCache::printStats();
+	PipelineCache::printStats();
+	printCallCounts();
+}
 
-		Post
-		In: Color & depth buffers
-		Out: Color buffer
-		*/
+void Renderer::readFrameStats(size_t slot)
+{
+	_gpuCuller->readStats(slot);
+	_lightClusterer->readStats(slot);
 
-		//Go through the RTs for everything up and including the second-to-last pass
-		for (size_t p = 0; p < _renderPasses.size() - 1; ++p)
+	if (!_timestampPool)
+		return;
+
+	//Only valid once the slot's fence has signalled; the first use of a slot has nothing to read.
+	if (_timestampsWritten[slot])
+	{
+		uint64_t timestamps[2] = {};
+		VkResult res = vkGetQueryPoolResults(_device, _timestampPool, (uint32_t)slot * 2, 2,
+			sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+
+		if (res == VK_SUCCESS)
 		{
-			_renderPasses[p]->render(buffer, &_backbufferRenderTargets[i]);
+			const uint64_t ticks = (timestamps[1] - timestamps[0]) & _timestampMask;
+			_gpuFrameTime = (float)(ticks * _physicalProperties.limits.timestampPeriod / 1000000.0);
 		}
+	}
 
-		//For the final pass, use the swap chain.
-		_renderPasses.back()->render(buffer, &_swapChain->framebuffers()[i]);
+	_timestampsWritten[slot] = true;
+}
 
-		VkCheck(vkEndCommandBuffer(buffer));
-	}
+void Renderer::recordCommandBuffers(const Scene* scene)
+{
+	if (_recordEachFrame)
+		return;
+
+	//The command buffers can't be reset while any frame is still executing them.
+	waitForFrames();
+
+	//Nothing is executing, so every slot's descriptor copies can be brought up to date now;
+	//copying into them after recording would invalidate the command buffers.
+	for (size_t i = 0; i < _uniformSlots; i++)
+		flushDescriptors(i);
+
+	for (size_t i = 0; i < _commandBuffers.size(); i++)
+		_recordCommandBuffer(_commandBuffers[i], i, VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT);
 }
 
 void Renderer::recreateSwapChain(uint32_t width, uint32_t height)
 {
-	vkDeviceWaitIdle(_device);
+	//Uploads can carry on; only frames and presentation use the swap chain.
+	waitForFrames();
+	VkCheck(vkQueueWaitIdle(_presentQueue.vkQueue));
+
 	_swapChain->resize(width, height);
 	_extent = _swapChain->surfaceCapabilities().currentExtent;
 	_allocateBackbufferRenderTargets();
 
+	if (_swapChain->framebuffers().size() != _uniformSlots)
+	{
+		_uniformSlots = _swapChain->framebuffers().size();
+
+		for (UniformPair& pair : _uniforms)
+			_allocateUniformRing(pair.second);
+
+		_createTimestampPool();
+		_allocateTextureRings();
+	}
+
+	_gpuCuller->resize(_extent, _uniformSlots);
+	_lightClusterer->resize(_uniformSlots);
+
 	for (RenderPass* pass : _renderPasses)
 	{
 		pass->resize(width, height);
@@ -280,6 +433,12 @@ void Renderer::recreateSwapChain(uint32_t width, uint32_t height)
 	_allocateCommandBuffers();
 }
 
+void Renderer::releaseTextureRing(VkDescriptorSet set)
+{
+	//The copies stay allocated until the ring pool is next recreated.
+	_textureRings.erase(set);
+}
+
 void Renderer::reload()
 {
 	for (RenderPass* p : _renderPasses)
@@ -291,53 +450,55 @@ void Renderer::reload()
 void Renderer::render()
 {
 	_swapChain->present();
-}
-
-void Renderer::setImageLayout(VkImage image, VkFormat format, 
-	VkImageLayout oldLayout, VkImageLayout newLayout, 
-	VkImageSubresourceRange& range) const
-{
-	VkCommandBuffer buffer = startOneShotCmdBuffer();
 
-	VkImageMemoryBarrier barrier = {};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.oldLayout = oldLayout;
-	barrier.newLayout = newLayout;
-	barrier.image = image;
-	barrier.subresourceRange = range;
+	//Frame time covers everything since the previous present, so with the GPU keeping up
+	//it approaches max(cpu, gpu) rather than their sum, and the fence wait stays near 0.
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
 
-	switch (oldLayout)
+	if (_frameLog.is_open() && _frameCount > 0)
 	{
-	case VK_IMAGE_LAYOUT_PREINITIALIZED:
-		barrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
-		break;
-	case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		break;
-	}
+		const std::chrono::duration<float> frame = now - _frameStart;
+		const float frameTime = frame.count() * 1000.0f;
+		const float waitTime = _swapChain->fenceWaitTime();
 
-	switch (newLayout)
-	{
-	case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
-		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		break;
-	case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
-		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-		break;
+		_frameLog << _frameCount << ',' << frameTime << ',' << frameTime - waitTime << ','
+			<< waitTime << ',' << _recordTime << ',' << _gpuFrameTime << ','
+			<< _swapChain->framesQueued() << '\n';
 	}
 
-	vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 
-		VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, 
-		nullptr, 0, nullptr, 1, &barrier);	
+	_frameStart = now;
+	_frameCount++;
+}
+
+void Renderer::setFramesInFlight(uint32_t count)
+{
+	_swapChain->setFramesInFlight(count);
+}
+
+void Renderer::setRecordEachFrame(bool enable)
+{
+	if (enable == _recordEachFrame)
+		return;
 
-	submitOneShotCmdBuffer(buffer);
+	_recordEachFrame = enable;
+	_recordTime = 0.0f;
+
+	//The up-front command buffers have gone stale in the meantime.
+	if (!enable)
+		recordCommandBuffers();
 }
 
-VkCommandBuffer Renderer::startOneShotCmdBuffer() const
+VkDescriptorSet Renderer::slotDescriptor(VkDescriptorSet set) const
+{
+	std::unordered_map<VkDescriptorSet, TextureRing>::const_iterator it = _textureRings.find(set);
+	return it == _textureRings.end() ? set : it->second.slots[_recordingImage];
+}
+
+VkCommandBuffer Renderer::startOneShotCmdBuffer(bool transfer) const
 {
 	VkCommandBufferAllocateInfo info = {};
 	info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	info.commandPool = _commandPool;
+	info.commandPool = transfer ? _transferCommandPool : _commandPool;
 	info.commandBufferCount = 1;
 	info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
 
@@ -353,7 +514,7 @@ VkCommandBuffer Renderer::startOneShotCmdBuffer() const
 	return buffer;
 }
 
-void Renderer::submitOneShotCmdBuffer(VkCommandBuffer buffer) const
+void Renderer::submitOneShotCmdBuffer(VkCommandBuffer buffer, VkFence fence, bool transfer) const
 {
 	VkCheck(vkEndCommandBuffer(buffer));
 
@@ -362,10 +523,13 @@ void Renderer::submitOneShotCmdBuffer(VkCommandBuffer buffer) const
 	submit.commandBufferCount = 1;
 	submit.pCommandBuffers = &buffer;
 
-	VkCheck(vkQueueSubmit(_graphicsQueue.vkQueue, 1, &submit, VK_NULL_HANDLE));
-	VkCheck(vkQueueWaitIdle(_graphicsQueue.vkQueue));
+	const VkQueue queue = transfer ? _transferQueue.vkQueue : _graphicsQueue.vkQueue;
+	VkCheck(vkQueueSubmit(queue, 1, &submit, fence));
+}
 
-	vkFreeCommandBuffers(_device, _commandPool, 1, &buffer);
+void Renderer::freeOneShotCmdBuffer(VkCommandBuffer buffer, bool transfer) const
+{
+	vkFreeCommandBuffers(_device, transfer ? _transferCommandPool : _commandPool, 1, &buffer);
 }
 
 void Renderer::updateUniform(const std::string& name, void* data, size_t size, size_t offset)
@@ -374,8 +538,23 @@ void Renderer::updateUniform(const std::string& name, void* data, size_t size, s
 		return;
 
 	Uniform* uniform = _uniforms[name];
-	uniform->stagingBuffer.copyData(data, size, offset);
-	copyBuffer(uniform->localBuffer, uniform->stagingBuffer, size, offset);
+	assert(offset + size <= uniform->size);
+	memcpy(uniform->shadow.data() + offset, data, size);
+
+	//Nothing is submitted here; each slot of the ring picks this up in flushUniforms.
+	for (std::pair<size_t, size_t>& range : uniform->dirty)
+	{
+		if (range.first == range.second)
+			range = std::make_pair(offset, offset + size);
+		else
+			range = std::make_pair((std::min)(range.first, offset), (std::max)(range.second, offset + size));
+	}
+}
+
+void Renderer::waitForFrames() const
+{
+	if (_swapChain)
+		_swapChain->waitForFrames();
 }
 
 void Renderer::_allocateBackbufferRenderTargets()
@@ -407,16 +586,7 @@ void Renderer::_allocateBackbufferRenderTargets()
 			info.imageType = VK_IMAGE_TYPE_2D;
 
 			VkCheck(vkCreateImage(Renderer::device(), &info, nullptr, &fb.image));
-
-			VkMemoryRequirements memReq;
-			vkGetImageMemoryRequirements(Renderer::device(), fb.image, &memReq);
-
-			VkMemoryAllocateInfo alloc = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-			alloc.allocationSize = memReq.size;
-			alloc.memoryTypeIndex = getMemoryTypeIndex(memReq.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-			VkCheck(vkAllocateMemory(Renderer::device(), &alloc, nullptr, &fb.memory));
-			VkCheck(vkBindImageMemory(Renderer::device(), fb.image, fb.memory, 0));
+			allocateImageMemory(fb.image, fb.memory);
 		}
 
 		//View
@@ -458,16 +628,7 @@ void Renderer::_allocateBackbufferRenderTargets()
 			info.imageType = VK_IMAGE_TYPE_2D;
 
 			VkCheck(vkCreateImage(Renderer::device(), &info, nullptr, &fb.depthImage));
-
-			VkMemoryRequirements memReq;
-			vkGetImageMemoryRequirements(Renderer::device(), fb.depthImage, &memReq);
-
-			VkMemoryAllocateInfo alloc = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-			alloc.allocationSize = memReq.size;
-			alloc.memoryTypeIndex = getMemoryTypeIndex(memReq.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-			VkCheck(vkAllocateMemory(Renderer::device(), &alloc, nullptr, &fb.depthMemory));
-			VkCheck(vkBindImageMemory(Renderer::device(), fb.depthImage, fb.depthMemory, 0));
+			allocateImageMemory(fb.depthImage, fb.depthMemory);
 		}
 
 		//Depth view
@@ -512,7 +673,17 @@ void Renderer::_allocateBackbufferRenderTargets()
 void Renderer::_allocateCommandBuffers()
 {
 	if (_commandBuffers.size())
+	{
+		vkFreeCommandBuffers(_device, _commandPool, (uint32_t)_commandBuffers.size(), _commandBuffers.data());
 		_commandBuffers.clear();
+	}
+
+	//Secondaries belong to the primaries that have just been freed.
+	_secondaryRecorder->clear();
+
+	//The number of frames in flight may have changed along with the swap chain.
+	_destroyFramePools();
+	_createFramePools();
 
 	const std::vector<Framebuffer> framebuffers = _swapChain->framebuffers();
 	_commandBuffers.resize(framebuffers.size());
@@ -528,10 +699,71 @@ void Renderer::_allocateCommandBuffers()
 	recordCommandBuffers();
 }
 
+void Renderer::_allocateTextureRing(TextureRing& ring)
+{
+	std::vector<VkDescriptorSetLayout> layouts(_uniformSlots, _textureLayout);
+	ring.slots.resize(_uniformSlots);
+
+	VkDescriptorSetAllocateInfo alloc = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+	alloc.descriptorSetCount = (uint32_t)_uniformSlots;
+	alloc.descriptorPool = _textureRingPool;
+	alloc.pSetLayouts = layouts.data();
+	VkCheck(vkAllocateDescriptorSets(_device, &alloc, ring.slots.data()));
+
+	//New copies hold nothing yet, so every slot needs the full set.
+	ring.dirty.assign(_uniformSlots, true);
+}
+
+void Renderer::_allocateTextureRings()
+{
+	//Destroying the pool frees every existing copy at once.
+	if (_textureRingPool)
+		vkDestroyDescriptorPool(_device, _textureRingPool, nullptr);
+
+	VkDescriptorPoolSize size = {};
+	size.descriptorCount = (uint32_t)(MAX_TEXTURES * MAX_MATERIALS * TEXLAYER_COUNT * _uniformSlots);
+	size.type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+
+	VkDescriptorPoolCreateInfo pool = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+	pool.poolSizeCount = 1;
+	pool.pPoolSizes = &size;
+	pool.maxSets = (uint32_t)(MAX_TEXTURES * _uniformSlots);
+
+	VkCheck(vkCreateDescriptorPool(_device, &pool, nullptr, &_textureRingPool));
+
+	for (TextureRingPair& pair : _textureRings)
+		_allocateTextureRing(pair.second);
+}
+
+void Renderer::_allocateUniformRing(Uniform* uniform)
+{
+	uniform->stagingBuffer.destroy();
+
+	VkBufferCreateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	info.size = uniform->size * _uniformSlots;
+
+	createAndBindBuffer(info, uniform->stagingBuffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+	//Host-visible memory stays mapped for the lifetime of the buffer.
+	uniform->mapped = uniform->stagingBuffer.memory.mapped;
+
+	//A new ring has nothing in it yet, so every slot needs the full contents.
+	uniform->dirty.assign(_uniformSlots, std::make_pair((size_t)0, (size_t)uniform->size));
+}
+
 void Renderer::_cleanup()
 {
 	VkCheck(vkDeviceWaitIdle(_device));
 
+	delete _gpuCuller;
+	_gpuCuller = nullptr;
+
+	delete _lightClusterer;
+	_lightClusterer = nullptr;
+
 	for (UniformPair& pair : _uniforms)
 	{
 		delete pair.second;
@@ -540,15 +772,26 @@ void Renderer::_cleanup()
 	_uniforms.clear();
 
 	vkDestroySampler(_device, _sampler, nullptr);
+	vkDestroyQueryPool(_device, _timestampPool, nullptr);
 	ShaderCache::clear();
+	//Outstanding loads refer to cached textures.
+	delete _textureLoader;
+	_textureLoader = nullptr;
+
+
 	TextureCache::shutdown();
 
+	vkDestroyDescriptorPool(_device, _textureRingPool, nullptr);
 	vkDestroyDescriptorPool(_device, _textureDescriptorPool, nullptr);
 	vkDestroyDescriptorSetLayout(_device, _textureLayout, nullptr);
 	vkDestroyDescriptorSetLayout(_device, _shadowLayout, nullptr);
 
 	destroyPipelines();
 
+	//Kept for the next run, so its pipelines come out of the cache.
+	PipelineCache::save();
+	PipelineCache::shutdown();
+
 	for (RenderPass* p : _renderPasses)
 	{
 		delete p;
@@ -560,7 +803,19 @@ void Renderer::_cleanup()
 	delete _swapChain;
 	_swapChain = nullptr;
 
+	_destroyFramePools();
+
+	delete _secondaryRecorder;
+	_secondaryRecorder = nullptr;
+
+	if (_transferCommandPool != _commandPool)
+		vkDestroyCommandPool(_device, _transferCommandPool, nullptr);
+
 	vkDestroyCommandPool(_device, _commandPool, nullptr);
+
+	delete _allocator;
+	_allocator = nullptr;
+
 	vkDestroyDevice(_device, nullptr);
 	_device = VK_NULL_HANDLE;
 	vkDestroySurfaceKHR(_instance, _surface, nullptr);
@@ -584,6 +839,37 @@ void Renderer::_createCommandPool()
 	info.queueFamilyIndex = _graphicsQueue.index;
 
 	VkCheck(vkCreateCommandPool(_device, &info, nullptr, &_commandPool));
+
+	_transferCommandPool = _commandPool;
+	if (dedicatedTransferQueue())
+	{
+		//Upload command buffers are freed individually once their batch completes.
+		info.queueFamilyIndex = _transferQueue.index;
+		VkCheck(vkCreateCommandPool(_device, &info, nullptr, &_transferCommandPool));
+	}
+}
+
+void Renderer::_createFramePools()
+{
+	VkCommandPoolCreateInfo pool = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+	pool.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	pool.queueFamilyIndex = _graphicsQueue.index;
+
+	VkCommandBufferAllocateInfo info = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+	info.commandBufferCount = 1;
+	info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+	const uint32_t frames = _swapChain->framesInFlight();
+	_framePools.resize(frames);
+	_frameCommandBuffers.resize(frames);
+
+	for (uint32_t i = 0; i < frames; ++i)
+	{
+		VkCheck(vkCreateCommandPool(_device, &pool, nullptr, &_framePools[i]));
+
+		info.commandPool = _framePools[i];
+		VkCheck(vkAllocateCommandBuffers(_device, &info, &_frameCommandBuffers[i]));
+	}
 }
 
 void Renderer::_createInstance()
@@ -603,6 +889,23 @@ void Renderer::_createInstance()
 
 	std::vector<const char*> extensions;
 	VulkanUtil::getRequiredExtensions(extensions);
+
+	//Device extensions like VK_KHR_multiview depend on it.
+	uint32_t count = 0;
+	vkEnumerateInstanceExtensionProperties(nullptr, &count, nullptr);
+
+	std::vector<VkExtensionProperties> available(count);
+	vkEnumerateInstanceExtensionProperties(nullptr, &count, available.data());
+
+	for (const VkExtensionProperties& extension : available)
+	{
+		if (strcmp(extension.extensionName, "VK_KHR_get_physical_device_properties2") == 0)
+		{
+			extensions.push_back("VK_KHR_get_physical_device_properties2");
+			_getProperties2 = true;
+		}
+	}
+
 	createInfo.enabledExtensionCount = (uint32_t)extensions.size();
 	createInfo.ppEnabledExtensionNames = extensions.data();
 
@@ -631,8 +934,9 @@ void Renderer::_createSampler()
 	samplerInfo.minFilter = VK_FILTER_LINEAR;
 	samplerInfo.magFilter = VK_FILTER_LINEAR;
 
+	//Textures carry full mip chains; render targets only have a single level.
 	samplerInfo.minLod = 0.0f;
-	samplerInfo.maxLod = 1.0f;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
 
 	samplerInfo.anisotropyEnable = VK_TRUE;
 	samplerInfo.maxAnisotropy = 16;
@@ -658,6 +962,33 @@ void Renderer::_createSwapChain()
 	_swapChain = new SwapChain(*this);
 	_swapChain->init(_surface);
 	_extent = _swapChain->surfaceCapabilities().currentExtent;
+	_uniformSlots = _swapChain->framebuffers().size();
+}
+
+void Renderer::_createTimestampPool()
+{
+	if (_timestampPool)
+		vkDestroyQueryPool(_device, _timestampPool, nullptr);
+	_timestampPool = VK_NULL_HANDLE;
+
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &familyCount, nullptr);
+
+	std::vector<VkQueueFamilyProperties> families(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &familyCount, families.data());
+
+	const uint32_t validBits = families[_graphicsQueue.index].timestampValidBits;
+	if (validBits == 0)
+		return;
+
+	_timestampMask = (validBits >= 64) ? ~0ull : ((1ull << validBits) - 1);
+
+	VkQueryPoolCreateInfo info = { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+	info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	info.queryCount = (uint32_t)_uniformSlots * 2;
+
+	VkCheck(vkCreateQueryPool(_device, &info, nullptr, &_timestampPool));
+	_timestampsWritten.assign(_uniformSlots, false);
 }
 
 void Renderer::_createUniforms()
@@ -666,6 +997,9 @@ void Renderer::_createUniforms()
 	createUniform("model", getAlignedRange(sizeof(ModelUniform)) * MAX_MODELS);
 	createUniform("light", getAlignedRange(sizeof(Light)));
 	createUniform("material", getAlignedRange(sizeof(MaterialData)) * MAX_MODELS);
+	createUniform("cull", getAlignedRange(sizeof(CullUniform)));
+	createUniform("atlas", sizeof(AtlasData), 0, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	createUniform("pointlights", sizeof(PointLightData), 0, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
 }
 
 void Renderer::_destroyBackbufferRenderTargets()
@@ -681,8 +1015,7 @@ void Renderer::_destroyBackbufferRenderTargets()
 		if (fb.image)
 			vkDestroyImage(Renderer::device(), fb.image, nullptr);
 
-		if (fb.memory)
-			vkFreeMemory(Renderer::device(), fb.memory, nullptr);
+		_allocator->free(fb.memory);
 
 		if (fb.depthView)
 			vkDestroyImageView(Renderer::device(), fb.depthView, nullptr);
@@ -690,12 +1023,41 @@ void Renderer::_destroyBackbufferRenderTargets()
 		if (fb.depthImage)
 			vkDestroyImage(Renderer::device(), fb.depthImage, nullptr);
 
-		if(fb.depthMemory)
-			vkFreeMemory(Renderer::device(), fb.depthMemory, nullptr);
+		_allocator->free(fb.depthMemory);
 	}
 	_backbufferRenderTargets.clear();
 }
 
+void Renderer::_destroyFramePools()
+{
+	//Destroying a pool frees its command buffers too.
+	for (VkCommandPool pool : _framePools)
+		vkDestroyCommandPool(_device, pool, nullptr);
+
+	_framePools.clear();
+	_frameCommandBuffers.clear();
+}
+
+const char* Renderer::_findDeviceExtension(std::initializer_list<const char*> names) const
+{
+	uint32_t count = 0;
+	vkEnumerateDeviceExtensionProperties(_physicalDevice, nullptr, &count, nullptr);
+
+	std::vector<VkExtensionProperties> available(count);
+	vkEnumerateDeviceExtensionProperties(_physicalDevice, nullptr, &count, available.data());
+
+	for (const char* name : names)
+	{
+		for (const VkExtensionProperties& extension : available)
+		{
+			if (strcmp(extension.extensionName, name) == 0)
+				return name;
+		}
+	}
+
+	return nullptr;
+}
+
 void Renderer::_initDevice()
 {
 	_physicalDevice = _pickPhysicalDevice();
@@ -707,17 +1069,39 @@ void Renderer::_initDevice()
 		VK_KHR_SWAPCHAIN_EXTENSION_NAME
 	};
 
+	//GPU culling compacts its draws with either of these; without one it still works, less efficiently.
+	const char* drawIndirectCount = _findDeviceExtension({ "VK_KHR_draw_indirect_count", "VK_AMD_draw_indirect_count" });
+	if (drawIndirectCount)
+		extensions.push_back(drawIndirectCount);
+
+	//The cube shadow map is drawn in a single pass with it; its feature is required with the extension.
+#ifdef VK_KHR_multiview
+	VkPhysicalDeviceMultiviewFeaturesKHR multiview = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES_KHR };
+	_multiview = _getProperties2 && _findDeviceExtension({ VK_KHR_MULTIVIEW_EXTENSION_NAME }) != nullptr;
+
+	if (_multiview)
+	{
+		extensions.push_back(VK_KHR_MULTIVIEW_EXTENSION_NAME);
+		multiview.multiview = VK_TRUE;
+	}
+#endif
+
 	VkDeviceCreateInfo info = {};
 	info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	info.pEnabledFeatures = &_physicalFeatures;
 	info.ppEnabledExtensionNames = extensions.data();
 	info.enabledExtensionCount = (uint32_t)extensions.size();
 
+#ifdef VK_KHR_multiview
+	if (_multiview)
+		info.pNext = &multiview;
+#endif
+
 	const float priority = 1.0f;
 	_queryDeviceQueueFamilies(_physicalDevice);
 	
 	std::vector<VkDeviceQueueCreateInfo> queryInfos;
-	std::set<uint32_t> uniqueFamilies = { _graphicsQueue.index, _presentQueue.index };
+	std::set<uint32_t> uniqueFamilies = { _graphicsQueue.index, _presentQueue.index, _transferQueue.index };
 
 	for (uint32_t family : uniqueFamilies)
 	{
@@ -742,6 +1126,19 @@ void Renderer::_initDevice()
 
 	vkGetDeviceQueue(_device, _graphicsQueue.index, 0, &_graphicsQueue.vkQueue);
 	vkGetDeviceQueue(_device, _presentQueue.index, 0, &_presentQueue.vkQueue);
+	vkGetDeviceQueue(_device, _transferQueue.index, 0, &_transferQueue.vkQueue);
+
+	if (drawIndirectCount)
+	{
+		const bool khr = strcmp(drawIndirectCount, "VK_KHR_draw_indirect_count") == 0;
+		CommandRecorder::setDrawIndirectCount((CommandRecorder::DrawIndexedIndirectCountFn)vkGetDeviceProcAddr(
+			_device, khr ? "vkCmdDrawIndexedIndirectCountKHR" : "vkCmdDrawIndexedIndirectCountAMD"));
+	}
+
+	if (dedicatedTransferQueue())
+		printf("Uploading on dedicated transfer queue family %u\n", _transferQueue.index);
+	else
+		printf("No dedicated transfer queue family, uploading on the graphics queue\n");
 }
 
 VkPhysicalDevice Renderer::_pickPhysicalDevice()
@@ -767,14 +1164,15 @@ VkPhysicalDevice Renderer::_pickPhysicalDevice()
 			if (properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
 			{
 				physicalDevice = physicalDevices[i];
-				_physicalProperties = properties;
-
-				vkGetPhysicalDeviceFeatures(physicalDevice, &_physicalFeatures);
 				break;
 			}
 		}
 
 		delete[] physicalDevices;
+
+		//Whichever device was picked, integrated ones included.
+		vkGetPhysicalDeviceProperties(physicalDevice, &_physicalProperties);
+		vkGetPhysicalDeviceFeatures(physicalDevice, &_physicalFeatures);
 	}
 
 	return physicalDevice;
@@ -806,6 +1204,109 @@ void Renderer::_queryDeviceQueueFamilies(VkPhysicalDevice device)
 		if (_graphicsQueue.index != -1 && _presentQueue.index != -1)
 			break;
 	}
+
+	//A family that can only transfer is usually a separate DMA engine that runs alongside
+	//the graphics queue. Its copies have to be at least texel granular though, or small mip
+	//levels couldn't be uploaded through it.
+	_transferQueue.index = _graphicsQueue.index;
+
+	for (uint32_t i = 0; i < queueFamilyCount; i++)
+	{
+		const VkQueueFamilyProperties& family = families[i];
+		const VkExtent3D& granularity = family.minImageTransferGranularity;
+
+		if (family.queueCount > 0 && (family.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+			!(family.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) &&
+			granularity.width == 1 && granularity.height == 1 && granularity.depth == 1)
+		{
+			_transferQueue.index = i;
+			break;
+		}
+	}
+}
+
+void Renderer::_recordCommandBuffer(VkCommandBuffer buffer, size_t image, VkCommandBufferUsageFlags usage)
+{
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = usage;
+
+	VkCheck(vkBeginCommandBuffer(buffer, &beginInfo));
+
+	//Picks the ring copies bound below, including from the secondaries' threads.
+	_recordingImage = image;
+
+	_secondaryRecorder->begin(buffer, usage);
+
+	if (_timestampPool)
+	{
+		vkCmdResetQueryPool(buffer, _timestampPool, (uint32_t)image * 2, 2);
+		vkCmdWriteTimestamp(buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, _timestampPool, (uint32_t)image * 2);
+	}
+
+	_recordUniformCopies(buffer, image);
+	_gpuCuller->cull(buffer, image);
+	_lightClusterer->cluster(buffer, image);
+
+	/*
+	Shadow
+	In: N/A
+	Out: Shadow map
+
+	Scene
+	In: Shadow map
+	Out: Color & depth buffers
+
+	Post
+	In: Color & depth buffers
+	Out: Color buffer
+	*/
+
+	//Go through the RTs for everything up and including the second-to-last pass
+	for (size_t p = 0; p < _renderPasses.size() - 1; ++p)
+	{
+		_renderPasses[p]->render(buffer, &_backbufferRenderTargets[image]);
+	}
+
+	//For the final pass, use the swap chain.
+	_renderPasses.back()->render(buffer, &_swapChain->framebuffers()[image]);
+
+	if (_timestampPool)
+		vkCmdWriteTimestamp(buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, _timestampPool, (uint32_t)image * 2 + 1);
+
+	VkCheck(vkEndCommandBuffer(buffer));
+}
+
+void Renderer::_recordUniformCopies(VkCommandBuffer cmd, size_t slot) const
+{
+	//The previous frame may still be reading the local buffers.
+	VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	const VkPipelineStageFlags shaderStages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+	vkCmdPipelineBarrier(cmd, shaderStages, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	for (const UniformPair& pair : _uniforms)
+	{
+		const Uniform* uniform = pair.second;
+
+		VkBufferCopy copy = {};
+		copy.srcOffset = uniform->size * slot;
+		copy.dstOffset = 0;
+		copy.size = uniform->size;
+
+		vkCmdCopyBuffer(cmd, uniform->stagingBuffer.buffer, uniform->localBuffer.buffer, 1, &copy);
+	}
+
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, shaderStages,
+		0, 1, &barrier, 0, nullptr, 0, nullptr);
 }
 
 void Renderer::_registerDebugger()
@@ -3,29 +3,46 @@
 
 #include <vulkan/vulkan.h>
 
+#include <chrono>
+#include <fstream>
+#include <initializer_list>
 #include <vector>
 #include <unordered_map>
 
 #include "Window.h"
 #include "Buffer.h"
+#include "MemoryAllocator.h"
 #include "VulkanUtil.h"
 #include "SetBinding.h"
 #include "renderpass/RenderPass.h"
 
 const std::string ASSET_PATH = "assets/";
 
+class GpuCuller;
+class LightClusterer;
 class Model;
 class Scene;
+class SecondaryRecorder;
 class SwapChain;
+class TextureLoader;
 
 struct Uniform
 {
 	//Local to the device, not CPU-mappable
 	Buffer localBuffer;
 
-	//CPU-mappable buffer
+	//CPU-mappable ring holding one copy of the buffer per frame slot
 	Buffer stagingBuffer;
 
+	//Persistent mapping of stagingBuffer
+	uint8_t* mapped;
+
+	//Most recent contents written by Renderer::updateUniform
+	std::vector<uint8_t> shadow;
+
+	//Per-slot [begin, end) range of shadow not yet written to that slot of the ring
+	std::vector<std::pair<size_t, size_t>> dirty;
+
 	//Total size of the entire buffer
 	VkDeviceSize size;
 
@@ -42,57 +59,137 @@ public:
 
 	void addRenderPass(RenderPass* renderPass);
 
+	void allocateImageMemory(VkImage image, Allocation& allocation,
+		VkMemoryPropertyFlags flags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) const;
+
 	void allocateTextureDescriptor(VkDescriptorSet& set, SetBinding binding = SET_BINDING_TEXTURE);
 
-	void copyBuffer(const Buffer& dst, const Buffer& src, VkDeviceSize size, VkDeviceSize offset = 0) const;
+	//For texture sets rewritten while frames are in flight. set itself is only written, never
+	//bound: each swap chain image binds a copy of its own, refreshed by flushDescriptors.
+	void allocateTextureRing(VkDescriptorSet& set);
 
 	void clearShaderCache();
 
 	void createAndBindBuffer(const VkBufferCreateInfo& info, Buffer& buffer, VkMemoryPropertyFlags flags) const;
 
-	Uniform* createUniform(const std::string& name, size_t size, size_t range = 0);
+	//Storage buffers go through the same per-frame ring, with usage set to STORAGE_BUFFER.
+	Uniform* createUniform(const std::string& name, size_t size, size_t range = 0,
+		VkBufferUsageFlags usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
 
 	void destroyPipelines();
 
+	//Copies ring sets written since the slot was last flushed into its copies; like
+	//flushUniforms, only called once the slot's fence has signalled.
+	void flushDescriptors(size_t slot);
+
+	void flushUniforms(size_t slot);
+
+	void freeOneShotCmdBuffer(VkCommandBuffer buffer, bool transfer = false) const;
+
+	//The command buffer to submit for a frame slot rendering to a swap chain image; only
+	//called once that slot's fence has signalled. Recorded on the spot when recording each frame.
+	VkCommandBuffer frameCommandBuffer(size_t frame, size_t image);
+
 	size_t getAlignedRange(size_t needed) const;
 
 	uint32_t getMemoryTypeIndex(uint32_t bits, VkMemoryPropertyFlags flags) const;
 
 	RenderPass* getRenderPass(RenderPassType type) const;
 
+	//GPU time of the most recently completed frame, in milliseconds; 0 if timestamps are unsupported.
+	inline float gpuFrameTime() const
+	{
+		return _gpuFrameTime;
+	}
+
 	Uniform* getUniform(const std::string& name);
 
+	//Every slot's copy of a ring set picks up its writes at that slot's next flush. Sets that
+	//aren't rings are ignored.
+	void markDescriptorsDirty(VkDescriptorSet set);
+
 	void init(const Window& window);
 
+	//Appends a CSV line per frame with CPU, fence wait and GPU times, showing how much the
+	//CPU and GPU overlap.
+	bool openFrameLog(const std::string& path);
+
+	//Vulkan calls each pass made through CommandRecorders the last time it was recorded.
+	void printCallCounts() const;
+
+	void printStats() const;
+
+	//Picks up the GPU time and culling stats of a frame slot whose fence has signalled.
+	void readFrameStats(size_t slot);
+
+	//Re-records the per-image command buffers. Does nothing when recording each frame,
+	//as every frame already picks up the latest state.
 	void recordCommandBuffers(const Scene* scene = 0);
 
+	inline bool recordsEachFrame() const
+	{
+		return _recordEachFrame;
+	}
+
+	//CPU time spent recording the last frame's command buffer, in milliseconds; 0 unless
+	//recording each frame.
+	inline float recordTime() const
+	{
+		return _recordTime;
+	}
+
 	void recreateSwapChain(uint32_t width = 0, uint32_t height = 0);
 
+	//Stops refreshing the copies of a ring set, e.g. when its owner goes away.
+	void releaseTextureRing(VkDescriptorSet set);
+
 	void reload();
 
 	void render();
 
-	void setImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, VkImageSubresourceRange& range) const;
+	//Takes effect when the swap chain is next recreated.
+	void setFramesInFlight(uint32_t count);
 
-	VkCommandBuffer startOneShotCmdBuffer() const;
+	//Instead of replaying command buffers recorded up front, record a fresh one every frame
+	//from a per-frame pool that is reset as a whole. Scene changes then cost nothing extra.
+	void setRecordEachFrame(bool enable);
 
-	void submitOneShotCmdBuffer(VkCommandBuffer buffer) const;
+	//The copy of a ring set to bind in the command buffer being recorded; any other set is
+	//returned as it is. Safe to call from the threads recording secondaries.
+	VkDescriptorSet slotDescriptor(VkDescriptorSet set) const;
+
+	//Transfer command buffers come from, and are submitted to, the transfer queue.
+	VkCommandBuffer startOneShotCmdBuffer(bool transfer = false) const;
+
+	//Ends and submits buffer; fence is signalled once it has executed.
+	void submitOneShotCmdBuffer(VkCommandBuffer buffer, VkFence fence, bool transfer = false) const;
 
 	void updateUniform(const std::string& name, void* data, size_t size, size_t offset = 0);
 
-	inline const std::vector<Framebuffer>& backbufferRenderTargets() const
+	//Blocks until no frame is executing, e.g. before rewriting what frames use.
+	void waitForFrames() const;
+
+	inline GpuCuller& gpuCuller()
 	{
-		return _backbufferRenderTargets;
+		return *_gpuCuller;
+	}
+
+	inline LightClusterer& lightClusterer()
+	{
+		return *_lightClusterer;
 	}
 
-	inline const VkCommandBuffer commandBuffer(size_t idx) const
+	inline static MemoryAllocator& allocator()
 	{
-		if (idx >= _commandBuffers.size())
-			return VK_NULL_HANDLE;
+		return *_allocator;
+	}
 
-		return _commandBuffers[idx];
+	inline const std::vector<Framebuffer>& backbufferRenderTargets() const
+	{
+		return _backbufferRenderTargets;
 	}
 
+
 	inline static const VkDevice device()
 	{
 		return _device;
@@ -103,16 +200,39 @@ public:
 		return _extent;
 	}
 
+	//False when uploads share the graphics queue, e.g. on devices with a single queue family.
+	inline bool dedicatedTransferQueue() const
+	{
+		return _transferQueue.index != _graphicsQueue.index;
+	}
+
 	inline const VkQueue graphicsQueue() const
 	{
 		return _graphicsQueue.vkQueue;
 	}
 
+	inline uint32_t graphicsQueueFamily() const
+	{
+		return _graphicsQueue.index;
+	}
+
 	inline const VkInstance instance() const
 	{
 		return _instance;
 	}
 
+	//Shapes drawn by one indirect draw; 1 without the multiDrawIndirect feature.
+	inline uint32_t maxDrawIndirectCount() const
+	{
+		return _physicalFeatures.multiDrawIndirect ? _physicalProperties.limits.maxDrawIndirectCount : 1;
+	}
+
+	//VK_KHR_multiview is enabled; never with headers that predate it.
+	inline bool multiviewSupported() const
+	{
+		return _multiview;
+	}
+
 	inline const VkPhysicalDevice physicalDevice() const
 	{
 		return _physicalDevice;
@@ -138,6 +258,17 @@ public:
 		return _sampler;
 	}
 
+	//Passes record their draws through this; only valid while command buffers are being recorded.
+	inline SecondaryRecorder& secondaryRecorder()
+	{
+		return *_secondaryRecorder;
+	}
+
+	inline TextureLoader& textureLoader()
+	{
+		return *_textureLoader;
+	}
+
 	inline const SwapChain* swapChain() const
 	{
 		return _swapChain;
@@ -148,6 +279,11 @@ public:
 		return _surface;
 	}
 
+	inline uint32_t transferQueueFamily() const
+	{
+		return _transferQueue.index;
+	}
+
 private:
 	struct QueueInfo
 	{
@@ -157,18 +293,50 @@ private:
 
 	typedef std::pair<const std::string, Uniform*> UniformPair;
 
+	//Per-slot copies of a set from allocateTextureRing, and which of them are out of date.
+	struct TextureRing
+	{
+		std::vector<VkDescriptorSet> slots;
+		std::vector<bool> dirty;
+	};
+
+	typedef std::pair<const VkDescriptorSet, TextureRing> TextureRingPair;
+
 	std::vector<VkCommandBuffer> _commandBuffers;
+
+	//One transient pool and command buffer per frame in flight, for recording each frame.
+	std::vector<VkCommandPool> _framePools;
+	std::vector<VkCommandBuffer> _frameCommandBuffers;
+	bool _recordEachFrame;
+	float _recordTime;
+
+	//Swap chain image whose command buffer is being recorded.
+	size_t _recordingImage;
+
 	std::vector<RenderPass*> _renderPasses;
 	std::vector<Framebuffer> _backbufferRenderTargets;
 	std::unordered_map<std::string, Uniform*> _uniforms;
+	size_t _uniformSlots;
+
+	//Two timestamps (start, end) per frame slot.
+	VkQueryPool _timestampPool;
+	std::vector<bool> _timestampsWritten;
+	uint64_t _timestampMask;
+	float _gpuFrameTime;
+
+	std::ofstream _frameLog;
+	uint64_t _frameCount;
+	std::chrono::steady_clock::time_point _frameStart;
 
 	static VkDevice _device;
 	static VkPhysicalDevice _physicalDevice;
+	static MemoryAllocator* _allocator;
 	VkDebugReportCallbackEXT _debugCallback;
 	VkInstance _instance;
 	VkSurfaceKHR _surface;
 	VkSampler _sampler;
 	VkCommandPool _commandPool;
+	VkCommandPool _transferCommandPool;
 	VkExtent2D _extent;
 	VkPhysicalDeviceProperties _physicalProperties;
 	VkPhysicalDeviceFeatures _physicalFeatures;
@@ -178,23 +346,49 @@ private:
 	VkDescriptorSetLayout _textureLayout;
 	VkDescriptorSetLayout _shadowLayout;
 
+	//Ring copies live in a pool of their own, recreated whenever the number of slots changes.
+	VkDescriptorPool _textureRingPool;
+	std::unordered_map<VkDescriptorSet, TextureRing> _textureRings;
+
 	QueueInfo _graphicsQueue;
 	QueueInfo _presentQueue;
 
+	//The same as _graphicsQueue unless the device has a transfer-only family.
+	QueueInfo _transferQueue;
+
 	SwapChain* _swapChain;
+	TextureLoader* _textureLoader;
+	SecondaryRecorder* _secondaryRecorder;
+	GpuCuller* _gpuCuller;
+	LightClusterer* _lightClusterer;
+
+	//VK_KHR_get_physical_device_properties2 is enabled on the instance, and VK_KHR_multiview on the device.
+	bool _getProperties2;
+	bool _multiview;
 
 	void _allocateBackbufferRenderTargets();
 	void _allocateCommandBuffers();
+	void _allocateTextureRing(TextureRing& ring);
+	void _allocateTextureRings();
+	void _allocateUniformRing(Uniform* uniform);
 	void _cleanup();
 	void _createCommandPool();
+	void _createFramePools();
 	void _createInstance();
 	void _createSampler();
 	void _createSwapChain();
+	void _createTimestampPool();
 	void _createUniforms();
 	void _destroyBackbufferRenderTargets();
+	void _destroyFramePools();
+
+	//The first of names the physical device supports, or nullptr.
+	const char* _findDeviceExtension(std::initializer_list<const char*> names) const;
 	void _initDevice();
 	VkPhysicalDevice _pickPhysicalDevice();
 	void _queryDeviceQueueFamilies(VkPhysicalDevice device);
+	void _recordCommandBuffer(VkCommandBuffer buffer, size_t image, VkCommandBufferUsageFlags usage);
+	void _recordUniformCopies(VkCommandBuffer cmd, size_t slot) const;
 	void _registerDebugger();
 };
 
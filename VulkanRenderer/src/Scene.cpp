@@ -1,6 +1,15 @@
 #include "Scene.h"
 #include "Camera.h"
+#include "GpuCuller.h"
+#include "LightClusterer.h"
 #include "Model.h"
+#include "PipelineCache.h"
+#include "renderpass/ShadowMapRenderPass.h"
+#include "texture/TextureLoader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 
 //TODO: move these?
 enum SceneFlags
@@ -13,11 +22,43 @@ enum SceneFlags
 	SCENEFLAG_ENABLESPECMAPS = 1 << 5,
 	SCENEFLAG_ENABLEPCF = 1 << 6,
 	SCENEFLAG_ENABLESSAO = 1 << 7,
-	SCENEFLAG_ENABLEFXAA = 1 << 8
+	SCENEFLAG_ENABLEFXAA = 1 << 8,
+	SCENEFLAG_HARDWARESHADOWS = 1 << 9,
+	SCENEFLAG_SHADOWSPLIT = 1 << 10
 };
 
-Scene::Scene(Renderer& renderer) : _camera(nullptr), _renderer(&renderer)
+//Directional shadows end this far from the camera, or at its far plane if that's closer.
+const float CASCADE_DISTANCE = 60.0f;
+
+//Blend between logarithmic (1) and uniform (0) split distances.
+const float CASCADE_SPLIT_LAMBDA = 0.75f;
+
+//How far towards the light, beyond a cascade's slice of the view, casters are still drawn.
+const float CASCADE_CASTER_DISTANCE = 50.0f;
+
+//Shadow atlas lights placed by setAtlasLights, and the cosine of the spot lights' half angle.
+const float ATLAS_LIGHT_RANGE = 6.0f;
+const float ATLAS_SPOT_CONE = 0.82f;
+
+//Point lights placed by setPointLights are scattered through a box this big around the origin.
+const glm::vec3 POINT_LIGHT_AREA(30.0f, 8.0f, 14.0f);
+const float POINT_LIGHT_RANGE = 1.5f;
+
+//Fully saturated, with hue from 0 to 6 going red, yellow, green, cyan, blue, magenta.
+static glm::vec3 hueColor(float hue)
+{
+	return glm::clamp(glm::vec3(fabsf(fmodf(hue, 6.0f) - 3.0f) - 1.0f,
+		2.0f - fabsf(fmodf(hue + 4.0f, 6.0f) - 3.0f), 2.0f - fabsf(fmodf(hue + 2.0f, 6.0f) - 3.0f)),
+		0.0f, 1.0f);
+}
+
+Scene::Scene(Renderer& renderer) : _camera(nullptr), _renderer(&renderer), _culling(true),
+	_testedShapes(0), _culledShapes(0), _shadowShapes(0), _shadowCulledShapes(0),
+	_staleShadowFaces(~0u), _shadowDirtyFaces(~0u), _shadowFacesRendered(0), _shadowFrames(0),
+	_cascades(0), _lightPos(0.0f), _lightDirection(0.0f, -1.0f, 0.0f)
 {
+	std::fill(_cascadeRadii, _cascadeRadii + MAX_CASCADES, 0.0f);
+
 	_init();
 }
 
@@ -40,45 +81,63 @@ void Scene::addModel(const std::string& name, float scale)
 	Model* model = new Model(name, _renderer);
 	model->setScale(scale);
 	_models.push_back(model);
+	_casterMatrices.push_back(glm::mat4(0.0f));
 
 
 	//We've changed the scene and need to update the command buffers to reflect that.
 	_renderer->recordCommandBuffers(this);
 }
 
-void Scene::draw(VkCommandBuffer cmd, RenderPass& pass) const
+float Scene::cascadeResolution(uint32_t cascade) const
+{
+	if (cascade >= _cascades)
+		return 0.0f;
+
+	return (float)CASCADE_DIM / (2.0f * _cascadeRadii[cascade]);
+}
+
+void Scene::draw(CommandRecorder& cmd, RenderPass& pass, size_t first, size_t count) const
 {
 	pass.updatePushConstants(cmd, sizeof(uint32_t), (void*)&_sceneFlags);
 
 	pass.bindDescriptorSetById(cmd, SET_BINDING_LIGHTS, nullptr);
 	pass.bindDescriptorSetById(cmd, SET_BINDING_CAMERA, nullptr);
 
-	for (Model* model : _models)
+	for (size_t i = first; i < first + count; ++i)
 	{
-		model->draw(_renderer, cmd, pass);
+		_models[i]->draw(_renderer, cmd, pass);
 	}
 }
 
-void Scene::drawGeom(VkCommandBuffer cmd, RenderPass& pass) const
+void Scene::drawGeom(CommandRecorder& cmd, RenderPass& pass, size_t first, size_t count) const
 {
 	pass.updatePushConstants(cmd, sizeof(uint32_t), (void*)&_sceneFlags);
 
 	pass.bindDescriptorSetById(cmd, SET_BINDING_LIGHTS, nullptr);
 	pass.bindDescriptorSetById(cmd, SET_BINDING_CAMERA, nullptr);
 
-	for (Model* model : _models)
+	for (size_t i = first; i < first + count; ++i)
 	{
-		model->drawGeom(_renderer, cmd, pass);
+		_models[i]->drawGeom(_renderer, cmd, pass);
 	}
 }
 
-void Scene::drawShadow(VkCommandBuffer cmd, RenderPass& pass) const
+void Scene::drawShadow(CommandRecorder& cmd, RenderPass& pass, uint32_t face, size_t first, size_t count) const
 {
 	pass.bindDescriptorSetById(cmd, SET_BINDING_LIGHTS, nullptr);
 	
-	for (Model* model : _models)
+	for (size_t i = first; i < first + count; ++i)
+	{
+		_models[i]->drawShadow(_renderer, cmd, pass, face);
+	}
+}
+
+void Scene::drawShadowTile(CommandRecorder& cmd, RenderPass& pass, const glm::vec4& lightPosRange,
+	size_t first, size_t count) const
+{
+	for (size_t i = first; i < first + count; ++i)
 	{
-		model->drawShadow(_renderer, cmd, pass);
+		_models[i]->drawShadowTile(_renderer, cmd, pass, lightPosRange);
 	}
 }
 
@@ -118,6 +177,69 @@ void Scene::keyDown(SDL_Keycode key)
 	case SDLK_n:
 		_sceneFlags ^= SCENEFLAG_SHOWNORMALS;
 		break;
+	case SDLK_c:
+		setCulling(!_culling);
+		printf("Frustum culling %s\n", _culling ? "on" : "off");
+		break;
+	case SDLK_g:
+		setGpuCulling(!_renderer->gpuCuller().enabled());
+		printf("GPU culling %s\n", _renderer->gpuCuller().enabled() ? "on" : "off");
+		break;
+	case SDLK_i:
+		_renderer->printStats();
+		printf("Frustum culling: %u shapes tested, %u culled, %u drawn%s\n", _testedShapes,
+			_culledShapes, _testedShapes - _culledShapes,
+			_renderer->recordsEachFrame() ? "" : " (inactive unless recording each frame)");
+		printf("Shadow culling: %u of %u shape draws into the shadow map culled\n", _shadowCulledShapes,
+			_shadowShapes);
+		printf("Shadow map: %.2f faces re-rendered per frame over the last %u frames\n",
+			_shadowFrames ? (float)_shadowFacesRendered / _shadowFrames : 0.0f, _shadowFrames);
+		_shadowFacesRendered = 0;
+		_shadowFrames = 0;
+
+		for (uint32_t c = 0; c < _cascades; ++c)
+		{
+			printf("Cascade %u: up to %.2f from the camera, %.1f texels per unit\n", c,
+				_lights[0].cascadeSplits[c], cascadeResolution(c));
+		}
+
+		if (_atlas.lightCount())
+		{
+			printf("Shadow atlas: %u lights, %u tiles, %.1f%% of the atlas in use\n", _atlas.lightCount(),
+				_atlas.tileCount(), 100.0f * (float)_atlas.usedTexels() / ((float)ATLAS_DIM * ATLAS_DIM));
+		}
+
+		if (_renderer->lightClusterer().lightCount() && _renderer->lightClusterer().clustered())
+		{
+			printf("Light clusters: %u point lights, %.2f listed per cluster\n", _renderer->lightClusterer().lightCount(),
+				(float)_renderer->lightClusterer().listedLights() / CLUSTER_COUNT);
+		}
+
+		if (_renderer->gpuCuller().enabled())
+		{
+			const GpuCuller::Stats& stats = _renderer->gpuCuller().stats();
+			printf("GPU culling: %u of %u shapes and %u of %u triangles visible\n", stats.visibleShapes,
+				stats.submittedShapes, stats.visibleTriangles, stats.submittedTriangles);
+		}
+		break;
+	case SDLK_k:
+		setCascades((_cascades + 1) % (MAX_CASCADES + 1));
+		printf("Shadow cascades: %u%s\n", _cascades, _cascades ? "" : " (point light)");
+		break;
+	case SDLK_u:
+		setLightClustering(!_renderer->lightClusterer().clustered());
+		printf("Clustered lighting %s\n", _renderer->lightClusterer().clustered() ? "on" : "off");
+		break;
+	case SDLK_h:
+		setShadowFilter((ShadowFilter)(((uint32_t)shadowFilter() + 1) % SHADOW_FILTER_COUNT));
+		flags = _sceneFlags; //Already recorded again.
+		printf("Shadow filtering: %s\n", shadowFilter() == ShadowFilter::SHADOW_FILTER_HARDWARE ? "hardware" :
+			(shadowFilter() == ShadowFilter::SHADOW_FILTER_MANUAL ? "manual" : "manual left, hardware right"));
+		break;
+	case SDLK_o:
+		setAtlasLights(_atlas.lightCount() == 0 ? 8 : (_atlas.lightCount() < MAX_ATLAS_LIGHTS ? MAX_ATLAS_LIGHTS : 0));
+		printf("Shadow atlas lights: %u\n", _atlas.lightCount());
+		break;
 	//A hacky way of getting the light to move to a specific position. TODO: fix.
 	case SDLK_l:
 		_setLightPos(_camera->eye());
@@ -138,6 +260,121 @@ void Scene::resize(uint32_t width, uint32_t height)
 	_camera->updateViewport(width, height);
 }
 
+void Scene::setPCF(bool enable)
+{
+	_sceneFlags = enable ? (_sceneFlags | SCENEFLAG_ENABLEPCF) : (_sceneFlags & ~SCENEFLAG_ENABLEPCF);
+	_renderer->recordCommandBuffers(this);
+}
+
+bool Scene::pcf() const
+{
+	return (_sceneFlags & SCENEFLAG_ENABLEPCF) != 0;
+}
+
+void Scene::setShadowFilter(ShadowFilter filter)
+{
+	_sceneFlags &= ~(SCENEFLAG_HARDWARESHADOWS | SCENEFLAG_SHADOWSPLIT);
+
+	if (filter == ShadowFilter::SHADOW_FILTER_HARDWARE)
+		_sceneFlags |= SCENEFLAG_HARDWARESHADOWS;
+	else if (filter == ShadowFilter::SHADOW_FILTER_SPLIT)
+		_sceneFlags |= SCENEFLAG_SHADOWSPLIT;
+
+	_renderer->recordCommandBuffers(this);
+}
+
+ShadowFilter Scene::shadowFilter() const
+{
+	if (_sceneFlags & SCENEFLAG_SHADOWSPLIT)
+		return ShadowFilter::SHADOW_FILTER_SPLIT;
+
+	return (_sceneFlags & SCENEFLAG_HARDWARESHADOWS) ? ShadowFilter::SHADOW_FILTER_HARDWARE :
+		ShadowFilter::SHADOW_FILTER_MANUAL;
+}
+
+void Scene::setCulling(bool enable)
+{
+	_culling = enable;
+}
+
+void Scene::setAtlasLights(uint32_t count)
+{
+	_atlas.clear();
+
+	//Alternating point lights and spot lights pointing down, spiralling out from the origin
+	//at varying heights, so that their tiles vary in size with the camera's distance.
+	for (uint32_t i = 0; i < (std::min)(count, MAX_ATLAS_LIGHTS); ++i)
+	{
+		const float angle = (float)i * 2.4f;
+		const float radius = 2.0f + (float)i * 0.6f;
+		const glm::vec3 pos(cosf(angle) * radius, 1.0f + (float)(i % 4) * 1.5f, sinf(angle) * radius);
+		const glm::vec3 color = hueColor((float)i * 6.0f / 7.0f);
+
+		if (i % 2)
+			_atlas.addLight(pos, ATLAS_LIGHT_RANGE, color, glm::vec3(0.0f, -1.0f, 0.0f), ATLAS_SPOT_CONE);
+		else
+			_atlas.addLight(pos, ATLAS_LIGHT_RANGE, color);
+	}
+
+	_atlas.update(*_camera);
+	_renderer->updateUniform("atlas", (void*)&_atlas.data(), _atlas.dataSize());
+	_renderer->recordCommandBuffers(this);
+}
+
+void Scene::setPointLights(uint32_t count)
+{
+	//The same scattering every time, so that runs can be compared.
+	uint32_t seed = 1;
+	std::vector<PointLight> lights((std::min)(count, MAX_POINT_LIGHTS));
+
+	for (size_t i = 0; i < lights.size(); ++i)
+	{
+		glm::vec3 pos;
+		for (uint32_t axis = 0; axis < 3; ++axis)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			pos[axis] = (float)(seed >> 8) / (float)(1u << 24) - 0.5f;
+		}
+
+		pos *= POINT_LIGHT_AREA;
+		pos.y += POINT_LIGHT_AREA.y * 0.5f;
+
+		lights[i].posRange = glm::vec4(pos, POINT_LIGHT_RANGE);
+		lights[i].color = glm::vec4(hueColor((float)(i % 6)), 1.0f);
+	}
+
+	_renderer->lightClusterer().setLights(lights);
+
+	//The clustering is only recorded while there are lights.
+	_renderer->recordCommandBuffers(this);
+}
+
+void Scene::setLightClustering(bool enable)
+{
+	_renderer->lightClusterer().setClustered(enable);
+	_renderer->recordCommandBuffers(this);
+}
+
+void Scene::setCascades(uint32_t count)
+{
+	count = (std::min)(count, MAX_CASCADES);
+
+	ShadowMapRenderPass* shadow = (ShadowMapRenderPass*)_renderer->getRenderPass(RenderPassType::SHADOWMAP);
+	if (shadow)
+		shadow->setCascades(count);
+
+	_cascades = count;
+	_setLightPos(_lightPos);
+
+	_renderer->recordCommandBuffers(this);
+}
+
+void Scene::setGpuCulling(bool enable)
+{
+	_renderer->gpuCuller().setEnabled(enable);
+	_renderer->recordCommandBuffers(this);
+}
+
 void Scene::update(float dtime)
 {
 	_camera->update(dtime);
@@ -151,12 +388,221 @@ void Scene::update(float dtime)
 		_camera->height()
 	};
 	_renderer->updateUniform("camera", (void*)&camera, sizeof(camera));
+	_renderer->lightClusterer().update(*_camera);
 	//_setLightPos(_lights[0].pos + (glm::vec3(-1.0f * dtime, 0.0f, 0.0f)));
 
+	//Cascades follow the camera.
+	if (_cascades && _fitCascades())
+		_renderer->updateUniform("light", (void*)&_lights[0], sizeof(Light));
+
+	//Models are left out of the command buffers until their meshes have been uploaded.
+	bool rerecord = false;
+
 	for (Model* model : _models)
 	{
 		model->update(_renderer, dtime);
+
+		if (model->updateUpload())
+			rerecord = true;
+	}
+
+	if (_renderer->gpuCuller().update(*this, _camera->projectionViewMatrix()))
+		rerecord = true;
+
+	if (_cull())
+		rerecord = true;
+
+	//Swapping placeholders for real textures changes the descriptors the command buffers use.
+	//Each slot copies them in before its frame is recorded, but command buffers recorded up
+	//front would be invalidated by the copy, so those are recorded again.
+	if (_renderer->textureLoader().update())
+	{
+		if (!_renderer->recordsEachFrame())
+			rerecord = true;
+
+		_staleShadowFaces = ~0u;
+	}
+
+	if (_cullShadows())
+		rerecord = true;
+
+	//Tiles are resized as the camera moves; their rects are in the command buffers.
+	if (_atlas.lightCount())
+	{
+		if (_atlas.update(*_camera))
+			rerecord = true;
+
+		_renderer->updateUniform("atlas", (void*)&_atlas.data(), _atlas.dataSize());
+	}
+
+	//Command buffers recorded up front only draw the faces that were stale when recorded.
+	ShadowMapRenderPass* shadow = (ShadowMapRenderPass*)_renderer->getRenderPass(RenderPassType::SHADOWMAP);
+	if (shadow && shadow->recordedFaces() != _shadowDirtyFaces)
+		rerecord = true;
+
+	if (rerecord)
+		_renderer->recordCommandBuffers(this);
+
+	if (shadow)
+	{
+		_shadowFacesRendered += shadow->facesRendered();
+		_shadowFrames++;
+	}
+}
+
+bool Scene::_cull()
+{
+	_testedShapes = 0;
+	_culledShapes = 0;
+
+	bool uncull = false;
+
+	//Visibility is read back when the command buffer is recorded, so it has to be this frame's.
+	//The GPU culler sees every shape, so there's nothing to gain from culling here as well.
+	if (!_culling || !_renderer->recordsEachFrame() || _renderer->gpuCuller().enabled())
+	{
+		for (Model* model : _models)
+		{
+			if (model->clearCulling())
+				uncull = true;
+		}
+
+		return uncull;
+	}
+
+	const glm::mat4 projView = _camera->projectionViewMatrix();
+
+	for (Model* model : _models)
+	{
+		if (!model->resident())
+			continue;
+
+		_testedShapes += (uint32_t)model->shapeCount();
+		_culledShapes += model->cull(projView);
+	}
+
+	return false;
+}
+
+bool Scene::_cullShadows()
+{
+	_shadowShapes = 0;
+	_shadowCulledShapes = 0;
+
+	const uint32_t allFaces = (1u << _lights[0].numViews) - 1;
+	_shadowDirtyFaces = _staleShadowFaces & allFaces;
+	_staleShadowFaces = 0;
+
+	bool changed = false;
+
+	for (size_t i = 0; i < _models.size(); ++i)
+	{
+		Model* model = _models[i];
+		if (!model->resident())
+			continue;
+
+		const uint32_t before = model->shadowFaceMask();
+
+		if (_culling ? model->cullShadows(_lights[0]) : model->clearShadowCulling())
+			changed = true;
+
+		//A model that moved has to be drawn where it is now, and erased from where it was.
+		const glm::mat4 world = model->worldMatrix();
+		if (world != _casterMatrices[i])
+		{
+			_shadowDirtyFaces |= (before | model->shadowFaceMask()) & allFaces;
+			_casterMatrices[i] = world;
+		}
+
+		_shadowShapes += (uint32_t)model->shapeCount() * _lights[0].numViews;
+		_shadowCulledShapes += model->shadowCulledShapes();
+	}
+
+	return changed;
+}
+
+bool Scene::_fitCascades()
+{
+	Light& light = _lights[0];
+
+	const float nearClip = _camera->nearClip();
+	const float farClip = (std::min)(_camera->farClip(), CASCADE_DISTANCE);
+	const float tanY = tanf(glm::radians(_camera->fov()) * 0.5f);
+	const float tanX = tanY * _camera->aspectRatio();
+	const glm::mat4 invView = glm::inverse(_camera->viewMatrix());
+
+	//Only rotates, so the light's texel grid stays put in the world as the camera moves.
+	const glm::vec3 up = fabsf(_lightDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	const glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), _lightDirection, up);
+
+	bool moved = light.numViews != _cascades;
+	float sliceNear = nearClip;
+
+	for (uint32_t c = 0; c < _cascades; ++c)
+	{
+		//Practical split scheme: logarithmic splits keep texel density even with distance,
+		//but leave the nearest cascade tiny, so they're blended with uniform ones.
+		const float p = (float)(c + 1) / _cascades;
+		const float logSplit = nearClip * powf(farClip / nearClip, p);
+		const float uniformSplit = nearClip + (farClip - nearClip) * p;
+		const float sliceFar = CASCADE_SPLIT_LAMBDA * logSplit + (1.0f - CASCADE_SPLIT_LAMBDA) * uniformSplit;
+
+		//A sphere around the slice keeps the same size however the camera turns.
+		glm::vec3 corners[8];
+		glm::vec3 center(0.0f);
+		for (uint32_t i = 0; i < 8; ++i)
+		{
+			const float d = (i < 4) ? sliceNear : sliceFar;
+			const float x = (i & 1) ? tanX * d : -tanX * d;
+			const float y = (i & 2) ? tanY * d : -tanY * d;
+			corners[i] = glm::vec3(invView * glm::vec4(x, y, -d, 1.0f));
+			center += corners[i] / 8.0f;
+		}
+
+		float radius = 0.0f;
+		for (const glm::vec3& corner : corners)
+			radius = (std::max)(radius, glm::length(corner - center));
+
+		//Rounded up so that float noise doesn't change the texel size from frame to frame.
+		radius = ceilf(radius * 16.0f) / 16.0f;
+
+		//Moving the centre in whole texels stops edges crawling as the camera moves.
+		const float texel = 2.0f * radius / (float)CASCADE_DIM;
+		glm::vec3 origin = glm::vec3(lightView * glm::vec4(center, 1.0f));
+		origin.x = floorf(origin.x / texel) * texel;
+		origin.y = floorf(origin.y / texel) * texel;
+
+		//Orthographic over the sphere, reaching further towards the light for casters outside
+		//the view. Built by hand for 0-1 depth and Vulkan's flipped Y, as glm's depth range
+		//depends on which header got to it first.
+		const float zNear = -origin.z - radius - CASCADE_CASTER_DISTANCE;
+		const float zFar = -origin.z + radius;
+
+		glm::mat4 proj(1.0f);
+		proj[0][0] = 1.0f / radius;
+		proj[1][1] = -1.0f / radius;
+		proj[2][2] = -1.0f / (zFar - zNear);
+		proj[3][0] = -origin.x / radius;
+		proj[3][1] = origin.y / radius;
+		proj[3][2] = -zNear / (zFar - zNear);
+
+		const glm::mat4 view = proj * lightView;
+		if (moved || view != light.views[c])
+		{
+			light.views[c] = view;
+			_staleShadowFaces |= 1u << c;
+			moved = true;
+		}
+
+		light.cascadeSplits[c] = sliceFar;
+		_cascadeRadii[c] = radius;
+		sliceNear = sliceFar;
 	}
+
+	light.proj = glm::mat4(1.0f);
+	light.numViews = _cascades;
+
+	return moved;
 }
 
 void Scene::_init()
@@ -180,7 +626,7 @@ void Scene::_init()
 	_setLightPos(glm::vec3(-8.0f, 4.0f, 2.0f));
 
 	_sceneFlags = SCENEFLAG_ENABLEBUMPMAPS | SCENEFLAG_ENABLESHADOWS | 
-		SCENEFLAG_ENABLESPECMAPS | SCENEFLAG_ENABLESSAO;
+		SCENEFLAG_ENABLESPECMAPS | SCENEFLAG_ENABLESSAO | SCENEFLAG_HARDWARESHADOWS;
 }
 
 void Scene::_reload()
@@ -188,13 +634,13 @@ void Scene::_reload()
 	_renderer->clearShaderCache();
 	_renderer->destroyPipelines();
 	_renderer->reload();
+	_staleShadowFaces = ~0u;
 
-	for (Model* m : _models)
-	{
-		m->reload(_renderer);
-	}
-
+	//Pipelines are created as they're first recorded.
+	PipelineCache::resetStats();
 	_renderer->recordCommandBuffers(this);
+	PipelineCache::printStats();
+	PipelineCache::save();
 }
 
 void Scene::_setLightPos(const glm::vec3& pos)
@@ -202,10 +648,10 @@ void Scene::_setLightPos(const glm::vec3& pos)
 	glm::mat4 proj = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 50.0f);
 	proj[1][1] *= -1; 
 
-	_lights[0].pos = _camera->eye();
+	_lights[0].pos = pos;
 	_lights[0].farPlane = 50.0f;
-	bool isPointLight = true; //TODO
-	if (isPointLight)
+	_lightPos = pos;
+	if (_cascades == 0)
 	{
 		_lights[0].numViews = 6;
 		_lights[0].proj = proj;
@@ -223,11 +669,13 @@ void Scene::_setLightPos(const glm::vec3& pos)
 	}
 	else
 	{
-		//Flat shadow map (directional light)
-		_lights[0].numViews = 1;
-		_lights[0].proj = _camera->projectionMatrix();
-		_lights[0].views[0] = _camera->viewMatrix();
+		//Directional light, shining from pos towards the origin.
+		if (glm::length(pos) > 0.0f)
+			_lightDirection = -glm::normalize(pos);
+
+		_fitCascades();
 	}
 
 	_renderer->updateUniform("light", (void*)&_lights[0], sizeof(Light));
+	_staleShadowFaces = ~0u;
 }
\ No newline at end of file
@@ -5,12 +5,27 @@
 #include "Renderer.h"
 #include "Light.h"
 #include "Camera.h"
+#include "ShadowAtlas.h"
 
 #include <SDL_keyboard.h>
 
+class CommandRecorder;
 class Model;
 class RenderPass;
 
+//How shadow maps are filtered, with or without PCF.
+enum class ShadowFilter
+{
+	//Bilinear depth comparisons through the comparison sampler, over a rotated Vogel disk.
+	SHADOW_FILTER_HARDWARE,
+	//Texels fetched and compared by hand, over a fixed grid or set of directions.
+	SHADOW_FILTER_MANUAL,
+	//Manual on the left half of the screen and hardware on the right, to compare their quality.
+	SHADOW_FILTER_SPLIT
+};
+
+const uint32_t SHADOW_FILTER_COUNT = 3;
+
 class Scene
 {
 public:
@@ -19,11 +34,60 @@ public:
 
 	void addModel(const std::string& name, float scale = 1.0f);
 
-	void draw(VkCommandBuffer cmd, RenderPass& pass) const;
+	inline Camera& camera()
+	{
+		return *_camera;
+	}
+
+	//Cascades the directional light's shadow is split into; 0 for the point light.
+	inline uint32_t cascades() const
+	{
+		return _cascades;
+	}
+
+	//Shadow map texels per world unit across a cascade, as of the last update.
+	float cascadeResolution(uint32_t cascade) const;
+
+	//Shapes tested against the camera frustum during the last update, and how many failed.
+	inline uint32_t culledShapes() const
+	{
+		return _culledShapes;
+	}
+
+	inline uint32_t testedShapes() const
+	{
+		return _testedShapes;
+	}
+
+	//Shape draws into the shadow map's faces, summed over faces, and how many were culled.
+	inline uint32_t shadowCulledShapes() const
+	{
+		return _shadowCulledShapes;
+	}
+
+	inline uint32_t shadowShapes() const
+	{
+		return _shadowShapes;
+	}
+
+	//A bit per shadow map face whose contents are stale, because the light or a model casting
+	//into it has moved since the last update. Faces without one are left as they were drawn.
+	inline uint32_t shadowFacesDirty() const
+	{
+		return _shadowDirtyFaces;
+	}
+
+	//Each draws models [first, first + count), so that passes can record ranges on separate threads.
+	void draw(CommandRecorder& cmd, RenderPass& pass, size_t first, size_t count) const;
 	
-	void drawGeom(VkCommandBuffer cmd, RenderPass& pass) const;
+	void drawGeom(CommandRecorder& cmd, RenderPass& pass, size_t first, size_t count) const;
+
+	//Draws into one face of the shadow map, leaving out shapes that can't cast into it.
+	void drawShadow(CommandRecorder& cmd, RenderPass& pass, uint32_t face, size_t first, size_t count) const;
 
-	void drawShadow(VkCommandBuffer cmd, RenderPass& pass) const;
+	//Draws into one tile of the shadow atlas, for the light at lightPosRange.
+	void drawShadowTile(CommandRecorder& cmd, RenderPass& pass, const glm::vec4& lightPosRange,
+		size_t first, size_t count) const;
 
 	void keyDown(SDL_Keycode key);
 
@@ -36,6 +100,43 @@ public:
 
 	void resize(uint32_t width, uint32_t height);
 
+	inline const ShadowAtlas& shadowAtlas() const
+	{
+		return _atlas;
+	}
+
+	//Replaces the shadow atlas's lights with count point and spot lights placed around the
+	//origin; 0 removes them.
+	void setAtlasLights(uint32_t count);
+
+	//Replaces the unshadowed point lights with count of them scattered around the origin. Only
+	//the deferred path draws them.
+	void setPointLights(uint32_t count);
+
+	//With clustering off the deferred lighting pass loops over every point light per pixel.
+	void setLightClustering(bool enable);
+
+	//Filters shadows over several taps rather than a single one.
+	bool pcf() const;
+	void setPCF(bool enable);
+
+	void setShadowFilter(ShadowFilter filter);
+
+	ShadowFilter shadowFilter() const;
+
+	//Switches to a directional light whose shadow is split into cascades over the camera's
+	//view, nearest first, or back to the point light and its cube map with a count of 0.
+	void setCascades(uint32_t count);
+
+	//Frustum culls shapes for the forward and geometry passes. Only has an effect while the
+	//renderer records each frame, as command buffers recorded up front must draw everything.
+	//Shadow map faces are culled either way, as they only change when the light or models move.
+	void setCulling(bool enable);
+
+	//Culls shapes on the GPU instead, against the frustum and the previous frame's depth, which
+	//also works with command buffers recorded up front.
+	void setGpuCulling(bool enable);
+
 	inline uint32_t sceneFlags() const
 	{
 		return _sceneFlags;
@@ -57,6 +158,37 @@ private:
 
 	uint32_t _sceneFlags;
 
+	bool _culling;
+	uint32_t _testedShapes;
+	uint32_t _culledShapes;
+	uint32_t _shadowShapes;
+	uint32_t _shadowCulledShapes;
+
+	//Faces to draw again at the next update whatever the models do, such as after the light moves.
+	uint32_t _staleShadowFaces;
+	uint32_t _shadowDirtyFaces;
+	//The world matrix each model's shadow was last drawn with.
+	std::vector<glm::mat4> _casterMatrices;
+	//Faces drawn into the shadow map since the last stats were printed, and over how many frames.
+	uint32_t _shadowFacesRendered;
+	uint32_t _shadowFrames;
+
+	uint32_t _cascades;
+	glm::vec3 _lightPos;
+	//A directional light shines from its position towards the origin.
+	glm::vec3 _lightDirection;
+	float _cascadeRadii[MAX_CASCADES];
+
+	//Point and spot lights besides the main one, shadowed through tiles of the atlas.
+	ShadowAtlas _atlas;
+
+	//Each returns true if command buffers recorded up front need recording again.
+	bool _cull();
+	bool _cullShadows();
+
+	//Fits each cascade around its slice of the camera's view. Returns true if any moved.
+	bool _fitCascades();
+
 	void _init();
 
 	void _reload();
@@ -0,0 +1,198 @@
+#include "SecondaryRecorder.h"
+#include "Renderer.h"
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+//Below this, a range isn't worth the cost of a secondary command buffer and a task of its own.
+const size_t MIN_ITEMS_PER_TASK = 4;
+
+//Outlives run() in case a worker picks up its job after the calling thread has taken every task.
+struct RunState
+{
+	std::atomic<size_t> next;
+	std::atomic<size_t> done;
+	size_t count;
+
+	std::mutex mutex;
+	std::condition_variable finished;
+};
+
+SecondaryRecorder::SecondaryRecorder(uint32_t queueFamily) : _primary(VK_NULL_HANDLE),
+	_usage(0), _poolsUsed(0), _firstPending(0), _queueFamily(queueFamily)
+{
+
+}
+
+SecondaryRecorder::~SecondaryRecorder()
+{
+	clear();
+}
+
+void SecondaryRecorder::begin(VkCommandBuffer primary, VkCommandBufferUsageFlags usage)
+{
+	_primary = primary;
+	_usage = usage;
+	_poolsUsed = 0;
+	_firstPending = 0;
+	_sections.clear();
+	_tasks.clear();
+
+	for (Pool& pool : _pools[primary])
+		VkCheck(vkResetCommandPool(Renderer::device(), pool.pool, 0));
+}
+
+uint32_t SecondaryRecorder::add(VkRenderPass renderPass, VkFramebuffer framebuffer,
+	size_t count, const RecordFunc& record)
+{
+	Section section;
+	section.renderPass = renderPass;
+	section.framebuffer = framebuffer;
+	section.count = count;
+	section.record = record;
+
+	_sections.push_back(section);
+	return (uint32_t)_sections.size() - 1;
+}
+
+void SecondaryRecorder::run()
+{
+	const size_t pending = _sections.size() - _firstPending;
+	if (pending == 0)
+		return;
+
+	//Spread the workers over the sections; small sections get fewer tasks.
+	const size_t workers = JobSystem::threadCount() + 1;
+	const size_t tasksPerSection = (workers + pending - 1) / pending;
+
+	for (uint32_t s = _firstPending; s < _sections.size(); ++s)
+	{
+		Section& section = _sections[s];
+
+		const size_t byCount = (section.count + MIN_ITEMS_PER_TASK - 1) / MIN_ITEMS_PER_TASK;
+		const size_t tasks = (std::max)((std::min)(tasksPerSection, byCount), (size_t)1);
+		const size_t perTask = (section.count + tasks - 1) / tasks;
+
+		for (size_t first = 0, t = 0; t < tasks; ++t, first += perTask)
+		{
+			//An empty section still gets a buffer, so the render pass instance is cleared.
+			Task task;
+			task.section = s;
+			task.first = (std::min)(first, section.count);
+			task.count = (std::min)(perTask, section.count - task.first);
+			task.buffer = _nextBuffer();
+
+			section.buffers.push_back(task.buffer);
+			_tasks.push_back(task);
+		}
+	}
+
+	_firstPending = (uint32_t)_sections.size();
+
+	std::shared_ptr<RunState> state = std::make_shared<RunState>();
+	state->next = 0;
+	state->done = 0;
+	state->count = _tasks.size();
+
+	JobSystem::Job work = [this, state]()
+	{
+		size_t i;
+		while ((i = state->next++) < state->count)
+		{
+			_record(_tasks[i]);
+
+			if (++state->done == state->count)
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				state->finished.notify_all();
+			}
+		}
+	};
+
+	const size_t helpers = (std::min)((size_t)JobSystem::threadCount(), state->count - 1);
+	for (size_t i = 0; i < helpers; ++i)
+		JobSystem::submit(work);
+
+	work();
+
+	{
+		std::unique_lock<std::mutex> lock(state->mutex);
+		state->finished.wait(lock, [&state] { return state->done == state->count; });
+	}
+
+	_tasks.clear();
+}
+
+void SecondaryRecorder::execute(uint32_t section) const
+{
+	const std::vector<VkCommandBuffer>& buffers = _sections[section].buffers;
+	assert(!buffers.empty());
+
+	vkCmdExecuteCommands(_primary, (uint32_t)buffers.size(), buffers.data());
+}
+
+void SecondaryRecorder::clear()
+{
+	for (std::pair<const VkCommandBuffer, std::vector<Pool>>& pair : _pools)
+	{
+		//Destroying a pool frees its command buffers too.
+		for (Pool& pool : pair.second)
+			vkDestroyCommandPool(Renderer::device(), pool.pool, nullptr);
+	}
+
+	_pools.clear();
+	_sections.clear();
+	_primary = VK_NULL_HANDLE;
+}
+
+VkCommandBuffer SecondaryRecorder::_nextBuffer()
+{
+	std::vector<Pool>& pools = _pools[_primary];
+
+	if (_poolsUsed == pools.size())
+	{
+		VkCommandPoolCreateInfo info = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+		info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		info.queueFamilyIndex = _queueFamily;
+
+		Pool pool;
+		VkCheck(vkCreateCommandPool(Renderer::device(), &info, nullptr, &pool.pool));
+
+		VkCommandBufferAllocateInfo alloc = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+		alloc.commandPool = pool.pool;
+		alloc.commandBufferCount = 1;
+		alloc.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		VkCheck(vkAllocateCommandBuffers(Renderer::device(), &alloc, &pool.buffer));
+
+		pools.push_back(pool);
+	}
+
+	return pools[_poolsUsed++].buffer;
+}
+
+void SecondaryRecorder::_record(const Task& task) const
+{
+	const Section& section = _sections[task.section];
+
+	VkCommandBufferInheritanceInfo inheritance = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO };
+	inheritance.renderPass = section.renderPass;
+	inheritance.subpass = 0;
+	inheritance.framebuffer = section.framebuffer;
+
+	//Secondaries executed by a simultaneous-use primary must be simultaneous-use themselves.
+	VkCommandBufferBeginInfo info = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+	info.flags = _usage | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	info.pInheritanceInfo = &inheritance;
+
+	VkCheck(vkBeginCommandBuffer(task.buffer, &info));
+
+	if (task.count)
+		section.record(task.buffer, task.first, task.count);
+
+	VkCheck(vkEndCommandBuffer(task.buffer));
+}
\ No newline at end of file
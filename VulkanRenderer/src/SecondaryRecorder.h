@@ -0,0 +1,87 @@
+#ifndef SECONDARY_RECORDER_H_
+#define SECONDARY_RECORDER_H_
+
+#include <vulkan/vulkan.h>
+
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+//Records the draws of a render pass into secondary command buffers on the JobSystem's workers.
+//Work is added as sections, one per render pass instance, and each section is split into
+//contiguous ranges of items. Every range is recorded by a single task into a buffer from a pool
+//of its own, so pools are never shared between threads. Pools belong to the primary that
+//executes them and are only reset when that primary is re-recorded.
+class SecondaryRecorder
+{
+public:
+	//Records draws for items [first, first + count) into cmd. Secondaries inherit nothing but
+	//the render pass, so viewport, scissor, descriptor sets and push constants must be set again.
+	typedef std::function<void(VkCommandBuffer cmd, size_t first, size_t count)> RecordFunc;
+
+	SecondaryRecorder(uint32_t queueFamily);
+	SecondaryRecorder& operator=(const SecondaryRecorder&) = delete;
+	SecondaryRecorder(const SecondaryRecorder&) = delete;
+	SecondaryRecorder(SecondaryRecorder&&) = delete;
+	~SecondaryRecorder();
+
+	//Called once primary has begun; recycles the secondaries it executed when last recorded.
+	void begin(VkCommandBuffer primary, VkCommandBufferUsageFlags usage);
+
+	//Queues count items to be drawn inside framebuffer. Returns the section to execute().
+	uint32_t add(VkRenderPass renderPass, VkFramebuffer framebuffer, size_t count, const RecordFunc& record);
+
+	//Records every section added since the last run; the calling thread takes tasks too.
+	void run();
+
+	//The primary must be inside the section's render pass instance, begun with
+	//VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS.
+	void execute(uint32_t section) const;
+
+	//Destroys every pool, e.g. when the primaries they were recorded for are freed.
+	void clear();
+
+private:
+	struct Pool
+	{
+		VkCommandPool pool;
+		VkCommandBuffer buffer;
+	};
+
+	struct Section
+	{
+		VkRenderPass renderPass;
+		VkFramebuffer framebuffer;
+		size_t count;
+		RecordFunc record;
+		std::vector<VkCommandBuffer> buffers;
+	};
+
+	struct Task
+	{
+		uint32_t section;
+		size_t first;
+		size_t count;
+		VkCommandBuffer buffer;
+	};
+
+	std::unordered_map<VkCommandBuffer, std::vector<Pool>> _pools;
+	std::vector<Section> _sections;
+	std::vector<Task> _tasks;
+
+	VkCommandBuffer _primary;
+	VkCommandBufferUsageFlags _usage;
+
+	//Pools of _primary handed out since begin().
+	size_t _poolsUsed;
+
+	//Sections before this one were recorded by an earlier run().
+	uint32_t _firstPending;
+
+	uint32_t _queueFamily;
+
+	VkCommandBuffer _nextBuffer();
+	void _record(const Task& task) const;
+};
+
+#endif //SECONDARY_RECORDER_H_
\ No newline at end of file
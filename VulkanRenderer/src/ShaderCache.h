@@ -5,6 +5,8 @@
 #include <vulkan/vulkan.h>
 #include <unordered_map>
 #include <fstream>
+#include <cassert>
+#include <cstdio>
 
 const std::string SHADER_EXT = ".spv";
 
@@ -29,6 +31,15 @@ struct ShaderCache final
 		return _moduleCache[shaderName];
 	}
 
+	//Whether the shader's SPIR-V is loaded or on disk, for features that have a fallback.
+	static bool exists(const std::string& shaderName)
+	{
+		if (_moduleCache.find(shaderName) != _moduleCache.end())
+			return true;
+
+		return std::ifstream(ASSET_PATH + shaderName + SHADER_EXT).good();
+	}
+
 	static void clear()
 	{
 		for (CachePair& pair : _moduleCache)
@@ -46,6 +57,13 @@ private:
 	static void _loadModule(const std::string& name)
 	{
 		std::ifstream file(ASSET_PATH + name + SHADER_EXT, std::ios::binary | std::ios::in | std::ios::ate);
+		if (!file.is_open())
+		{
+			//Sources are compiled by buildshaders.ps1.
+			printf("Missing SPIR-V for %s\n", name.c_str());
+			assert(false);
+		}
+
 		size_t size = file.tellg();
 
 		char* code = new char[size];
@@ -0,0 +1,240 @@
+#include "ShadowAtlas.h"
+#include "Camera.h"
+#include "Frustum.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+//Tiles are powers of two between these, so that they pack into the atlas without gaps.
+const uint32_t ATLAS_MIN_TILE = 128;
+const uint32_t ATLAS_MAX_TILE = 1024;
+
+//The atlas as a grid of the smallest tiles.
+const uint32_t ATLAS_GRID = ATLAS_DIM / ATLAS_MIN_TILE;
+
+//A light keeps its tile size until the size it asks for is this many halvings away, so that
+//tiles don't flicker between sizes as the camera moves.
+const float ATLAS_HYSTERESIS = 0.75f;
+
+const float ATLAS_NEAR = 0.05f;
+
+//Spot cones are widened by this much so that filtering near their edge stays inside the tile,
+//and are never wider than ATLAS_MAX_CONE.
+const float ATLAS_CONE_MARGIN = 1.1f;
+const float ATLAS_MAX_CONE = glm::radians(160.0f);
+
+//Matches atlasFace() in shadercommon.inc.
+const glm::vec3 FACE_DIRECTIONS[6] = {
+	glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+	glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+	glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+};
+
+//Squares of the smallest tiles are numbered along a Z-order curve, so any run of cells that
+//starts at a multiple of a square's area is that square.
+static glm::uvec2 cellPosition(uint32_t cell)
+{
+	glm::uvec2 pos(0u);
+	for (uint32_t bit = 0; (1u << (2 * bit)) < ATLAS_GRID * ATLAS_GRID; ++bit)
+	{
+		pos.x |= ((cell >> (2 * bit)) & 1u) << bit;
+		pos.y |= ((cell >> (2 * bit + 1)) & 1u) << bit;
+	}
+
+	return pos * ATLAS_MIN_TILE;
+}
+
+//Right handed, with 0-1 depth; built by hand as glm's depth range depends on which header
+//got to it first.
+static glm::mat4 perspective(float fov, float zNear, float zFar)
+{
+	const float f = 1.0f / tanf(fov * 0.5f);
+
+	glm::mat4 proj(0.0f);
+	proj[0][0] = f;
+	proj[1][1] = f;
+	proj[2][2] = zFar / (zNear - zFar);
+	proj[2][3] = -1.0f;
+	proj[3][2] = (zNear * zFar) / (zNear - zFar);
+	return proj;
+}
+
+static glm::vec3 upFor(const glm::vec3& direction)
+{
+	return fabsf(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+}
+
+ShadowAtlas::ShadowAtlas() : _usedTexels(0)
+{
+	memset(&_data, 0, sizeof(_data));
+	memset(_sizes, 0, sizeof(_sizes));
+}
+
+bool ShadowAtlas::addLight(const glm::vec3& pos, float range, const glm::vec3& color,
+	const glm::vec3& direction, float cone)
+{
+	if (_data.lightCount == MAX_ATLAS_LIGHTS)
+		return false;
+
+	AtlasLight& light = _data.lights[_data.lightCount];
+	light.posRange = glm::vec4(pos, range);
+	light.color = glm::vec4(color, 1.0f);
+	light.spot = (cone > 0.0f) ? glm::vec4(glm::normalize(direction), cone) : glm::vec4(0.0f);
+	light.firstTile = 0;
+	light.tileCount = 0;
+
+	_sizes[_data.lightCount] = 0;
+	_data.lightCount++;
+	return true;
+}
+
+void ShadowAtlas::clear()
+{
+	_data.lightCount = 0;
+	_data.tileCount = 0;
+	_usedTexels = 0;
+}
+
+size_t ShadowAtlas::dataSize() const
+{
+	return offsetof(AtlasData, tiles) + _data.tileCount * sizeof(AtlasTile);
+}
+
+bool ShadowAtlas::update(const Camera& camera)
+{
+	const uint32_t count = _data.lightCount;
+
+	//Lights whose range is wholly out of view light nothing that can be seen.
+	BoundsList bounds;
+	for (uint32_t i = 0; i < count; ++i)
+		bounds.add(glm::vec3(_data.lights[i].posRange), glm::vec3(_data.lights[i].posRange.w));
+
+	std::vector<uint8_t> visible;
+	Frustum(camera.projectionViewMatrix()).cull(bounds, visible);
+
+	//The fraction of the screen's height the range covers picks the size the light would like.
+	const glm::vec3 eye = glm::vec3(camera.eye());
+	const float tanHalfFov = tanf(glm::radians(camera.fov()) * 0.5f);
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (!visible[i])
+		{
+			_sizes[i] = 0;
+			continue;
+		}
+
+		const float range = _data.lights[i].posRange.w;
+		const float distance = glm::length(glm::vec3(_data.lights[i].posRange) - eye);
+		const float coverage = (distance > range) ? range / (distance * tanHalfFov) : 1.0f;
+		const float wanted = log2f((std::max)(coverage * ATLAS_MAX_TILE, 1.0f));
+
+		if (_sizes[i] && fabsf(wanted - log2f((float)_sizes[i])) < ATLAS_HYSTERESIS)
+			continue;
+
+		const uint32_t size = 1u << (uint32_t)(wanted + 0.5f);
+		_sizes[i] = (std::min)((std::max)(size, ATLAS_MIN_TILE), ATLAS_MAX_TILE);
+	}
+
+	//Every tile is halved, down to the smallest, until they all fit.
+	std::vector<uint32_t> sizes(_sizes, _sizes + count);
+	for (;;)
+	{
+		uint32_t cells = 0;
+		bool shrinkable = false;
+
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			const uint32_t side = sizes[i] / ATLAS_MIN_TILE;
+			cells += side * side * (_data.lights[i].spot.w > 0.0f ? 1u : 6u);
+			shrinkable |= sizes[i] > ATLAS_MIN_TILE;
+		}
+
+		if (cells <= ATLAS_GRID * ATLAS_GRID || !shrinkable)
+			break;
+
+		for (uint32_t& size : sizes)
+			size = (size > ATLAS_MIN_TILE) ? size / 2 : size;
+	}
+
+	//Largest first, so that every tile starts on a multiple of its own area.
+	std::vector<uint32_t> order(count);
+	for (uint32_t i = 0; i < count; ++i)
+		order[i] = i;
+
+	std::stable_sort(order.begin(), order.end(), [&sizes](uint32_t a, uint32_t b)
+	{
+		return sizes[a] > sizes[b];
+	});
+
+	const std::vector<AtlasTile> previous(_data.tiles, _data.tiles + _data.tileCount);
+
+	_data.tileCount = 0;
+	_usedTexels = 0;
+	uint32_t cell = 0;
+
+	for (uint32_t i : order)
+	{
+		AtlasLight& light = _data.lights[i];
+		const uint32_t side = sizes[i] / ATLAS_MIN_TILE;
+		const uint32_t tiles = (light.spot.w > 0.0f) ? 1u : 6u;
+
+		//Only reachable with more lights than there are cells; the rest go unshadowed.
+		if (!sizes[i] || cell + side * side * tiles > ATLAS_GRID * ATLAS_GRID)
+		{
+			light.firstTile = 0;
+			light.tileCount = 0;
+			continue;
+		}
+
+		light.firstTile = _data.tileCount;
+		light.tileCount = tiles;
+		_fillTiles(i, sizes[i], cell);
+
+		cell += side * side * tiles;
+		_data.tileCount += tiles;
+		_usedTexels += sizes[i] * sizes[i] * tiles;
+	}
+
+	//Which casters a tile draws depends on its light, so that counts as moving too.
+	bool moved = previous.size() != _data.tileCount;
+	for (uint32_t t = 0; t < _data.tileCount && !moved; ++t)
+	{
+		moved = previous[t].rect != _data.tiles[t].rect ||
+			previous[t].lightPosRange != _data.tiles[t].lightPosRange;
+	}
+
+	return moved;
+}
+
+void ShadowAtlas::_fillTiles(uint32_t light, uint32_t size, uint32_t cell)
+{
+	const AtlasLight& l = _data.lights[light];
+	const glm::vec3 pos = glm::vec3(l.posRange);
+	const float range = l.posRange.w;
+	const uint32_t side = size / ATLAS_MIN_TILE;
+
+	for (uint32_t f = 0; f < l.tileCount; ++f)
+	{
+		AtlasTile& tile = _data.tiles[l.firstTile + f];
+
+		const glm::uvec2 corner = cellPosition(cell + f * side * side);
+		tile.rect = glm::vec4((float)corner.x, (float)corner.y, (float)size, (float)size);
+		tile.lightPosRange = l.posRange;
+
+		if (l.spot.w > 0.0f)
+		{
+			const glm::vec3 direction = glm::vec3(l.spot);
+			const float fov = (std::min)(2.0f * acosf(l.spot.w) * ATLAS_CONE_MARGIN, ATLAS_MAX_CONE);
+			tile.viewProj = perspective(fov, ATLAS_NEAR, range) *
+				glm::lookAt(pos, pos + direction, upFor(direction));
+		}
+		else
+		{
+			tile.viewProj = perspective(glm::radians(90.0f), ATLAS_NEAR, range) *
+				glm::lookAt(pos, pos + FACE_DIRECTIONS[f], upFor(FACE_DIRECTIONS[f]));
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,70 @@
+#ifndef SHADOW_ATLAS_H_
+#define SHADOW_ATLAS_H_
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "Light.h"
+
+class Camera;
+
+//Width and height of the depth texture every tile is packed into.
+const uint32_t ATLAS_DIM = 4096;
+
+//Shadows point and spot lights through tiles of one shared depth texture rather than a render
+//target each. Every update, each light's tiles are sized by how much of the screen its range
+//covers, halved until they all fit, and packed into the atlas. The lights and their tiles are
+//what the shaders read, through the "atlas" storage buffer.
+class ShadowAtlas
+{
+public:
+	ShadowAtlas();
+
+	//A point light, with a tile per cube face, or a spot light along direction with a single
+	//tile if cone (the cosine of its half angle) is above 0. Returns false once full.
+	bool addLight(const glm::vec3& pos, float range, const glm::vec3& color,
+		const glm::vec3& direction = glm::vec3(0.0f), float cone = 0.0f);
+
+	void clear();
+
+	inline const AtlasData& data() const
+	{
+		return _data;
+	}
+
+	//Bytes of data() in use: the lights, and the tiles of the last update.
+	size_t dataSize() const;
+
+	inline uint32_t lightCount() const
+	{
+		return _data.lightCount;
+	}
+
+	inline uint32_t tileCount() const
+	{
+		return _data.tileCount;
+	}
+
+	//Atlas texels covered by the tiles of the last update.
+	inline uint32_t usedTexels() const
+	{
+		return _usedTexels;
+	}
+
+	//Resizes and repacks every light's tiles for the camera, and fills in their matrices.
+	//Returns true if any tile moved within the atlas, in which case command buffers have to
+	//be recorded again.
+	bool update(const Camera& camera);
+
+private:
+	AtlasData _data;
+
+	//Tile size each light asked for last time, before budgeting; 0 when out of view.
+	uint32_t _sizes[MAX_ATLAS_LIGHTS];
+
+	uint32_t _usedTexels;
+
+	void _fillTiles(uint32_t light, uint32_t size, uint32_t cell);
+};
+
+#endif //SHADOW_ATLAS_H_
\ No newline at end of file
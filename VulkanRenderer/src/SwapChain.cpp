@@ -1,10 +1,14 @@
 #include "SwapChain.h"
 
+#include <algorithm>
+#include <chrono>
+
 //VK_USE_PLATFORM_WIN32_KHR inadvertently prevents us using std::numeric_limits::max
 #undef max
 
 SwapChain::SwapChain(Renderer& vkImpl)
-	: _vkSwapchain(VK_NULL_HANDLE), _surface(VK_NULL_HANDLE), _impl(&vkImpl)
+	: _vkSwapchain(VK_NULL_HANDLE), _surface(VK_NULL_HANDLE), _impl(&vkImpl),
+	_framesInFlight(MAX_FRAMES_IN_FLIGHT), _frame(0), _fenceWaitTime(0.0f), _framesQueued(0)
 {
 	_populateSwapChainInfo();
 }
@@ -24,18 +28,41 @@ void SwapChain::init(VkSurfaceKHR surface)
 	_createSwapChain();
 	_createImageViews();
 	_createDepthBuffer();
-	_createSemaphores();
+	_createFrames();
 }
 
 void SwapChain::present()
 {
+	const uint64_t timeout = std::numeric_limits<uint64_t>::max();
+	Frame& frame = _frames[_frame];
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	//Only the frame whose semaphores and fence are about to be reused has to have finished.
+	VkCheck(vkWaitForFences(Renderer::device(), 1, &frame.fence, VK_TRUE, timeout));
+
 	uint32_t idx;
-	VkCheck(vkAcquireNextImageKHR(Renderer::device(), _vkSwapchain, std::numeric_limits<uint64_t>::max(), _imageAvailableSemaphore, VK_NULL_HANDLE, &idx));
+	VkCheck(vkAcquireNextImageKHR(Renderer::device(), _vkSwapchain, timeout, frame.imageAvailable, VK_NULL_HANDLE, &idx));
+
+	//The uniform ring slot and descriptor copies for this image may only be rewritten once its
+	//last submission has completed.
+	if (_imageFences[idx] != VK_NULL_HANDLE && _imageFences[idx] != frame.fence)
+		VkCheck(vkWaitForFences(Renderer::device(), 1, &_imageFences[idx], VK_TRUE, timeout));
 
-	VkSemaphore semaphores[] = { _imageAvailableSemaphore };
-	VkSemaphore signals[] = { _renderingFinishedSemaphore };
+	std::chrono::duration<float> waited = std::chrono::steady_clock::now() - start;
+	_fenceWaitTime = waited.count() * 1000.0f;
+
+	_imageFences[idx] = frame.fence;
+	VkCheck(vkResetFences(Renderer::device(), 1, &frame.fence));
+
+	_impl->readFrameStats((size_t)idx);
+	_impl->flushUniforms((size_t)idx);
+	_impl->flushDescriptors((size_t)idx);
+
+	VkSemaphore semaphores[] = { frame.imageAvailable };
+	VkSemaphore signals[] = { frame.renderingFinished };
 	VkPipelineStageFlags stages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-	VkCommandBuffer buffers[] = { _impl->commandBuffer((size_t)idx) };
+	VkCommandBuffer buffers[] = { _impl->frameCommandBuffer(_frame, (size_t)idx) };
 	VkSwapchainKHR swapChains[] = { _vkSwapchain };
 
 	VkSubmitInfo submitInfo = {};
@@ -48,7 +75,7 @@ void SwapChain::present()
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = buffers;
 
-	VkCheck(vkQueueSubmit(_impl->graphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE));
+	VkCheck(vkQueueSubmit(_impl->graphicsQueue(), 1, &submitInfo, frame.fence));
 
 	VkPresentInfoKHR presentInfo = {};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -59,6 +86,15 @@ void SwapChain::present()
 	presentInfo.pImageIndices = &idx;
 
 	VkCheck(vkQueuePresentKHR(_impl->presentQueue(), &presentInfo));
+
+	_framesQueued = 0;
+	for (const Frame& f : _frames)
+	{
+		if (vkGetFenceStatus(Renderer::device(), f.fence) == VK_NOT_READY)
+			_framesQueued++;
+	}
+
+	_frame = (_frame + 1) % _frames.size();
 }
 
 void SwapChain::resize(uint32_t width, uint32_t height)
@@ -70,17 +106,41 @@ void SwapChain::resize(uint32_t width, uint32_t height)
 	_createImageViews();
 	_createDepthBuffer();
 	_createFramebuffers();
-	_createSemaphores();
+	_createFrames();
+}
+
+void SwapChain::setFramesInFlight(uint32_t count)
+{
+	_framesInFlight = (std::max)(count, 1u);
+}
+
+void SwapChain::waitForFrames() const
+{
+	std::vector<VkFence> fences;
+	for (const Frame& frame : _frames)
+		fences.push_back(frame.fence);
+
+	if (!fences.empty())
+	{
+		VkCheck(vkWaitForFences(Renderer::device(), (uint32_t)fences.size(), fences.data(),
+			VK_TRUE, std::numeric_limits<uint64_t>::max()));
+	}
 }
 
 void SwapChain::_cleanup()
 {
-	vkDestroySemaphore(Renderer::device(), _imageAvailableSemaphore, nullptr);
-	vkDestroySemaphore(Renderer::device(), _renderingFinishedSemaphore, nullptr);
+	for (Frame& frame : _frames)
+	{
+		vkDestroySemaphore(Renderer::device(), frame.imageAvailable, nullptr);
+		vkDestroySemaphore(Renderer::device(), frame.renderingFinished, nullptr);
+		vkDestroyFence(Renderer::device(), frame.fence, nullptr);
+	}
+	_frames.clear();
+	_imageFences.clear();
 
 	vkDestroyImageView(Renderer::device(), _depthView, nullptr);
 	vkDestroyImage(Renderer::device(), _depthImage, nullptr);
-	vkFreeMemory(Renderer::device(), _depthMemory, nullptr);
+	Renderer::allocator().free(_depthMemory);
 
 	for (Framebuffer& fb : _framebuffers)
 	{
@@ -97,7 +157,8 @@ void SwapChain::_createDepthBuffer()
 {
 	VkImageCreateInfo info = {};
 	info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-	info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	//Sampled to build the Hi-Z pyramid when the scene pass draws straight to the swap chain.
+	info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
 	info.tiling = VK_IMAGE_TILING_OPTIMAL;
 	info.extent.width = _swapChainInfo.surfaceCapabilities.currentExtent.width;
 	info.extent.height = _swapChainInfo.surfaceCapabilities.currentExtent.height;
@@ -111,16 +172,7 @@ void SwapChain::_createDepthBuffer()
 	info.imageType = VK_IMAGE_TYPE_2D;
 
 	VkCheck(vkCreateImage(Renderer::device(), &info, nullptr, &_depthImage));
-
-	VkMemoryRequirements memReq;
-	vkGetImageMemoryRequirements(Renderer::device(), _depthImage, &memReq);
-
-	VkMemoryAllocateInfo alloc = {};
-	alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	alloc.allocationSize = memReq.size;
-	alloc.memoryTypeIndex = _impl->getMemoryTypeIndex(memReq.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	VkCheck(vkAllocateMemory(Renderer::device(), &alloc, nullptr, &_depthMemory));
-	VkCheck(vkBindImageMemory(Renderer::device(), _depthImage, _depthMemory, 0));
+	_impl->allocateImageMemory(_depthImage, _depthMemory);
 
 	VkImageViewCreateInfo view = {};
 	view.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -136,12 +188,37 @@ void SwapChain::_createDepthBuffer()
 	VkCheck(vkCreateImageView(Renderer::device(), &view, nullptr, &_depthView));
 }
 
+void SwapChain::_createFrames()
+{
+	VkSemaphoreCreateInfo semaphore = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+
+	//Signalled, so the first use of each frame doesn't wait.
+	VkFenceCreateInfo fence = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+	fence.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+	_frames.resize(_framesInFlight);
+	_frame = 0;
+
+	for (Frame& frame : _frames)
+	{
+		VkCheck(vkCreateSemaphore(Renderer::device(), &semaphore, nullptr, &frame.imageAvailable));
+		VkCheck(vkCreateSemaphore(Renderer::device(), &semaphore, nullptr, &frame.renderingFinished));
+		VkCheck(vkCreateFence(Renderer::device(), &fence, nullptr, &frame.fence));
+	}
+
+	_imageFences.assign(_framebuffers.size(), VK_NULL_HANDLE);
+}
+
 void SwapChain::_createFramebuffers()
 {
 	VkExtent2D extent = _swapChainInfo.surfaceCapabilities.currentExtent;
 
 	for (Framebuffer& fb : _framebuffers)
 	{
+		//Every image shares the one depth buffer; it's only destroyed with the swap chain's.
+		fb.depthImage = _depthImage;
+		fb.depthView = _depthView;
+
 		const VkImageView attachments[] = {
 			fb.view, _depthView
 		};
@@ -191,15 +268,6 @@ void SwapChain::_createImageViews()
 	}
 }
 
-void SwapChain::_createSemaphores()
-{
-	VkSemaphoreCreateInfo info = {};
-	info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-	
-	VkCheck(vkCreateSemaphore(Renderer::device(), &info, nullptr, &_imageAvailableSemaphore));
-	VkCheck(vkCreateSemaphore(Renderer::device(), &info, nullptr, &_renderingFinishedSemaphore));
-}
-
 void SwapChain::_createSwapChain()
 {
 	//TODO: pass these in from Renderer.
@@ -14,6 +14,9 @@ struct SwapChainInfo
 };
 
 
+//Frames that may be queued on the GPU before the CPU has to wait; overridden with -frames.
+const uint32_t MAX_FRAMES_IN_FLIGHT = 2;
+
 class SwapChain
 {
 public:
@@ -29,6 +32,29 @@ public:
 	
 	void resize(uint32_t width, uint32_t height);
 
+	//Takes effect on the next resize.
+	void setFramesInFlight(uint32_t count);
+
+	//Blocks until every submitted frame has finished on the GPU.
+	void waitForFrames() const;
+
+	//Time the last present() spent blocked on a fence, in milliseconds.
+	inline float fenceWaitTime() const
+	{
+		return _fenceWaitTime;
+	}
+
+	inline uint32_t framesInFlight() const
+	{
+		return (uint32_t)_frames.size();
+	}
+
+	//Frames still executing on the GPU right after the last present().
+	inline uint32_t framesQueued() const
+	{
+		return _framesQueued;
+	}
+
 	inline const VkSurfaceCapabilitiesKHR& surfaceCapabilities() const
 	{
 		return _swapChainInfo.surfaceCapabilities;
@@ -57,19 +83,37 @@ private:
 	VkSurfaceKHR _surface;
 
 	VkImage _depthImage;
-	VkDeviceMemory _depthMemory;
+	Allocation _depthMemory;
 	VkImageView _depthView;
 
-	VkSemaphore _imageAvailableSemaphore;
-	VkSemaphore _renderingFinishedSemaphore;
+	struct Frame
+	{
+		VkSemaphore imageAvailable;
+		VkSemaphore renderingFinished;
+
+		//Signalled when the frame's submission has retired
+		VkFence fence;
+	};
+
+	std::vector<Frame> _frames;
+	uint32_t _framesInFlight;
+	size_t _frame;
+
+	//Fence of the last frame to use each image. The image's command buffer, uniform ring
+	//slot and descriptor copies can't be reused before it signals, which only matters when
+	//there are more images than frames in flight.
+	std::vector<VkFence> _imageFences;
+
+	float _fenceWaitTime;
+	uint32_t _framesQueued;
 
 	SwapChainInfo _swapChainInfo;
 
 	void _cleanup();
 	void _createDepthBuffer();
+	void _createFrames();
 	void _createFramebuffers();
 	void _createImageViews();
-	void _createSemaphores();
 	void _createSwapChain();
 	void _populateSwapChainInfo();
 };
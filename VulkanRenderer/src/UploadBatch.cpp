@@ -0,0 +1,248 @@
+#include "UploadBatch.h"
+#include "Renderer.h"
+
+#include <algorithm>
+#include <limits>
+
+//Everything uploaded ends up as vertex/index data, uniforms or sampled images.
+static const VkAccessFlags UPLOAD_READ_ACCESS = VK_ACCESS_INDIRECT_COMMAND_READ_BIT |
+	VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT |
+	VK_ACCESS_SHADER_READ_BIT;
+static const VkPipelineStageFlags UPLOAD_READ_STAGES = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+	VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+	VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+UploadBatch::UploadBatch(Renderer& renderer)
+	: _renderer(&renderer), _fence(VK_NULL_HANDLE), _state(BATCH_RECORDING),
+	_dedicated(renderer.dedicatedTransferQueue()), _stagedSize(0)
+{
+	_cmd = _renderer->startOneShotCmdBuffer(_dedicated);
+	_graphicsCmd = _dedicated ? _renderer->startOneShotCmdBuffer() : _cmd;
+
+	VkFenceCreateInfo info = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+	VkCheck(vkCreateFence(Renderer::device(), &info, nullptr, &_fence));
+}
+
+UploadBatch::~UploadBatch()
+{
+	//The staging buffers and command buffers may still be in use.
+	if (_state != BATCH_RECORDING)
+		wait();
+
+	for (Buffer* b : _staging)
+		delete b;
+
+	_renderer->freeOneShotCmdBuffer(_cmd, _dedicated);
+	if (_dedicated)
+		_renderer->freeOneShotCmdBuffer(_graphicsCmd);
+
+	vkDestroyFence(Renderer::device(), _fence, nullptr);
+}
+
+const Buffer& UploadBatch::stage(VkDeviceSize size)
+{
+	assert(_state == BATCH_RECORDING);
+
+	VkBufferCreateInfo info = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+	info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	info.size = size;
+
+	Buffer* staging = new Buffer;
+	_renderer->createAndBindBuffer(info, *staging,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+	_staging.push_back(staging);
+	_stagedSize += size;
+
+	return *staging;
+}
+
+void UploadBatch::copyBuffer(const Buffer& dst, const void* data, VkDeviceSize size, VkDeviceSize dstOffset)
+{
+	const Buffer& staging = stage(size);
+	staging.copyData((void*)data, (size_t)size);
+
+	copyStaged(staging, 0, dst, size, dstOffset);
+}
+
+void UploadBatch::copyStaged(const Buffer& staging, VkDeviceSize srcOffset, const Buffer& dst,
+	VkDeviceSize size, VkDeviceSize dstOffset)
+{
+	VkBufferCopy copy = {};
+	copy.srcOffset = srcOffset;
+	copy.dstOffset = dstOffset;
+	copy.size = size;
+
+	vkCmdCopyBuffer(_cmd, staging.buffer, dst.buffer, 1, &copy);
+
+	if (std::find(_buffers.begin(), _buffers.end(), dst.buffer) == _buffers.end())
+		_buffers.push_back(dst.buffer);
+}
+
+void UploadBatch::transferImage(VkImage image, const VkImageSubresourceRange& range, VkImageLayout layout)
+{
+	//On a single queue the barriers that follow the copies are all that's needed.
+	if (!_dedicated)
+		return;
+
+	VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+	barrier.srcQueueFamilyIndex = _renderer->transferQueueFamily();
+	barrier.dstQueueFamilyIndex = _renderer->graphicsQueueFamily();
+	barrier.oldLayout = layout;
+	barrier.newLayout = layout;
+	barrier.image = image;
+	barrier.subresourceRange = range;
+
+	//Release
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(_cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	//Acquire, ahead of any blits or transitions recorded afterwards.
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(_graphicsCmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void UploadBatch::setImageLayout(VkCommandBuffer cmd, VkImage image, VkImageLayout oldLayout,
+	VkImageLayout newLayout, const VkImageSubresourceRange& range)
+{
+	VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.image = image;
+	barrier.subresourceRange = range;
+
+	VkPipelineStageFlags srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+	VkPipelineStageFlags dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+	switch (oldLayout)
+	{
+	case VK_IMAGE_LAYOUT_PREINITIALIZED:
+		barrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
+		srcStage = VK_PIPELINE_STAGE_HOST_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		break;
+	}
+
+	switch (newLayout)
+	{
+	case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		break;
+	}
+
+	vkCmdPipelineBarrier(cmd, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void UploadBatch::submit()
+{
+	assert(_state == BATCH_RECORDING);
+
+	if (!_dedicated)
+	{
+		_submitGraphics();
+		return;
+	}
+
+	std::vector<VkBufferMemoryBarrier> barriers(_buffers.size());
+	for (size_t i = 0; i < _buffers.size(); ++i)
+	{
+		VkBufferMemoryBarrier& barrier = barriers[i];
+		barrier = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+		barrier.srcQueueFamilyIndex = _renderer->transferQueueFamily();
+		barrier.dstQueueFamilyIndex = _renderer->graphicsQueueFamily();
+		barrier.buffer = _buffers[i];
+		barrier.size = VK_WHOLE_SIZE;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	}
+
+	if (!barriers.empty())
+	{
+		vkCmdPipelineBarrier(_cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			0, 0, nullptr, (uint32_t)barriers.size(), barriers.data(), 0, nullptr);
+	}
+
+	_renderer->submitOneShotCmdBuffer(_cmd, _fence, true);
+	_state = BATCH_TRANSFERRING;
+}
+
+bool UploadBatch::complete()
+{
+	if (_state == BATCH_TRANSFERRING && vkGetFenceStatus(Renderer::device(), _fence) == VK_SUCCESS)
+		_submitGraphics();
+
+	if (_state == BATCH_ACQUIRING && vkGetFenceStatus(Renderer::device(), _fence) == VK_SUCCESS)
+		_state = BATCH_COMPLETE;
+
+	return _state == BATCH_COMPLETE;
+}
+
+void UploadBatch::wait()
+{
+	assert(_state != BATCH_RECORDING);
+
+	const uint64_t timeout = std::numeric_limits<uint64_t>::max();
+
+	if (_state == BATCH_TRANSFERRING)
+	{
+		VkCheck(vkWaitForFences(Renderer::device(), 1, &_fence, VK_TRUE, timeout));
+		_submitGraphics();
+	}
+
+	if (_state == BATCH_ACQUIRING)
+	{
+		VkCheck(vkWaitForFences(Renderer::device(), 1, &_fence, VK_TRUE, timeout));
+		_state = BATCH_COMPLETE;
+	}
+}
+
+void UploadBatch::_submitGraphics()
+{
+	//Acquires the buffers, or on a single queue just makes the copies visible.
+	if (_dedicated)
+	{
+		std::vector<VkBufferMemoryBarrier> barriers(_buffers.size());
+		for (size_t i = 0; i < _buffers.size(); ++i)
+		{
+			VkBufferMemoryBarrier& barrier = barriers[i];
+			barrier = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+			barrier.srcQueueFamilyIndex = _renderer->transferQueueFamily();
+			barrier.dstQueueFamilyIndex = _renderer->graphicsQueueFamily();
+			barrier.buffer = _buffers[i];
+			barrier.size = VK_WHOLE_SIZE;
+			barrier.dstAccessMask = UPLOAD_READ_ACCESS;
+		}
+
+		if (!barriers.empty())
+		{
+			vkCmdPipelineBarrier(_graphicsCmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, UPLOAD_READ_STAGES,
+				0, 0, nullptr, (uint32_t)barriers.size(), barriers.data(), 0, nullptr);
+		}
+
+		VkCheck(vkResetFences(Renderer::device(), 1, &_fence));
+	}
+	else
+	{
+		VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = UPLOAD_READ_ACCESS;
+
+		vkCmdPipelineBarrier(_graphicsCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, UPLOAD_READ_STAGES,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+	}
+
+	_renderer->submitOneShotCmdBuffer(_graphicsCmd, _fence);
+	_state = BATCH_ACQUIRING;
+}
\ No newline at end of file
@@ -0,0 +1,99 @@
+#ifndef UPLOAD_BATCH_H_
+#define UPLOAD_BATCH_H_
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+
+#include "Buffer.h"
+
+class Renderer;
+
+//Records any number of uploads and submits them together with a fence. The staging
+//memory belongs to the batch and is only released once the copies have completed.
+//
+//When the device has a dedicated transfer queue the copies run there, concurrently with
+//rendering. Once they've finished, a second, small submission on the graphics queue takes
+//ownership of everything written and runs whatever needs graphics support (mip blits).
+//Without one both halves are the same command buffer on the graphics queue.
+class UploadBatch
+{
+public:
+	UploadBatch(Renderer& renderer);
+	UploadBatch& operator=(const UploadBatch&) = delete;
+	UploadBatch(const UploadBatch&) = delete;
+	UploadBatch(UploadBatch&&) = delete;
+
+	//Waits for the copies if they're still running.
+	~UploadBatch();
+
+	//Host-visible memory for size bytes, valid until the batch completes.
+	const Buffer& stage(VkDeviceSize size);
+
+	//Stages data and records its copy into dst, which is handed to the graphics queue on submit.
+	void copyBuffer(const Buffer& dst, const void* data, VkDeviceSize size, VkDeviceSize dstOffset = 0);
+
+	//Records a copy out of memory from stage() that the caller has filled in itself, e.g. to
+	//gather scattered data into one staging buffer.
+	void copyStaged(const Buffer& staging, VkDeviceSize srcOffset, const Buffer& dst,
+		VkDeviceSize size, VkDeviceSize dstOffset = 0);
+
+	//Hands image over to the graphics queue, staying in layout. Call once its copies are
+	//recorded; anything after that goes into graphicsCommandBuffer().
+	void transferImage(VkImage image, const VkImageSubresourceRange& range, VkImageLayout layout);
+
+	static void setImageLayout(VkCommandBuffer cmd, VkImage image, VkImageLayout oldLayout,
+		VkImageLayout newLayout, const VkImageSubresourceRange& range);
+
+	void submit();
+
+	//True once every copy has finished and the graphics queue owns the results. Also moves
+	//the batch on to its graphics submission, so it needs calling regularly.
+	bool complete();
+
+	void wait();
+
+	//For copies and anything else the transfer queue supports.
+	inline VkCommandBuffer commandBuffer() const
+	{
+		return _cmd;
+	}
+
+	//For work that needs the graphics queue and runs after the copies.
+	inline VkCommandBuffer graphicsCommandBuffer() const
+	{
+		return _graphicsCmd;
+	}
+
+	//Total staging memory held by the batch.
+	inline VkDeviceSize stagedSize() const
+	{
+		return _stagedSize;
+	}
+
+private:
+	enum BatchState
+	{
+		BATCH_RECORDING,
+		BATCH_TRANSFERRING,
+		BATCH_ACQUIRING,
+		BATCH_COMPLETE
+	};
+
+	Renderer* _renderer;
+	VkCommandBuffer _cmd;
+	VkCommandBuffer _graphicsCmd;
+	VkFence _fence;
+	BatchState _state;
+	bool _dedicated;
+
+	std::vector<Buffer*> _staging;
+	VkDeviceSize _stagedSize;
+
+	//Copy destinations whose ownership is transferred on submit.
+	std::vector<VkBuffer> _buffers;
+
+	void _submitGraphics();
+};
+
+#endif //UPLOAD_BATCH_H_
\ No newline at end of file
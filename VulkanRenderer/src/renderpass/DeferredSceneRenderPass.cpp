@@ -3,7 +3,12 @@
 #include "SSAORenderPass.h"
 #include "../Scene.h"
 #include "../Model.h"
+#include "../PipelineCache.h"
 #include "../ShaderCache.h"
+#include "../SecondaryRecorder.h"
+#include "../CommandRecorder.h"
+#include "../GpuCuller.h"
+#include "../LightClusterer.h"
 #include "../Renderer.h"
 #include "../SwapChain.h"
 #include "../texture/TextureArray.h"
@@ -96,21 +101,31 @@ void DeferredSceneRenderPass::render(VkCommandBuffer cmd, const Framebuffer* fra
 	//Geometry pass first
 	info.framebuffer = _deferredFramebuffers[0].framebuffer;
 
-	VkViewport viewport = { 
+	const VkViewport viewport = { 
 		0, 0, (float)_extent.width, (float)_extent.height, 0.0f, 1.0f
 	};
-	VkRect2D scissor = { 0, 0, _extent.width, _extent.height };
+	const VkRect2D scissor = { 0, 0, _extent.width, _extent.height };
 
-	vkCmdSetViewport(cmd, 0, 1, &viewport);
-	vkCmdSetScissor(cmd, 0, 1, &scissor);
+	_resetCallCounts();
 
-	vkCmdBeginRenderPass(cmd, &info, VK_SUBPASS_CONTENTS_INLINE);
+	SecondaryRecorder& recorder = _renderer->secondaryRecorder();
+	const uint32_t section = recorder.add(_geometryPass, info.framebuffer, _scene ? _scene->models().size() : 0,
+		[this, viewport, scissor, shadow](VkCommandBuffer secondary, size_t first, size_t count)
+	{
+		CommandRecorder cmd(secondary);
+		cmd.setViewport(viewport);
+		cmd.setScissor(scissor);
 
-	bindDescriptorSet(cmd, SET_BINDING_SHADOW, shadow);
+		bindDescriptorSet(cmd, SET_BINDING_SHADOW, shadow);
 
-	if (_scene)
-		_scene->drawGeom(cmd, *this);
+		_scene->drawGeom(cmd, *this, first, count);
+		_addCallCounts(cmd);
+	});
 
+	recorder.run();
+
+	vkCmdBeginRenderPass(cmd, &info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+	recorder.execute(section);
 	vkCmdEndRenderPass(cmd);
 
 
@@ -135,6 +150,9 @@ void DeferredSceneRenderPass::render(VkCommandBuffer cmd, const Framebuffer* fra
 		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_DEPENDENCY_BY_REGION_BIT,
 		0, nullptr, 0, nullptr, 3, memBarriers);
 
+	//The next frame is culled against this one's depth.
+	_renderer->gpuCuller().buildHiZ(cmd, _deferredFramebuffers[0].depthImage, _deferredFramebuffers[0].depthView,
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
 	//SSAO pass
 	_ssaoPass->render(cmd);
@@ -148,8 +166,20 @@ void DeferredSceneRenderPass::render(VkCommandBuffer cmd, const Framebuffer* fra
 	info.clearValueCount = 2;
 	info.pClearValues = clrValues;
 	info.renderPass = _renderPass;
+
+	//Dynamic state is undefined after executing the geometry pass's secondaries.
+	vkCmdSetViewport(cmd, 0, 1, &viewport);
+	vkCmdSetScissor(cmd, 0, 1, &scissor);
+
 	vkCmdBeginRenderPass(cmd, &info, VK_SUBPASS_CONTENTS_INLINE);
 
+	//Material textures come from the first model, so there's nothing to shade without one.
+	if (_scene->models().empty())
+	{
+		vkCmdEndRenderPass(cmd);
+		return;
+	}
+
 	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _deferredPipeline);
 
 	VkDescriptorSet deferredSets[] = {
@@ -165,6 +195,11 @@ void DeferredSceneRenderPass::render(VkCommandBuffer cmd, const Framebuffer* fra
 	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, 
 		_deferredPipelineLayout, 0, 7, deferredSets, 1, offsets);
 
+	//The point lights and the lists the clusterer wrote for this frame.
+	const VkDescriptorSet clusters = _renderer->lightClusterer().shadingSet();
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+		_deferredPipelineLayout, 7, 1, &clusters, 0, nullptr);
+
 	vkCmdDraw(cmd, 4, 1, 0, 0);
 
 	vkCmdEndRenderPass(cmd);
@@ -182,17 +217,17 @@ void DeferredSceneRenderPass::resize(uint32_t width, uint32_t height)
 
 void DeferredSceneRenderPass::_createDescriptorSets(Renderer* renderer)
 {
-	VkDescriptorPoolSize sizes[5] = {};
+	VkDescriptorPoolSize sizes[6] = {};
 	//Camera matrix & lights
 	sizes[0].descriptorCount = 2;
 	sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 
-	//Sampler
-	sizes[1].descriptorCount = 1;
+	//Sampler, and the shadow maps' comparison sampler for both passes' set layouts
+	sizes[1].descriptorCount = 3;
 	sizes[1].type = VK_DESCRIPTOR_TYPE_SAMPLER;
 
 	//Textures
-	sizes[2].descriptorCount = MAX_TEXTURES * MAX_MATERIALS + 2;
+	sizes[2].descriptorCount = MAX_TEXTURES * MAX_MATERIALS + 3;
 	sizes[2].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
 
 	//Model & material data
@@ -203,9 +238,13 @@ void DeferredSceneRenderPass::_createDescriptorSets(Renderer* renderer)
 	sizes[4].descriptorCount = MAX_TEXTURES;
 	sizes[4].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 
+	//Shadow atlas lights & tiles, for the geometry and lighting passes' set layouts
+	sizes[5].descriptorCount = 2;
+	sizes[5].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+
 	VkDescriptorPoolCreateInfo pool = {};
 	pool.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	pool.poolSizeCount = 5;
+	pool.poolSizeCount = 6;
 	pool.pPoolSizes = sizes;
 	pool.maxSets = SET_BINDING_COUNT*2 + MAX_TEXTURES*2;
 
@@ -471,14 +510,14 @@ void DeferredSceneRenderPass::_createPipeline(const std::string& shaderName)
 	info.pDepthStencilState = &dss;
 	info.pDynamicState = &dys;
 
-	VkCheck(vkCreateGraphicsPipelines(Renderer::device(), VK_NULL_HANDLE, 1, &info, nullptr, &pipeline));
+	PipelineCache::createGraphics(info, &pipeline);
 
 	_pipelines[shaderName] = pipeline;
 }
 
 void DeferredSceneRenderPass::_createPipelineLayout()
 {
-	VkDescriptorSetLayoutBinding bindings[2] = {};
+	VkDescriptorSetLayoutBinding bindings[5] = {};
 	bindings[0].binding = 0;
 	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 	bindings[0].stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS;
@@ -511,7 +550,7 @@ void DeferredSceneRenderPass::_createPipelineLayout()
 	info.bindingCount = 1;
 	bindings[0].binding = 0;
 	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
-	bindings[0].descriptorCount = MAX_MATERIALS;
+	bindings[0].descriptorCount = MAX_MATERIALS * TEXLAYER_COUNT;
 	VkCheck(vkCreateDescriptorSetLayout(Renderer::device(), &info, nullptr, &_descriptorLayouts[SET_BINDING_TEXTURE]));
 
 	info.bindingCount = 1;
@@ -520,11 +559,22 @@ void DeferredSceneRenderPass::_createPipelineLayout()
 	bindings[0].stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS;
 	VkCheck(vkCreateDescriptorSetLayout(Renderer::device(), &info, nullptr, &_descriptorLayouts[SET_BINDING_LIGHTS]));
 	
-	info.bindingCount = 1;
+	//The shadow cube map, the cascades, the shadow atlas, the atlas's lights and tiles and the
+	//shadow maps' comparison sampler.
+	info.bindingCount = 5;
 	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
 	bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-	//bindings[1] = bindings[0];
-	//bindings[1].binding = 1;
+	bindings[1] = bindings[0];
+	bindings[1].binding = 1;
+	bindings[2] = bindings[0];
+	bindings[2].binding = 2;
+	bindings[3] = bindings[0];
+	bindings[3].binding = 3;
+	bindings[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[3].stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS;
+	bindings[4] = bindings[0];
+	bindings[4].binding = 4;
+	bindings[4].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
 	VkCheck(vkCreateDescriptorSetLayout(Renderer::device(), &info, nullptr, &_descriptorLayouts[SET_BINDING_SHADOW]));
 
 	info.bindingCount = 1;
@@ -689,9 +739,9 @@ void DeferredSceneRenderPass::_cleanupDeferredTargets()
 		vkDestroyImage(d, fb.normalImage, nullptr);
 		vkDestroyImage(d, fb.depthImage, nullptr);
 
-		vkFreeMemory(d, fb.memory, nullptr);
-		vkFreeMemory(d, fb.normalMemory, nullptr);
-		vkFreeMemory(d, fb.depthMemory, nullptr);
+		Renderer::allocator().free(fb.memory);
+		Renderer::allocator().free(fb.normalMemory);
+		Renderer::allocator().free(fb.depthMemory);
 	}
 
 	_deferredFramebuffers.clear();
@@ -726,15 +776,7 @@ void DeferredSceneRenderPass::_createRenderTargets(Renderer* renderer)
 
 			VkCheck(vkCreateImage(Renderer::device(), &info, nullptr, &fb.image));
 
-			VkMemoryRequirements memReq;
-			vkGetImageMemoryRequirements(Renderer::device(), fb.image, &memReq);
-
-			VkMemoryAllocateInfo alloc = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-			alloc.allocationSize = memReq.size;
-			alloc.memoryTypeIndex = renderer->getMemoryTypeIndex(memReq.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-			VkCheck(vkAllocateMemory(Renderer::device(), &alloc, nullptr, &fb.memory));
-			VkCheck(vkBindImageMemory(Renderer::device(), fb.image, fb.memory, 0));
+			renderer->allocateImageMemory(fb.image, fb.memory);
 		}
 
 		//View - color
@@ -780,15 +822,7 @@ void DeferredSceneRenderPass::_createRenderTargets(Renderer* renderer)
 
 			VkCheck(vkCreateImage(Renderer::device(), &info, nullptr, &fb.normalImage));
 
-			VkMemoryRequirements memReq;
-			vkGetImageMemoryRequirements(Renderer::device(), fb.normalImage, &memReq);
-
-			VkMemoryAllocateInfo alloc = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-			alloc.allocationSize = memReq.size;
-			alloc.memoryTypeIndex = renderer->getMemoryTypeIndex(memReq.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-			VkCheck(vkAllocateMemory(Renderer::device(), &alloc, nullptr, &fb.normalMemory));
-			VkCheck(vkBindImageMemory(Renderer::device(), fb.normalImage, fb.normalMemory, 0));
+			renderer->allocateImageMemory(fb.normalImage, fb.normalMemory);
 		}
 
 		//View - normals
@@ -831,15 +865,7 @@ void DeferredSceneRenderPass::_createRenderTargets(Renderer* renderer)
 
 			VkCheck(vkCreateImage(Renderer::device(), &info, nullptr, &fb.depthImage));
 
-			VkMemoryRequirements memReq;
-			vkGetImageMemoryRequirements(Renderer::device(), fb.depthImage, &memReq);
-
-			VkMemoryAllocateInfo alloc = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-			alloc.allocationSize = memReq.size;
-			alloc.memoryTypeIndex = renderer->getMemoryTypeIndex(memReq.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-			VkCheck(vkAllocateMemory(Renderer::device(), &alloc, nullptr, &fb.depthMemory));
-			VkCheck(vkBindImageMemory(Renderer::device(), fb.depthImage, fb.depthMemory, 0));
+			renderer->allocateImageMemory(fb.depthImage, fb.depthMemory);
 		}
 
 		//Depth view
@@ -947,7 +973,7 @@ void DeferredSceneRenderPass::_createDeferredLayout()
 
 	//Set 0 - render targets
 	info.bindingCount = 4;
-	VkDescriptorSetLayoutBinding bindings[4] = {};
+	VkDescriptorSetLayoutBinding bindings[5] = {};
 	bindings[0].binding = 0;
 	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 	bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
@@ -993,7 +1019,7 @@ void DeferredSceneRenderPass::_createDeferredLayout()
 	//Set 3 - textures
 	info.bindingCount = 1;
 	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
-	bindings[0].descriptorCount = MAX_MATERIALS;
+	bindings[0].descriptorCount = MAX_MATERIALS * TEXLAYER_COUNT;
 	bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 	VkCheck(vkCreateDescriptorSetLayout(Renderer::device(), &info,
 		nullptr, &_deferredSetLayouts[3]));
@@ -1006,13 +1032,27 @@ void DeferredSceneRenderPass::_createDeferredLayout()
 	VkCheck(vkCreateDescriptorSetLayout(Renderer::device(), &info, 
 		nullptr, &_deferredSetLayouts[4]));
 
-	//Set 5 - shadow map
+	//Set 5 - shadow cube map, cascades, shadow atlas, the atlas's lights and tiles and the
+	//comparison sampler
+	info.bindingCount = 5;
 	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
 	bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	bindings[1] = bindings[0];
+	bindings[1].binding = 1;
+	bindings[2] = bindings[0];
+	bindings[2].binding = 2;
+	bindings[3] = bindings[0];
+	bindings[3].binding = 3;
+	bindings[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[3].stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS;
+	bindings[4] = bindings[0];
+	bindings[4].binding = 4;
+	bindings[4].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
 	VkCheck(vkCreateDescriptorSetLayout(Renderer::device(), &info, 
 		nullptr, &_deferredSetLayouts[5]));
 
 	//Set 6 - material data
+	info.bindingCount = 1;
 	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	VkCheck(vkCreateDescriptorSetLayout(Renderer::device(), &info,
 		nullptr, &_deferredSetLayouts[6]));
@@ -1023,10 +1063,14 @@ void DeferredSceneRenderPass::_createDeferredLayout()
 	pushConstants.size = sizeof(uint32_t);
 	pushConstants.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
+	//Set 7 - point lights and their clusters, owned by the clusterer
+	std::vector<VkDescriptorSetLayout> layouts = _deferredSetLayouts;
+	layouts.push_back(_renderer->lightClusterer().shadingLayout());
+
 	VkPipelineLayoutCreateInfo layoutCreateInfo = {};
 	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	layoutCreateInfo.pSetLayouts = _deferredSetLayouts.data();
-	layoutCreateInfo.setLayoutCount = (uint32_t)_deferredSetLayouts.size();
+	layoutCreateInfo.pSetLayouts = layouts.data();
+	layoutCreateInfo.setLayoutCount = (uint32_t)layouts.size();
 	layoutCreateInfo.pushConstantRangeCount = 1;
 	layoutCreateInfo.pPushConstantRanges = &pushConstants;
 
@@ -1127,8 +1171,7 @@ void DeferredSceneRenderPass::_createDeferredPipeline()
 	info.pDepthStencilState = &dss;
 	info.pDynamicState = &dys;
 
-	VkCheck(vkCreateGraphicsPipelines(Renderer::device(), VK_NULL_HANDLE,
-		1, &info, nullptr, &_deferredPipeline));
+	PipelineCache::createGraphics(info, &_deferredPipeline);
 }
 
 void DeferredSceneRenderPass::_createSkybox()
@@ -53,7 +53,7 @@ private:
 	{
 		VkImage normalImage;
 		VkImageView normalView;
-		VkDeviceMemory normalMemory;
+		Allocation normalMemory;
 	};
 
 	std::vector<DeferredFramebuffer> _deferredFramebuffers;
@@ -1,5 +1,6 @@
 #include "PostProcessRenderPass.h"
 #include "../Renderer.h"
+#include "../PipelineCache.h"
 #include "../ShaderCache.h"
 #include "../Model.h"
 #include "../SwapChain.h"
@@ -309,8 +310,7 @@ void PostProcessRenderPass::_createPipeline(const std::string& shaderName)
 	info.pDepthStencilState = &dss;
 	info.pDynamicState = &dys;
 
-	VkCheck(vkCreateGraphicsPipelines(Renderer::device(), VK_NULL_HANDLE,
-		1, &info, nullptr, &pipeline));
+	PipelineCache::createGraphics(info, &pipeline);
 
 	_pipelines[shaderName] = pipeline;
 }
@@ -451,15 +451,7 @@ void PostProcessRenderPass::_allocatePostprocessRenderTargets(Renderer* renderer
 
 			VkCheck(vkCreateImage(Renderer::device(), &info, nullptr, &fb.image));
 
-			VkMemoryRequirements memReq;
-			vkGetImageMemoryRequirements(Renderer::device(), fb.image, &memReq);
-
-			VkMemoryAllocateInfo alloc = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-			alloc.allocationSize = memReq.size;
-			alloc.memoryTypeIndex = renderer->getMemoryTypeIndex(memReq.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-			VkCheck(vkAllocateMemory(Renderer::device(), &alloc, nullptr, &fb.memory));
-			VkCheck(vkBindImageMemory(Renderer::device(), fb.image, fb.memory, 0));
+			renderer->allocateImageMemory(fb.image, fb.memory);
 		}
 
 		//View
@@ -502,15 +494,7 @@ void PostProcessRenderPass::_allocatePostprocessRenderTargets(Renderer* renderer
 
 			VkCheck(vkCreateImage(Renderer::device(), &info, nullptr, &fb.depthImage));
 
-			VkMemoryRequirements memReq;
-			vkGetImageMemoryRequirements(Renderer::device(), fb.depthImage, &memReq);
-
-			VkMemoryAllocateInfo alloc = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-			alloc.allocationSize = memReq.size;
-			alloc.memoryTypeIndex = renderer->getMemoryTypeIndex(memReq.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-			VkCheck(vkAllocateMemory(Renderer::device(), &alloc, nullptr, &fb.depthMemory));
-			VkCheck(vkBindImageMemory(Renderer::device(), fb.depthImage, fb.depthMemory, 0));
+			renderer->allocateImageMemory(fb.depthImage, fb.depthMemory);
 		}
 
 		//Depth view
@@ -568,8 +552,7 @@ void PostProcessRenderPass::_destroyPostprocessRenderTargets()
 		if (fb.image)
 			vkDestroyImage(Renderer::device(), fb.image, nullptr);
 
-		if (fb.memory)
-			vkFreeMemory(Renderer::device(), fb.memory, nullptr);
+		Renderer::allocator().free(fb.memory);
 
 		if (fb.depthView)
 			vkDestroyImageView(Renderer::device(), fb.depthView, nullptr);
@@ -577,8 +560,7 @@ void PostProcessRenderPass::_destroyPostprocessRenderTargets()
 		if (fb.depthImage)
 			vkDestroyImage(Renderer::device(), fb.depthImage, nullptr);
 
-		if (fb.depthMemory)
-			vkFreeMemory(Renderer::device(), fb.depthMemory, nullptr);
+		Renderer::allocator().free(fb.depthMemory);
 	}
 
 	_postprocessRenderTargets.clear();
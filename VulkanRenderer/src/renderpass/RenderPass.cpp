@@ -1,5 +1,11 @@
 #include "RenderPass.h"
 #include "../Renderer.h"
+#include "../CommandRecorder.h"
+
+RenderPass::RenderPass() : _callCount(0), _skippedCount(0)
+{
+
+}
 
 RenderPass::~RenderPass()
 {
@@ -18,6 +24,11 @@ void RenderPass::bindDescriptorSet(VkCommandBuffer cmd, SetBinding index, const
 	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipelineLayout, index, 1, &set, 0, nullptr);
 }
 
+void RenderPass::bindDescriptorSet(CommandRecorder& cmd, SetBinding index, const VkDescriptorSet& set) const
+{
+	cmd.bindDescriptorSet(_pipelineLayout, index, set);
+}
+
 void RenderPass::bindDescriptorSetById(VkCommandBuffer cmd, SetBinding set, std::vector<uint32_t>* offsets) const
 {
 	if (set > SET_BINDING_COUNT)
@@ -29,6 +40,17 @@ void RenderPass::bindDescriptorSetById(VkCommandBuffer cmd, SetBinding set, std:
 	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipelineLayout, set, 1, &_descriptorSets[set], offsetCount, offsetData);
 }
 
+void RenderPass::bindDescriptorSetById(CommandRecorder& cmd, SetBinding set, std::vector<uint32_t>* offsets) const
+{
+	if (set > SET_BINDING_COUNT)
+		return;
+
+	uint32_t offsetCount = (offsets ? (uint32_t)offsets->size() : 0);
+	const uint32_t* offsetData = (offsets ? offsets->data() : nullptr);
+
+	cmd.bindDescriptorSet(_pipelineLayout, set, _descriptorSets[set], offsetCount, offsetData);
+}
+
 void RenderPass::destroyPipelines()
 {
 	for (std::pair<const std::string, VkPipeline>& pair : _pipelines)
@@ -37,7 +59,19 @@ void RenderPass::destroyPipelines()
 	_pipelines.clear();
 }
 
-void RenderPass::updatePushConstants(VkCommandBuffer cmd, size_t size, void* data) const
+void RenderPass::updatePushConstants(CommandRecorder& cmd, size_t size, void* data) const
+{
+	cmd.pushConstants(_pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, (uint32_t)size, data);
+}
+
+void RenderPass::_addCallCounts(const CommandRecorder& cmd)
+{
+	_callCount += cmd.calls();
+	_skippedCount += cmd.skipped();
+}
+
+void RenderPass::_resetCallCounts()
 {
-	vkCmdPushConstants(cmd, _pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, (uint32_t)size, data);
+	_callCount = 0;
+	_skippedCount = 0;
 }
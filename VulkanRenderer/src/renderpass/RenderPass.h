@@ -2,6 +2,8 @@
 #define RENDER_PASS_H_
 
 #include <vulkan/vulkan.h>
+#include <atomic>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include "../texture/Texture.h"
@@ -14,21 +16,36 @@ enum class RenderPassType
 	POSTPROCESS
 };
 
+class CommandRecorder;
 class Renderer;
 
 class RenderPass
 {
 public:
+	RenderPass();
 	virtual ~RenderPass();
 
 	void bindDescriptorSet(VkCommandBuffer cmd, SetBinding index, const VkDescriptorSet& set) const;
 
+	void bindDescriptorSet(CommandRecorder& cmd, SetBinding index, const VkDescriptorSet& set) const;
+
 	void bindDescriptorSetById(VkCommandBuffer cmd, SetBinding set, std::vector<uint32_t>* offsets = nullptr) const;
 
+	void bindDescriptorSetById(CommandRecorder& cmd, SetBinding set, std::vector<uint32_t>* offsets = nullptr) const;
+
+	//Vulkan calls made through CommandRecorders by the last render(), across all of its threads.
+	inline uint32_t callCount() const
+	{
+		return _callCount;
+	}
+
 	void destroyPipelines();
 
+	//Safe to call from the threads recording a pass's secondary command buffers.
 	VkPipeline getPipelineForShader(const std::string& shaderName)
 	{
+		std::lock_guard<std::mutex> lock(_pipelineMutex);
+
 		if (_pipelines.find(shaderName) == _pipelines.end())
 			_createPipeline(shaderName);
 
@@ -41,7 +58,13 @@ public:
 
 	virtual void render(VkCommandBuffer cmd, const Framebuffer* framebuffer = nullptr) = 0;
 
-	void updatePushConstants(VkCommandBuffer cmd, size_t size, void* data) const;
+	//Binds dropped by the CommandRecorders of the last render().
+	inline uint32_t skippedCount() const
+	{
+		return _skippedCount;
+	}
+
+	void updatePushConstants(CommandRecorder& cmd, size_t size, void* data) const;
 
 	inline VkRenderPass renderPass() const
 	{
@@ -61,6 +84,15 @@ protected:
 	std::vector<VkDescriptorSet> _descriptorSets;
 
 	std::unordered_map<std::string, VkPipeline> _pipelines;
+	std::mutex _pipelineMutex;
+
+	std::atomic<uint32_t> _callCount;
+	std::atomic<uint32_t> _skippedCount;
+
+	//Adds a finished recorder's counts to the pass's.
+	void _addCallCounts(const CommandRecorder& cmd);
+
+	void _resetCallCounts();
 
 	virtual void _createDescriptorSets(Renderer* renderer) = 0;
 
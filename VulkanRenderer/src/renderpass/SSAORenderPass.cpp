@@ -5,6 +5,7 @@
 #include "../Renderer.h"
 #include "../Scene.h"
 #include "../texture/Texture.h"
+#include "../PipelineCache.h"
 #include "../ShaderCache.h"
 #include "../Model.h"
 
@@ -399,7 +400,7 @@ void SSAORenderPass::_cleanup()
 
 		vkDestroyImageView(d, _ssaoFramebuffer.view, nullptr);
 		vkDestroyImage(d, _ssaoFramebuffer.image, nullptr);
-		vkFreeMemory(d, _ssaoFramebuffer.memory, nullptr);
+		Renderer::allocator().free(_ssaoFramebuffer.memory);
 	}
 
 	if (_blurFramebuffer.framebuffer != VK_NULL_HANDLE)
@@ -408,7 +409,7 @@ void SSAORenderPass::_cleanup()
 
 		vkDestroyImageView(d, _blurFramebuffer.view, nullptr);
 		vkDestroyImage(d, _blurFramebuffer.image, nullptr);
-		vkFreeMemory(d, _blurFramebuffer.memory, nullptr);
+		Renderer::allocator().free(_blurFramebuffer.memory);
 	}
 
 }
@@ -531,14 +532,12 @@ void SSAORenderPass::_createSSAOPipeline()
 	info.pDepthStencilState = &dss;
 	info.pDynamicState = &dys;
 
-	VkCheck(vkCreateGraphicsPipelines(Renderer::device(), VK_NULL_HANDLE,
-		1, &info, nullptr, &_ssaoPipeline));
+	PipelineCache::createGraphics(info, &_ssaoPipeline);
 
 
 	info.renderPass = _blurPass;
 	stages[1].module = ShaderCache::getModule("shaders/screen/ssao_blur.frag");
-	VkCheck(vkCreateGraphicsPipelines(Renderer::device(), VK_NULL_HANDLE,
-		1, &info, nullptr, &_blurPipeline));
+	PipelineCache::createGraphics(info, &_blurPipeline);
 }
 
 void SSAORenderPass::_generateKernelSamples()
@@ -598,19 +597,7 @@ void SSAORenderPass::_createRenderTargets()
 		VkCheck(vkCreateImage(Renderer::device(), &info, nullptr, 
 			&_ssaoFramebuffer.image));
 
-		VkMemoryRequirements memReq;
-		vkGetImageMemoryRequirements(Renderer::device(), _ssaoFramebuffer.image,
-			&memReq);
-
-		VkMemoryAllocateInfo alloc = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-		alloc.allocationSize = memReq.size;
-		alloc.memoryTypeIndex = _renderer->getMemoryTypeIndex(memReq.memoryTypeBits,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-		VkCheck(vkAllocateMemory(Renderer::device(), &alloc, nullptr, 
-			&_ssaoFramebuffer.memory));
-		VkCheck(vkBindImageMemory(Renderer::device(), _ssaoFramebuffer.image, 
-			_ssaoFramebuffer.memory, 0));
+		_renderer->allocateImageMemory(_ssaoFramebuffer.image, _ssaoFramebuffer.memory);
 	}
 
 	//view
@@ -672,19 +659,7 @@ void SSAORenderPass::_createRenderTargets()
 		VkCheck(vkCreateImage(Renderer::device(), &info, nullptr, 
 			&_blurFramebuffer.image));
 
-		VkMemoryRequirements memReq;
-		vkGetImageMemoryRequirements(Renderer::device(), _blurFramebuffer.image,
-			&memReq);
-
-		VkMemoryAllocateInfo alloc = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-		alloc.allocationSize = memReq.size;
-		alloc.memoryTypeIndex = _renderer->getMemoryTypeIndex(memReq.memoryTypeBits,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-		VkCheck(vkAllocateMemory(Renderer::device(), &alloc, nullptr, 
-			&_blurFramebuffer.memory));
-		VkCheck(vkBindImageMemory(Renderer::device(), _blurFramebuffer.image, 
-			_blurFramebuffer.memory, 0));
+		_renderer->allocateImageMemory(_blurFramebuffer.image, _blurFramebuffer.memory);
 	}
 
 	//view
@@ -2,7 +2,11 @@
 #include "ShadowMapRenderPass.h"
 #include "../Scene.h"
 #include "../Model.h"
+#include "../PipelineCache.h"
 #include "../ShaderCache.h"
+#include "../SecondaryRecorder.h"
+#include "../CommandRecorder.h"
+#include "../GpuCuller.h"
 
 //TODO: retrieve from global config.
 const uint32_t MAX_MATERIALS = 64;
@@ -25,6 +29,7 @@ void SceneRenderPass::allocateTextureDescriptor(VkDescriptorSet& set, SetBinding
 
 void SceneRenderPass::init(Renderer* renderer)
 {
+	_renderer = renderer;
 	_extent = renderer->extent();
 
 	_createRenderPass();
@@ -50,44 +55,64 @@ void SceneRenderPass::render(VkCommandBuffer cmd, const Framebuffer* framebuffer
 	info.renderArea.extent = _extent;
 	info.framebuffer = framebuffer->framebuffer;
 
-	VkViewport viewport = { 0, 0, (float)_extent.width, (float)_extent.height, 0.0f, 1.0f };
-	VkRect2D scissor = { 0, 0, _extent.width, _extent.height };
+	const VkViewport viewport = { 0, 0, (float)_extent.width, (float)_extent.height, 0.0f, 1.0f };
+	const VkRect2D scissor = { 0, 0, _extent.width, _extent.height };
+	const VkDescriptorSet shadow = ((ShadowMapRenderPass*)_shadowPass)->set();
 
-	vkCmdSetViewport(cmd, 0, 1, &viewport);
-	vkCmdSetScissor(cmd, 0, 1, &scissor);
+	//Ranges of models are recorded on the worker threads.
+	_resetCallCounts();
 
-	vkCmdBeginRenderPass(cmd, &info, VK_SUBPASS_CONTENTS_INLINE);
+	SecondaryRecorder& recorder = _renderer->secondaryRecorder();
+	const uint32_t section = recorder.add(_renderPass, info.framebuffer, _scene ? _scene->models().size() : 0,
+		[this, viewport, scissor, shadow](VkCommandBuffer secondary, size_t first, size_t count)
+	{
+		CommandRecorder cmd(secondary);
+		cmd.setViewport(viewport);
+		cmd.setScissor(scissor);
+
+		bindDescriptorSet(cmd, SET_BINDING_SHADOW, shadow);
 
-	bindDescriptorSet(cmd, SET_BINDING_SHADOW, ((ShadowMapRenderPass*)_shadowPass)->set());
+		_scene->draw(cmd, *this, first, count);
+		_addCallCounts(cmd);
+	});
 
-	if (_scene)
-		_scene->draw(cmd, *this);
+	recorder.run();
 
+	vkCmdBeginRenderPass(cmd, &info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+	recorder.execute(section);
 	vkCmdEndRenderPass(cmd);
+
+	//The next frame is culled against this one's depth.
+	_renderer->gpuCuller().buildHiZ(cmd, framebuffer->depthImage, framebuffer->depthView,
+		VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
 };
 
 void SceneRenderPass::_createDescriptorSets(Renderer* renderer)
 {
-	VkDescriptorPoolSize sizes[4] = {};
+	VkDescriptorPoolSize sizes[5] = {};
 	//Camera matrix & lights
 	sizes[0].descriptorCount = 2;
 	sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 
-	//Sampler
-	sizes[1].descriptorCount = 1;
+	//Sampler, and the shadow maps' comparison sampler
+	sizes[1].descriptorCount = 2;
 	sizes[1].type = VK_DESCRIPTOR_TYPE_SAMPLER;
 
 	//Textures
-	sizes[2].descriptorCount = MAX_TEXTURES * MAX_MATERIALS + 2;
+	sizes[2].descriptorCount = MAX_TEXTURES * MAX_MATERIALS + 3;
 	sizes[2].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
 
 	//Model & material data
 	sizes[3].descriptorCount = 2 + MAX_MATERIALS;
 	sizes[3].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 
+	//Shadow atlas lights & tiles
+	sizes[4].descriptorCount = 1;
+	sizes[4].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+
 	VkDescriptorPoolCreateInfo pool = {};
 	pool.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	pool.poolSizeCount = 4;
+	pool.poolSizeCount = 5;
 	pool.pPoolSizes = sizes;
 	pool.maxSets = SET_BINDING_COUNT + MAX_TEXTURES;
 
@@ -322,17 +347,18 @@ void SceneRenderPass::_createPipeline(const std::string& shaderName)
 	info.pDepthStencilState = &dss;
 	info.pDynamicState = &dys;
 
-	VkCheck(vkCreateGraphicsPipelines(Renderer::device(), VK_NULL_HANDLE, 1, &info, nullptr, &pipeline));
+	PipelineCache::createGraphics(info, &pipeline);
 
 	_pipelines[shaderName] = pipeline;
 }
 
 void SceneRenderPass::_createPipelineLayout()
 {
-	VkDescriptorSetLayoutBinding bindings[2] = {};
+	//The fragment shader reads the viewport size, to split the screen when comparing shadow filters.
+	VkDescriptorSetLayoutBinding bindings[5] = {};
 	bindings[0].binding = 0;
 	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
 	bindings[0].descriptorCount = 1;
 
 	VkDescriptorSetLayoutCreateInfo info = {};
@@ -357,7 +383,7 @@ void SceneRenderPass::_createPipelineLayout()
 	info.bindingCount = 1;
 	bindings[0].binding = 0;
 	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
-	bindings[0].descriptorCount = MAX_MATERIALS;
+	bindings[0].descriptorCount = MAX_MATERIALS * TEXLAYER_COUNT;
 	VkCheck(vkCreateDescriptorSetLayout(Renderer::device(), &info, nullptr, &_descriptorLayouts[SET_BINDING_TEXTURE]));
 
 	info.bindingCount = 1;
@@ -366,16 +392,25 @@ void SceneRenderPass::_createPipelineLayout()
 	bindings[0].stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS;
 	VkCheck(vkCreateDescriptorSetLayout(Renderer::device(), &info, nullptr, &_descriptorLayouts[SET_BINDING_LIGHTS]));
 
+	//The shadow cube map, the cascades, the shadow atlas, the atlas's lights and tiles and the
+	//shadow maps' comparison sampler.
+	info.bindingCount = 5;
 	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
 	bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-	//info.bindingCount = 2;
-	//bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
-	//bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-	//bindings[1].binding = 1;
-	//bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
-	//bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	bindings[1] = bindings[0];
+	bindings[1].binding = 1;
+	bindings[2] = bindings[0];
+	bindings[2].binding = 2;
+	bindings[3] = bindings[0];
+	bindings[3].binding = 3;
+	bindings[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[3].stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS;
+	bindings[4] = bindings[0];
+	bindings[4].binding = 4;
+	bindings[4].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
 	VkCheck(vkCreateDescriptorSetLayout(Renderer::device(), &info, nullptr, &_descriptorLayouts[SET_BINDING_SHADOW]));
 
+	info.bindingCount = 1;
 	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	bindings[0].descriptorCount = 1;
 	VkCheck(vkCreateDescriptorSetLayout(Renderer::device(), &info, nullptr, &_descriptorLayouts[SET_BINDING_MATERIAL]));
@@ -9,7 +9,7 @@ class SceneRenderPass : public RenderPass
 {
 public:
 	SceneRenderPass(Scene& scene, RenderPass& shadowPass) 
-		: _scene(&scene), _shadowPass(&shadowPass) {}
+		: _renderer(nullptr), _scene(&scene), _shadowPass(&shadowPass) {}
 
 	~SceneRenderPass();
 
@@ -33,6 +33,8 @@ protected:
 	virtual void _createRenderPass() override;
 
 private:
+	Renderer* _renderer;
+
 	Scene* _scene;
 
 	RenderPass* _shadowPass;
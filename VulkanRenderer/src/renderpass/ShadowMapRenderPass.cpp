@@ -1,35 +1,82 @@
 #include "ShadowMapRenderPass.h"
 #include "../Renderer.h"
+#include "../Light.h"
 #include "../Scene.h"
+#include "../ShadowAtlas.h"
 #include "../texture/Texture.h"
 #include "../Model.h"
+#include "../PipelineCache.h"
 #include "../ShaderCache.h"
+#include "../SecondaryRecorder.h"
+#include "../CommandRecorder.h"
+#include "../UploadBatch.h"
+
+#include <algorithm>
+#include <cstdio>
 
 const uint32_t SHADOW_DIM = 1024;
 
-//For cubes we want to use an unnormalised format to avoid banding
-//this also allows us to add other channels for debugging if we need them
+//Every map is depth, so that it can be sampled through a comparison sampler. The cube map
+//stores distance over the light's far plane, written by the fragment shader, which keeps it
+//linear and free of banding.
 const VkFormat SHADOW_MAP_FORMAT = VK_FORMAT_D32_SFLOAT;
-const VkFormat SHADOW_MAP_FORMAT_CUBE = VK_FORMAT_R32_SFLOAT; //or D32_SFLOAT
 
 //TODO: retrieve from global config.
 const uint32_t MAX_MATERIALS = 64;
 const uint32_t MAX_TEXTURES = 64;
 const uint32_t MAX_MODELS = 64;
 
+//Every face of the cube.
+const uint32_t CUBE_VIEW_MASK = 0x3F;
+
+//Drawn into the atlas's render pass rather than the main one.
+const std::string ATLAS_SHADER = "shaders/common/shadowatlas";
+
+//Without its SPIR-V every face gets a render pass instance of its own instead.
+const std::string MULTIVIEW_SHADER = "shaders/common/shadowmap_multiview.vert";
+
+//Cascades keep their rasterized depth; writing gl_FragDepth would turn off early depth testing.
+const std::string CASCADE_FRAGMENT_SHADER = "shaders/common/shadowcascade.frag";
+
 ShadowMapRenderPass::~ShadowMapRenderPass()
 {
-	for(VkFramebuffer fb : _framebuffers)
-		vkDestroyFramebuffer(Renderer::device(), fb, nullptr);
+	_destroyFramebuffer();
+
+	vkDestroyImageView(Renderer::device(), _layeredView, nullptr);
+	vkDestroyFramebuffer(Renderer::device(), _atlasFramebuffer, nullptr);
+	vkDestroyRenderPass(Renderer::device(), _atlasRenderPass, nullptr);
+	vkDestroySampler(Renderer::device(), _compareSampler, nullptr);
 
 	delete _depthTexture;
+	delete _cascadeTexture;
+	delete _atlasTexture;
+}
+
+uint32_t ShadowMapRenderPass::facesRendered() const
+{
+	uint32_t faces = 0;
+
+	for (uint32_t i = 0; i < _framebuffers.size(); ++i)
+	{
+		if (_faceStale(i))
+			faces += _multiview ? 6 : 1;
+	}
+
+	return faces;
 }
 
 void ShadowMapRenderPass::init(Renderer* renderer)
 {
-	const size_t layers = (_type == ShadowMapType::SHADOW_MAP_CUBE) ? 6 : 1;
-	_framebuffers.resize(layers, VK_NULL_HANDLE);
+	_renderer = renderer;
+	_multiview = _useMultiview(_type);
 
+	if (_type == ShadowMapType::SHADOW_MAP_CASCADES)
+		_cascades = MAX_CASCADES;
+
+	if (_multiview)
+		printf("Drawing the cube shadow map in a single pass with multiview\n");
+
+	_createCompareSampler();
 	_createRenderPass();
 	_createPipelineLayout();
 	_createDescriptorSets(renderer);
@@ -39,78 +86,170 @@ void ShadowMapRenderPass::init(Renderer* renderer)
 
 void ShadowMapRenderPass::recreateShadowMap(Renderer* renderer)
 {
-	const bool cube = (_type == ShadowMapType::SHADOW_MAP_CUBE);
-	const VkImageViewType viewType = (cube) ?
-		VK_IMAGE_VIEW_TYPE_CUBE : VK_IMAGE_VIEW_TYPE_2D;
-	const VkFormat format = (cube) ? SHADOW_MAP_FORMAT_CUBE : SHADOW_MAP_FORMAT;
-	_depthTexture = new Texture(SHADOW_DIM, SHADOW_DIM, format,	viewType,
-		renderer);
-	_depthTexture->bind(renderer, 0, (cube) ? 0 : 1);
-
+	_depthTexture = new Texture(SHADOW_DIM, SHADOW_DIM, SHADOW_MAP_FORMAT,
+		VK_IMAGE_VIEW_TYPE_CUBE, renderer);
+	_initLayout(*_depthTexture, VK_IMAGE_ASPECT_DEPTH_BIT, 6);
+
+	//The views of the faces are cube views, so the layers get a view of their own.
+	VkImageViewCreateInfo view = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+	view.image = _depthTexture->image();
+	view.format = SHADOW_MAP_FORMAT;
+	view.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+	view.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+	view.subresourceRange.levelCount = 1;
+	view.subresourceRange.layerCount = 6;
+	VkCheck(vkCreateImageView(Renderer::device(), &view, nullptr, &_layeredView));
+
+	if (_cascades)
+		_createCascades();
+
+	_createAtlas();
+	_writeSet();
 	_createFramebuffer();
 }
 
 void ShadowMapRenderPass::render(VkCommandBuffer cmd, const Framebuffer*)
 {
-	VkClearValue clear = { 1.0f, 0 };
+	const bool cube = (_type == ShadowMapType::SHADOW_MAP_CUBE);
+	const uint32_t dim = cube ? SHADOW_DIM : CASCADE_DIM;
 
-	//Use color clears for non-depth formats
-	if(SHADOW_MAP_FORMAT_CUBE != VK_FORMAT_D32_SFLOAT)
-		clear.color = { std::numeric_limits<float>::max() };
+	VkClearValue clear = { 1.0f, 0 };
 
 	VkRenderPassBeginInfo info = { VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
 	info.clearValueCount = 1;
 	info.pClearValues = &clear;
 	info.renderPass = _renderPass;
 	info.renderArea.offset = { 0, 0 };
-	info.renderArea.extent = { SHADOW_DIM, SHADOW_DIM };
+	info.renderArea.extent = { dim, dim };
 
-	VkViewport viewport = {
-		0, 0, (float)SHADOW_DIM, (float)SHADOW_DIM, 0.0f, 1.0f
+	const VkViewport viewport = {
+		0, 0, (float)dim, (float)dim, 0.0f, 1.0f
 	};
-	VkRect2D scissor = { 0, 0, SHADOW_DIM, SHADOW_DIM };
+	const VkRect2D scissor = { 0, 0, dim, dim };
+
+	//Without multiview every face is a render pass instance of its own, but they can all be
+	//recorded at once.
+	_resetCallCounts();
+	_recordedFaces = _scene ? _scene->shadowFacesDirty() : ~0u;
+
+	SecondaryRecorder& recorder = _renderer->secondaryRecorder();
+	std::vector<uint32_t> sections(_framebuffers.size());
+
+	for (uint32_t i = 0; i < _framebuffers.size(); ++i)
+	{
+		if (!_faceStale(i))
+			continue;
+
+		const uint32_t face = _multiview ? SHADOW_FACES_ALL : i;
+
+		sections[i] = recorder.add(_renderPass, _framebuffers[i], _scene ? _scene->models().size() : 0,
+			[this, viewport, scissor, face](VkCommandBuffer secondary, size_t first, size_t count)
+		{
+			CommandRecorder cmd(secondary);
+			cmd.setViewport(viewport);
+			cmd.setScissor(scissor);
+
+			//The multiview shader takes the face from gl_ViewIndex instead.
+			if (face != SHADOW_FACES_ALL)
+			{
+				const uint32_t pushConstants[] = { face };
+				cmd.pushConstants(_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+					0, sizeof(pushConstants), pushConstants);
+			}
+
+			_scene->drawShadow(cmd, *this, face, first, count);
+			_addCallCounts(cmd);
+		});
+	}
+
+	//A tile only draws the casters within its light's range, as of recording; the tiles move
+	//too often to be worth keeping from frame to frame.
+	const uint32_t tiles = _scene ? _scene->shadowAtlas().tileCount() : 0;
+	std::vector<uint32_t> tileSections(tiles);
+
+	for (uint32_t t = 0; t < tiles; ++t)
+	{
+		const AtlasTile& tile = _scene->shadowAtlas().data().tiles[t];
+		const VkViewport tileViewport = { tile.rect.x, tile.rect.y, tile.rect.z, tile.rect.w, 0.0f, 1.0f };
+		const VkRect2D tileScissor = {
+			{ (int32_t)tile.rect.x, (int32_t)tile.rect.y }, { (uint32_t)tile.rect.z, (uint32_t)tile.rect.w }
+		};
+		const glm::vec4 light = tile.lightPosRange;
+
+		tileSections[t] = recorder.add(_atlasRenderPass, _atlasFramebuffer, _scene->models().size(),
+			[this, tileViewport, tileScissor, t, light](VkCommandBuffer secondary, size_t first, size_t count)
+		{
+			CommandRecorder cmd(secondary);
+			cmd.setViewport(tileViewport);
+			cmd.setScissor(tileScissor);
+
+			const uint32_t pushConstants[] = { t };
+			cmd.pushConstants(_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+				0, sizeof(pushConstants), pushConstants);
+
+			//The tiles are in the same set the scene passes sample the atlas through.
+			bindDescriptorSetById(cmd, SET_BINDING_SHADOW);
+
+			_scene->drawShadowTile(cmd, *this, light, first, count);
+			_addCallCounts(cmd);
+		});
+	}
 
-	vkCmdSetViewport(cmd, 0, 1, &viewport);
-	vkCmdSetScissor(cmd, 0, 1, &scissor);
+	recorder.run();
 
 	for (uint32_t i = 0; i < _framebuffers.size(); ++i)
 	{
+		if (!_faceStale(i))
+			continue;
+
 		info.framebuffer = _framebuffers[i];
-		vkCmdBeginRenderPass(cmd, &info, VK_SUBPASS_CONTENTS_INLINE);
+		vkCmdBeginRenderPass(cmd, &info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		recorder.execute(sections[i]);
+		vkCmdEndRenderPass(cmd);
+	}
 
-		const uint32_t pushConstants[] = { i };
-		vkCmdPushConstants(cmd, _pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 
-			0, sizeof(pushConstants), pushConstants);
+	if (tiles)
+	{
+		const VkClearValue atlasClear = { 1.0f, 0 };
 
-		if (_scene)
-			_scene->drawShadow(cmd, *this);
+		info.renderPass = _atlasRenderPass;
+		info.framebuffer = _atlasFramebuffer;
+		info.renderArea.extent = { ATLAS_DIM, ATLAS_DIM };
+		info.pClearValues = &atlasClear;
 
+		vkCmdBeginRenderPass(cmd, &info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		for (uint32_t section : tileSections)
+			recorder.execute(section);
 		vkCmdEndRenderPass(cmd);
 	}
 }
 
 void ShadowMapRenderPass::_createDescriptorSets(Renderer* renderer)
 {
-	VkDescriptorPoolSize sizes[4] = {};
+	VkDescriptorPoolSize sizes[5] = {};
 	//Lights & camera
 	sizes[0].descriptorCount = 2;
 	sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 
-	//Sampler
-	sizes[1].descriptorCount = 1;
+	//Sampler, and the shadow maps' comparison sampler
+	sizes[1].descriptorCount = 2;
 	sizes[1].type = VK_DESCRIPTOR_TYPE_SAMPLER;
 
 	//Textures
-	sizes[2].descriptorCount = MAX_TEXTURES * MAX_MATERIALS + 2;
+	sizes[2].descriptorCount = MAX_TEXTURES * MAX_MATERIALS + 3;
 	sizes[2].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
 
 	//Model & material data
 	sizes[3].descriptorCount = 2 + MAX_MATERIALS;
 	sizes[3].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 
+	//Shadow atlas lights & tiles
+	sizes[4].descriptorCount = 1;
+	sizes[4].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+
 	VkDescriptorPoolCreateInfo pool = {};
 	pool.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	pool.poolSizeCount = 4;
+	pool.poolSizeCount = 5;
 	pool.pPoolSizes = sizes;
 	pool.maxSets = SET_BINDING_COUNT + MAX_TEXTURES;
 
@@ -211,31 +350,26 @@ void ShadowMapRenderPass::_createPipeline(const std::string& shaderName)
 {
 	VkPipeline pipeline;
 
+	//Atlas tiles are always depth, and are never drawn with multiview.
+	const bool atlas = (shaderName == ATLAS_SHADER);
+	const bool multiview = _multiview && !atlas;
+	const bool cascades = _cascades && !atlas;
+
 	VkPipelineShaderStageCreateInfo stages[2] = {};
 	stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
 	stages[0].pName = "main";
-	stages[0].module = ShaderCache::getModule(shaderName + ".vert");
+	stages[0].module = ShaderCache::getModule(shaderName + (multiview ? "_multiview.vert" : ".vert"));
 
 	stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
 	stages[1].pName = "main";
-	stages[1].module = ShaderCache::getModule(shaderName + ".frag");
-
-	VkPipelineColorBlendAttachmentState cba = {};
-	cba.blendEnable = VK_TRUE;
-	cba.colorWriteMask = VK_COLOR_COMPONENT_R_BIT;
-	cba.colorBlendOp = VK_BLEND_OP_MIN;
+	stages[1].module = ShaderCache::getModule(cascades ? CASCADE_FRAGMENT_SHADER : shaderName + ".frag");
 
+	//Depth only; the cube map's nearest distance is kept by the depth test.
 	VkPipelineColorBlendStateCreateInfo cbs = {};
 	cbs.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
 
-	if (_type == ShadowMapType::SHADOW_MAP_CUBE)
-	{
-		cbs.attachmentCount = 1;
-		cbs.pAttachments = &cba;
-	}
-
 	VkPipelineInputAssemblyStateCreateInfo ias = {};
 	ias.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
 	ias.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
@@ -318,7 +452,7 @@ void ShadowMapRenderPass::_createPipeline(const std::string& shaderName)
 	VkGraphicsPipelineCreateInfo info = {};
 	info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
 	info.layout = _pipelineLayout;
-	info.renderPass = _renderPass;
+	info.renderPass = atlas ? _atlasRenderPass : _renderPass;
 	info.stageCount = 2;
 	info.subpass = 0;
 	info.pStages = stages;
@@ -331,15 +465,14 @@ void ShadowMapRenderPass::_createPipeline(const std::string& shaderName)
 	info.pDepthStencilState = &dss;
 	info.pDynamicState = &dys;
 
-	VkCheck(vkCreateGraphicsPipelines(Renderer::device(), VK_NULL_HANDLE, 1, 
-		&info, nullptr, &pipeline));
+	PipelineCache::createGraphics(info, &pipeline);
 
 	_pipelines[shaderName] = pipeline;
 }
 
 void ShadowMapRenderPass::_createPipelineLayout()
 {
-	VkDescriptorSetLayoutBinding bindings[2] = {};
+	VkDescriptorSetLayoutBinding bindings[5] = {};
 	bindings[0].binding = 0;
 	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 	bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
@@ -370,7 +503,7 @@ void ShadowMapRenderPass::_createPipelineLayout()
 	info.bindingCount = 1;
 	bindings[0].binding = 0;
 	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
-	bindings[0].descriptorCount = MAX_MATERIALS;
+	bindings[0].descriptorCount = MAX_MATERIALS * TEXLAYER_COUNT;
 	VkCheck(vkCreateDescriptorSetLayout(Renderer::device(), &info, nullptr,
 		&_descriptorLayouts[SET_BINDING_TEXTURE]));
 
@@ -381,12 +514,24 @@ void ShadowMapRenderPass::_createPipelineLayout()
 	VkCheck(vkCreateDescriptorSetLayout(Renderer::device(), &info, nullptr,
 		&_descriptorLayouts[SET_BINDING_LIGHTS]));
 
-	info.bindingCount = 1;
+	//The cube map, the cascades, the atlas, its tiles and the comparison sampler; set() is
+	//allocated with it for the scene passes. The atlas's tiles are read when drawing them too.
+	info.bindingCount = 5;
 	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
 	bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 	bindings[1].binding = 1;
 	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
 	bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	bindings[1].descriptorCount = 1;
+	bindings[2] = bindings[1];
+	bindings[2].binding = 2;
+	bindings[3].binding = 3;
+	bindings[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[3].stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS;
+	bindings[3].descriptorCount = 1;
+	bindings[4] = bindings[1];
+	bindings[4].binding = 4;
+	bindings[4].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
 	VkCheck(vkCreateDescriptorSetLayout(Renderer::device(), &info, nullptr,
 		&_descriptorLayouts[SET_BINDING_SHADOW]));
 
@@ -412,20 +557,100 @@ void ShadowMapRenderPass::_createPipelineLayout()
 		nullptr, &_pipelineLayout));
 }
 
+void ShadowMapRenderPass::setCascades(uint32_t count)
+{
+	_rebuild((std::min)(count, MAX_CASCADES));
+}
+
+void ShadowMapRenderPass::setMultiview(bool enable)
+{
+	_multiviewAllowed = enable;
+	_rebuild(_cascades);
+}
+
+void ShadowMapRenderPass::_createAtlas()
+{
+	_atlasTexture = new Texture(ATLAS_DIM, ATLAS_DIM, SHADOW_MAP_FORMAT, VK_IMAGE_VIEW_TYPE_2D, _renderer);
+	_initLayout(*_atlasTexture, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+
+	_atlasRenderPass = _makeRenderPass(false);
+
+	VkFramebufferCreateInfo info = { VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO };
+	info.renderPass = _atlasRenderPass;
+	info.width = ATLAS_DIM;
+	info.height = ATLAS_DIM;
+	info.layers = 1;
+	info.attachmentCount = 1;
+
+	const VkImageView view = _atlasTexture->view();
+	info.pAttachments = &view;
+	VkCheck(vkCreateFramebuffer(Renderer::device(), &info, nullptr, &_atlasFramebuffer));
+}
+
+void ShadowMapRenderPass::_createCascades()
+{
+	if (_cascadeTexture)
+		return;
+
+	//Each view starts at its own layer, so the first covers every cascade for sampling and
+	//the rest are drawn into.
+	_cascadeTexture = new Texture(CASCADE_DIM, CASCADE_DIM, SHADOW_MAP_FORMAT,
+		VK_IMAGE_VIEW_TYPE_2D_ARRAY, _renderer, (uint8_t)MAX_CASCADES);
+	_initLayout(*_cascadeTexture, VK_IMAGE_ASPECT_DEPTH_BIT, MAX_CASCADES);
+}
+
+void ShadowMapRenderPass::_createCompareSampler()
+{
+	//Bilinear comparisons give a 2x2 filter per tap for free, where the format can filter.
+	VkFormatProperties props;
+	vkGetPhysicalDeviceFormatProperties(_renderer->physicalDevice(), SHADOW_MAP_FORMAT, &props);
+	const VkFilter filter = (props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) ?
+		VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+
+	if (filter == VK_FILTER_NEAREST)
+		printf("Shadow map depth format can't be filtered; hardware comparisons take a single texel\n");
+
+	VkSamplerCreateInfo info = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+	info.minFilter = filter;
+	info.magFilter = filter;
+	info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	info.maxLod = 0.0f;
+
+	//Lit where the reference is no further than the nearest caster.
+	info.compareEnable = VK_TRUE;
+	info.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+	info.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+
+	VkCheck(vkCreateSampler(Renderer::device(), &info, nullptr, &_compareSampler));
+}
+
 void ShadowMapRenderPass::_createFramebuffer()
 {
-	VkImageView attachments[] = {
-		_depthTexture->view()
-	};
+	const bool cube = (_type == ShadowMapType::SHADOW_MAP_CUBE);
+	const uint32_t dim = cube ? SHADOW_DIM : CASCADE_DIM;
+
 	VkFramebufferCreateInfo info = { VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO };
 	info.renderPass = _renderPass;
-	info.width = SHADOW_DIM;
-	info.height = SHADOW_DIM;
+	info.width = dim;
+	info.height = dim;
 	info.layers = 1;
 	info.attachmentCount = 1;
-	info.pAttachments = attachments;
 
-	const std::vector<VkImageView>& views = _depthTexture->views();
+	if (_multiview)
+	{
+		_framebuffers.assign(1, VK_NULL_HANDLE);
+		info.pAttachments = &_layeredView;
+		VkCheck(vkCreateFramebuffer(Renderer::device(), &info, nullptr, &_framebuffers[0]));
+		return;
+	}
+
+	const size_t layers = cube ? 6 : _cascades;
+	_framebuffers.assign(layers, VK_NULL_HANDLE);
+
+	const std::vector<VkImageView>& views = cube ? _depthTexture->views() : _cascadeTexture->views();
 	for (size_t i = 0; i < _framebuffers.size(); ++i)
 	{
 		info.pAttachments = &views[i];
@@ -436,25 +661,49 @@ void ShadowMapRenderPass::_createFramebuffer()
 
 void ShadowMapRenderPass::_createRenderPass()
 {
-	const bool cube = (_type == ShadowMapType::SHADOW_MAP_CUBE);
+	_renderPass = _makeRenderPass(_multiview);
+}
+
+void ShadowMapRenderPass::_destroyFramebuffer()
+{
+	for (VkFramebuffer fb : _framebuffers)
+		vkDestroyFramebuffer(Renderer::device(), fb, nullptr);
+
+	_framebuffers.clear();
+}
+
+bool ShadowMapRenderPass::_faceStale(uint32_t framebuffer) const
+{
+	//The multiview framebuffer covers every face.
+	if (_multiview)
+		return (_recordedFaces & CUBE_VIEW_MASK) != 0;
+
+	return (_recordedFaces & (1u << framebuffer)) != 0;
+}
 
+void ShadowMapRenderPass::_initLayout(const Texture& texture, VkImageAspectFlags aspect, uint32_t layers)
+{
+	VkImageSubresourceRange range = {};
+	range.aspectMask = aspect;
+	range.levelCount = 1;
+	range.layerCount = layers;
+
+	UploadBatch batch(*_renderer);
+	UploadBatch::setImageLayout(batch.graphicsCommandBuffer(), texture.image(), VK_IMAGE_LAYOUT_UNDEFINED,
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, range);
+	batch.submit();
+	batch.wait();
+}
+
+VkRenderPass ShadowMapRenderPass::_makeRenderPass(bool multiview) const
+{
 	VkAttachmentReference attach = {};
 	attach.attachment = 0;
+	attach.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
 	VkSubpassDescription subpass = {};
 	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-
-	if (cube)
-	{
-		attach.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-		subpass.pColorAttachments = &attach;
-		subpass.colorAttachmentCount = 1;
-	}
-	else
-	{
-		attach.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-		subpass.pDepthStencilAttachment = &attach;
-	}
+	subpass.pDepthStencilAttachment = &attach;
 
 	VkAttachmentDescription desc = {};
 	desc.samples = VK_SAMPLE_COUNT_1_BIT;
@@ -464,7 +713,7 @@ void ShadowMapRenderPass::_createRenderPass()
 	desc.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	desc.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 	desc.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	desc.format = cube? SHADOW_MAP_FORMAT_CUBE : SHADOW_MAP_FORMAT;
+	desc.format = SHADOW_MAP_FORMAT;
 
 	VkSubpassDependency dependencies[2] = {};
 	dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
@@ -491,6 +740,14 @@ void ShadowMapRenderPass::_createRenderPass()
 	dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
 	dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
 
+	//Depth is written by the fragment tests, and every map is sampled in the scene's fragment
+	//shaders.
+	dependencies[0].dstStageMask |= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+		VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[1].srcStageMask |= VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[1].dstStageMask |= VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	dependencies[1].dstAccessMask |= VK_ACCESS_SHADER_READ_BIT;
+
 	VkRenderPassCreateInfo info = { VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO };
 	info.subpassCount = 1;
 	info.pSubpasses = &subpass;
@@ -499,5 +756,99 @@ void ShadowMapRenderPass::_createRenderPass()
 	info.dependencyCount = 2;
 	info.pDependencies = dependencies;
 
-	VkCheck(vkCreateRenderPass(Renderer::device(), &info, nullptr, &_renderPass));
+	//Each draw goes to all six layers, which are all seen from the same point.
+#ifdef VK_KHR_multiview
+	VkRenderPassMultiviewCreateInfoKHR multiviewInfo = { VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO_KHR };
+	multiviewInfo.subpassCount = 1;
+	multiviewInfo.pViewMasks = &CUBE_VIEW_MASK;
+	multiviewInfo.correlationMaskCount = 1;
+	multiviewInfo.pCorrelationMasks = &CUBE_VIEW_MASK;
+
+	if (multiview)
+		info.pNext = &multiviewInfo;
+#endif
+
+	VkRenderPass renderPass;
+	VkCheck(vkCreateRenderPass(Renderer::device(), &info, nullptr, &renderPass));
+	return renderPass;
+}
+
+void ShadowMapRenderPass::_rebuild(uint32_t cascades)
+{
+	const ShadowMapType type = cascades ? ShadowMapType::SHADOW_MAP_CASCADES : ShadowMapType::SHADOW_MAP_CUBE;
+	const bool multiview = _useMultiview(type);
+
+	if (type == _type && cascades == _cascades && multiview == _multiview)
+		return;
+
+	//The render pass, and so every pipeline and framebuffer made with it, changes.
+	_renderer->waitForFrames();
+
+	destroyPipelines();
+	_destroyFramebuffer();
+	vkDestroyRenderPass(Renderer::device(), _renderPass, nullptr);
+
+	_type = type;
+	_cascades = cascades;
+	_multiview = multiview;
+
+	if (_cascades)
+		_createCascades();
+
+	_writeSet();
+	_createRenderPass();
+	_createFramebuffer();
+}
+
+bool ShadowMapRenderPass::_useMultiview(ShadowMapType type) const
+{
+	if (!_multiviewAllowed || type != ShadowMapType::SHADOW_MAP_CUBE || !_renderer->multiviewSupported())
+		return false;
+
+	if (!ShaderCache::exists(MULTIVIEW_SHADER))
+	{
+		printf("Missing SPIR-V for %s, drawing cube faces one at a time\n", MULTIVIEW_SHADER.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+void ShadowMapRenderPass::_writeSet()
+{
+	//Until the cascades are first drawn their binding gets the cube's faces, which are never
+	//sampled through it.
+	VkDescriptorImageInfo images[4] = {};
+	images[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	images[0].imageView = _depthTexture->view();
+	images[1].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	images[1].imageView = _cascadeTexture ? _cascadeTexture->view() : _layeredView;
+	images[2].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	images[2].imageView = _atlasTexture->view();
+	images[3].sampler = _compareSampler;
+
+	VkDescriptorBufferInfo buff = {};
+	Uniform* uniform = _renderer->getUniform("atlas");
+	buff.buffer = uniform->localBuffer.buffer;
+	buff.offset = 0;
+	buff.range = uniform->size;
+
+	VkWriteDescriptorSet writes[5] = {};
+	for (uint32_t i = 0; i < 5; ++i)
+	{
+		writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[i].descriptorCount = 1;
+		writes[i].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		writes[i].dstSet = _descriptorSets[SET_BINDING_SHADOW];
+		writes[i].dstBinding = i;
+		writes[i].pImageInfo = (i < 3) ? &images[i] : nullptr;
+	}
+
+	writes[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	writes[3].pBufferInfo = &buff;
+
+	writes[4].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+	writes[4].pImageInfo = &images[3];
+
+	vkUpdateDescriptorSets(Renderer::device(), 5, writes, 0, nullptr);
 }
\ No newline at end of file
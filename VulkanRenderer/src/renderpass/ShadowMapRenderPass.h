@@ -5,17 +5,24 @@
 
 class Scene;
 
+//Width and height of each of a directional light's shadow cascades.
+const uint32_t CASCADE_DIM = 2048;
+
 enum class ShadowMapType
 {
-	SHADOW_MAP_2D,
+	//A layer per cascade of a directional light, in one depth array.
+	SHADOW_MAP_CASCADES,
 	SHADOW_MAP_CUBE
 };
 
 class ShadowMapRenderPass : public RenderPass
 {
 public:
-	ShadowMapRenderPass(Scene& scene, ShadowMapType type) : _scene(&scene),
-		_depthTexture(nullptr), _type(type) {}
+	ShadowMapRenderPass(Scene& scene, ShadowMapType type) : _renderer(nullptr), _scene(&scene),
+		_depthTexture(nullptr), _cascadeTexture(nullptr), _atlasTexture(nullptr),
+		_atlasRenderPass(VK_NULL_HANDLE), _atlasFramebuffer(VK_NULL_HANDLE), _compareSampler(VK_NULL_HANDLE),
+		_type(type), _cascades(0), _multiview(false), _multiviewAllowed(true), _layeredView(VK_NULL_HANDLE),
+		_recordedFaces(0) {}
 
 	~ShadowMapRenderPass();
 
@@ -23,11 +30,46 @@ public:
 
 	void recreateShadowMap(Renderer* renderer);
 
+	//Only draws the faces the scene reports as stale; the others keep what was drawn before.
+	//Every tile of the shadow atlas is drawn each time, into a render pass of its own.
 	virtual void render(VkCommandBuffer cmd, const Framebuffer*) override;
 
+	//The stale faces as of the last recording.
+	inline uint32_t recordedFaces() const
+	{
+		return _recordedFaces;
+	}
+
+	//Faces drawn by the last recording, each time it is executed. With multiview all six are
+	//drawn together, so one stale face costs as much as all of them.
+	uint32_t facesRendered() const;
+
+	inline uint32_t cascades() const
+	{
+		return _cascades;
+	}
+
+	//The cube map at binding 0, the cascades at 1, the shadow atlas at 2, the atlas's lights
+	//and tiles at 3 and a depth comparison sampler for all three maps at 4, for the scene passes.
 	inline VkDescriptorSet set() const
 	{
-		return _depthTexture ? _depthTexture->set() : VK_NULL_HANDLE;
+		return _descriptorSets.empty() ? VK_NULL_HANDLE : _descriptorSets[SET_BINDING_SHADOW];
+	}
+
+	//Draws a directional light's cascades into the layers of a depth array instead of the
+	//cube map, or goes back to the cube map with a count of 0. Command buffers have to be
+	//recorded again afterwards.
+	void setCascades(uint32_t count);
+
+	//Cube faces are drawn by a single render pass instance, each draw broadcast to all six
+	//layers through VK_KHR_multiview, rather than by a render pass instance per face.
+	//Only takes effect for cube maps on devices with the extension, and is kept while cascades
+	//are drawn; command buffers have to be recorded again afterwards.
+	void setMultiview(bool enable);
+
+	inline bool multiview() const
+	{
+		return _multiview;
 	}
 
 	inline virtual RenderPassType type() {
@@ -46,13 +88,57 @@ protected:
 private:
 	std::vector<VkFramebuffer> _framebuffers;
 
+	Renderer* _renderer;
+
 	Scene* _scene;
 
+	//The cube map. It's kept while cascades are drawn, as both stay bound.
 	Texture* _depthTexture;
+	//Created the first time cascades are drawn, with a layer for as many as there can be.
+	Texture* _cascadeTexture;
+
+	//Depth only, whatever the main light's map is, so it has its own render pass.
+	Texture* _atlasTexture;
+	VkRenderPass _atlasRenderPass;
+	VkFramebuffer _atlasFramebuffer;
+
+	//Compares against the reference depth in hardware, bilinearly filtered where the depth
+	//format allows it.
+	VkSampler _compareSampler;
 
 	ShadowMapType _type;
+	uint32_t _cascades;
+
+	bool _multiview;
+	bool _multiviewAllowed;
+
+	//All six faces as a 2D array, for the multiview framebuffer. Also bound in place of
+	//the cascades until they're first drawn.
+	VkImageView _layeredView;
 
+	uint32_t _recordedFaces;
+
+	void _createAtlas();
+	void _createCascades();
+	void _createCompareSampler();
 	void _createFramebuffer();
+	void _destroyFramebuffer();
+	bool _faceStale(uint32_t framebuffer) const;
+
+	//Whichever map isn't being drawn is still bound, so it's made readable up front.
+	void _initLayout(const Texture& texture, VkImageAspectFlags aspect, uint32_t layers);
+
+	//Clears to the far plane and leaves the map readable by the scene's fragment shaders.
+	VkRenderPass _makeRenderPass(bool multiview) const;
+
+	//Recreates the render pass and framebuffers for the given cascade count, and the current
+	//multiview setting. No-op if neither changes what's drawn.
+	void _rebuild(uint32_t cascades);
+
+	//Multiview needs the cube map, the extension, and the multiview vertex shader.
+	bool _useMultiview(ShadowMapType type) const;
+
+	void _writeSet();
 };
 
 #endif //SHADOW_MAP_RENDER_PASS_H_
\ No newline at end of file
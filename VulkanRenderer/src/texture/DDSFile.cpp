@@ -0,0 +1,192 @@
+#include "DDSFile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+static const uint32_t DDS_MAGIC = 0x20534444; //"DDS "
+static const uint32_t DDPF_FOURCC = 0x4;
+
+static uint32_t fourCC(const char* code)
+{
+	return (uint32_t)code[0] | ((uint32_t)code[1] << 8) | ((uint32_t)code[2] << 16) | ((uint32_t)code[3] << 24);
+}
+
+struct DDSPixelFormat
+{
+	uint32_t size;
+	uint32_t flags;
+	uint32_t fourCC;
+	uint32_t rgbBitCount;
+	uint32_t rBitMask;
+	uint32_t gBitMask;
+	uint32_t bBitMask;
+	uint32_t aBitMask;
+};
+
+struct DDSHeader
+{
+	uint32_t size;
+	uint32_t flags;
+	uint32_t height;
+	uint32_t width;
+	uint32_t pitchOrLinearSize;
+	uint32_t depth;
+	uint32_t mipMapCount;
+	uint32_t reserved1[11];
+	DDSPixelFormat format;
+	uint32_t caps;
+	uint32_t caps2;
+	uint32_t caps3;
+	uint32_t caps4;
+	uint32_t reserved2;
+};
+
+struct DDSHeaderDX10
+{
+	uint32_t dxgiFormat;
+	uint32_t resourceDimension;
+	uint32_t miscFlag;
+	uint32_t arraySize;
+	uint32_t miscFlags2;
+};
+
+//Only the DXGI formats that map onto BCn are recognised.
+static VkFormat formatFromDXGI(uint32_t dxgi)
+{
+	switch (dxgi)
+	{
+	case 71: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	case 72: return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+	case 74: return VK_FORMAT_BC2_UNORM_BLOCK;
+	case 75: return VK_FORMAT_BC2_SRGB_BLOCK;
+	case 77: return VK_FORMAT_BC3_UNORM_BLOCK;
+	case 78: return VK_FORMAT_BC3_SRGB_BLOCK;
+	case 80: return VK_FORMAT_BC4_UNORM_BLOCK;
+	case 81: return VK_FORMAT_BC4_SNORM_BLOCK;
+	case 83: return VK_FORMAT_BC5_UNORM_BLOCK;
+	case 84: return VK_FORMAT_BC5_SNORM_BLOCK;
+	case 98: return VK_FORMAT_BC7_UNORM_BLOCK;
+	case 99: return VK_FORMAT_BC7_SRGB_BLOCK;
+	}
+
+	return VK_FORMAT_UNDEFINED;
+}
+
+static VkFormat formatFromFourCC(uint32_t code)
+{
+	if (code == fourCC("DXT1")) return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	if (code == fourCC("DXT3")) return VK_FORMAT_BC2_UNORM_BLOCK;
+	if (code == fourCC("DXT5")) return VK_FORMAT_BC3_UNORM_BLOCK;
+	if (code == fourCC("ATI1") || code == fourCC("BC4U")) return VK_FORMAT_BC4_UNORM_BLOCK;
+	if (code == fourCC("ATI2") || code == fourCC("BC5U")) return VK_FORMAT_BC5_UNORM_BLOCK;
+
+	return VK_FORMAT_UNDEFINED;
+}
+
+static uint32_t blockBytes(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+	case VK_FORMAT_BC4_SNORM_BLOCK:
+		return 8;
+	default:
+		return 16;
+	}
+}
+
+DDSFile::DDSFile() : _format(VK_FORMAT_UNDEFINED), _width(0), _height(0)
+{
+
+}
+
+bool DDSFile::load(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::in | std::ios::ate);
+	if (!file)
+		return false;
+
+	const size_t fileSize = (size_t)file.tellg();
+	if (fileSize < sizeof(uint32_t) + sizeof(DDSHeader))
+		return false;
+
+	file.seekg(0);
+
+	uint32_t magic = 0;
+	DDSHeader header;
+	file.read((char*)&magic, sizeof(magic));
+	file.read((char*)&header, sizeof(header));
+
+	if (magic != DDS_MAGIC || header.size != sizeof(DDSHeader) || !(header.format.flags & DDPF_FOURCC))
+		return false;
+
+	size_t dataStart = sizeof(uint32_t) + sizeof(DDSHeader);
+
+	if (header.format.fourCC == fourCC("DX10"))
+	{
+		DDSHeaderDX10 dx10;
+		if (fileSize < dataStart + sizeof(dx10))
+			return false;
+
+		file.read((char*)&dx10, sizeof(dx10));
+		dataStart += sizeof(dx10);
+
+		//Arrays, cubemaps and volumes aren't needed for material textures.
+		if (dx10.arraySize > 1)
+			return false;
+
+		_format = formatFromDXGI(dx10.dxgiFormat);
+	}
+	else
+		_format = formatFromFourCC(header.format.fourCC);
+
+	if (_format == VK_FORMAT_UNDEFINED || header.width == 0 || header.height == 0)
+		return false;
+
+	_width = header.width;
+	_height = header.height;
+
+	const uint32_t levels = (std::max)(header.mipMapCount, 1u);
+	const uint32_t bytes = blockBytes(_format);
+
+	_offsets.clear();
+	_sizes.clear();
+
+	VkDeviceSize offset = 0;
+	uint32_t width = _width;
+	uint32_t height = _height;
+
+	for (uint32_t i = 0; i < levels; ++i)
+	{
+		const VkDeviceSize size = (VkDeviceSize)((width + 3) / 4) * ((height + 3) / 4) * bytes;
+
+		_offsets.push_back(offset);
+		_sizes.push_back(size);
+		offset += size;
+
+		width = (std::max)(width / 2, 1u);
+		height = (std::max)(height / 2, 1u);
+	}
+
+	if (fileSize < dataStart + offset)
+		return false;
+
+	_data.resize((size_t)offset);
+	file.read((char*)_data.data(), offset);
+
+	return file.good();
+}
+
+std::string DDSFile::pathFor(const std::string& sourcePath)
+{
+	const size_t dot = sourcePath.find_last_of('.');
+	const size_t slash = sourcePath.find_last_of("/\\");
+
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return sourcePath + ".dds";
+
+	return sourcePath.substr(0, dot) + ".dds";
+}
\ No newline at end of file
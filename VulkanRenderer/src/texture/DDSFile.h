@@ -0,0 +1,60 @@
+#ifndef DDS_FILE_H_
+#define DDS_FILE_H_
+
+#include <vulkan/vulkan.h>
+#include <string>
+#include <vector>
+
+//Reader for block-compressed (BC1-BC7) DDS files, such as those written by TextureConverter.
+//Only single 2D images are supported; every mip level present in the file is kept.
+class DDSFile
+{
+public:
+	DDSFile();
+
+	bool load(const std::string& path);
+
+	//The .dds that would sit next to a source image, e.g. foo/bar.tga -> foo/bar.dds
+	static std::string pathFor(const std::string& sourcePath);
+
+	inline VkFormat format() const
+	{
+		return _format;
+	}
+
+	inline uint32_t width() const
+	{
+		return _width;
+	}
+
+	inline uint32_t height() const
+	{
+		return _height;
+	}
+
+	inline uint32_t levels() const
+	{
+		return (uint32_t)_offsets.size();
+	}
+
+	inline const uint8_t* level(uint32_t idx) const
+	{
+		return _data.data() + _offsets[idx];
+	}
+
+	inline VkDeviceSize levelSize(uint32_t idx) const
+	{
+		return _sizes[idx];
+	}
+
+private:
+	std::vector<uint8_t> _data;
+	std::vector<VkDeviceSize> _offsets;
+	std::vector<VkDeviceSize> _sizes;
+
+	VkFormat _format;
+	uint32_t _width;
+	uint32_t _height;
+};
+
+#endif //DDS_FILE_H_
\ No newline at end of file
@@ -4,6 +4,14 @@
 #include "Texture.h"
 #include "../Renderer.h"
 #include "TextureCache.h"
+#include "DDSFile.h"
+#include "../UploadBatch.h"
+
+#include <algorithm>
+#include <cstring>
+
+bool Texture::_compressionEnabled = false;
+bool Texture::_mipmapsEnabled = true;
 
 static bool isDepthFormat(VkFormat format)
 {
@@ -22,15 +30,16 @@ static bool isDepthFormat(VkFormat format)
 
 Texture::Texture(const std::string& path, Renderer* renderer)
 	: _path(path), _format(VK_FORMAT_R8G8B8A8_UNORM), _set(VK_NULL_HANDLE),
-	_layers(1), _viewType(VK_IMAGE_VIEW_TYPE_2D_ARRAY), _width(0), _height(0)
+	_layers(1), _viewType(VK_IMAGE_VIEW_TYPE_2D_ARRAY), _width(0), _height(0), _mipLevels(1),
+	_image(VK_NULL_HANDLE), _decoded(false)
 {
 	load(renderer);
 }
 
 Texture::Texture(uint32_t width, uint32_t height, VkFormat format, 
-	VkImageViewType viewType, Renderer* renderer) 
-	: _path(""), _width(width), _height(height), _format(format), _layers(1),
-	_viewType(viewType)
+	VkImageViewType viewType, Renderer* renderer, uint8_t layers) 
+	: _path(""), _width(width), _height(height), _format(format), _layers(layers),
+	_viewType(viewType), _mipLevels(1), _image(VK_NULL_HANDLE), _decoded(false)
 {
 	//TODO: HACK. move this to a different type of Texture.
 	_createInMemory(renderer);
@@ -42,7 +51,7 @@ Texture::~Texture()
 		vkDestroyImageView(Renderer::device(), v, nullptr);
 
 	vkDestroyImage(Renderer::device(), _image, nullptr);
-	vkFreeMemory(Renderer::device(), _memory, nullptr);
+	Renderer::allocator().free(_memory);
 }
 
 void Texture::bind(Renderer* renderer, VkDescriptorSet set, uint32_t binding,
@@ -60,51 +69,94 @@ void Texture::bind(Renderer* renderer, VkDescriptorSet set, uint32_t binding,
 		_updateSet(renderer, set, binding, index);
 }
 
+bool Texture::decode()
+{
+	if (!_decoded)
+		_decoded = _decode();
+
+	return _decoded;
+}
+
 bool Texture::load(Renderer* renderer)
 {
+	if (!decode())
+		return false;
+
+	UploadBatch batch(*renderer);
+	upload(renderer, batch);
+	batch.submit();
+	batch.wait();
+
+	return true;
+}
+
+VkDeviceSize Texture::stagingSize(Renderer* renderer) const
+{
+	std::vector<VkBufferImageCopy> copies;
+	return _copies(_usesBlit(renderer), copies);
+}
+
+void Texture::upload(Renderer* renderer, UploadBatch& batch)
+{
+	assert(_decoded);
+
 	VkImageCreateInfo info = {};
-	_createImage(renderer, info);
+	_createImage(info);
 
 	assert(_image);
-	if (!_image)
-		return false;
-
 	_allocBindImageMemory(renderer);
 
 	VkImageSubresourceRange range = {};
 	range.layerCount = _layers;
-	range.levelCount = 1;
+	range.levelCount = _mipLevels;
 	range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 
-	renderer->setImageLayout(_image, _format, info.initialLayout, 
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, range);
+	VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = _image;
+	barrier.subresourceRange = range;
+	barrier.oldLayout = info.initialLayout;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(batch.commandBuffer(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	const bool blit = _usesBlit(renderer);
 
 	std::vector<VkBufferImageCopy> copies;
+	const Buffer& staging = batch.stage(_copies(blit, copies));
 
-	for (size_t i = 0; i < _extents.size(); ++i)
+	uint8_t* mapped = staging.memory.mapped;
+
+	if (!_dds.empty())
 	{
-		VkBufferImageCopy copy = {};
-		copy.imageExtent = _extents[i];
-		copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		copy.imageSubresource.baseArrayLayer = (uint32_t)i;
-		copy.imageSubresource.layerCount = 1;
-		copy.bufferOffset = i * (_width * _height * 4);
-		copy.bufferImageHeight = _extents[i].height;
-		copy.bufferRowLength = _extents[i].width;
-		copy.imageSubresource.mipLevel = 0;
-
-		copies.push_back(copy);
+		for (const VkBufferImageCopy& copy : copies)
+		{
+			const DDSFile& file = _dds[copy.imageSubresource.baseArrayLayer];
+			const uint32_t level = copy.imageSubresource.mipLevel;
+			memcpy(mapped + copy.bufferOffset, file.level(level), (size_t)file.levelSize(level));
+		}
 	}
+	else if (blit)
+	{
+		for (const VkBufferImageCopy& copy : copies)
+		{
+			const std::vector<uint8_t>& pixels = _pixels[copy.imageSubresource.baseArrayLayer];
+			memcpy(mapped + copy.bufferOffset, pixels.data(), pixels.size());
+		}
+	}
+	else
+		_downsample(mapped, copies);
 
-	VkCommandBuffer cmd = renderer->startOneShotCmdBuffer();
-	vkCmdCopyBufferToImage(cmd, _staging.buffer, _image, 
+	vkCmdCopyBufferToImage(batch.commandBuffer(), staging.buffer, _image,
 		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)copies.size(),
 		copies.data());
-	renderer->submitOneShotCmdBuffer(cmd);
 
-	renderer->setImageLayout(_image, _format, 
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 
-		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, range);
+	//Blits need the graphics queue.
+	batch.transferImage(_image, range, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+	_generateMips(batch.graphicsCommandBuffer(), blit);
 
 	VkImageViewCreateInfo view = {};
 	view.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -118,7 +170,9 @@ bool Texture::load(Renderer* renderer)
 	_views.resize(1);
 	VkCheck(vkCreateImageView(Renderer::device(), &view, nullptr, &_views[0]));
 
-	return true;
+	//Everything is in staging now.
+	std::vector<std::vector<uint8_t>>().swap(_pixels);
+	std::vector<DDSFile>().swap(_dds);
 }
 
 void Texture::unbind(Renderer* renderer, VkDescriptorSet set, uint32_t binding,
@@ -142,21 +196,17 @@ void Texture::unbind(Renderer* renderer, VkDescriptorSet set, uint32_t binding,
 
 void Texture::setImageData(Renderer* renderer, void* data, size_t len)
 {
-	VkBufferCreateInfo buff = {};
-	buff.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	buff.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-	buff.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-	buff.size = len;
-	renderer->createAndBindBuffer(buff, _staging, 
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	_staging.copyData(data, len, 0);
+	UploadBatch batch(*renderer);
+
+	const Buffer& staging = batch.stage(len);
+	staging.copyData(data, len, 0);
 
 	VkImageSubresourceRange range = {};
 	range.layerCount = _layers;
 	range.levelCount = 1;
 	range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 
-	renderer->setImageLayout(_image, _format, VK_IMAGE_LAYOUT_UNDEFINED, 
+	UploadBatch::setImageLayout(batch.commandBuffer(), _image, VK_IMAGE_LAYOUT_UNDEFINED,
 		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, range);
 
 	VkBufferImageCopy copy = {};
@@ -169,69 +219,118 @@ void Texture::setImageData(Renderer* renderer, void* data, size_t len)
 	copy.bufferImageHeight = _height;
 	copy.bufferRowLength = _width;
 
-	VkCommandBuffer cmd = renderer->startOneShotCmdBuffer();
-	vkCmdCopyBufferToImage(cmd, _staging.buffer, _image, 
+	vkCmdCopyBufferToImage(batch.commandBuffer(), staging.buffer, _image,
 		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
-	renderer->submitOneShotCmdBuffer(cmd);
 
-	renderer->setImageLayout(_image, _format, 
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 
+	batch.transferImage(_image, range, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+	UploadBatch::setImageLayout(batch.graphicsCommandBuffer(), _image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
 		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, range);
+
+	//Only used while setting up render passes, which sample the image straight away.
+	batch.submit();
+	batch.wait();
+}
+
+void Texture::enableCompression(bool enable)
+{
+	_compressionEnabled = enable;
+}
+
+void Texture::enableMipmaps(bool enable)
+{
+	_mipmapsEnabled = enable;
 }
 
 void Texture::_allocBindImageMemory(Renderer* renderer)
 {
-	VkMemoryRequirements memReq;
-	vkGetImageMemoryRequirements(Renderer::device(), _image, &memReq);
-
-	VkMemoryAllocateInfo alloc = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-	alloc.allocationSize = memReq.size;
-	alloc.memoryTypeIndex = renderer->getMemoryTypeIndex(memReq.memoryTypeBits,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	VkCheck(vkAllocateMemory(Renderer::device(), &alloc, nullptr, &_memory));
-	VkCheck(vkBindImageMemory(Renderer::device(), _image, _memory, 0));
+	renderer->allocateImageMemory(_image, _memory);
 }
 
-void Texture::_createImage(Renderer* renderer, VkImageCreateInfo& info)
+bool Texture::_canBlit(Renderer* renderer) const
 {
-	int channels;
-	stbi_uc* tex = stbi_load(_path.c_str(), (int*)&_width, (int*)&_height,
-		&channels, STBI_rgb_alpha);
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties(renderer->physicalDevice(), _format, &properties);
 
-	if (!tex)
-		return;
+	const VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_BLIT_SRC_BIT |
+		VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
 
-	//Force an alpha channel to be allocated even if we don't need one.
-	VkDeviceSize size = _width * _height * 4;
+	return (properties.optimalTilingFeatures & needed) == needed;
+}
 
-	VkExtent3D extent = { _width, _height, 1 };
-	_extents.push_back(extent);
+uint32_t Texture::_chainLength() const
+{
+	if (!_mipmapsEnabled)
+		return 1;
 
-	VkBufferCreateInfo buff = {};
-	buff.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	buff.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-	buff.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-	buff.size = size * 1;
+	uint32_t levels = 1;
+	for (uint32_t dim = (std::max)(_width, _height); dim > 1; dim /= 2)
+		levels++;
 
-	renderer->createAndBindBuffer(buff, _staging, 
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	_staging.copyData((void*)tex, size);
+	return levels;
+}
 
-	stbi_image_free(tex);
+VkDeviceSize Texture::_copies(bool blit, std::vector<VkBufferImageCopy>& copies) const
+{
+	VkDeviceSize size = 0;
+	for (size_t i = 0; i < _extents.size(); ++i)
+	{
+		uint32_t width = _extents[i].width;
+		uint32_t height = _extents[i].height;
+
+		const uint32_t levels = blit ? 1 : _mipLevels;
+		for (uint32_t level = 0; level < levels; ++level)
+		{
+			//Block-compressed rows are tightly packed, so the row length and height stay at 0.
+			VkBufferImageCopy copy = {};
+			copy.imageExtent = { width, height, 1 };
+			copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			copy.imageSubresource.baseArrayLayer = (uint32_t)i;
+			copy.imageSubresource.layerCount = 1;
+			copy.imageSubresource.mipLevel = level;
+			copy.bufferOffset = size;
+
+			if (_dds.empty())
+			{
+				copy.bufferImageHeight = height;
+				copy.bufferRowLength = width;
+				size += width * height * 4;
+			}
+			else
+				size += _dds[i].levelSize(level);
+
+			copies.push_back(copy);
+
+			width = (std::max)(width / 2, 1u);
+			height = (std::max)(height / 2, 1u);
+		}
+	}
 
+	return size;
+}
+
+void Texture::_createImage(VkImageCreateInfo& info)
+{
 	info = {};
 	info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
 	info.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+
+	if (_viewType == VK_IMAGE_VIEW_TYPE_CUBE)
+		info.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
+
 	info.imageType = VK_IMAGE_TYPE_2D;
-	info.extent = extent;
-	info.arrayLayers = 1;
-	info.mipLevels = 1;
+	info.extent = { _width, _height, 1 };
+	info.arrayLayers = _layers;
+	info.mipLevels = _mipLevels;
 	info.format = _format;
 	info.tiling = VK_IMAGE_TILING_OPTIMAL;
 	info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 	info.samples = VK_SAMPLE_COUNT_1_BIT;
 
+	//Each level is blitted from the one above it.
+	if (_mipLevels > 1 && _dds.empty())
+		info.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+
 	VkCheck(vkCreateImage(Renderer::device(), &info, nullptr, &_image));
 }
 
@@ -242,7 +341,7 @@ void Texture::_createInMemory(Renderer* renderer)
 	VkExtent3D extent = { _width, _height, 1 };
 	_extents.push_back(extent);
 
-	const uint32_t layers = (_viewType == VK_IMAGE_VIEW_TYPE_CUBE) ? 6 : 1;
+	const uint32_t layers = (_viewType == VK_IMAGE_VIEW_TYPE_CUBE) ? 6 : _layers;
 
 	VkImageCreateInfo info = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
 	info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
@@ -298,6 +397,198 @@ void Texture::_createInMemory(Renderer* renderer)
 		renderer->allocateTextureDescriptor(_set, b);
 }
 
+bool Texture::_decode()
+{
+	return _decodeLayers({ _path });
+}
+
+bool Texture::_decodeCompressed(const std::vector<std::string>& paths)
+{
+	if (!_compressionEnabled)
+		return false;
+
+	std::vector<DDSFile> files(paths.size());
+	for (size_t i = 0; i < paths.size(); ++i)
+	{
+		if (paths[i].empty() || !files[i].load(DDSFile::pathFor(paths[i])))
+			return false;
+
+		const DDSFile& first = files[0];
+		if (files[i].format() != first.format() || files[i].width() != first.width() ||
+			files[i].height() != first.height() || files[i].levels() != first.levels())
+			return false;
+	}
+
+	_dds.swap(files);
+
+	const DDSFile& first = _dds[0];
+	_format = first.format();
+	_width = first.width();
+	_height = first.height();
+	_mipLevels = _mipmapsEnabled ? first.levels() : 1;
+
+	_extents.assign(_dds.size(), { _width, _height, 1 });
+
+	return true;
+}
+
+bool Texture::_decodeLayers(const std::vector<std::string>& paths)
+{
+	if (_decodeCompressed(paths))
+		return true;
+
+	_pixels.resize(paths.size());
+	_extents.assign(paths.size(), { 0, 0, 1 });
+
+	for (size_t i = 0; i < paths.size(); ++i)
+	{
+		if (paths[i].empty())
+			continue;
+
+		int width, height, channels;
+
+		//Force an alpha channel to be allocated even if we don't need one.
+		stbi_uc* tex = stbi_load(paths[i].c_str(), &width, &height, &channels, STBI_rgb_alpha);
+		if (!tex)
+			continue;
+
+		_pixels[i].assign(tex, tex + width * height * 4);
+		stbi_image_free(tex);
+
+		_extents[i] = { (uint32_t)width, (uint32_t)height, 1 };
+		_width = (std::max)(_width, (uint32_t)width);
+		_height = (std::max)(_height, (uint32_t)height);
+	}
+
+	if (_width == 0 || _height == 0)
+	{
+		_pixels.clear();
+		_extents.clear();
+		return false;
+	}
+
+	//TODO: if an image is < stride then we need to somehow communicate re-normalised UVs to the shader.
+	//TODO: could pack empty layers tighter.
+	for (size_t i = 0; i < paths.size(); ++i)
+	{
+		if (_pixels[i].empty())
+		{
+			_extents[i] = { _width, _height, 1 };
+			_pixels[i].assign(_width * _height * 4, 0);
+		}
+	}
+
+	_mipLevels = _chainLength();
+
+	return true;
+}
+
+void Texture::_downsample(uint8_t* staging, const std::vector<VkBufferImageCopy>& copies) const
+{
+	//2x2 box filter of RGBA8 texels, clamping at the edges of odd-sized levels.
+	for (size_t c = 0; c < copies.size(); ++c)
+	{
+		const VkBufferImageCopy& dst = copies[c];
+		uint8_t* out = staging + dst.bufferOffset;
+
+		if (dst.imageSubresource.mipLevel == 0)
+		{
+			const std::vector<uint8_t>& pixels = _pixels[dst.imageSubresource.baseArrayLayer];
+			memcpy(out, pixels.data(), pixels.size());
+			continue;
+		}
+
+		const VkBufferImageCopy& src = copies[c - 1];
+		const uint8_t* in = staging + src.bufferOffset;
+		const uint32_t srcWidth = src.imageExtent.width;
+		const uint32_t srcHeight = src.imageExtent.height;
+
+		for (uint32_t y = 0; y < dst.imageExtent.height; ++y)
+		{
+			const uint32_t y0 = (std::min)(y * 2, srcHeight - 1);
+			const uint32_t y1 = (std::min)(y * 2 + 1, srcHeight - 1);
+
+			for (uint32_t x = 0; x < dst.imageExtent.width; ++x)
+			{
+				const uint32_t x0 = (std::min)(x * 2, srcWidth - 1);
+				const uint32_t x1 = (std::min)(x * 2 + 1, srcWidth - 1);
+
+				for (uint32_t ch = 0; ch < 4; ++ch)
+				{
+					const uint32_t sum = in[(y0 * srcWidth + x0) * 4 + ch] + in[(y0 * srcWidth + x1) * 4 + ch] +
+						in[(y1 * srcWidth + x0) * 4 + ch] + in[(y1 * srcWidth + x1) * 4 + ch];
+
+					out[(y * dst.imageExtent.width + x) * 4 + ch] = (uint8_t)((sum + 2) / 4);
+				}
+			}
+		}
+	}
+}
+
+void Texture::_generateMips(VkCommandBuffer cmd, bool blit) const
+{
+	VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = _image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.layerCount = _layers;
+	barrier.subresourceRange.levelCount = 1;
+
+	int32_t width = (int32_t)_width;
+	int32_t height = (int32_t)_height;
+
+	//Each level goes DST -> SRC once written, feeds the next level, then is handed to the shaders.
+	for (uint32_t level = 1; blit && level < _mipLevels; ++level)
+	{
+		barrier.subresourceRange.baseMipLevel = level - 1;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		VkImageBlit region = {};
+		region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, _layers };
+		region.srcOffsets[1] = { width, height, 1 };
+
+		width = (std::max)(width / 2, 1);
+		height = (std::max)(height / 2, 1);
+
+		region.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, _layers };
+		region.dstOffsets[1] = { width, height, 1 };
+
+		vkCmdBlitImage(cmd, _image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region, VK_FILTER_LINEAR);
+
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+
+	//Whatever hasn't been blitted from is still a copy/blit destination.
+	barrier.subresourceRange.baseMipLevel = blit ? _mipLevels - 1 : 0;
+	barrier.subresourceRange.levelCount = blit ? 1 : _mipLevels;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+bool Texture::_usesBlit(Renderer* renderer) const
+{
+	return _dds.empty() && ((_mipLevels == 1) || _canBlit(renderer));
+}
+
 void Texture::_updateSet(Renderer* renderer, VkDescriptorSet set, 
 	uint32_t binding, uint32_t index)
 {
@@ -7,32 +7,70 @@
 
 #include "../SetBinding.h"
 #include "../Buffer.h"
+#include "DDSFile.h"
 
 class Renderer;
+class UploadBatch;
 
 class Texture
 {
 public:
 	Texture(const std::string& path, Renderer* renderer);
 
+	//Layers only applies to array view types; a cube always has six.
 	Texture(uint32_t width, uint32_t height, VkFormat format, 
-		VkImageViewType viewType, Renderer* renderer);
+		VkImageViewType viewType, Renderer* renderer, uint8_t layers = 1);
 
-	~Texture();
+	virtual ~Texture();
 
 	void bind(Renderer* renderer, VkDescriptorSet set = VK_NULL_HANDLE, uint32_t binding = 0, uint32_t index = 0);
 
+	//Reads and decodes the source images into memory. Touches no Vulkan state, so it's
+	//safe to call from a worker thread; returns false if nothing could be read.
+	bool decode();
+
+	//Decodes if needed, then uploads in a batch of its own and waits for the copy.
 	bool load(Renderer* renderer);
 
+	//Bytes of staging memory upload() needs; only valid once decoded.
+	VkDeviceSize stagingSize(Renderer* renderer) const;
+
+	//Creates the image and records its upload into batch. The decoded data is released
+	//afterwards, so it can only be called once.
+	void upload(Renderer* renderer, UploadBatch& batch);
+
 	void unbind(Renderer* renderer, VkDescriptorSet set = VK_NULL_HANDLE, uint32_t binding = 0, uint32_t index = 0);
 
 	void setImageData(Renderer* renderer, void* data, size_t len);
 
+	//Set by the Renderer from the device's textureCompressionBC feature.
+	static void enableCompression(bool enable);
+
+	//Applies to textures loaded after the call; used to compare against full mip chains.
+	static void enableMipmaps(bool enable);
+
+	//Size of the image's memory; 0 until it's been uploaded.
+	inline VkDeviceSize memorySize() const
+	{
+		return _memory.size;
+	}
+
+	//True once the image has been uploaded and can be sampled.
+	inline bool resident() const
+	{
+		return !_views.empty();
+	}
+
 	inline const VkDescriptorSet& set() const
 	{
 		return _set;
 	}
 
+	inline VkImage image() const
+	{
+		return _image;
+	}
+
 	inline const VkImageView view() const
 	{
 		return _views[0];
@@ -45,13 +83,14 @@ public:
 
 protected:
 	Texture(uint8_t layers, VkImageViewType type = VK_IMAGE_VIEW_TYPE_2D_ARRAY) 
-		: _path(""), _layers(layers), _viewType(type),
-		_format(VK_FORMAT_R8G8B8A8_UNORM), _width(0), _height(0)
+		: _path(""), _layers(layers), _viewType(type), _set(VK_NULL_HANDLE),
+		_format(VK_FORMAT_R8G8B8A8_UNORM), _width(0), _height(0), _mipLevels(1),
+		_image(VK_NULL_HANDLE), _decoded(false)
 	{};
 
 	std::vector<VkImageView> _views;
 	VkImage _image;
-	VkDeviceMemory _memory;
+	Allocation _memory;
 	VkDescriptorSet _set;
 
 	//Individual dimensions of each image used by this Texture
@@ -60,25 +99,60 @@ protected:
 	//Maximum dimensions (i.e. stride) of all images used by this Texture
 	uint32_t _width;
 	uint32_t _height;
+	uint32_t _mipLevels;
 	
 	VkFormat _format;
 	VkImageViewType _viewType;
 	const uint8_t _layers;
 
-	Buffer _staging;
+	//Decoded RGBA8 level 0 of each layer, tightly packed at that layer's extent.
+	std::vector<std::vector<uint8_t>> _pixels;
+
+	//Precompressed layers; when present these are uploaded instead of _pixels.
+	std::vector<DDSFile> _dds;
+
+	bool _decoded;
 
 	void _allocBindImageMemory(Renderer* renderer);
 
+	//Number of levels to create for an image of the current dimensions.
+	uint32_t _chainLength() const;
+
+	void _createImage(VkImageCreateInfo& info);
+
 	//TODO: make Texture abstract and rename existing Texture to Texture2D
-	virtual void _createImage(Renderer* renderer, VkImageCreateInfo& info) /*= 0*/;
+	virtual bool _decode() /*= 0*/;
+
+	//Uses the precompressed .dds next to each path if the device can sample BCn and
+	//all of them agree on format, size and level count. Returns false to fall back to RGBA8.
+	bool _decodeCompressed(const std::vector<std::string>& paths);
+
+	//One layer per path; empty or unreadable paths become blank layers of the largest size.
+	bool _decodeLayers(const std::vector<std::string>& paths);
 
 	void _updateSet(Renderer* renderer, VkDescriptorSet set, uint32_t binding = 0, uint32_t index = 0);
 
 private:
 	std::string _path;
 
+	static bool _compressionEnabled;
+	static bool _mipmapsEnabled;
+
+	bool _canBlit(Renderer* renderer) const;
+
+	//Lays out every copy upload() makes, relative to the start of its staging range.
+	//Returns the total size.
+	VkDeviceSize _copies(bool blit, std::vector<VkBufferImageCopy>& copies) const;
+
 	//TODO: move to DynamicTexture, DepthTexture, etc. or similar class
 	void _createInMemory(Renderer* renderer);
+
+	void _downsample(uint8_t* staging, const std::vector<VkBufferImageCopy>& copies) const;
+	void _generateMips(VkCommandBuffer cmd, bool blit) const;
+
+	//Blit the chain on the GPU where the format allows, otherwise it's built on the CPU.
+	//Precompressed images already carry their chain.
+	bool _usesBlit(Renderer* renderer) const;
 };
 
 #endif //TEXTURE_H_
\ No newline at end of file
@@ -12,7 +12,7 @@ public:
 	~TextureArray();
 
 protected:
-	void _createImage(Renderer* renderer, VkImageCreateInfo& info) override;
+	bool _decode() override;
 	
 private:
 	std::vector<std::string> _paths;
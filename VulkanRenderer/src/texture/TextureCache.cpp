@@ -1,3 +1,100 @@
 #include "TextureCache.h"
+#include "TextureArray.h"
+#include "TextureLoader.h"
 
-std::unordered_map<std::string, Texture*> TextureCache::_textureCache;
\ No newline at end of file
+#include <algorithm>
+#include <cstdio>
+
+std::unordered_map<std::string, TextureCache::Entry> TextureCache::_textureCache;
+uint32_t TextureCache::_hits = 0;
+uint32_t TextureCache::_misses = 0;
+
+Texture* const TextureCache::getTexture(const std::string& texturePath, Renderer& renderer)
+{
+	const std::string key = _key(texturePath);
+
+	auto it = _textureCache.find(key);
+	if (it != _textureCache.end())
+	{
+		//Acquired textures may still be waiting on the loader.
+		if (!it->second.texture->resident())
+			renderer.textureLoader().flush();
+
+		//Outlives every acquire() of the same path. Not a reference of its own, so fetching
+		//the placeholder for each slot doesn't count as sharing it.
+		it->second.permanent = true;
+		return it->second.texture;
+	}
+
+	Texture* texture = new Texture(texturePath, &renderer);
+	_textureCache[key] = { texture, 0, true };
+
+	return texture;
+}
+
+Texture* TextureCache::acquire(const std::string& texturePath, Renderer& renderer,
+	VkDescriptorSet set, uint32_t binding, uint32_t index)
+{
+	const std::string key = _key(texturePath);
+
+	auto it = _textureCache.find(key);
+	if (it != _textureCache.end())
+	{
+		_hits++;
+		it->second.refs++;
+	}
+	else
+	{
+		_misses++;
+		Entry entry = { new TextureArray({ texturePath }, &renderer), 1, false };
+		it = _textureCache.insert(TextureCachePair(key, entry)).first;
+	}
+
+	renderer.textureLoader().load(it->second.texture, set, binding, index);
+
+	return it->second.texture;
+}
+
+void TextureCache::release(Texture* texture, Renderer& renderer)
+{
+	for (auto it = _textureCache.begin(); it != _textureCache.end(); ++it)
+	{
+		if (it->second.texture != texture)
+			continue;
+
+		assert(it->second.refs > 0);
+		if (--it->second.refs == 0 && !it->second.permanent)
+		{
+			renderer.textureLoader().cancel(texture);
+			delete texture;
+			_textureCache.erase(it);
+		}
+
+		return;
+	}
+}
+
+void TextureCache::printStats()
+{
+	//Every acquire() beyond the first would otherwise have been a copy of its own.
+	VkDeviceSize saved = 0;
+	for (const TextureCachePair& pair : _textureCache)
+	{
+		if (pair.second.refs > 1)
+			saved += pair.second.texture->memorySize() * (pair.second.refs - 1);
+	}
+
+	const uint32_t requests = _hits + _misses;
+	const float hitRate = requests ? (float)_hits / requests * 100.0f : 0.0f;
+
+	printf("Texture cache: %u textures, %u hits, %u misses (%.1f%% hit rate), %llu KB saved\n",
+		(uint32_t)_textureCache.size(), _hits, _misses, hitRate, saved / 1024);
+}
+
+std::string TextureCache::_key(const std::string& path)
+{
+	std::string key = path;
+	std::replace(key.begin(), key.end(), '\\', '/');
+
+	return key;
+}
\ No newline at end of file
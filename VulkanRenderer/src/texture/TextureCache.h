@@ -6,6 +6,9 @@
 #include "../Renderer.h"
 #include "Texture.h"
 
+//Shares textures between every material and model that refers to the same file.
+//Acquired entries are reference counted and destroyed once the last user releases them;
+//getTexture() entries are permanent.
 struct TextureCache final
 {
 	TextureCache& operator=(const TextureCache&) = delete;
@@ -17,34 +20,49 @@ struct TextureCache final
 
 	}
 
-	static Texture* const getTexture(const std::string& texturePath, Renderer& renderer)
-	{
-		if (_textureCache.find(texturePath) != _textureCache.end())
-			return _textureCache[texturePath];
+	//Loads the texture synchronously and keeps it until shutdown.
+	static Texture* const getTexture(const std::string& texturePath, Renderer& renderer);
 
-		_loadTexture(texturePath, renderer);
+	//Returns the texture for path, queueing it with the texture loader if it isn't cached yet.
+	//Either way it ends up bound at (set, binding, index) once it's resident.
+	static Texture* acquire(const std::string& texturePath, Renderer& renderer,
+		VkDescriptorSet set, uint32_t binding, uint32_t index);
 
-		return _textureCache[texturePath];
-	}
+	//Drops a reference taken by acquire().
+	static void release(Texture* texture, Renderer& renderer);
+
+	static void printStats();
 
 	static void shutdown()
 	{
 		for (TextureCachePair& pair : _textureCache)
 		{
-			delete pair.second;
+			delete pair.second.texture;
 		}
 
 		_textureCache.clear();
+		_hits = 0;
+		_misses = 0;
 	}
 
 private:
-	typedef std::pair<const std::string, Texture*> TextureCachePair;
-	static std::unordered_map<std::string, Texture*> _textureCache;
-
-	static void _loadTexture(const std::string& name, Renderer& renderer)
+	struct Entry
 	{
-		_textureCache[name] = new Texture(name, &renderer);
-	}
+		Texture* texture;
+		//acquire() references only.
+		uint32_t refs;
+		//Loaded by getTexture(), and kept until shutdown.
+		bool permanent;
+	};
+
+	typedef std::pair<const std::string, Entry> TextureCachePair;
+	static std::unordered_map<std::string, Entry> _textureCache;
+
+	static uint32_t _hits;
+	static uint32_t _misses;
+
+	//MTL files written on Windows often use backslashes.
+	static std::string _key(const std::string& path);
 };
 
 #endif //TEXTURE_CACHE_H_
\ No newline at end of file
@@ -0,0 +1,199 @@
+#include "TextureLoader.h"
+#include "Texture.h"
+#include "../JobSystem.h"
+#include "../Renderer.h"
+#include "../UploadBatch.h"
+
+#include <algorithm>
+
+TextureLoader::TextureLoader(Renderer& renderer, VkDeviceSize stagingBudget)
+	: _renderer(&renderer), _stagingBudget(stagingBudget)
+{
+
+}
+
+TextureLoader::~TextureLoader()
+{
+	while (!_requests.empty())
+		cancel(_requests.back()->texture);
+}
+
+void TextureLoader::load(Texture* texture, VkDescriptorSet set, uint32_t binding, uint32_t index)
+{
+	//Textures that have been recorded into a batch count as resident before their copies
+	//have finished, so outstanding requests have to be checked first.
+	for (const std::shared_ptr<Request>& pending : _requests)
+	{
+		if (pending->texture == texture)
+		{
+			pending->bindings.push_back({ set, binding, index });
+			return;
+		}
+	}
+
+	if (texture->resident())
+	{
+		texture->bind(_renderer, set, binding, index);
+		_renderer->markDescriptorsDirty(set);
+		return;
+	}
+
+	std::shared_ptr<Request> request = std::make_shared<Request>();
+	request->texture = texture;
+	request->bindings.push_back({ set, binding, index });
+	request->state = REQUEST_QUEUED;
+	request->decoded = false;
+
+	_requests.push_back(request);
+
+	//The job holds its own reference, so a request cancelled before it runs stays valid.
+	JobSystem::submit([request]()
+	{
+		{
+			std::lock_guard<std::mutex> lock(request->mutex);
+			if (request->state == REQUEST_CANCELLED)
+				return;
+
+			request->state = REQUEST_DECODING;
+		}
+
+		const bool decoded = request->texture->decode();
+
+		{
+			std::lock_guard<std::mutex> lock(request->mutex);
+			request->state = REQUEST_DECODED;
+			request->decoded = decoded;
+		}
+
+		request->done.notify_all();
+	});
+}
+
+void TextureLoader::cancel(Texture* texture)
+{
+	for (size_t i = 0; i < _requests.size(); ++i)
+	{
+		Request& request = *_requests[i];
+		if (request.texture != texture)
+			continue;
+
+		_wait(request, false);
+
+		//The copies into its image may still be running.
+		if (request.batch)
+			request.batch->wait();
+
+		{
+			std::lock_guard<std::mutex> lock(request.mutex);
+			request.state = REQUEST_CANCELLED;
+		}
+
+		_requests.erase(_requests.begin() + i);
+		return;
+	}
+}
+
+void TextureLoader::cancelBindings(VkDescriptorSet set)
+{
+	for (const std::shared_ptr<Request>& request : _requests)
+	{
+		std::vector<Binding>& bindings = request->bindings;
+		bindings.erase(std::remove_if(bindings.begin(), bindings.end(),
+			[set](const Binding& b) { return b.set == set; }), bindings.end());
+	}
+}
+
+bool TextureLoader::update()
+{
+	std::vector<std::shared_ptr<Request>> finished;
+	std::shared_ptr<UploadBatch> batch;
+
+	for (const std::shared_ptr<Request>& request : _requests)
+	{
+		if (request->batch)
+		{
+			if (request->batch->complete())
+				finished.push_back(request);
+
+			continue;
+		}
+
+		bool decoded;
+		{
+			std::lock_guard<std::mutex> lock(request->mutex);
+			if (request->state != REQUEST_DECODED)
+				continue;
+
+			decoded = request->decoded;
+		}
+
+		//A texture that couldn't be read keeps its placeholder.
+		if (!decoded)
+		{
+			finished.push_back(request);
+			continue;
+		}
+
+		Texture* texture = request->texture;
+		const VkDeviceSize size = texture->stagingSize(_renderer);
+
+		//The rest waits for the next update, but a batch always takes at least one
+		//texture so that nothing larger than the budget gets stuck.
+		if (batch && batch->stagedSize() + size > _stagingBudget)
+			break;
+
+		if (!batch)
+			batch = std::make_shared<UploadBatch>(*_renderer);
+
+		texture->upload(_renderer, *batch);
+		request->batch = batch;
+	}
+
+	//Each request keeps its batch alive until the copies have completed and it's bound.
+	if (batch)
+		batch->submit();
+
+	if (finished.empty())
+		return false;
+
+	//Frames in flight bind their own copies of the sets, so these writes don't wait for the
+	//GPU; each copy picks them up once its slot's fence has signalled.
+	for (const std::shared_ptr<Request>& request : finished)
+	{
+		if (request->decoded)
+		{
+			for (const Binding& b : request->bindings)
+			{
+				request->texture->bind(_renderer, b.set, b.binding, b.index);
+				_renderer->markDescriptorsDirty(b.set);
+			}
+		}
+
+		_requests.erase(std::find(_requests.begin(), _requests.end(), request));
+	}
+
+	return true;
+}
+
+void TextureLoader::flush()
+{
+	while (!_requests.empty())
+	{
+		Request& request = *_requests.front();
+		_wait(request, true);
+
+		if (request.batch)
+			request.batch->wait();
+
+		update();
+	}
+}
+
+void TextureLoader::_wait(Request& request, bool untilDecoded)
+{
+	std::unique_lock<std::mutex> lock(request.mutex);
+	request.done.wait(lock, [&request, untilDecoded]
+	{
+		return untilDecoded ? request.state == REQUEST_DECODED : request.state != REQUEST_DECODING;
+	});
+}
\ No newline at end of file
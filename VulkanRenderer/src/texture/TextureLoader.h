@@ -0,0 +1,96 @@
+#ifndef TEXTURE_LOADER_H_
+#define TEXTURE_LOADER_H_
+
+#include <vulkan/vulkan.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class Renderer;
+class Texture;
+class UploadBatch;
+
+//Decodes textures on the JobSystem's workers and uploads them from the main thread as
+//they finish. Each update submits one batch holding at most stagingBudget bytes of
+//staging memory, the rest streams in over the following frames, and textures are only
+//bound once their batch has completed. Until then whatever was already bound (a
+//placeholder) stays visible.
+class TextureLoader
+{
+public:
+	TextureLoader(Renderer& renderer, VkDeviceSize stagingBudget);
+	TextureLoader& operator=(const TextureLoader&) = delete;
+	TextureLoader(const TextureLoader&) = delete;
+	TextureLoader(TextureLoader&&) = delete;
+	~TextureLoader();
+
+	//Starts decoding texture; once uploaded it's bound at (set, binding, index). Textures
+	//already being loaded gain another binding, and resident ones are bound immediately.
+	void load(Texture* texture, VkDescriptorSet set, uint32_t binding, uint32_t index);
+
+	//Forgets any outstanding load of texture, waiting if a worker is decoding it right now.
+	//Must be called before a texture that was passed to load() is deleted.
+	void cancel(Texture* texture);
+
+	//Drops every pending binding into set, e.g. when its owner goes away.
+	void cancelBindings(VkDescriptorSet set);
+
+	//Binds textures whose uploads have completed and submits whatever has finished
+	//decoding since the last update. Returns true if any descriptors were written, in
+	//which case command buffers recorded up front have to be re-recorded.
+	bool update();
+
+	//Blocks until every texture requested so far is uploaded and bound.
+	void flush();
+
+	inline size_t pending() const
+	{
+		return _requests.size();
+	}
+
+private:
+	enum RequestState
+	{
+		REQUEST_QUEUED,
+		REQUEST_DECODING,
+		REQUEST_DECODED,
+		REQUEST_CANCELLED
+	};
+
+	struct Binding
+	{
+		VkDescriptorSet set;
+		uint32_t binding;
+		uint32_t index;
+	};
+
+	//Shared with the decode job, which only ever touches the texture, state and result.
+	struct Request
+	{
+		Texture* texture;
+		std::vector<Binding> bindings;
+
+		//Set once the texture has been uploaded; shared by everything submitted with it.
+		std::shared_ptr<UploadBatch> batch;
+
+		//Guarded by mutex
+		RequestState state;
+		bool decoded;
+
+		std::mutex mutex;
+		std::condition_variable done;
+	};
+
+	Renderer* _renderer;
+	VkDeviceSize _stagingBudget;
+
+	//In submission order; only touched by the main thread.
+	std::vector<std::shared_ptr<Request>> _requests;
+
+	//Blocks until request has been decoded, or just until no worker is decoding it.
+	static void _wait(Request& request, bool untilDecoded);
+};
+
+#endif //TEXTURE_LOADER_H_
\ No newline at end of file